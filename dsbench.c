@@ -0,0 +1,725 @@
+/*
+ * Copyright 2020 IBM Corp. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * dsbench - a benchmark harness for the DataStage API.
+ *
+ * dsbench runs a scripted workload against a server and reports the
+ * operations per second it achieved and a histogram of how long each
+ * operation took. The same workload can be run in the ways dsjob can work,
+ * so that a change to one of dsjob's hot paths can be measured:
+ *
+ *  oneshot     every operation opens the project and job and closes them
+ *              again, as a separate dsjob command does
+ *  cached      the handles are opened once and reused, as in dsjob's
+ *              -batch and -daemon modes
+ *  batched     as cached, and work that dsjob can avoid repeating is done
+ *              once: parameters are looked up once rather than on every
+ *              binding, and log scans use the log iterator rather than
+ *              fetching each entry by id
+ *
+ * Any mode can be run on several threads at once with -threads, each
+ * thread with its own handles, as dsjob's worker pools do: opening a
+ * handle, and DSGetLastError() after a failed open, are serialized under
+ * apiLock.
+ */
+
+#include "dsport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <dsapi.h>
+
+#ifndef BOOL
+#define BOOL int
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define MODE_ONESHOT    0
+#define MODE_CACHED     1
+#define MODE_BATCHED    2
+
+#define MAX_THREADS     64
+#define MAX_JOBS        64
+
+/*
+ * Latencies are counted in logarithmic buckets, four to each doubling from
+ * one microsecond.
+ */
+#define N_BUCKETS       160
+
+typedef struct HISTOGRAM
+{
+    long nOps;
+    long nErrors;
+    LONGLONG totalMicros;
+    LONGLONG maxMicros;
+    long buckets[N_BUCKETS];
+} HISTOGRAM;
+
+typedef struct BENCH BENCH;
+typedef struct THREAD THREAD;
+
+/*
+ * What to run and how, shared by all the threads.
+ */
+struct BENCH
+{
+    const char *workload;       /* Workload name */
+    int (*op)(BENCH *, THREAD *, long); /* Runs operation n */
+    int mode;                   /* MODE_xxx */
+    int nThreads;
+    long nOps;                  /* Operations to run */
+    volatile LONG nextOp;       /* Next operation for a thread to take */
+    char *project;
+    char *jobs[MAX_JOBS];
+    int nJobs;
+    int newestId;               /* logscan: newest log entry id */
+    char *paramList;            /* params: the job's parameters */
+    DSPARAM *paramValues;       /* params: their defaults, batched mode */
+    int nParams;
+};
+
+/*
+ * A benchmark thread and the handles it holds in the cached modes.
+ */
+struct THREAD
+{
+    BENCH *bench;
+    DSPROJECT hProject;
+    DSJOB hJobs[MAX_JOBS];
+    HISTOGRAM histogram;
+};
+
+static LONGLONG frequency;      /* Performance counter ticks per second */
+static CRITICAL_SECTION apiLock;
+
+/*****************************************************************************/
+/*
+ * Histograms.
+ */
+static void countOp(
+    HISTOGRAM *histogram,       /* Histogram to add to */
+    LONGLONG micros,            /* How long the operation took */
+    BOOL failed                 /* The operation failed */
+)
+{
+    int bucket = 0;
+    if (micros >= 1)
+    {
+        int e = 0;
+        while ((micros >> (e + 1)) != 0)
+            e++;
+        bucket = 4 * e + ((e >= 2) ? (int) ((micros >> (e - 2)) & 3) :
+                          (int) (((micros << 2) >> e) & 3));
+        if (bucket >= N_BUCKETS)
+            bucket = N_BUCKETS - 1;
+    }
+    histogram->nOps++;
+    if (failed)
+        histogram->nErrors++;
+    histogram->totalMicros += micros;
+    if (micros > histogram->maxMicros)
+        histogram->maxMicros = micros;
+    histogram->buckets[bucket]++;
+}
+
+static void addHistogram(
+    HISTOGRAM *total,           /* Histogram to add to */
+    HISTOGRAM *histogram        /* Histogram to add */
+)
+{
+    int i;
+    total->nOps += histogram->nOps;
+    total->nErrors += histogram->nErrors;
+    total->totalMicros += histogram->totalMicros;
+    if (histogram->maxMicros > total->maxMicros)
+        total->maxMicros = histogram->maxMicros;
+    for (i = 0; i < N_BUCKETS; i++)
+        total->buckets[i] += histogram->buckets[i];
+}
+
+/*
+ * The lower bound of a bucket, in milliseconds.
+ */
+static double bucketMillis(
+    int bucket
+)
+{
+    return ldexp(1.0 + (bucket % 4) / 4.0, bucket / 4) / 1000;
+}
+
+/*
+ * The latency at a percentile, in milliseconds, taking the middle of the
+ * bucket it falls in.
+ */
+static double percentileMillis(
+    HISTOGRAM *histogram,
+    int pct                     /* Percentile, 1 to 100 */
+)
+{
+    long rank = (long) ((pct * (double) histogram->nOps + 99) / 100);
+    long seen = 0;
+    int bucket;
+    for (bucket = 0; bucket < N_BUCKETS - 1; bucket++)
+        if ((seen += histogram->buckets[bucket]) >= rank)
+            break;
+    return (bucketMillis(bucket) + bucketMillis(bucket + 1)) / 2;
+}
+
+static void printReport(
+    BENCH *bench,
+    HISTOGRAM *histogram,
+    double seconds              /* Elapsed time */
+)
+{
+    static const char *modeNames[] = { "oneshot", "cached", "batched" };
+    long most = 0;
+    int first = -1;
+    int last = 0;
+    int i;
+    printf("Workload\t: %s\n", bench->workload);
+    printf("Mode\t\t: %s, %d thread%s\n", modeNames[bench->mode], bench->nThreads,
+           (bench->nThreads == 1) ? "" : "s");
+    printf("Operations\t: %ld in %.3f seconds, %ld failed\n",
+           histogram->nOps, seconds, histogram->nErrors);
+    if (histogram->nOps == 0)
+        return;
+    printf("Throughput\t: %.1f ops/sec\n", (seconds > 0) ? histogram->nOps / seconds : 0.0);
+    printf("Latency (ms)\t: mean %.3f p50 %.3f p90 %.3f p99 %.3f max %.3f\n",
+           (double) histogram->totalMicros / histogram->nOps / 1000,
+           percentileMillis(histogram, 50), percentileMillis(histogram, 90),
+           percentileMillis(histogram, 99), (double) histogram->maxMicros / 1000);
+    for (i = 0; i < N_BUCKETS; i++)
+    {
+        if (histogram->buckets[i] == 0)
+            continue;
+        if (first < 0)
+            first = i;
+        last = i;
+        if (histogram->buckets[i] > most)
+            most = histogram->buckets[i];
+    }
+    printf("Histogram (ms)\t:\n");
+    for (i = first; i <= last; i++)
+    {
+        int width = (int) (histogram->buckets[i] * 50 / most);
+        printf("%10.3f - %10.3f %10ld ", bucketMillis(i), bucketMillis(i + 1),
+               histogram->buckets[i]);
+        while (width-- > 0)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+/*
+ * Return a malloc'ed copy of a string, or NULL if out of memory.
+ */
+static char *copyString(
+    char *str                   /* String to duplicate */
+)
+{
+    char *copy = malloc(strlen(str) + 1);
+    if (copy != NULL)
+        strcpy(copy, str);
+    return copy;
+}
+
+/*****************************************************************************/
+/*
+ * Handles. In oneshot mode these open the project and job for every
+ * operation and close them afterwards; otherwise the thread keeps them.
+ * A failed open sets *status to the error, read under the same lock.
+ */
+static DSPROJECT openProject(
+    char *project,              /* Project to open */
+    int *status                 /* Returned error */
+)
+{
+    DSPROJECT hProject;
+    EnterCriticalSection(&apiLock);
+    if ((hProject = DSOpenProject(project)) == NULL)
+        *status = DSGetLastError();
+    LeaveCriticalSection(&apiLock);
+    return hProject;
+}
+
+static DSJOB openJob(
+    DSPROJECT hProject,         /* Open project */
+    char *job,                  /* Job to open */
+    int *status                 /* Returned error */
+)
+{
+    DSJOB hJob;
+    EnterCriticalSection(&apiLock);
+    if ((hJob = DSOpenJob(hProject, job)) == NULL)
+        *status = DSGetLastError();
+    LeaveCriticalSection(&apiLock);
+    return hJob;
+}
+
+static DSJOB getJob(
+    THREAD *thread,
+    int job,                    /* Index into bench->jobs */
+    int *status                 /* Returned error */
+)
+{
+    BENCH *bench = thread->bench;
+    if ((thread->hProject == NULL) &&
+            ((thread->hProject = openProject(bench->project, status)) == NULL))
+        return NULL;
+    if (thread->hJobs[job] == NULL)
+        thread->hJobs[job] = openJob(thread->hProject, bench->jobs[job], status);
+    return thread->hJobs[job];
+}
+
+static void releaseHandles(
+    THREAD *thread,
+    BOOL always                 /* Close them even in the cached modes */
+)
+{
+    int i;
+    if (!always && (thread->bench->mode != MODE_ONESHOT))
+        return;
+    for (i = 0; i < MAX_JOBS; i++)
+    {
+        if (thread->hJobs[i] != NULL)
+            (void) DSCloseJob(thread->hJobs[i]);
+        thread->hJobs[i] = NULL;
+    }
+    if (thread->hProject != NULL)
+        (void) DSCloseProject(thread->hProject);
+    thread->hProject = NULL;
+}
+
+/*****************************************************************************/
+/*
+ * The workloads. Each runs operation n and returns DSJE_NOERROR or the
+ * error it failed with.
+ */
+
+/*
+ * open: open and close the project, and the job if one is given.
+ */
+static int opOpen(
+    BENCH *bench,
+    THREAD *thread,
+    long n
+)
+{
+    int status = DSJE_NOERROR;
+    if ((thread->hProject = openProject(bench->project, &status)) == NULL)
+        return status;
+    if (bench->nJobs > 0)
+    {
+        DSJOB hJob = openJob(thread->hProject, bench->jobs[n % bench->nJobs], &status);
+        if (hJob != NULL)
+            (void) DSCloseJob(hJob);
+    }
+    (void) DSCloseProject(thread->hProject);
+    thread->hProject = NULL;
+    return status;
+}
+
+/*
+ * jobinfo: get the status of a job, as a status poll does.
+ */
+static int opJobInfo(
+    BENCH *bench,
+    THREAD *thread,
+    long n
+)
+{
+    DSJOBINFO jobInfo;
+    int status;
+    DSJOB hJob = getJob(thread, (int) (n % bench->nJobs), &status);
+    if (hJob == NULL)
+        return status;
+    return DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo);
+}
+
+/*
+ * logscan: read log entry newestId - n, or in batched mode the next entry
+ * from the log iterator (which only one thread can use).
+ */
+static int opLogScan(
+    BENCH *bench,
+    THREAD *thread,
+    long n
+)
+{
+    int status;
+    DSJOB hJob = getJob(thread, 0, &status);
+    if (hJob == NULL)
+        return status;
+    if (bench->mode == MODE_BATCHED)
+    {
+        DSLOGEVENT event;
+        if (n == 0)
+            return DSFindFirstLogEntry(hJob, DSJ_LOGANY, 0, 0, 0, &event);
+        return DSFindNextLogEntry(hJob, &event);
+    }
+    else
+    {
+        DSLOGDETAIL detail;
+        if (bench->newestId - n < 0)
+            return DSJE_NOMORE;
+        return DSGetLogEntry(hJob, (int) (bench->newestId - n), &detail);
+    }
+}
+
+/*
+ * params: lock the job and set each of its parameters to its default, as
+ * starting a run with parameters does. The other modes look each one up
+ * as they go; batched mode sets the same values, looked up beforehand.
+ */
+static int opParams(
+    BENCH *bench,
+    THREAD *thread,
+    long n
+)
+{
+    char *param;
+    int status;
+    int i;
+    DSJOB hJob = getJob(thread, 0, &status);
+    if (hJob == NULL)
+        return status;
+    if ((status = DSLockJob(hJob)) != DSJE_NOERROR)
+        return status;
+    for (i = 0, param = bench->paramList; (status == DSJE_NOERROR) && (*param != '\0');
+            i++, param += strlen(param) + 1)
+    {
+        DSPARAMINFO paramInfo;
+        if (bench->mode == MODE_BATCHED)
+            status = DSSetParam(hJob, param, &(bench->paramValues[i]));
+        else if ((status = DSGetParamInfo(hJob, param, &paramInfo)) == DSJE_NOERROR)
+            status = DSSetParam(hJob, param, &(paramInfo.defaultValue));
+    }
+    (void) DSUnlockJob(hJob);
+    return status;
+}
+
+/*
+ * run: run a job and wait for it to finish.
+ */
+static int opRun(
+    BENCH *bench,
+    THREAD *thread,
+    long n
+)
+{
+    int status;
+    DSJOB hJob = getJob(thread, (int) (n % bench->nJobs), &status);
+    if (hJob == NULL)
+        return status;
+    if ((status = DSLockJob(hJob)) != DSJE_NOERROR)
+        return status;
+    if ((status = DSRunJob(hJob, DSJ_RUNNORMAL)) == DSJE_NOERROR)
+        status = DSWaitForJob(hJob);
+    (void) DSUnlockJob(hJob);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Threads.
+ */
+static unsigned __stdcall benchThread(
+    void *arg                   /* The THREAD */
+)
+{
+    THREAD *thread = arg;
+    BENCH *bench = thread->bench;
+    LONG n;
+    while ((n = InterlockedIncrement(&(bench->nextOp)) - 1) < bench->nOps)
+    {
+        LARGE_INTEGER start;
+        LARGE_INTEGER end;
+        int status;
+        QueryPerformanceCounter(&start);
+        status = bench->op(bench, thread, n);
+        releaseHandles(thread, FALSE);
+        QueryPerformanceCounter(&end);
+        countOp(&(thread->histogram),
+                (end.QuadPart - start.QuadPart) * 1000000 / frequency,
+                status != DSJE_NOERROR);
+        if ((status != DSJE_NOERROR) && (thread->histogram.nErrors == 1))
+            fprintf(stderr, "Operation %ld failed with status %d\n", (long) n, status);
+    }
+    releaseHandles(thread, TRUE);
+    return 0;
+}
+
+/*
+ * Work out what the log and parameter workloads need before timing starts.
+ */
+static int prepare(
+    BENCH *bench
+)
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    DSJOBINFO jobInfo;
+    int status = DSJE_NOERROR;
+    if ((bench->op != opLogScan) && (bench->op != opParams))
+        return DSJE_NOERROR;
+    if ((hProject = openProject(bench->project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+        return status;
+    }
+    if ((hJob = openJob(hProject, bench->jobs[0], &status)) == NULL)
+        fprintf(stderr, "ERROR: Failed to open job\n");
+    else if (bench->op == opLogScan)
+    {
+        bench->newestId = DSGetNewestLogId(hJob, DSJ_LOGANY);
+        if (bench->newestId < 0)
+        {
+            status = DSGetLastError();
+            fprintf(stderr, "Error %d getting newest log id\n", status);
+        }
+        else if (bench->nOps > bench->newestId + 1)
+            bench->nOps = bench->newestId + 1;
+    }
+    else if ((status = DSGetJobInfo(hJob, DSJ_PARAMLIST, &jobInfo)) != DSJE_NOERROR)
+        fprintf(stderr, "Error %d getting parameter list\n", status);
+    else
+    {
+        char *param;
+        for (param = jobInfo.info.paramList; *param != '\0'; param += strlen(param) + 1)
+            bench->nParams++;
+        bench->paramList = malloc(param - jobInfo.info.paramList + 1);
+        bench->paramValues = calloc(bench->nParams + 1, sizeof(DSPARAM));
+        if ((bench->paramList == NULL) || (bench->paramValues == NULL))
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            status = DSJE_NOERROR - 1;
+        }
+        else
+        {
+            int i;
+            memcpy(bench->paramList, jobInfo.info.paramList, param - jobInfo.info.paramList + 1);
+            for (i = 0, param = bench->paramList; (status == DSJE_NOERROR) && (*param != '\0');
+                    i++, param += strlen(param) + 1)
+            {
+                DSPARAMINFO paramInfo;
+                DSPARAM *value = &(bench->paramValues[i]);
+                if ((status = DSGetParamInfo(hJob, param, &paramInfo)) != DSJE_NOERROR)
+                    fprintf(stderr, "Error %d getting parameter '%s'\n", status, param);
+                else
+                {
+                    /* A value that isn't a number is a string the API owns */
+                    char *text = paramInfo.defaultValue.paramValue.pString;
+                    *value = paramInfo.defaultValue;
+                    if ((value->paramType != DSJ_PARAMTYPE_INTEGER) &&
+                            (value->paramType != DSJ_PARAMTYPE_FLOAT) && (text != NULL) &&
+                            ((value->paramValue.pString = copyString(text)) == NULL))
+                    {
+                        fprintf(stderr, "ERROR: Out of memory\n");
+                        status = DSJE_NOERROR - 1;
+                    }
+                }
+            }
+        }
+    }
+    if (hJob != NULL)
+        (void) DSCloseJob(hJob);
+    (void) DSCloseProject(hProject);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Main routine
+ */
+static const struct
+{
+    const char *name;
+    int (*op)(BENCH *, THREAD *, long);
+    int minJobs;                /* Jobs that must be named */
+    int maxJobs;
+    long defaultOps;
+} Workload[] =
+{
+    { "open",     opOpen,     0,  MAX_JOBS,   1000 },
+    { "jobinfo",  opJobInfo,  1,  MAX_JOBS,   10000 },
+    { "logscan",  opLogScan,  1,  1,          100000 },
+    { "params",   opParams,   1,  1,          1000 },
+    { "run",      opRun,      1,  MAX_JOBS,   10 }
+};
+
+#define N_WORKLOADS (sizeof(Workload) / sizeof(Workload[0]))
+
+static void usage(void)
+{
+    int i;
+    fprintf(stderr, "Command syntax:\n");
+    fprintf(stderr, "\tdsbench [-domain <domain>][-server <server>][-user <user>][-password <password>]\n");
+    fprintf(stderr, "\t\t\t[-mode <oneshot | cached | batched>]\n");
+    fprintf(stderr, "\t\t\t[-threads <n>]\n");
+    fprintf(stderr, "\t\t\t[-ops <n>]\n");
+    fprintf(stderr, "\t\t\t<workload> <project> [<job>...]\n");
+    fprintf(stderr, "\nValid workloads are:\n");
+    for (i = 0; i < (int) N_WORKLOADS; i++)
+        fprintf(stderr, "\t%s\n", Workload[i].name);
+}
+
+int main(
+    int argc,                   /* Argument count */
+    char *argv[]                /* Argument strings */
+)
+{
+    static BENCH bench;
+    static THREAD threads[MAX_THREADS];
+    HANDLE handles[MAX_THREADS];
+    HISTOGRAM total;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    char *domain = NULL;
+    char *server = NULL;
+    char *user = NULL;
+    char *password = NULL;
+    int workload = -1;
+    int nStarted = 0;
+    int status;
+    int i;
+    BOOL badOptions = FALSE;
+
+    bench.mode = MODE_ONESHOT;
+    bench.nThreads = 1;
+    bench.nOps = 0;
+    for (i = 1; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "domain") == 0)
+            domain = arg;
+        else if (strcmp(opt, "server") == 0)
+            server = arg;
+        else if (strcmp(opt, "user") == 0)
+            user = arg;
+        else if (strcmp(opt, "password") == 0)
+            password = arg;
+        else if (strcmp(opt, "mode") == 0)
+        {
+            if (strcmp(arg, "oneshot") == 0)
+                bench.mode = MODE_ONESHOT;
+            else if (strcmp(arg, "cached") == 0)
+                bench.mode = MODE_CACHED;
+            else if (strcmp(arg, "batched") == 0)
+                bench.mode = MODE_BATCHED;
+            else
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "threads") == 0)
+        {
+            bench.nThreads = atoi(arg);
+            if ((bench.nThreads < 1) || (bench.nThreads > MAX_THREADS))
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "ops") == 0)
+        {
+            if ((bench.nOps = atol(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be a workload and a project, then the jobs */
+    if (!badOptions && (i + 2 <= argc))
+    {
+        for (workload = 0; workload < (int) N_WORKLOADS; workload++)
+            if (strcmp(argv[i], Workload[workload].name) == 0)
+                break;
+        bench.nJobs = argc - i - 2;
+        if ((workload == (int) N_WORKLOADS) || (bench.nJobs < Workload[workload].minJobs) ||
+                (bench.nJobs > Workload[workload].maxJobs))
+            badOptions = TRUE;
+    }
+    else
+        badOptions = TRUE;
+    if (badOptions)
+    {
+        usage();
+        return DSJE_NOERROR - 1;
+    }
+    bench.workload = Workload[workload].name;
+    bench.op = Workload[workload].op;
+    bench.project = argv[i + 1];
+    for (i = 0; i < bench.nJobs; i++)
+        bench.jobs[i] = argv[argc - bench.nJobs + i];
+    if (bench.nOps == 0)
+        bench.nOps = Workload[workload].defaultOps;
+    if ((bench.op == opLogScan) && (bench.mode == MODE_BATCHED) && (bench.nThreads > 1))
+    {
+        fprintf(stderr, "A batched log scan uses the log iterator and runs on one thread\n");
+        bench.nThreads = 1;
+    }
+
+    InitializeCriticalSection(&apiLock);
+    DSSetServerParams(domain, user, password, server);
+    QueryPerformanceFrequency(&start);
+    frequency = start.QuadPart;
+    if ((status = prepare(&bench)) != DSJE_NOERROR)
+        return status;
+
+    /* Run the threads */
+    QueryPerformanceCounter(&start);
+    for (i = 0; i < bench.nThreads; i++)
+    {
+        threads[i].bench = &bench;
+        handles[nStarted] = (HANDLE) _beginthreadex(NULL, 0, benchThread, &(threads[i]), 0, NULL);
+        if (handles[nStarted] != 0)
+            nStarted++;
+    }
+    if (nStarted == 0)
+    {
+        (void) benchThread(&(threads[0]));
+        bench.nThreads = 1;
+    }
+    for (i = 0; i < nStarted; i++)
+    {
+        (void) WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+    }
+    QueryPerformanceCounter(&end);
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < bench.nThreads; i++)
+        addHistogram(&total, &(threads[i].histogram));
+    printReport(&bench, &total, (double) (end.QuadPart - start.QuadPart) / frequency);
+    for (i = 0; (bench.paramValues != NULL) && (i < bench.nParams); i++)
+        if ((bench.paramValues[i].paramType != DSJ_PARAMTYPE_INTEGER) &&
+                (bench.paramValues[i].paramType != DSJ_PARAMTYPE_FLOAT))
+            free(bench.paramValues[i].paramValue.pString);
+    free(bench.paramList);
+    free(bench.paramValues);
+    return (total.nErrors == 0) ? DSJE_NOERROR : DSJE_NOERROR - 1;
+}
+
+/* End of module */
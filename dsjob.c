@@ -14,11 +14,15 @@
  * limitations under the License.
  */
 
-#include <windows.h>
+#include "dsport.h"
+#include <fcntl.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <malloc.h>
+#include <time.h>
 #include <ctype.h>
+#include <math.h>
 #include <dsapi.h>
 
 #ifndef BOOL
@@ -37,1333 +41,13386 @@
 
 /*****************************************************************************/
 /*
- * Print out the given string list one string per line, prefixing each
- * string by the specified number of tabs.
+ * API call instrumentation.
+ *
+ * Every call that dsjob makes into the DataStage API goes through one of
+ * the wrappers below, which the API names are redefined to at the end of
+ * this section, so the rest of the file is written as if it called the API
+ * directly. With -stats or -trace each call is timed with
+ * QueryPerformanceCounter(). -stats prints, as dsjob exits, the number of
+ * calls made to each API routine with their total time and median and
+ * 99th percentile latency. -trace <file> writes each call to the file as a
+ * Chrome trace event, for viewing in chrome://tracing or Perfetto.
+ *
+ * Latencies are counted in a histogram of logarithmic buckets, four to
+ * each doubling from one microsecond, so the percentiles are accurate to
+ * within about 12%.
+ */
+#define TRACE_BUCKETS   160     /* Up to 2^40 microseconds */
+
+typedef struct TRACESTAT
+{
+    const char *name;           /* API routine */
+    long nCalls;
+    LONGLONG totalTicks;
+    long buckets[TRACE_BUCKETS];
+} TRACESTAT;
+
+#define TRACE_SETSERVERPARAMS   0
+#define TRACE_OPENPROJECT       1
+#define TRACE_CLOSEPROJECT      2
+#define TRACE_OPENJOB           3
+#define TRACE_CLOSEJOB          4
+#define TRACE_LOCKJOB           5
+#define TRACE_UNLOCKJOB         6
+#define TRACE_SETJOBLIMIT       7
+#define TRACE_SETPARAM          8
+#define TRACE_RUNJOB            9
+#define TRACE_STOPJOB           10
+#define TRACE_WAITFORJOB        11
+#define TRACE_GETJOBINFO        12
+#define TRACE_GETSTAGEINFO      13
+#define TRACE_GETLINKINFO       14
+#define TRACE_GETPARAMINFO      15
+#define TRACE_GETPROJECTLIST    16
+#define TRACE_GETPROJECTINFO    17
+#define TRACE_FINDFIRSTLOGENTRY 18
+#define TRACE_FINDNEXTLOGENTRY  19
+#define TRACE_GETLOGENTRY       20
+#define TRACE_GETNEWESTLOGID    21
+#define TRACE_LOGEVENT          22
+#define TRACE_GETLASTERROR      23
+#define TRACE_GETLASTERRORMSG   24
+#define N_TRACE_APIS            25
+
+static TRACESTAT traceStats[N_TRACE_APIS] =
+{
+    { "DSSetServerParams", 0, 0, { 0 } },
+    { "DSOpenProject", 0, 0, { 0 } },
+    { "DSCloseProject", 0, 0, { 0 } },
+    { "DSOpenJob", 0, 0, { 0 } },
+    { "DSCloseJob", 0, 0, { 0 } },
+    { "DSLockJob", 0, 0, { 0 } },
+    { "DSUnlockJob", 0, 0, { 0 } },
+    { "DSSetJobLimit", 0, 0, { 0 } },
+    { "DSSetParam", 0, 0, { 0 } },
+    { "DSRunJob", 0, 0, { 0 } },
+    { "DSStopJob", 0, 0, { 0 } },
+    { "DSWaitForJob", 0, 0, { 0 } },
+    { "DSGetJobInfo", 0, 0, { 0 } },
+    { "DSGetStageInfo", 0, 0, { 0 } },
+    { "DSGetLinkInfo", 0, 0, { 0 } },
+    { "DSGetParamInfo", 0, 0, { 0 } },
+    { "DSGetProjectList", 0, 0, { 0 } },
+    { "DSGetProjectInfo", 0, 0, { 0 } },
+    { "DSFindFirstLogEntry", 0, 0, { 0 } },
+    { "DSFindNextLogEntry", 0, 0, { 0 } },
+    { "DSGetLogEntry", 0, 0, { 0 } },
+    { "DSGetNewestLogId", 0, 0, { 0 } },
+    { "DSLogEvent", 0, 0, { 0 } },
+    { "DSGetLastError", 0, 0, { 0 } },
+    { "DSGetLastErrorMsg", 0, 0, { 0 } }
+};
+
+static BOOL tracing = FALSE;            /* -stats or -trace given */
+static BOOL traceSummary = FALSE;       /* -stats given */
+static FILE *traceFile = NULL;          /* -trace file */
+static BOOL traceFirstEvent = TRUE;
+static LONGLONG traceFrequency;         /* Counter ticks per second */
+static LONGLONG traceOrigin;            /* Counter when tracing started */
+static CRITICAL_SECTION traceLock;      /* Protects everything above */
+
+/*
+ * Start timing. Returns FALSE if the trace file can't be created.
+ */
+static BOOL startTrace(
+    BOOL summary,               /* Print a summary at the end */
+    char *fileName              /* Trace event file, or NULL */
+)
+{
+    LARGE_INTEGER counter;
+    if ((fileName != NULL) && ((traceFile = fopen(fileName, "w")) == NULL))
+    {
+        fprintf(stderr, "ERROR: Failed to create trace file '%s'\n", fileName);
+        return FALSE;
+    }
+    if (traceFile != NULL)
+        fprintf(traceFile, "[\n");
+    InitializeCriticalSection(&traceLock);
+    QueryPerformanceFrequency(&counter);
+    traceFrequency = counter.QuadPart;
+    QueryPerformanceCounter(&counter);
+    traceOrigin = counter.QuadPart;
+    traceSummary = summary;
+    tracing = TRUE;
+    return TRUE;
+}
+
+static LONGLONG traceBegin(void)
+{
+    LARGE_INTEGER counter;
+    if (!tracing)
+        return 0;
+    QueryPerformanceCounter(&counter);
+    return counter.QuadPart;
+}
+
+/*
+ * Account for a call that started at the given counter value.
+ */
+static void traceEnd(
+    int api,                    /* TRACE_xxx */
+    LONGLONG start              /* From traceBegin() */
+)
+{
+    LARGE_INTEGER counter;
+    TRACESTAT *stat = &(traceStats[api]);
+    LONGLONG ticks;
+    LONGLONG micros;
+    int bucket = 0;
+    if (!tracing)
+        return;
+    QueryPerformanceCounter(&counter);
+    ticks = counter.QuadPart - start;
+    micros = ticks * 1000000 / traceFrequency;
+    /* Bucket 4e+m is [2^e(1 + m/4), 2^e(1 + (m+1)/4)) microseconds */
+    if (micros >= 1)
+    {
+        int e = 0;
+        while ((micros >> (e + 1)) != 0)
+            e++;
+        bucket = 4 * e + ((e >= 2) ? (int) ((micros >> (e - 2)) & 3) :
+                          (int) (((micros << 2) >> e) & 3));
+        if (bucket >= TRACE_BUCKETS)
+            bucket = TRACE_BUCKETS - 1;
+    }
+    EnterCriticalSection(&traceLock);
+    stat->nCalls++;
+    stat->totalTicks += ticks;
+    stat->buckets[bucket]++;
+    if (traceFile != NULL)
+    {
+        fprintf(traceFile, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                "\"pid\":%lu,\"tid\":%lu}",
+                traceFirstEvent ? "" : ",\n", stat->name,
+                (double) (start - traceOrigin) * 1e6 / traceFrequency,
+                (double) ticks * 1e6 / traceFrequency,
+                (unsigned long) GetCurrentProcessId(), (unsigned long) GetCurrentThreadId());
+        traceFirstEvent = FALSE;
+    }
+    LeaveCriticalSection(&traceLock);
+}
+
+/*
+ * The latency at a percentile of a histogram, in milliseconds, taking the
+ * middle of the bucket it falls in.
+ */
+static double tracePercentile(
+    TRACESTAT *stat,
+    int pct                     /* Percentile, 1 to 100 */
+)
+{
+    long rank = (long) ((pct * (double) stat->nCalls + 99) / 100);
+    long seen = 0;
+    int bucket;
+    for (bucket = 0; bucket < TRACE_BUCKETS - 1; bucket++)
+        if ((seen += stat->buckets[bucket]) >= rank)
+            break;
+    return ldexp(1.0 + ((bucket % 4) + 0.5) / 4, bucket / 4) / 1000;
+}
+
+/*
+ * Finish tracing: close the trace file and print the summary.
+ */
+static void endTrace(void)
+{
+    double total = 0.0;
+    int i;
+    if (!tracing)
+        return;
+    tracing = FALSE;
+    if (traceFile != NULL)
+    {
+        fprintf(traceFile, "\n]\n");
+        fclose(traceFile);
+        traceFile = NULL;
+    }
+    if (traceSummary)
+    {
+        fprintf(stderr, "\n%-22s %8s %12s %10s %10s\n", "API", "Calls", "Total ms", "p50 ms", "p99 ms");
+        for (i = 0; i < N_TRACE_APIS; i++)
+        {
+            TRACESTAT *stat = &(traceStats[i]);
+            double ms = (double) stat->totalTicks * 1000 / traceFrequency;
+            if (stat->nCalls == 0)
+                continue;
+            fprintf(stderr, "%-22s %8ld %12.3f %10.3f %10.3f\n", stat->name, stat->nCalls,
+                    ms, tracePercentile(stat, 50), tracePercentile(stat, 99));
+            total += ms;
+        }
+        fprintf(stderr, "%-22s %8s %12.3f\n", "Total", "", total);
+    }
+    DeleteCriticalSection(&traceLock);
+}
+
+/*
+ * The wrappers.
+ */
+static void tracedDSSetServerParams(char *domain, char *user, char *password, char *server)
+{
+    LONGLONG start = traceBegin();
+    (DSSetServerParams)(domain, user, password, server);
+    traceEnd(TRACE_SETSERVERPARAMS, start);
+}
+
+static DSPROJECT tracedDSOpenProject(char *project)
+{
+    LONGLONG start = traceBegin();
+    DSPROJECT hProject = (DSOpenProject)(project);
+    traceEnd(TRACE_OPENPROJECT, start);
+    return hProject;
+}
+
+static int tracedDSCloseProject(DSPROJECT hProject)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSCloseProject)(hProject);
+    traceEnd(TRACE_CLOSEPROJECT, start);
+    return status;
+}
+
+static DSJOB tracedDSOpenJob(DSPROJECT hProject, char *job)
+{
+    LONGLONG start = traceBegin();
+    DSJOB hJob = (DSOpenJob)(hProject, job);
+    traceEnd(TRACE_OPENJOB, start);
+    return hJob;
+}
+
+static int tracedDSCloseJob(DSJOB hJob)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSCloseJob)(hJob);
+    traceEnd(TRACE_CLOSEJOB, start);
+    return status;
+}
+
+static int tracedDSLockJob(DSJOB hJob)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSLockJob)(hJob);
+    traceEnd(TRACE_LOCKJOB, start);
+    return status;
+}
+
+static int tracedDSUnlockJob(DSJOB hJob)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSUnlockJob)(hJob);
+    traceEnd(TRACE_UNLOCKJOB, start);
+    return status;
+}
+
+static int tracedDSSetJobLimit(DSJOB hJob, int limitType, int limitValue)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSSetJobLimit)(hJob, limitType, limitValue);
+    traceEnd(TRACE_SETJOBLIMIT, start);
+    return status;
+}
+
+static int tracedDSSetParam(DSJOB hJob, char *param, DSPARAM *value)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSSetParam)(hJob, param, value);
+    traceEnd(TRACE_SETPARAM, start);
+    return status;
+}
+
+static int tracedDSRunJob(DSJOB hJob, int mode)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSRunJob)(hJob, mode);
+    traceEnd(TRACE_RUNJOB, start);
+    return status;
+}
+
+static int tracedDSStopJob(DSJOB hJob)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSStopJob)(hJob);
+    traceEnd(TRACE_STOPJOB, start);
+    return status;
+}
+
+static int tracedDSWaitForJob(DSJOB hJob)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSWaitForJob)(hJob);
+    traceEnd(TRACE_WAITFORJOB, start);
+    return status;
+}
+
+static int tracedDSGetJobInfo(DSJOB hJob, int infoType, DSJOBINFO *info)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSGetJobInfo)(hJob, infoType, info);
+    traceEnd(TRACE_GETJOBINFO, start);
+    return status;
+}
+
+static int tracedDSGetStageInfo(DSJOB hJob, char *stage, int infoType, DSSTAGEINFO *info)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSGetStageInfo)(hJob, stage, infoType, info);
+    traceEnd(TRACE_GETSTAGEINFO, start);
+    return status;
+}
+
+static int tracedDSGetLinkInfo(DSJOB hJob, char *stage, char *link, int infoType, DSLINKINFO *info)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSGetLinkInfo)(hJob, stage, link, infoType, info);
+    traceEnd(TRACE_GETLINKINFO, start);
+    return status;
+}
+
+static int tracedDSGetParamInfo(DSJOB hJob, char *param, DSPARAMINFO *info)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSGetParamInfo)(hJob, param, info);
+    traceEnd(TRACE_GETPARAMINFO, start);
+    return status;
+}
+
+static char *tracedDSGetProjectList(void)
+{
+    LONGLONG start = traceBegin();
+    char *list = (DSGetProjectList)();
+    traceEnd(TRACE_GETPROJECTLIST, start);
+    return list;
+}
+
+static int tracedDSGetProjectInfo(DSPROJECT hProject, int infoType, DSPROJECTINFO *info)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSGetProjectInfo)(hProject, infoType, info);
+    traceEnd(TRACE_GETPROJECTINFO, start);
+    return status;
+}
+
+static int tracedDSFindFirstLogEntry(DSJOB hJob, int type, time_t startTime, time_t endTime,
+                                     int maxNumber, DSLOGEVENT *event)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSFindFirstLogEntry)(hJob, type, startTime, endTime, maxNumber, event);
+    traceEnd(TRACE_FINDFIRSTLOGENTRY, start);
+    return status;
+}
+
+static int tracedDSFindNextLogEntry(DSJOB hJob, DSLOGEVENT *event)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSFindNextLogEntry)(hJob, event);
+    traceEnd(TRACE_FINDNEXTLOGENTRY, start);
+    return status;
+}
+
+static int tracedDSGetLogEntry(DSJOB hJob, int eventId, DSLOGDETAIL *detail)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSGetLogEntry)(hJob, eventId, detail);
+    traceEnd(TRACE_GETLOGENTRY, start);
+    return status;
+}
+
+static int tracedDSGetNewestLogId(DSJOB hJob, int type)
+{
+    LONGLONG start = traceBegin();
+    int id = (DSGetNewestLogId)(hJob, type);
+    traceEnd(TRACE_GETNEWESTLOGID, start);
+    return id;
+}
+
+static int tracedDSLogEvent(DSJOB hJob, int type, char *reserved, char *message)
+{
+    LONGLONG start = traceBegin();
+    int status = (DSLogEvent)(hJob, type, reserved, message);
+    traceEnd(TRACE_LOGEVENT, start);
+    return status;
+}
+
+/*
+ * Set while another thread shares the API with the main thread (the
+ * daemon's publisher), so that the last error is read under the lock the
+ * other thread opens its handles under. See apiLock.
+ */
+static CRITICAL_SECTION *lastErrorLock = NULL;
+
+static int tracedDSGetLastError(void)
+{
+    LONGLONG start;
+    int status;
+    if (lastErrorLock != NULL)
+        EnterCriticalSection(lastErrorLock);
+    start = traceBegin();
+    status = (DSGetLastError)();
+    traceEnd(TRACE_GETLASTERROR, start);
+    if (lastErrorLock != NULL)
+        LeaveCriticalSection(lastErrorLock);
+    return status;
+}
+
+static char *tracedDSGetLastErrorMsg(DSPROJECT hProject)
+{
+    LONGLONG start;
+    char *text;
+    if (lastErrorLock != NULL)
+        EnterCriticalSection(lastErrorLock);
+    start = traceBegin();
+    text = (DSGetLastErrorMsg)(hProject);
+    traceEnd(TRACE_GETLASTERRORMSG, start);
+    if (lastErrorLock != NULL)
+        LeaveCriticalSection(lastErrorLock);
+    return text;
+}
+
+#define DSSetServerParams       tracedDSSetServerParams
+#define DSOpenProject           tracedDSOpenProject
+#define DSCloseProject          tracedDSCloseProject
+#define DSOpenJob               tracedDSOpenJob
+#define DSCloseJob              tracedDSCloseJob
+#define DSLockJob               tracedDSLockJob
+#define DSUnlockJob             tracedDSUnlockJob
+#define DSSetJobLimit           tracedDSSetJobLimit
+#define DSSetParam              tracedDSSetParam
+#define DSRunJob                tracedDSRunJob
+#define DSStopJob               tracedDSStopJob
+#define DSWaitForJob            tracedDSWaitForJob
+#define DSGetJobInfo            tracedDSGetJobInfo
+#define DSGetStageInfo          tracedDSGetStageInfo
+#define DSGetLinkInfo           tracedDSGetLinkInfo
+#define DSGetParamInfo          tracedDSGetParamInfo
+#define DSGetProjectList        tracedDSGetProjectList
+#define DSGetProjectInfo        tracedDSGetProjectInfo
+#define DSFindFirstLogEntry     tracedDSFindFirstLogEntry
+#define DSFindNextLogEntry      tracedDSFindNextLogEntry
+#define DSGetLogEntry           tracedDSGetLogEntry
+#define DSGetNewestLogId        tracedDSGetNewestLogId
+#define DSLogEvent              tracedDSLogEvent
+#define DSGetLastError          tracedDSGetLastError
+#define DSGetLastErrorMsg       tracedDSGetLastErrorMsg
+
+/*****************************************************************************/
+/*
+ * Buffered output.
+ *
+ * Commands that can produce a lot of output (such as log exports) format it
+ * into an OUTBUF rather than making several stdio calls per record. A buffer
+ * either writes itself to a file with a single fwrite() whenever it fills,
+ * or, if it has no file, grows in memory so that the caller can pass the
+ * text on later. stdoutBuf is the buffer for standard output; anything
+ * written there must be flushed with outFlush() before the command returns
+ * or writes to stdout by other means.
+ */
+#define OUTBUF_SIZE     65536
+
+typedef struct OUTBUF
+{
+    FILE *fp;                   /* Destination, NULL to grow in memory */
+    char *data;
+    size_t len;
+    size_t size;
+    time_t lastTime;            /* Time last formatted by outTime() */
+    char timeText[32];          /* ... and its ctime() text */
+    const char *columns;        /* Columns of the last CSV/TSV header */
+    int nFields;                /* Fields so far in the current record */
+} OUTBUF;
+
+static char stdoutData[OUTBUF_SIZE];
+static OUTBUF stdoutBuf = { NULL, stdoutData, 0, OUTBUF_SIZE, -1, "", NULL, 0 };
+
+static void outFlush(
+    OUTBUF *buf                 /* Buffer to flush */
+)
+{
+    if ((buf->fp != NULL) && (buf->len > 0))
+    {
+        (void) fwrite(buf->data, 1, buf->len, buf->fp);
+        buf->len = 0;
+        fflush(buf->fp);
+    }
+}
+
+/*
+ * Make room for at least n more bytes, by flushing a file buffer or by
+ * growing a memory buffer. Returns FALSE if that isn't possible, in which
+ * case the caller must write less.
+ */
+static BOOL outReserve(
+    OUTBUF *buf,                /* Buffer to write to */
+    size_t n                    /* Bytes wanted */
+)
+{
+    if (buf->len + n <= buf->size)
+        return TRUE;
+    if (buf->fp != NULL)
+    {
+        outFlush(buf);
+        return (n <= buf->size);
+    }
+    else
+    {
+        size_t size = (buf->size == 0) ? OUTBUF_SIZE : buf->size;
+        char *bigger;
+        while (size < buf->len + n)
+            size *= 2;
+        if ((bigger = realloc(buf->data, size)) == NULL)
+            return FALSE;
+        buf->data = bigger;
+        buf->size = size;
+        return TRUE;
+    }
+}
+
+static void outMem(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *data,           /* Bytes to write */
+    size_t n
+)
+{
+    if (n == 0)
+        return;
+    if (outReserve(buf, n))
+    {
+        memcpy(buf->data + buf->len, data, n);
+        buf->len += n;
+    }
+    else if (buf->fp != NULL)
+    {
+        /* Too big for the buffer (which is now empty)... write it directly */
+        (void) fwrite(data, 1, n, buf->fp);
+    }
+}
+
+static void outStr(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *str             /* String to write */
+)
+{
+    outMem(buf, str, strlen(str));
+}
+
+static void outChar(
+    OUTBUF *buf,                /* Buffer to write to */
+    char ch                     /* Character to write */
+)
+{
+    if ((buf->len < buf->size) || outReserve(buf, 1))
+        buf->data[buf->len++] = ch;
+}
+
+static void outInt(
+    OUTBUF *buf,                /* Buffer to write to */
+    long value                  /* Number to write in decimal */
+)
+{
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    unsigned long v = (value < 0) ? 0UL - (unsigned long) value : (unsigned long) value;
+    do
+    {
+        *--p = (char) ('0' + (v % 10));
+        v /= 10;
+    } while (v != 0);
+    if (value < 0)
+        *--p = '-';
+    outMem(buf, p, digits + sizeof(digits) - p);
+}
+
+/*
+ * Write a time in ctime() format (including the trailing newline). Log
+ * entries arrive in time order with many per second, so the text of the
+ * last time is kept and, within the same minute, only the seconds are
+ * patched rather than calling ctime() again.
+ */
+static void outTime(
+    OUTBUF *buf,                /* Buffer to write to */
+    time_t t                    /* Time to write */
+)
+{
+    if (t != buf->lastTime)
+    {
+        /* "Wed Jan 02 02:03:55 1980\n": seconds are at offset 17 */
+        long secs = (buf->lastTime < 0) ? -1 :
+                    (buf->timeText[17] - '0') * 10 + (buf->timeText[18] - '0');
+        long delta = (long) (t - buf->lastTime);
+        if ((secs >= 0) && (strlen(buf->timeText) == 25) &&
+                (delta > -secs) && (delta < 60 - secs))
+        {
+            secs += delta;
+            buf->timeText[17] = (char) ('0' + secs / 10);
+            buf->timeText[18] = (char) ('0' + secs % 10);
+        }
+        else if (ctime_s(buf->timeText, sizeof(buf->timeText), &t) != 0)
+            strcpy(buf->timeText, "????\n");
+        buf->lastTime = t;
+    }
+    outStr(buf, buf->timeText);
+}
+
+/*****************************************************************************/
+/*
+ * Display names of codes. Each list of codes has a table of CODENAME
+ * entries, looked up by codeName(), so that writing a record costs a short
+ * scan of a constant table rather than a switch and a formatted print.
+ */
+typedef struct CODENAME
+{
+    int code;                   /* The code */
+    char *name;                 /* Its display name */
+} CODENAME;
+
+#define N_CODES(table)  ((int) (sizeof(table) / sizeof(table[0])))
+
+static char *codeName(
+    const CODENAME *table,      /* Table to look in */
+    int n,                      /* Entries in the table */
+    int code,                   /* Code to look up */
+    char *unknown               /* Name of a code not in the table */
+)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        if (table[i].code == code)
+            return table[i].name;
+    return unknown;
+}
+
+/*
+ * The DSJ_LOGxxx event types, and the display name of each.
+ */
+static const CODENAME logTypes[] =
+{
+    { DSJ_LOGINFO,      "INFO" },
+    { DSJ_LOGWARNING,   "WARNING" },
+    { DSJ_LOGFATAL,     "FATAL" },
+    { DSJ_LOGREJECT,    "REJECT" },
+    { DSJ_LOGSTARTED,   "STARTED" },
+    { DSJ_LOGRESET,     "RESET" },
+    { DSJ_LOGBATCH,     "BATCH" },
+    { DSJ_LOGOTHER,     "OTHER" }
+};
+#define N_LOG_TYPES     N_CODES(logTypes)
+
+static char *logTypeName(
+    int type                    /* Event type */
+)
+{
+    return codeName(logTypes, N_LOG_TYPES, type, "????");
+}
+
+/*
+ * Find the event type with the given name, which is len characters long
+ * (so that it may be part of a list). Returns FALSE if there is none.
+ */
+static BOOL parseLogType(
+    const char *name,           /* Type name */
+    size_t len,                 /* Its length */
+    int *type                   /* Returned DSJ_LOGxxx type */
+)
+{
+    int i;
+    for (i = 0; i < N_LOG_TYPES; i++)
+    {
+        if ((strncmp(name, logTypes[i].name, len) == 0) &&
+                (logTypes[i].name[len] == '\0'))
+        {
+            *type = logTypes[i].code;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*****************************************************************************/
+/*
+ * Write the given string list one string per line, prefixing each string
+ * by the specified number of tabs.
+ */
+static void writeStrList(
+    OUTBUF *buf,                /* Buffer to write to */
+    int indent,                 /* Number of tabs to indent */
+    char *str                   /* String list to write */
+)
+{
+    int i;
+    while(*str != '\0')
+    {
+        size_t len = strlen(str);
+        for (i = 0; i < indent; i++)
+            outChar(buf, '\t');
+        outMem(buf, str, len);
+        outChar(buf, '\n');
+        str += (len + 1);
+    }
+}
+
+/*****************************************************************************/
+/*
+ * Output records.
+ *
+ * Handlers write their results as records made up of named fields, and the
+ * -format switch decides how a record comes out:
+ *
+ *  - text: the traditional dsjob output. A field with a label is written
+ *    on a line of its own after the label; fields without one are written
+ *    as the tab separated cells of a table row.
+ *  - json: one JSON object per line, keyed by the field names.
+ *  - csv, tsv: one line per record, with a header line listing the
+ *    columns whenever a record with different columns follows.
+ *
+ * Every string is escaped for the format, so a record is always one line
+ * in the machine-readable formats however many lines a message has. CSV
+ * fields are quoted with '"' doubled, and take TSV's \\, \n and \r escapes
+ * as well, rather than the line breaks RFC 4180 allows inside quotes, so
+ * that a record can be read a line at a time (as -servers does). Status
+ * and type codes are written as two fields, the name and then the number
+ * under the same key with "Code" appended. A field that could not be got
+ * is written as null (an empty cell in CSV/TSV) so that the columns stay
+ * in step, and as the given text, if any, in text mode.
+ */
+#define FORMAT_TEXT     0
+#define FORMAT_JSON     1
+#define FORMAT_CSV      2
+#define FORMAT_TSV      3
+
+static int outputFormat = FORMAT_TEXT;
+static const char *recordTag = NULL;    /* Leading "server" field, for -tag */
+
+/*
+ * What each character of a string value is written as in the current
+ * format, or NULL for the character itself. Built by setOutputFormat() so
+ * that escaping a string is a table lookup per character.
+ */
+static const char *escapeText[256];
+static char controlEscapes[32][8];      /* JSON \u00xx escapes */
+
+static void setOutputFormat(
+    int format                  /* FORMAT_xxx */
+)
+{
+    int ch;
+    outputFormat = format;
+    for (ch = 0; ch < 256; ch++)
+        escapeText[ch] = NULL;
+    switch(format)
+    {
+    case FORMAT_JSON:
+        for (ch = 0; ch < 32; ch++)
+        {
+            sprintf(controlEscapes[ch], "\\u%04x", ch);
+            escapeText[ch] = controlEscapes[ch];
+        }
+        escapeText['"'] = "\\\"";
+        escapeText['\\'] = "\\\\";
+        escapeText['\n'] = "\\n";
+        escapeText['\r'] = "\\r";
+        escapeText['\t'] = "\\t";
+        break;
+    case FORMAT_CSV:
+        escapeText['"'] = "\"\"";
+        escapeText['\\'] = "\\\\";
+        escapeText['\n'] = "\\n";
+        escapeText['\r'] = "\\r";
+        break;
+    case FORMAT_TSV:
+        escapeText['\\'] = "\\\\";
+        escapeText['\n'] = "\\n";
+        escapeText['\r'] = "\\r";
+        escapeText['\t'] = "\\t";
+        break;
+    }
+}
+
+/*
+ * Write the CSV/TSV header line for records with the given columns, unless
+ * it is the header already in force.
+ */
+static void outHeader(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *columns         /* Field names, comma separated */
+)
+{
+    const char *p;
+    if ((outputFormat == FORMAT_TEXT) || (outputFormat == FORMAT_JSON) ||
+            (buf->columns == columns))
+        return;
+    if (recordTag != NULL)
+        outStr(buf, (outputFormat == FORMAT_TSV) ? "server\t" : "server,");
+    for (p = columns; *p != '\0'; p++)
+        outChar(buf, ((*p == ',') && (outputFormat == FORMAT_TSV)) ? '\t' : *p);
+    outChar(buf, '\n');
+    buf->columns = columns;
+}
+
+static void outStrField(OUTBUF *buf, const char *key, const char *label, const char *value);
+
+/*
+ * Start a record. columns is the comma separated list of the field names
+ * (as they appear in a CSV header) that the record will have. With -tag,
+ * every record in the structured formats starts with a "server" field.
+ */
+static void outBeginRecord(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *columns         /* Field names, comma separated */
+)
+{
+    buf->nFields = 0;
+    if (outputFormat == FORMAT_JSON)
+        outChar(buf, '{');
+    else
+        outHeader(buf, columns);
+    if ((recordTag != NULL) && (outputFormat != FORMAT_TEXT))
+        outStrField(buf, "server", NULL, recordTag);
+}
+
+static void outEndRecord(
+    OUTBUF *buf                 /* Buffer to write to */
+)
+{
+    if (outputFormat == FORMAT_JSON)
+        outStr(buf, "}\n");
+    else if ((outputFormat != FORMAT_TEXT) || (buf->nFields > 0))
+        outChar(buf, '\n');
+    buf->nFields = 0;
+}
+
+/*
+ * Write text that only appears in text mode, such as a table heading.
+ */
+static void outText(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *text            /* Text to write */
+)
+{
+    if (outputFormat == FORMAT_TEXT)
+        outStr(buf, text);
+}
+
+/*
+ * Write what comes before a field's value: its label or cell separator in
+ * text mode, its key in JSON, or the column separator in CSV/TSV.
+ */
+static void outKey(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label           /* Text label, NULL for a table cell */
+)
+{
+    switch(outputFormat)
+    {
+    case FORMAT_TEXT:
+        if (label != NULL)
+            outStr(buf, label);
+        else if (buf->nFields++ > 0)
+            outChar(buf, '\t');
+        break;
+    case FORMAT_JSON:
+        if (buf->nFields++ > 0)
+            outChar(buf, ',');
+        outChar(buf, '"');
+        outStr(buf, key);
+        outStr(buf, "\":");
+        break;
+    default:
+        if (buf->nFields++ > 0)
+            outChar(buf, (outputFormat == FORMAT_CSV) ? ',' : '\t');
+        break;
+    }
+}
+
+/*
+ * Write part of a string value, escaped as the format requires. The
+ * caller writes the quotes around the whole value with outQuote().
+ */
+static void outEscaped(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *str,            /* Text to write */
+    size_t len                  /* Its length */
+)
+{
+    const char *end = str + len;
+    const char *run = str;
+    const char *p;
+    if (outputFormat == FORMAT_TEXT)
+    {
+        outMem(buf, str, len);
+        return;
+    }
+    for (p = str; p < end; p++)
+    {
+        const char *with = escapeText[(unsigned char) *p];
+        if (with != NULL)
+        {
+            outMem(buf, run, p - run);
+            outStr(buf, with);
+            run = p + 1;
+        }
+    }
+    outMem(buf, run, end - run);
+}
+
+static void outQuote(
+    OUTBUF *buf                 /* Buffer to write to */
+)
+{
+    if ((outputFormat == FORMAT_JSON) || (outputFormat == FORMAT_CSV))
+        outChar(buf, '"');
+}
+
+static void outStrField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    const char *value           /* Value */
+)
+{
+    outKey(buf, key, label);
+    outQuote(buf);
+    outEscaped(buf, value, strlen(value));
+    outQuote(buf);
+    if ((outputFormat == FORMAT_TEXT) && (label != NULL))
+        outChar(buf, '\n');
+}
+
+/*
+ * Write a number that has already been formatted, unquoted. JSON has no
+ * infinity or NaN, so those are written as null.
+ */
+static void outNumberField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    const char *value           /* Number as text */
+)
+{
+    outKey(buf, key, label);
+    if ((outputFormat == FORMAT_JSON) && !isdigit((unsigned char) value[(value[0] == '-') ? 1 : 0]))
+        outStr(buf, "null");
+    else
+        outStr(buf, value);
+    if ((outputFormat == FORMAT_TEXT) && (label != NULL))
+        outChar(buf, '\n');
+}
+
+static void outIntField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    long value                  /* Value */
+)
+{
+    outKey(buf, key, label);
+    outInt(buf, value);
+    if ((outputFormat == FORMAT_TEXT) && (label != NULL))
+        outChar(buf, '\n');
+}
+
+/*
+ * Format a time as "yyyy-mm-dd hh:mm:ss" local time.
+ */
+static void formatTime(
+    char *text,                 /* Returned text, at least 20 characters */
+    time_t t                    /* Time to format */
+)
+{
+    struct tm tm;
+    if ((localtime_s(&tm, &t) != 0) || (strftime(text, 20, "%Y-%m-%d %H:%M:%S", &tm) == 0))
+        strcpy(text, "????");
+}
+
+/*
+ * Write a time. In text mode this is the ctime() format, which brings its
+ * own newline; otherwise it is the formatTime() format.
+ */
+static void outTimeField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    time_t t                    /* Value */
+)
+{
+    outKey(buf, key, label);
+    if (outputFormat == FORMAT_TEXT)
+        outTime(buf, t);
+    else
+    {
+        char text[32];
+        formatTime(text, t);
+        outQuote(buf);
+        outStr(buf, text);
+        outQuote(buf);
+    }
+}
+
+/*
+ * Write a status or type code as its name and its number. In text mode the
+ * name is followed by the number in brackets if showCode is set.
+ */
+static void writeCode(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    const char *name,           /* Name of the code, NULL if not known */
+    const char *text,           /* Text mode value if name is NULL */
+    int code,                   /* The code */
+    BOOL hasCode,               /* FALSE to write the number as null */
+    BOOL showCode               /* Show the number in text mode */
+)
+{
+    if (outputFormat == FORMAT_TEXT)
+    {
+        if ((name == NULL) && (text == NULL))
+            return;
+        outKey(buf, key, label);
+        outStr(buf, (name != NULL) ? name : text);
+        if (showCode && hasCode && (name != NULL))
+        {
+            outStr(buf, " (");
+            outInt(buf, code);
+            outChar(buf, ')');
+        }
+        if (label != NULL)
+            outChar(buf, '\n');
+        return;
+    }
+    outKey(buf, key, label);
+    if (name == NULL)
+        outStr(buf, (outputFormat == FORMAT_JSON) ? "null" : "");
+    else
+    {
+        outQuote(buf);
+        outEscaped(buf, name, strlen(name));
+        outQuote(buf);
+    }
+    if (outputFormat == FORMAT_JSON)
+    {
+        outStr(buf, ",\"");
+        outStr(buf, key);
+        outStr(buf, "Code\":");
+    }
+    else
+        outChar(buf, (outputFormat == FORMAT_CSV) ? ',' : '\t');
+    if (hasCode)
+        outInt(buf, code);
+    else if (outputFormat == FORMAT_JSON)
+        outStr(buf, "null");
+}
+
+/*
+ * A code shown as "NAME (n)" in text mode.
+ */
+static void outCodeField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    const char *name,           /* Name of the code */
+    int code                    /* The code */
+)
+{
+    writeCode(buf, key, label, name, NULL, code, TRUE, TRUE);
+}
+
+/*
+ * A code shown just by name in text mode.
+ */
+static void outNameField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    const char *name,           /* Name of the code */
+    int code                    /* The code */
+)
+{
+    writeCode(buf, key, label, name, NULL, code, TRUE, FALSE);
+}
+
+/*
+ * A code field holding a state that has no code of its own, such as a job
+ * that was never run.
+ */
+static void outStateField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    const char *name            /* Name of the state */
+)
+{
+    writeCode(buf, key, label, name, NULL, 0, FALSE, FALSE);
+}
+
+/*
+ * A code field whose value could not be got. text is what text mode
+ * shows instead, or NULL for nothing at all.
+ */
+static void outNullCodeField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    const char *text            /* Text mode value, or NULL */
+)
+{
+    writeCode(buf, key, label, NULL, text, 0, FALSE, FALSE);
+}
+
+/*
+ * A field whose value could not be got, or a group of nColumns fields
+ * (see outBeginObject()). text is what text mode shows instead, or NULL
+ * for nothing at all.
+ */
+static void outNullField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    const char *text,           /* Text mode value, or NULL */
+    int nColumns                /* Columns it takes in CSV/TSV */
+)
+{
+    if (outputFormat == FORMAT_TEXT)
+    {
+        if (text != NULL)
+        {
+            outKey(buf, key, label);
+            outStr(buf, text);
+            if (label != NULL)
+                outChar(buf, '\n');
+        }
+    }
+    else if (outputFormat == FORMAT_JSON)
+    {
+        outKey(buf, key, label);
+        outStr(buf, "null");
+    }
+    else
+    {
+        while (nColumns-- > 0)
+            outKey(buf, key, label);
+    }
+}
+
+/*
+ * Write a string list. In text mode a labelled list is written one string
+ * per line indented by the given number of tabs, and a table cell has the
+ * strings one after another on separate lines. Otherwise the list is a
+ * JSON array if asArray is set, else a single string with the strings
+ * separated by newlines.
+ */
+static void writeList(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    int indent,                 /* Tabs to indent a labelled list by */
+    char *list,                 /* The string list */
+    BOOL asArray                /* Write a JSON array */
+)
+{
+    char *str;
+    outKey(buf, key, label);
+    if ((outputFormat == FORMAT_TEXT) && (label != NULL))
+    {
+        writeStrList(buf, indent, list);
+        return;
+    }
+    if ((outputFormat == FORMAT_JSON) && asArray)
+    {
+        outChar(buf, '[');
+        for (str = list; *str != '\0'; str += strlen(str) + 1)
+        {
+            if (str != list)
+                outChar(buf, ',');
+            outChar(buf, '"');
+            outEscaped(buf, str, strlen(str));
+            outChar(buf, '"');
+        }
+        outChar(buf, ']');
+        return;
+    }
+    outQuote(buf);
+    for (str = list; *str != '\0'; str += strlen(str) + 1)
+    {
+        if (str != list)
+            outEscaped(buf, "\n", 1);
+        outEscaped(buf, str, strlen(str));
+    }
+    outQuote(buf);
+}
+
+static void outListField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    int indent,                 /* Tabs to indent a labelled list by */
+    char *list                  /* The string list */
+)
+{
+    writeList(buf, key, label, indent, list, TRUE);
+}
+
+/*
+ * A message held as a string list of its lines.
+ */
+static void outMessageField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label, NULL for a table cell */
+    int indent,                 /* Tabs to indent a labelled message by */
+    char *lines                 /* The lines, as a string list */
+)
+{
+    writeList(buf, key, label, indent, lines, FALSE);
+}
+
+/*
+ * Group fields under a key: a nested object in JSON, the label in text
+ * mode. In CSV/TSV the fields simply carry on as further columns, so a
+ * group that could not be got must be written by outNullField() with the
+ * number of columns it would have had.
+ */
+static void outBeginObject(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label           /* Text label */
+)
+{
+    if (outputFormat == FORMAT_TEXT)
+        outStr(buf, label);
+    else if (outputFormat == FORMAT_JSON)
+    {
+        outKey(buf, key, label);
+        outChar(buf, '{');
+        buf->nFields = 0;
+    }
+}
+
+static void outEndObject(
+    OUTBUF *buf                 /* Buffer to write to */
+)
+{
+    if (outputFormat == FORMAT_JSON)
+    {
+        outChar(buf, '}');
+        buf->nFields = 1;
+    }
+}
+
+/*
+ * Write each string of a list as a record with a single field, as the
+ * -lprojects, -ljobs and similar commands do.
+ */
+static void outListRecords(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name, and so the column list */
+    char *list                  /* The string list */
+)
+{
+    char *str;
+    for (str = list; *str != '\0'; str += strlen(str) + 1)
+    {
+        outBeginRecord(buf, key);
+        outStrField(buf, key, "", str);
+        outEndRecord(buf);
+    }
+}
+
+/*****************************************************************************/
+/*
+ * Write out the fields of a job log entry. In text mode each line is
+ * prefixed by the requested number of tabs. The fields are those listed
+ * in logDetailColumns, and there are LOGDETAIL_FIELDS of them in CSV/TSV.
+ */
+#define LOGDETAIL_FIELDS 5
+
+static const char logDetailColumns[] = "eventId,time,type,typeCode,message";
+
+static void writeLogDetail(
+    OUTBUF *buf,                /* Buffer to write to */
+    int indent,                 /* Number of tabs to indent by */
+    DSLOGDETAIL *logDetail      /* The log entry to write */
+)
+{
+    char prefix[6] = "\t\t\t\t\t";
+    prefix[indent] = '\0';
+    outText(buf, prefix);
+    if (logDetail->eventId < 0)
+        outNullField(buf, "eventId", "Event Id: ", "unknown", 1);
+    else
+        outIntField(buf, "eventId", "Event Id: ", logDetail->eventId);
+    outText(buf, prefix);
+    outTimeField(buf, "time", "Time\t: ", logDetail->timestamp);
+    outText(buf, prefix);
+    outNameField(buf, "type", "Type\t: ", logTypeName(logDetail->type), logDetail->type);
+    outText(buf, prefix);
+    outMessageField(buf, "message", "Message\t:\n", indent+1, logDetail->fullMessage);
+}
+
+/*****************************************************************************/
+/*
+ * Return a malloc'ed copy of a string, or NULL if out of memory.
+ */
+static char *copyString(
+    char *str                   /* String to duplicate */
+)
+{
+    char *copy = malloc(strlen(str) + 1);
+    if (copy != NULL)
+        strcpy(copy, str);
+    return copy;
+}
+
+/*
+ * Read a line of any length from the given file, stripping the line
+ * terminator. The buffer is grown as necessary. Returns FALSE at end of file.
+ */
+static BOOL readLine(
+    FILE *fp,                   /* File to read from */
+    char **buffer,              /* Line buffer, may be reallocated */
+    size_t *size                /* Allocated size of the buffer */
+)
+{
+    size_t len = 0;
+    if (*buffer == NULL)
+    {
+        *size = 1024;
+        if ((*buffer = malloc(*size)) == NULL)
+            return FALSE;
+    }
+    while (fgets(*buffer + len, (int) (*size - len), fp) != NULL)
+    {
+        len += strlen(*buffer + len);
+        if ((len > 0) && ((*buffer)[len - 1] == '\n'))
+            break;
+        if (len + 1 == *size)
+        {
+            char *bigger = realloc(*buffer, *size * 2);
+            if (bigger == NULL)
+                break;
+            *buffer = bigger;
+            *size *= 2;
+        }
+    }
+    if (len == 0)
+        return FALSE;
+    while ((len > 0) && (((*buffer)[len - 1] == '\n') || ((*buffer)[len - 1] == '\r')))
+        (*buffer)[--len] = '\0';
+    return TRUE;
+}
+
+/*
+ * Split a line into arguments in place. Arguments are separated by white
+ * space; double quotes group words into one argument and within quotes a
+ * backslash escapes the next character. Returns the argument vector (which
+ * the caller must free) and sets the count, or returns NULL if we run out
+ * of memory.
+ */
+static char **splitCommandLine(
+    char *line,                 /* Line to split, modified in place */
+    int *argcOut                /* Returned argument count */
+)
+{
+    int argc = 0;
+    int maxArgs = 16;
+    char **argv = malloc(maxArgs * sizeof(char *));
+    char *in = line;
+    char *out;
+    if (argv == NULL)
+        return NULL;
+    for (;;)
+    {
+        BOOL quoted = FALSE;
+        while (isspace((unsigned char) *in))
+            in++;
+        if (*in == '\0')
+            break;
+        if (argc + 1 >= maxArgs)
+        {
+            char **bigger = realloc(argv, maxArgs * 2 * sizeof(char *));
+            if (bigger == NULL)
+            {
+                free(argv);
+                return NULL;
+            }
+            argv = bigger;
+            maxArgs *= 2;
+        }
+        argv[argc++] = out = in;
+        while ((*in != '\0') && (quoted || !isspace((unsigned char) *in)))
+        {
+            if (*in == '"')
+                quoted = !quoted;
+            else if (quoted && (*in == '\\') && (in[1] != '\0'))
+                *out++ = *++in;
+            else
+                *out++ = *in;
+            in++;
+        }
+        if (*in != '\0')
+            in++;
+        *out = '\0';
+    }
+    argv[argc] = NULL;
+    *argcOut = argc;
+    return argv;
+}
+
+/*****************************************************************************/
+/*
+ * Connection layer.
+ *
+ * Every project and job open, by a handler or a worker, goes through
+ * connectOpen(). An open that fails on the way to the server (one of
+ * isTransportError()'s) is retried up to openRetries times (-retry),
+ * after a delay that doubles from RETRY_BASE_DELAY each time with random
+ * jitter, so that a blip in the engine tier is ridden out and a crowd of
+ * clients does not all come back at once. Each failure is reported with
+ * its cause from DSGetLastErrorMsg().
+ *
+ * A circuit breaker stops a dead server being hammered: after
+ * BREAKER_THRESHOLD transport failures in a row no open is tried for
+ * BREAKER_COOLDOWN seconds, and opens fail at once. Then one trial open is
+ * let through; if it works the breaker closes again, otherwise it stays
+ * open for another cooldown. The API talks to one server per process
+ * (-servers runs a process for each), so the one breaker is per server.
+ */
+#define DEFAULT_OPEN_RETRIES 3
+#define RETRY_BASE_DELAY    250     /* Milliseconds */
+#define RETRY_MAX_DELAY     8000    /* Milliseconds */
+#define BREAKER_THRESHOLD   5       /* Failures in a row that trip it */
+#define BREAKER_COOLDOWN    30      /* Seconds it then stays open */
+
+typedef struct BREAKER
+{
+    int failures;               /* Transport failures in a row */
+    time_t openUntil;           /* No opens until then, 0 if closed */
+    BOOL trial;                 /* The trial open is in progress */
+    CRITICAL_SECTION lock;      /* Protects everything above */
+} BREAKER;
+
+static int openRetries = DEFAULT_OPEN_RETRIES;
+static BREAKER breaker;
+
+/*
+ * Return TRUE if the status code suggests that the session the cached
+ * handles belong to is no longer usable, so reconnecting may help.
+ */
+static BOOL isConnectionError(
+    int status                  /* Status returned by a handler */
+)
+{
+    switch(status)
+    {
+    case DSJE_BADHANDLE:
+    case DSJE_TIMEOUT:
+    case DSJE_SERVER_ERROR:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/*
+ * Return TRUE if an open failed getting to the server rather than at it,
+ * so that trying again later may work. A project or job that isn't there
+ * (DSJE_BADPROJECT, DSJE_OPENFAIL) fails the same way every time, and a
+ * bad handle is the caller's, so neither is retried or counted against
+ * the server.
+ */
+static BOOL isTransportError(
+    int status                  /* Status of the open */
+)
+{
+    switch(status)
+    {
+    case DSJE_TIMEOUT:
+    case DSJE_SERVER_ERROR:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/*
+ * Say whether an open may be tried now. Returns the seconds the breaker
+ * will stay open for, or 0 if the open may go ahead.
+ */
+static long breakerWait(void)
+{
+    long wait = 0;
+    EnterCriticalSection(&(breaker.lock));
+    if (breaker.openUntil != 0)
+    {
+        wait = (long) (breaker.openUntil - time(NULL));
+        if ((wait <= 0) && !breaker.trial)
+        {
+            breaker.trial = TRUE;
+            wait = 0;
+        }
+        else if (wait <= 0)
+            wait = 1;           /* Someone else's trial is under way */
+    }
+    LeaveCriticalSection(&(breaker.lock));
+    return wait;
+}
+
+/*
+ * Record the outcome of an open. Anything but a transport error shows
+ * the server is there, so closes the breaker.
+ */
+static void breakerRecord(
+    int status                  /* DSJE_NOERROR or why the open failed */
+)
+{
+    EnterCriticalSection(&(breaker.lock));
+    if (!isTransportError(status))
+    {
+        breaker.failures = 0;
+        breaker.openUntil = 0;
+        breaker.trial = FALSE;
+    }
+    else if (breaker.trial || (++(breaker.failures) >= BREAKER_THRESHOLD))
+    {
+        breaker.openUntil = time(NULL) + BREAKER_COOLDOWN;
+        breaker.trial = FALSE;
+    }
+    LeaveCriticalSection(&(breaker.lock));
+}
+
+/*
+ * A delay of between half and all of the given one, different in each
+ * process and thread.
+ */
+static DWORD retryJitter(
+    DWORD delay                 /* Milliseconds */
+)
+{
+    unsigned long seed;
+    seed = (unsigned long) GetTickCount() * 2654435761UL;
+    seed ^= (unsigned long) GetCurrentProcessId() * 40503UL;
+    seed ^= (unsigned long) GetCurrentThreadId() * 2246822519UL;
+    seed = (seed ^ (seed >> 15)) & 0xffffffffUL;
+    return delay / 2 + (DWORD) (seed % (delay / 2 + 1));
+}
+
+/*
+ * Open a project, or a job if hProject is not NULL, retrying transport
+ * failures. Each attempt is made under lock if it is not NULL. Returns
+ * the handle, or NULL with *status set. Nothing is written to stderr if
+ * quiet is set.
+ */
+static void *connectOpen(
+    DSPROJECT hProject,         /* Project to open a job in, or NULL */
+    char *name,                 /* Project or job name */
+    CRITICAL_SECTION *lock,     /* Lock to make the call under, or NULL */
+    BOOL quiet,                 /* Don't report failures */
+    int *status                 /* Returned error status */
+)
+{
+    const char *what = (hProject == NULL) ? "project" : "job";
+    DWORD delay = RETRY_BASE_DELAY;
+    DWORD pause;
+    void *handle = NULL;
+    char *errText;
+    long wait;
+    int attempt;
+    for (attempt = 0; ; attempt++)
+    {
+        if ((wait = breakerWait()) > 0)
+        {
+            /* The last failure is still the one DSGetLastError() reports */
+            if (!quiet)
+                fprintf(stderr, "Not connecting to the server for another %ld seconds after repeated failures\n", wait);
+            *status = DSJE_NO_DATASTAGE;
+            return NULL;
+        }
+        if (lock != NULL)
+            EnterCriticalSection(lock);
+        handle = (hProject == NULL) ? (void *) DSOpenProject(name) : (void *) DSOpenJob(hProject, name);
+        *status = (handle != NULL) ? DSJE_NOERROR : DSGetLastError();
+        errText = ((handle == NULL) && !quiet) ? DSGetLastErrorMsg(hProject) : NULL;
+        if (lock != NULL)
+            LeaveCriticalSection(lock);
+        breakerRecord(*status);
+        if ((handle != NULL) || !isTransportError(*status))
+            return handle;
+        pause = retryJitter(delay);
+        if (!quiet)
+        {
+            fprintf(stderr, "Failed to open %s '%s', status %d: %s\n", what, name, *status,
+                    ((errText != NULL) && (*errText != '\0')) ? errText : "no message");
+            if (attempt < openRetries)
+                fprintf(stderr, "Retrying in %lu ms...\n", (unsigned long) pause);
+        }
+        if (attempt >= openRetries)
+            return NULL;
+        Sleep(pause);
+        if ((delay *= 2) > RETRY_MAX_DELAY)
+            delay = RETRY_MAX_DELAY;
+    }
+}
+
+/*****************************************************************************/
+/*
+ * Project and job handle cache.
+ *
+ * Every sub-command handler opens its project and job through the routines
+ * below. Normally they simply call through to the API, but in batch and
+ * daemon mode (see -batch and -daemon) the handles are kept open in a cache
+ * keyed by project and job name, so that a run of commands against the
+ * same project pays for the engine session only once. Handles that have
+ * not been used for cacheIdleTimeout seconds are closed by
+ * evictIdleHandles().
+ */
+typedef struct HANDLECACHE
+{
+    char *project;              /* Project name */
+    char *job;                  /* Job name, NULL for a project entry */
+    DSPROJECT hProject;         /* Project handle (owning project for jobs) */
+    DSJOB hJob;                 /* Job handle, NULL for a project entry */
+    time_t lastUsed;            /* When the handle was last handed out */
+    struct HANDLECACHE *next;
+} HANDLECACHE;
+
+#define DEFAULT_IDLE_TIMEOUT 300 /* Seconds */
+
+static BOOL cacheHandles = FALSE;
+static int cacheIdleTimeout = DEFAULT_IDLE_TIMEOUT;
+static HANDLECACHE *handleCache = NULL;
+
+static HANDLECACHE *addCacheEntry(
+    char *project,              /* Project name */
+    char *job,                  /* Job name or NULL */
+    DSPROJECT hProject,         /* Project handle */
+    DSJOB hJob                  /* Job handle or NULL */
+)
+{
+    HANDLECACHE *entry = malloc(sizeof(HANDLECACHE));
+    if (entry == NULL)
+        return NULL;
+    entry->project = copyString(project);
+    entry->job = (job == NULL) ? NULL : copyString(job);
+    entry->hProject = hProject;
+    entry->hJob = hJob;
+    entry->lastUsed = time(NULL);
+    entry->next = handleCache;
+    handleCache = entry;
+    return entry;
+}
+
+static void freeCacheEntry(
+    HANDLECACHE *entry          /* Entry already unlinked from the cache */
+)
+{
+    if (entry->hJob != NULL)
+        (void) DSCloseJob(entry->hJob);
+    else
+        (void) DSCloseProject(entry->hProject);
+    free(entry->project);
+    free(entry->job);
+    free(entry);
+}
+
+/*
+ * Close and forget a cached project handle, together with any job handles
+ * that were opened through it.
+ */
+static void dropCachedProject(
+    DSPROJECT hProject          /* Project handle to drop */
+)
+{
+    HANDLECACHE **link;
+    HANDLECACHE *entry;
+    HANDLECACHE *projectEntry = NULL;
+    for (link = &handleCache; (entry = *link) != NULL; )
+    {
+        if (entry->hProject != hProject)
+            link = &(entry->next);
+        else
+        {
+            *link = entry->next;
+            if (entry->hJob != NULL)
+                freeCacheEntry(entry);
+            else
+                projectEntry = entry;
+        }
+    }
+    /* Jobs must be closed before the project they belong to */
+    if (projectEntry != NULL)
+        freeCacheEntry(projectEntry);
+}
+
+/*
+ * Close every handle that has been idle for longer than the timeout. A
+ * project is only considered idle once all of its jobs are.
+ */
+static void evictIdleHandles(void)
+{
+    time_t now = time(NULL);
+    HANDLECACHE **link;
+    HANDLECACHE *entry;
+    HANDLECACHE *job;
+    /* First the idle jobs... */
+    for (link = &handleCache; (entry = *link) != NULL; )
+    {
+        if ((entry->hJob != NULL) && ((now - entry->lastUsed) > cacheIdleTimeout))
+        {
+            *link = entry->next;
+            freeCacheEntry(entry);
+        }
+        else
+            link = &(entry->next);
+    }
+    /* ... then any idle project that has no jobs left open */
+    do
+    {
+        for (entry = handleCache; entry != NULL; entry = entry->next)
+        {
+            if ((entry->hJob != NULL) || ((now - entry->lastUsed) <= cacheIdleTimeout))
+                continue;
+            for (job = handleCache; job != NULL; job = job->next)
+                if ((job->hJob != NULL) && (job->hProject == entry->hProject))
+                    break;
+            if (job == NULL)
+                break;
+        }
+        if (entry != NULL)
+            dropCachedProject(entry->hProject);
+    } while (entry != NULL);
+}
+
+/*
+ * Close every cached handle, e.g. at the end of a session or before
+ * reconnecting after a server error.
+ */
+static void flushHandleCache(void)
+{
+    while (handleCache != NULL)
+        dropCachedProject(handleCache->hProject);
+}
+
+/*
+ * Open a project through the cache. Returns NULL with *status set if it
+ * can't be opened; the status is the open's own, which DSGetLastError()
+ * may no longer be by the time the caller could ask.
+ */
+static DSPROJECT openProject(
+    char *project,              /* Name of project to open */
+    int *status                 /* Returned error status */
+)
+{
+    HANDLECACHE *entry;
+    DSPROJECT hProject;
+    if (!cacheHandles)
+        return connectOpen(NULL, project, lastErrorLock, FALSE, status);
+    for (entry = handleCache; entry != NULL; entry = entry->next)
+    {
+        if ((entry->hJob == NULL) && (strcmp(entry->project, project) == 0))
+        {
+            entry->lastUsed = time(NULL);
+            *status = DSJE_NOERROR;
+            return entry->hProject;
+        }
+    }
+    /* If we can't add it to the cache, closeProject() will really close it */
+    hProject = connectOpen(NULL, project, lastErrorLock, FALSE, status);
+    if (hProject != NULL)
+        (void) addCacheEntry(project, NULL, hProject, NULL);
+    return hProject;
+}
+
+/*
+ * Open a job through the cache, as for openProject().
+ */
+static DSJOB openJob(
+    DSPROJECT hProject,         /* Project the job belongs to */
+    char *job,                  /* Name of job to open */
+    int *status                 /* Returned error status */
+)
+{
+    HANDLECACHE *entry;
+    HANDLECACHE *projectEntry = NULL;
+    DSJOB hJob;
+    if (!cacheHandles)
+        return connectOpen(hProject, job, lastErrorLock, FALSE, status);
+    for (entry = handleCache; entry != NULL; entry = entry->next)
+    {
+        if (entry->hProject != hProject)
+            continue;
+        if (entry->hJob == NULL)
+            projectEntry = entry;
+        else if (strcmp(entry->job, job) == 0)
+        {
+            entry->lastUsed = time(NULL);
+            *status = DSJE_NOERROR;
+            return entry->hJob;
+        }
+    }
+    /* Only cache jobs whose project is cached too */
+    hJob = connectOpen(hProject, job, lastErrorLock, FALSE, status);
+    if ((hJob != NULL) && (projectEntry != NULL))
+        (void) addCacheEntry(projectEntry->project, job, hProject, hJob);
+    return hJob;
+}
+
+static int closeJob(
+    DSJOB hJob                  /* Job handle from openJob() */
+)
+{
+    HANDLECACHE *entry;
+    for (entry = handleCache; entry != NULL; entry = entry->next)
+        if (entry->hJob == hJob)
+            return DSJE_NOERROR;
+    return DSCloseJob(hJob);
+}
+
+static int closeProject(
+    DSPROJECT hProject          /* Project handle from openProject() */
+)
+{
+    HANDLECACHE *entry;
+    for (entry = handleCache; entry != NULL; entry = entry->next)
+        if ((entry->hJob == NULL) && (entry->hProject == hProject))
+            return DSJE_NOERROR;
+    return DSCloseProject(hProject);
+}
+
+/*****************************************************************************/
+/*
+ * Design-time metadata cache.
+ *
+ * The stage, link and parameter lists of a job and the parameter details
+ * only change when the job is changed, so -lstages, -llinks, -lparams and
+ * -paraminfo keep them in a file per job in DSJOB_CACHEDIR (by default
+ * %TEMP%\dsjobcache) and only ask the server for what the file does not
+ * have. The API has no compile counter, so the job's wave number is the
+ * validator: it is checked once per command, and when it has moved the
+ * job's cached items are thrown away. A cached item therefore lasts until
+ * the job is next run, which covers checking parameters ahead of a run.
+ * -nocache turns the cache off.
+ *
+ * Each line of a cache file is an item name followed by its fields,
+ * separated by tabs, with backslash escapes for tab, newline, carriage
+ * return and backslash. An item that the server reported as not available
+ * is kept as a name with no fields. Worker threads may use the caches of
+ * different jobs at once: findMetaCache() holds metaLock while it looks
+ * through the list of caches, and metaGetParamTypes(), which workers may
+ * call for the same job, holds it while it reads or replaces the type map,
+ * but not while it calls the server.
+ */
+#define METACACHE_VERSION "dsjob metadata cache 1"
+
+typedef struct METAENTRY
+{
+    char *name;                 /* Item name, such as "linklist/Xfm" */
+    char *data;                 /* Fields, each NUL terminated, then a NUL */
+    int nFields;                /* 0 if the item is not available */
+    struct METAENTRY *next;
+} METAENTRY;
+
+typedef struct METACACHE
+{
+    char *key;                  /* server/project/job */
+    char *fileName;
+    int waveNumber;
+    unsigned long checked;      /* Command the wave number was checked in */
+    METAENTRY *entries;
+    struct METACACHE *next;
+} METACACHE;
+
+static BOOL useMetaCache = TRUE;
+static char *serverName = NULL;         /* As passed to DSSetServerParams() */
+static unsigned long commandNumber = 0; /* Counts commands run */
+static METACACHE *metaCaches = NULL;
+static CRITICAL_SECTION metaLock;
+
+static void freeMetaEntries(
+    METACACHE *cache            /* Cache to empty */
+)
+{
+    while (cache->entries != NULL)
+    {
+        METAENTRY *entry = cache->entries;
+        cache->entries = entry->next;
+        free(entry->name);
+        free(entry->data);
+        free(entry);
+    }
+}
+
+/*
+ * Throw away the items that the wave number validates when it moves on,
+ * keeping the parameter type map, which has a validator of its own.
+ */
+static void freeRunMetaEntries(
+    METACACHE *cache            /* Cache to empty */
+)
+{
+    METAENTRY **link = &(cache->entries);
+    while (*link != NULL)
+    {
+        METAENTRY *entry = *link;
+        if (strcmp(entry->name, "paramtypes") == 0)
+            link = &(entry->next);
+        else
+        {
+            *link = entry->next;
+            free(entry->name);
+            free(entry->data);
+            free(entry);
+        }
+    }
+}
+
+/*
+ * Add an item to a cache, taking a copy of the fields (a block of len
+ * bytes ending with an extra NUL).
+ */
+static METAENTRY *addMetaEntry(
+    METACACHE *cache,           /* Cache to add to */
+    const char *name,           /* Item name */
+    const char *data,           /* Fields */
+    size_t len,                 /* Length of the fields block */
+    int nFields                 /* Number of fields */
+)
+{
+    METAENTRY *entry = malloc(sizeof(METAENTRY));
+    if (entry == NULL)
+        return NULL;
+    entry->name = malloc(strlen(name) + 1);
+    entry->data = malloc(len);
+    if ((entry->name == NULL) || (entry->data == NULL))
+    {
+        free(entry->name);
+        free(entry->data);
+        free(entry);
+        return NULL;
+    }
+    strcpy(entry->name, name);
+    memcpy(entry->data, data, len);
+    entry->nFields = nFields;
+    entry->next = cache->entries;
+    cache->entries = entry;
+    return entry;
+}
+
+/*
+ * Undo the escapes in a field read from a cache file, in place.
+ */
+static void unescapeField(
+    char *field                 /* Field to unescape */
+)
+{
+    char *in;
+    char *out = field;
+    for (in = field; *in != '\0'; in++)
+    {
+        if ((*in == '\\') && (in[1] != '\0'))
+        {
+            in++;
+            *out++ = (*in == 't') ? '\t' : (*in == 'n') ? '\n' : (*in == 'r') ? '\r' : *in;
+        }
+        else
+            *out++ = *in;
+    }
+    *out = '\0';
+}
+
+static void writeEscaped(
+    FILE *fp,                   /* File to write to */
+    const char *str             /* Field to write */
+)
+{
+    for (; *str != '\0'; str++)
+    {
+        switch(*str)
+        {
+        case '\t':
+            fputs("\\t", fp);
+            break;
+        case '\n':
+            fputs("\\n", fp);
+            break;
+        case '\r':
+            fputs("\\r", fp);
+            break;
+        case '\\':
+            fputs("\\\\", fp);
+            break;
+        default:
+            putc(*str, fp);
+            break;
+        }
+    }
+}
+
+/*
+ * Read a cache file. Returns FALSE, leaving the cache empty, if the file
+ * does not exist or is not a cache file for this job.
+ */
+static BOOL readMetaCache(
+    METACACHE *cache            /* Cache to fill */
+)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t size = 0;
+    BOOL valid = FALSE;
+    if ((fp = fopen(cache->fileName, "r")) == NULL)
+        return FALSE;
+    if (readLine(fp, &line, &size) && (strcmp(line, METACACHE_VERSION) == 0) &&
+            readLine(fp, &line, &size) && (strncmp(line, "key\t", 4) == 0))
+    {
+        unescapeField(line + 4);
+        if ((strcmp(line + 4, cache->key) == 0) &&
+                readLine(fp, &line, &size) && (strncmp(line, "wave\t", 5) == 0))
+        {
+            cache->waveNumber = atoi(line + 5);
+            valid = TRUE;
+        }
+    }
+    while (valid && readLine(fp, &line, &size))
+    {
+        /* Split the line into NUL terminated fields in place */
+        char *name = line;
+        char *field;
+        char *end;
+        char *data;
+        char *out;
+        int nFields = 0;
+        if ((field = strchr(line, '\t')) != NULL)
+            *field++ = '\0';
+        unescapeField(name);
+        data = out = field;
+        while (field != NULL)
+        {
+            if ((end = strchr(field, '\t')) != NULL)
+                *end++ = '\0';
+            unescapeField(field);
+            memmove(out, field, strlen(field) + 1);
+            out += strlen(out) + 1;
+            nFields++;
+            field = end;
+        }
+        if (nFields == 0)
+            valid = (addMetaEntry(cache, name, "", 1, 0) != NULL);
+        else
+        {
+            *out++ = '\0';
+            valid = (addMetaEntry(cache, name, data, out - data, nFields) != NULL);
+        }
+    }
+    free(line);
+    fclose(fp);
+    if (!valid)
+        freeMetaEntries(cache);
+    return valid;
+}
+
+/*
+ * Write a cache out to its file, by way of a temporary file so that a
+ * concurrent reader never sees half a file.
+ */
+static void writeMetaCache(
+    METACACHE *cache            /* Cache to save */
+)
+{
+    char tempName[MAX_PATH + 32];
+    FILE *fp;
+    METAENTRY *entry;
+    sprintf(tempName, "%.*s.%lu", MAX_PATH, cache->fileName,
+            (unsigned long) GetCurrentProcessId());
+    if ((fp = fopen(tempName, "w")) == NULL)
+        return;
+    fprintf(fp, "%s\nkey\t", METACACHE_VERSION);
+    writeEscaped(fp, cache->key);
+    fprintf(fp, "\nwave\t%d\n", cache->waveNumber);
+    for (entry = cache->entries; entry != NULL; entry = entry->next)
+    {
+        char *field = entry->data;
+        int i;
+        writeEscaped(fp, entry->name);
+        for (i = 0; i < entry->nFields; i++, field += strlen(field) + 1)
+        {
+            putc('\t', fp);
+            writeEscaped(fp, field);
+        }
+        putc('\n', fp);
+    }
+    if ((fclose(fp) != 0) || !MoveFileExA(tempName, cache->fileName, MOVEFILE_REPLACE_EXISTING))
+        (void) DeleteFileA(tempName);
+}
+
+/*
+ * The 32-bit FNV-1a hash of some bytes, and of a string.
+ */
+static unsigned long fnvHashBytes(
+    const char *data,           /* Bytes to hash */
+    size_t len
+)
+{
+    unsigned long hash = 2166136261UL;
+    for (; len > 0; data++, len--)
+        hash = ((hash ^ (unsigned char) *data) * 16777619UL) & 0xffffffffUL;
+    return hash;
+}
+
+static unsigned long fnvHash(
+    const char *str             /* String to hash */
+)
+{
+    return fnvHashBytes(str, strlen(str));
+}
+
+/*
+ * Work out the directory that dsjob keeps its files in, DSJOB_CACHEDIR or
+ * by default dsjobcache in the temporary directory, creating it if need
+ * be. Returns FALSE if the name doesn't fit.
+ */
+static BOOL getCacheDir(
+    char *dir                   /* Returned name, MAX_PATH characters */
+)
+{
+    char *env = getenv("DSJOB_CACHEDIR");
+    if (env != NULL)
+    {
+        if (strlen(env) >= MAX_PATH)
+            return FALSE;
+        strcpy(dir, env);
+    }
+    else
+    {
+        DWORD n = GetTempPathA(MAX_PATH, dir);
+        if ((n == 0) || (n + sizeof("dsjobcache") > MAX_PATH))
+            return FALSE;
+        strcat(dir, "dsjobcache");
+    }
+    (void) CreateDirectoryA(dir, NULL);
+    return TRUE;
+}
+
+/*
+ * Return the cache for a job, creating it (and reading its file) if this
+ * is the first time the job has been asked about. NULL is returned if the
+ * cache is off or can't be set up. Called with metaLock held.
+ */
+static METACACHE *lookupMetaCache(
+    char *project,              /* Project name */
+    char *job                   /* Job name */
+)
+{
+    METACACHE *cache;
+    char *server = (serverName != NULL) ? serverName : "";
+    char *key;
+    char dir[MAX_PATH];
+    char *p;
+    if (!useMetaCache)
+        return NULL;
+    if ((key = malloc(strlen(server) + strlen(project) + strlen(job) + 3)) == NULL)
+        return NULL;
+    sprintf(key, "%s/%s/%s", server, project, job);
+    for (cache = metaCaches; cache != NULL; cache = cache->next)
+    {
+        if (strcmp(cache->key, key) == 0)
+        {
+            free(key);
+            return cache;
+        }
+    }
+    if (!getCacheDir(dir) || ((cache = calloc(1, sizeof(METACACHE))) == NULL))
+    {
+        free(key);
+        return NULL;
+    }
+    cache->key = key;
+    if ((cache->fileName = malloc(strlen(dir) + strlen(project) + strlen(job) + 16)) == NULL)
+    {
+        free(key);
+        free(cache);
+        return NULL;
+    }
+    /*
+     * The file is named after the project and job, with anything that may
+     * not be in a file name replaced, plus a hash of the whole key to keep
+     * apart names that come out the same.
+     */
+    sprintf(cache->fileName, "%s" PATH_SEPARATOR "%s_%s_%08lx.dsc", dir, project, job, fnvHash(cache->key));
+    for (p = cache->fileName + strlen(dir) + 1; *p != '\0'; p++)
+        if (!isalnum((unsigned char) *p) && (strchr("._-", *p) == NULL))
+            *p = '_';
+    cache->waveNumber = -1;
+    (void) readMetaCache(cache);
+    cache->next = metaCaches;
+    metaCaches = cache;
+    return cache;
+}
+
+static METACACHE *findMetaCache(
+    char *project,              /* Project name */
+    char *job                   /* Job name */
+)
+{
+    METACACHE *cache;
+    EnterCriticalSection(&metaLock);
+    cache = lookupMetaCache(project, job);
+    LeaveCriticalSection(&metaLock);
+    return cache;
+}
+
+/*
+ * Look up an item in a job's cache, first checking (once per command)
+ * that the job's wave number has not moved on. Returns NULL if the item
+ * has to be fetched, in which case *cacheOut is set to the cache to store
+ * it in (or NULL if it should not be stored).
+ */
+static METAENTRY *findMetaEntry(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project name */
+    char *job,                  /* Job name */
+    const char *name,           /* Item name */
+    METACACHE **cacheOut        /* Returned cache to store the item in */
+)
+{
+    METACACHE *cache = findMetaCache(project, job);
+    METAENTRY *entry;
+    *cacheOut = NULL;
+    if (cache == NULL)
+        return NULL;
+    if (cache->checked != commandNumber)
+    {
+        DSJOBINFO jobInfo;
+        if (DSGetJobInfo(hJob, DSJ_JOBWAVENO, &jobInfo) != DSJE_NOERROR)
+            return NULL;
+        if (jobInfo.info.jobWaveNumber != cache->waveNumber)
+        {
+            freeRunMetaEntries(cache);
+            cache->waveNumber = jobInfo.info.jobWaveNumber;
+        }
+        cache->checked = commandNumber;
+    }
+    for (entry = cache->entries; entry != NULL; entry = entry->next)
+        if (strcmp(entry->name, name) == 0)
+            return entry;
+    *cacheOut = cache;
+    return NULL;
+}
+
+/*
+ * Store a string list (NULL if the item is not available) in a cache.
+ */
+static void storeMetaList(
+    METACACHE *cache,           /* Cache from findMetaEntry(), or NULL */
+    const char *name,           /* Item name */
+    char *list                  /* The list */
+)
+{
+    char *str;
+    int n = 0;
+    if (cache == NULL)
+        return;
+    if (list == NULL)
+        list = "";
+    for (str = list; *str != '\0'; str += strlen(str) + 1)
+        n++;
+    if (addMetaEntry(cache, name, list, str - list + 1, n) != NULL)
+        writeMetaCache(cache);
+}
+
+/*
+ * DSGetJobInfo() for DSJ_STAGELIST and DSJ_PARAMLIST, by way of the cache.
+ */
+static int metaGetJobInfo(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job,
+    int infoType,               /* DSJ_STAGELIST or DSJ_PARAMLIST */
+    DSJOBINFO *jobInfo          /* Returned information */
+)
+{
+    const char *name = (infoType == DSJ_STAGELIST) ? "stagelist" : "paramlist";
+    METACACHE *cache;
+    METAENTRY *entry = findMetaEntry(hJob, project, job, name, &cache);
+    int status;
+    if (entry != NULL)
+    {
+        if (entry->nFields == 0)
+            return DSJE_NOT_AVAILABLE;
+        jobInfo->infoType = infoType;
+        if (infoType == DSJ_STAGELIST)
+            jobInfo->info.stageList = entry->data;
+        else
+            jobInfo->info.paramList = entry->data;
+        return DSJE_NOERROR;
+    }
+    status = DSGetJobInfo(hJob, infoType, jobInfo);
+    if (status == DSJE_NOERROR)
+        storeMetaList(cache, name, (infoType == DSJ_STAGELIST) ?
+                      jobInfo->info.stageList : jobInfo->info.paramList);
+    else if (status == DSJE_NOT_AVAILABLE)
+        storeMetaList(cache, name, NULL);
+    return status;
+}
+
+/*
+ * DSGetStageInfo() for DSJ_LINKLIST, by way of the cache.
+ */
+static int metaGetLinkList(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job,
+    char *stage,                /* Stage name */
+    DSSTAGEINFO *stageInfo      /* Returned information */
+)
+{
+    char *name = malloc(strlen(stage) + sizeof("linklist/"));
+    METACACHE *cache = NULL;
+    METAENTRY *entry = NULL;
+    int status;
+    if (name != NULL)
+    {
+        sprintf(name, "linklist/%s", stage);
+        entry = findMetaEntry(hJob, project, job, name, &cache);
+    }
+    if (entry != NULL)
+    {
+        free(name);
+        if (entry->nFields == 0)
+            return DSJE_NOT_AVAILABLE;
+        stageInfo->infoType = DSJ_LINKLIST;
+        stageInfo->info.linkList = entry->data;
+        return DSJE_NOERROR;
+    }
+    status = DSGetStageInfo(hJob, stage, DSJ_LINKLIST, stageInfo);
+    if (status == DSJE_NOERROR)
+        storeMetaList(cache, name, stageInfo->info.linkList);
+    else if (status == DSJE_NOT_AVAILABLE)
+        storeMetaList(cache, name, NULL);
+    free(name);
+    return status;
+}
+
+/*
+ * DSGetStageInfo() for DSJ_STAGETYPE, by way of the cache.
+ */
+static int metaGetStageType(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job,
+    char *stage,                /* Stage name */
+    DSSTAGEINFO *stageInfo      /* Returned information */
+)
+{
+    char *name = malloc(strlen(stage) + sizeof("stagetype/"));
+    METACACHE *cache = NULL;
+    METAENTRY *entry = NULL;
+    int status;
+    if (name != NULL)
+    {
+        sprintf(name, "stagetype/%s", stage);
+        entry = findMetaEntry(hJob, project, job, name, &cache);
+    }
+    if (entry != NULL)
+    {
+        free(name);
+        if (entry->nFields == 0)
+            return DSJE_NOT_AVAILABLE;
+        stageInfo->infoType = DSJ_STAGETYPE;
+        stageInfo->info.typeName = entry->data;
+        return DSJE_NOERROR;
+    }
+    status = DSGetStageInfo(hJob, stage, DSJ_STAGETYPE, stageInfo);
+    if (status == DSJE_NOERROR)
+    {
+        /* Stored as a list of one string */
+        char *list = malloc(strlen(stageInfo->info.typeName) + 2);
+        if (list != NULL)
+        {
+            strcpy(list, stageInfo->info.typeName);
+            list[strlen(list) + 1] = '\0';
+            storeMetaList(cache, name, list);
+            free(list);
+        }
+    }
+    else if (status == DSJE_NOT_AVAILABLE)
+        storeMetaList(cache, name, NULL);
+    free(name);
+    return status;
+}
+
+/*
+ * The text form of a parameter value, as kept in the cache. Returns a
+ * pointer to the value itself or to text formatted into number.
+ */
+static char *paramValueText(
+    DSPARAM *param,             /* The value */
+    char *number                /* Space for a number, 32 characters */
+)
+{
+    switch(param->paramType)
+    {
+    case DSJ_PARAMTYPE_INTEGER:
+        sprintf(number, "%d", param->paramValue.pInt);
+        return number;
+    case DSJ_PARAMTYPE_FLOAT:
+        sprintf(number, "%.9G", param->paramValue.pFloat);
+        return number;
+    case DSJ_PARAMTYPE_STRING:
+        return param->paramValue.pString;
+    case DSJ_PARAMTYPE_ENCRYPTED:
+        return param->paramValue.pEncrypt;
+    case DSJ_PARAMTYPE_PATHNAME:
+        return param->paramValue.pPath;
+    case DSJ_PARAMTYPE_LIST:
+        return param->paramValue.pListValue;
+    case DSJ_PARAMTYPE_DATE:
+        return param->paramValue.pDate;
+    case DSJ_PARAMTYPE_TIME:
+        return param->paramValue.pTime;
+    default:
+        return "";
+    }
+}
+
+/*
+ * Point a parameter value at its text form from the cache.
+ */
+static void setParamValue(
+    DSPARAM *param,             /* Value to set */
+    int paramType,              /* DSJ_PARAMTYPE_xxx */
+    char *text                  /* Its text form */
+)
+{
+    param->paramType = paramType;
+    switch(paramType)
+    {
+    case DSJ_PARAMTYPE_INTEGER:
+        param->paramValue.pInt = atoi(text);
+        break;
+    case DSJ_PARAMTYPE_FLOAT:
+        param->paramValue.pFloat = (float) atof(text);
+        break;
+    case DSJ_PARAMTYPE_ENCRYPTED:
+        param->paramValue.pEncrypt = text;
+        break;
+    case DSJ_PARAMTYPE_PATHNAME:
+        param->paramValue.pPath = text;
+        break;
+    case DSJ_PARAMTYPE_LIST:
+        param->paramValue.pListValue = text;
+        break;
+    case DSJ_PARAMTYPE_DATE:
+        param->paramValue.pDate = text;
+        break;
+    case DSJ_PARAMTYPE_TIME:
+        param->paramValue.pTime = text;
+        break;
+    default:
+        param->paramValue.pString = text;
+        break;
+    }
+}
+
+/*
+ * DSGetParamInfo(), by way of the cache. The fields of a cached parameter
+ * are its type, help text, prompt, prompt at run flag, the types and
+ * values of the default and original default, then the list values and
+ * the original list values, each list ended by an empty field (which
+ * leaves each list as a proper string list in the cached block).
+ */
+static int metaGetParamInfo(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job,
+    char *param,                /* Parameter name */
+    DSPARAMINFO *paramInfo      /* Returned information */
+)
+{
+    char *name = malloc(strlen(param) + sizeof("paraminfo/"));
+    METACACHE *cache = NULL;
+    METAENTRY *entry = NULL;
+    OUTBUF fields = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    char number[32];
+    int status;
+    if (name != NULL)
+    {
+        sprintf(name, "paraminfo/%s", param);
+        entry = findMetaEntry(hJob, project, job, name, &cache);
+    }
+    if ((entry != NULL) && (entry->nFields >= 10))
+    {
+        char *field[8];
+        char *p = entry->data;
+        int i;
+        free(name);
+        for (i = 0; i < 8; i++, p += strlen(p) + 1)
+            field[i] = p;
+        paramInfo->paramType = atoi(field[0]);
+        paramInfo->helpText = field[1];
+        paramInfo->paramPrompt = field[2];
+        paramInfo->promptAtRun = atoi(field[3]);
+        setParamValue(&(paramInfo->defaultValue), atoi(field[4]), field[5]);
+        setParamValue(&(paramInfo->desDefaultValue), atoi(field[6]), field[7]);
+        paramInfo->listValues = p;
+        while (*p != '\0')
+            p += strlen(p) + 1;
+        paramInfo->desListValues = p + 1;
+        return DSJE_NOERROR;
+    }
+    status = DSGetParamInfo(hJob, param, paramInfo);
+    if ((status == DSJE_NOERROR) && (cache != NULL))
+    {
+        /* Build the fields block and add it */
+        char *lists[2];
+        char *str;
+        int nFields = 10;
+        int i;
+        lists[0] = paramInfo->listValues;
+        lists[1] = paramInfo->desListValues;
+        outInt(&fields, paramInfo->paramType);
+        outChar(&fields, '\0');
+        outMem(&fields, paramInfo->helpText, strlen(paramInfo->helpText) + 1);
+        outMem(&fields, paramInfo->paramPrompt, strlen(paramInfo->paramPrompt) + 1);
+        outInt(&fields, paramInfo->promptAtRun);
+        outChar(&fields, '\0');
+        outInt(&fields, paramInfo->defaultValue.paramType);
+        outChar(&fields, '\0');
+        str = paramValueText(&(paramInfo->defaultValue), number);
+        outMem(&fields, str, strlen(str) + 1);
+        outInt(&fields, paramInfo->desDefaultValue.paramType);
+        outChar(&fields, '\0');
+        str = paramValueText(&(paramInfo->desDefaultValue), number);
+        outMem(&fields, str, strlen(str) + 1);
+        for (i = 0; i < 2; i++)
+        {
+            if ((paramInfo->paramType == DSJ_PARAMTYPE_LIST) && (lists[i] != NULL))
+            {
+                for (str = lists[i]; *str != '\0'; str += strlen(str) + 1)
+                {
+                    outMem(&fields, str, strlen(str) + 1);
+                    nFields++;
+                }
+            }
+            outChar(&fields, '\0');
+        }
+        outChar(&fields, '\0');
+        if ((fields.data != NULL) &&
+                (addMetaEntry(cache, name, fields.data, fields.len, nFields) != NULL))
+            writeMetaCache(cache);
+        free(fields.data);
+    }
+    free(name);
+    return status;
+}
+
+/*
+ * Copy the type map out of a "paramtypes" item, leaving out its hash.
+ */
+static char *copyParamTypes(
+    const char *data,           /* The item's fields */
+    int nFields
+)
+{
+    const char *start = data + strlen(data) + 1;
+    const char *field = start;
+    char *copy;
+    int i;
+    for (i = 1; i < nFields; i++)
+        field += strlen(field) + 1;
+    if ((copy = malloc(field - start + 1)) != NULL)
+        memcpy(copy, start, field - start + 1);
+    return copy;
+}
+
+/*
+ * Return a copy of the type map of a job's parameters, a block of name
+ * and DSJ_PARAMTYPE_xxx number fields ended by an extra NUL, so that
+ * setting parameters costs the same however many there are. The map is
+ * built with one walk of DSJ_PARAMLIST and kept in the cache as the
+ * "paramtypes" item, whose first field is a hash of the parameter list.
+ * The wave number moves on with every run, so the map is validated by
+ * the hash instead, against the list fetched afresh each time: it lasts
+ * until the job is recompiled with different parameters, and a type that
+ * changes on its own is caught when DSSetParam() rejects the value. NULL
+ * is returned if the cache is off, in which case each parameter has to be
+ * looked up on its own. The caller frees the copy.
+ */
+static char *metaGetParamTypes(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job
+)
+{
+    METACACHE *cache = findMetaCache(project, job);
+    METAENTRY *entry;
+    OUTBUF types = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    DSJOBINFO jobInfo;
+    DSPARAMINFO paramInfo;
+    char *paramList;
+    char *param;
+    char *copy = NULL;
+    char hash[16];
+    size_t len;
+    int nFields = 1;
+    int status;
+    if (cache == NULL)
+        return NULL;
+    status = DSGetJobInfo(hJob, DSJ_PARAMLIST, &jobInfo);
+    if (status == DSJE_NOT_AVAILABLE)
+        jobInfo.info.paramList = "";
+    else if (status != DSJE_NOERROR)
+        return NULL;
+    for (param = jobInfo.info.paramList; *param != '\0'; param += strlen(param) + 1)
+        ;
+    len = param - jobInfo.info.paramList;
+    sprintf(hash, "%08lx", fnvHashBytes(jobInfo.info.paramList, len));
+    EnterCriticalSection(&metaLock);
+    for (entry = cache->entries; entry != NULL; entry = entry->next)
+        if (strcmp(entry->name, "paramtypes") == 0)
+            break;
+    if ((entry != NULL) && (entry->nFields > 0) && (strcmp(entry->data, hash) == 0))
+        copy = copyParamTypes(entry->data, entry->nFields);
+    LeaveCriticalSection(&metaLock);
+    if (copy != NULL)
+        return copy;
+    /* Take a copy of the list, as the calls below may reuse it */
+    if ((paramList = malloc(len + 1)) == NULL)
+        return NULL;
+    memcpy(paramList, jobInfo.info.paramList, len + 1);
+    outMem(&types, hash, strlen(hash) + 1);
+    for (param = paramList; *param != '\0'; param += strlen(param) + 1)
+    {
+        if (DSGetParamInfo(hJob, param, &paramInfo) == DSJE_NOERROR)
+        {
+            outMem(&types, param, strlen(param) + 1);
+            outInt(&types, paramInfo.paramType);
+            outChar(&types, '\0');
+            nFields += 2;
+        }
+    }
+    outChar(&types, '\0');
+    free(paramList);
+    if (types.data == NULL)
+        return NULL;
+    EnterCriticalSection(&metaLock);
+    for (entry = cache->entries; entry != NULL; entry = entry->next)
+        if (strcmp(entry->name, "paramtypes") == 0)
+            break;
+    if (entry != NULL)
+    {
+        /* Replace the old map in place */
+        char *data = malloc(types.len);
+        if (data != NULL)
+        {
+            memcpy(data, types.data, types.len);
+            free(entry->data);
+            entry->data = data;
+            entry->nFields = nFields;
+            writeMetaCache(cache);
+        }
+    }
+    else if (addMetaEntry(cache, "paramtypes", types.data, types.len, nFields) != NULL)
+        writeMetaCache(cache);
+    LeaveCriticalSection(&metaLock);
+    copy = copyParamTypes(types.data, nFields);
+    free(types.data);
+    return copy;
+}
+
+/*****************************************************************************/
+/*
+ * Job parameters.
+ *
+ * The parameters of a -run are collected, from -param options and from
+ * -paramfile files, into a PARAMSET. Each entry is a copy of a
+ * "name=value" setting with the '=' replaced by a NUL, so it holds the
+ * name followed by the value. A later setting of a parameter replaces an
+ * earlier one, so -param can override a value from a file.
+ */
+typedef struct PARAMSET
+{
+    char **param;               /* Settings */
+    int nParams;
+    int maxParams;
+} PARAMSET;
+
+static void freeParams(
+    PARAMSET *params            /* Set to empty */
+)
+{
+    int i;
+    for (i = 0; i < params->nParams; i++)
+        free(params->param[i]);
+    free(params->param);
+    params->param = NULL;
+    params->nParams = params->maxParams = 0;
+}
+
+/*
+ * Add a "name=value" setting to a set. Returns FALSE if the setting has
+ * no '=' or there is no memory for it.
+ */
+static BOOL addParam(
+    PARAMSET *params,           /* Set to add to */
+    char *setting               /* name=value string */
+)
+{
+    char *value = strchr(setting, '=');
+    char *copy;
+    int i;
+    if (value == NULL)
+        return FALSE;
+    if ((copy = copyString(setting)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return FALSE;
+    }
+    copy[value - setting] = '\0';
+    for (i = 0; i < params->nParams; i++)
+    {
+        if (strcmp(params->param[i], copy) == 0)
+        {
+            free(params->param[i]);
+            params->param[i] = copy;
+            return TRUE;
+        }
+    }
+    if (params->nParams == params->maxParams)
+    {
+        char **bigger = realloc(params->param, (params->maxParams + 16) * sizeof(char *));
+        if (bigger == NULL)
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            free(copy);
+            return FALSE;
+        }
+        params->param = bigger;
+        params->maxParams += 16;
+    }
+    params->param[params->nParams++] = copy;
+    return TRUE;
+}
+
+/*
+ * Add the settings in a parameter file, one "name=value" per line, to a
+ * set. Blank lines and lines starting with '#' are ignored. A file name
+ * of "-" reads stdin, where a line holding just "." also ends the list so
+ * that in batch mode the parameters can follow the -run command.
+ */
+static BOOL readParamFile(
+    PARAMSET *params,           /* Set to add to */
+    char *fileName              /* Parameter file, or "-" */
+)
+{
+    FILE *fp = stdin;
+    char *line = NULL;
+    size_t size = 0;
+    int lineNo = 0;
+    BOOL ok = TRUE;
+    if ((strcmp(fileName, "-") != 0) && ((fp = fopen(fileName, "r")) == NULL))
+    {
+        fprintf(stderr, "ERROR: Failed to open parameter file '%s'\n", fileName);
+        return FALSE;
+    }
+    while (ok && readLine(fp, &line, &size))
+    {
+        lineNo++;
+        if ((fp == stdin) && (strcmp(line, ".") == 0))
+            break;
+        if ((line[0] == '\0') || (line[0] == '#'))
+            continue;
+        if (!(ok = addParam(params, line)))
+            fprintf(stderr, "Invalid parameter setting at line %d of '%s'\n", lineNo, fileName);
+    }
+    free(line);
+    if (fp != stdin)
+        fclose(fp);
+    return ok;
+}
+
+/*
+ * Find the type of a parameter in a type map from metaGetParamTypes().
+ * Returns -1 if the parameter is not in the map.
+ */
+static int findParamType(
+    char *types,                /* Type map */
+    char *param                 /* Parameter name */
+)
+{
+    while (*types != '\0')
+    {
+        char *type = types + strlen(types) + 1;
+        if (strcmp(types, param) == 0)
+            return atoi(type);
+        types = type + strlen(type) + 1;
+    }
+    return -1;
+}
+
+/*
+ * Convert a value to a parameter's type (anything we don't know how to
+ * convert is tried as a string) and register it with DSSetParam.
+ */
+static int setParamValueOfType(
+    DSJOB hJob,                 /* Job the parameter belongs to */
+    char *param,                /* Parameter name */
+    char *value,                /* Its value */
+    int type                    /* DSJ_PARAMTYPE_xxx */
+)
+{
+    DSPARAM paramData;
+    /*
+     * Construct the value structure to pass to the server. We could
+     * attempt to validate some of these parameters rather than
+     * simply copying them... but for simplicity we don't!
+     */
+    setParamValue(&paramData, type, value);
+    if ((type < DSJ_PARAMTYPE_STRING) || (type > DSJ_PARAMTYPE_TIME))
+        paramData.paramType = DSJ_PARAMTYPE_STRING;
+    return DSSetParam(hJob, param, &paramData);
+}
+
+/*
+ * Set a job's parameters at the server end. The type of each parameter
+ * comes from the job's type map where possible, and otherwise, or if the
+ * server rejects the value as that type, from asking the server about it.
+ */
+static int setParams(
+    DSJOB hJob,                 /* Job the parameters belong to */
+    char *project,              /* Project and job names */
+    char *job,
+    PARAMSET *params            /* Parameters to set */
+)
+{
+    char *types = NULL;
+    int status = DSJE_NOERROR;
+    int i;
+    if (params->nParams > 0)
+        types = metaGetParamTypes(hJob, project, job);
+    for (i = 0; (status == DSJE_NOERROR) && (i < params->nParams); i++)
+    {
+        char *param = params->param[i];
+        char *value = param + strlen(param) + 1;
+        int type = (types != NULL) ? findParamType(types, param) : -1;
+        DSPARAMINFO paramInfo;
+        /* Try setting the parameter as the type in the map */
+        if ((type >= 0) && (setParamValueOfType(hJob, param, value, type) == DSJE_NOERROR))
+            continue;
+        /* Get the parameter information which tells us what type it is */
+        status = DSGetParamInfo(hJob, param, &paramInfo);
+        if (status != DSJE_NOERROR)
+        {
+            fprintf(stderr, "Error %d getting information for parameter '%s'\n", status, param);
+            break;
+        }
+        status = setParamValueOfType(hJob, param, value, paramInfo.paramType);
+        if (status != DSJE_NOERROR)
+            fprintf(stderr, "Error setting value of parameter '%s'\n", param);
+    }
+    free(types);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Worker thread support for the commands that fan out over many jobs.
+ *
+ * vmdsapi does not promise that a handle can be used by more than one
+ * thread at a time, and DSGetLastError() reports the most recent failure in
+ * the process rather than in the calling thread. So:
+ *
+ *  - DSSetServerParams() is only ever called by main() before any worker
+ *    starts, and all workers share its settings.
+ *  - Each worker opens its own project and job handles and never passes
+ *    them to another thread. The handle cache above is not thread safe and
+ *    is not used by workers.
+ *  - Opening a project or job, together with the DSGetLastError() call that
+ *    explains a failure, is serialized under apiLock. While the daemon's
+ *    publisher runs beside the main thread, the main thread's opens and
+ *    last-error reads are too (see lastErrorLock), and so are all of the
+ *    publisher's calls, since any of them may set the last error.
+ *
+ * Calls on a worker's own handles are otherwise made concurrently.
+ */
+#define DEFAULT_THREADS 4
+#define MAX_THREADS 64
+
+static CRITICAL_SECTION apiLock;
+
+typedef struct WORKER
+{
+    int index;                  /* Worker number, from 0 */
+    void *context;              /* State shared by all the workers */
+    void (*body)(struct WORKER *);  /* What the worker does */
+    char *project;              /* Project hProject is open on */
+    DSPROJECT hProject;         /* This worker's own project handle */
+    BOOL quiet;                 /* Don't report failed opens on stderr */
+} WORKER;
+
+/*
+ * Return the worker's handle on the given project, opening it (and closing
+ * any handle on a different project) if necessary. On failure NULL is
+ * returned and *status is set.
+ */
+static DSPROJECT workerProject(
+    WORKER *worker,             /* Calling worker */
+    char *project,              /* Project name */
+    int *status                 /* Returned error status */
+)
+{
+    if ((worker->hProject != NULL) && (strcmp(worker->project, project) == 0))
+        return worker->hProject;
+    if (worker->hProject != NULL)
+        (void) DSCloseProject(worker->hProject);
+    worker->project = project;
+    worker->hProject = connectOpen(NULL, project, &apiLock, worker->quiet, status);
+    return worker->hProject;
+}
+
+/*
+ * Open a job on the worker's project handle. On failure NULL is returned
+ * and *status is set.
+ */
+static DSJOB workerJob(
+    WORKER *worker,             /* Calling worker */
+    char *project,              /* Project name */
+    char *job,                  /* Job name */
+    int *status                 /* Returned error status */
+)
+{
+    DSJOB hJob = NULL;
+    DSPROJECT hProject = workerProject(worker, project, status);
+    if (hProject != NULL)
+        hJob = connectOpen(hProject, job, &apiLock, worker->quiet, status);
+    return hJob;
+}
+
+static unsigned __stdcall workerThread(
+    void *arg                   /* The WORKER */
+)
+{
+    WORKER *worker = arg;
+    worker->body(worker);
+    if (worker->hProject != NULL)
+        (void) DSCloseProject(worker->hProject);
+    return 0;
+}
+
+/*
+ * Run the body on nThreads worker threads and wait for them all to finish.
+ * If no thread can be started the body is run on the calling thread, so
+ * the work still gets done.
+ */
+static void runWorkers(
+    int nThreads,               /* Number of workers */
+    void (*body)(WORKER *),     /* Routine each worker runs */
+    void *context               /* Shared state passed to the workers */
+)
+{
+    WORKER workers[MAX_THREADS];
+    HANDLE threads[MAX_THREADS];
+    int nStarted = 0;
+    int i;
+    if (nThreads > MAX_THREADS)
+        nThreads = MAX_THREADS;
+    for (i = 0; i < nThreads; i++)
+    {
+        workers[i].index = i;
+        workers[i].context = context;
+        workers[i].body = body;
+        workers[i].project = NULL;
+        workers[i].hProject = NULL;
+        workers[i].quiet = FALSE;
+        threads[nStarted] = (HANDLE) _beginthreadex(NULL, 0, workerThread,
+                                                    &(workers[i]), 0, NULL);
+        if (threads[nStarted] != 0)
+            nStarted++;
+    }
+    if (nStarted == 0)
+        (void) workerThread(&(workers[0]));
+    for (i = 0; i < nStarted; i++)
+    {
+        (void) WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+}
+
+/*****************************************************************************/
+/*
+ * Return the display name of a job status code, as reported by -jobinfo.
+ */
+static const CODENAME jobStatusNames[] =
+{
+    { DSJS_RUNNING,     "RUNNING" },
+    { DSJS_RUNOK,       "RUN OK" },
+    { DSJS_RUNWARN,     "RUN with WARNINGS" },
+    { DSJS_RUNFAILED,   "RUN FAILED" },
+    { DSJS_VALOK,       "VALIDATED OK" },
+    { DSJS_VALWARN,     "VALIDATE with WARNINGS" },
+    { DSJS_VALFAILED,   "VALIDATION FILED" },
+    { DSJS_RESET,       "RESET" },
+    { DSJS_STOPPED,     "STOPPED" },
+    { DSJS_NOTRUNNABLE, "NOT COMPILED" },
+    { DSJS_NOTRUNNING,  "NOT RUNNING" }
+};
+
+static char *jobStatusName(
+    int jobStatus               /* DSJS_xxx status code */
+)
+{
+    return codeName(jobStatusNames, N_CODES(jobStatusNames), jobStatus, "UNKNOWN");
+}
+
+/*****************************************************************************/
+/*
+ * The options of a -run request, as parsed by parseRunArgs().
+ */
+typedef struct RUNREQUEST
+{
+    char *project;              /* Project name */
+    char *job;                  /* Job name */
+    int mode;                   /* DSJ_RUNxxx mode */
+    int warningLimit;           /* Warning limit, -1 if not set */
+    int rowLimit;               /* Row limit, 0 if not set */
+    PARAMSET params;            /* Parameter settings */
+    BOOL waitForJob;            /* Wait for the job to finish */
+    BOOL async;                 /* Hand back a token for -join instead */
+} RUNREQUEST;
+
+/*
+ * Parse the arguments of a -run request. Returns FALSE if they are invalid.
+ * A request that parses must be freed with freeParams(&request->params).
+ */
+static BOOL parseRunArgs(
+    int argc,                   /* Argument count */
+    char *argv[],               /* Arguments following -run */
+    RUNREQUEST *request         /* Returned request */
+)
+{
+    int i;
+    BOOL badOptions = FALSE;
+    request->mode = DSJ_RUNNORMAL;
+    request->warningLimit = -1;
+    request->rowLimit = 0;
+    request->params.param = NULL;
+    request->params.nParams = request->params.maxParams = 0;
+    request->waitForJob = FALSE;
+    request->async = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        if (strcmp(opt, "wait") == 0)
+            request->waitForJob = TRUE;
+        else if (strcmp(opt, "async") == 0)
+            request->async = TRUE;
+        else
+        {
+            char *arg = argv[i+1];
+            if (++i >= argc)
+                badOptions = TRUE;
+            else if (strcmp(opt, "mode") == 0)
+            {
+                if (strcmp(arg, "NORMAL") == 0)
+                    request->mode = DSJ_RUNNORMAL;
+                else if (strcmp(arg, "RESET") == 0)
+                    request->mode = DSJ_RUNRESET;
+                else if (strcmp(arg, "VALIDATE") == 0)
+                    request->mode = DSJ_RUNVALIDATE;
+                else
+                    badOptions = TRUE;
+            }
+            else if (strcmp(opt, "param") == 0)
+                badOptions = !addParam(&(request->params), arg);
+            else if (strcmp(opt, "paramfile") == 0)
+                badOptions = !readParamFile(&(request->params), arg);
+            else if (strcmp(opt, "warn") == 0)
+                request->warningLimit = atoi(arg);
+            else if (strcmp(opt, "rows") == 0)
+                request->rowLimit = atoi(arg);
+            else
+                badOptions = TRUE;
+        }
+    }
+    /* Must be two parameters left... project and job */
+    if (request->waitForJob && request->async)
+        badOptions = TRUE;
+    else if ((i+2) == argc)
+    {
+        request->project = argv[i];
+        request->job = argv[i+1];
+    }
+    else
+        badOptions = TRUE;
+    if (badOptions)
+        freeParams(&(request->params));
+    return !badOptions;
+}
+
+/*
+ * Set the limits and parameters of a request on a job that the caller has
+ * opened and locked, then start it running.
+ */
+static int startJob(
+    DSJOB hJob,                 /* Locked job to run */
+    RUNREQUEST *request         /* What to run and how */
+)
+{
+    int status = DSJE_NOERROR;
+    if (request->warningLimit >= 0)
+    {
+        status = DSSetJobLimit(hJob, DSJ_LIMITWARN, request->warningLimit);
+        if (status != DSJE_NOERROR)
+            fprintf(stderr, "Error setting warning limit\n");
+    }
+    if ((request->rowLimit != 0) && (status == DSJE_NOERROR))
+    {
+        status = DSSetJobLimit(hJob, DSJ_LIMITROWS, request->rowLimit);
+        if (status != DSJE_NOERROR)
+            fprintf(stderr, "Error setting row limit\n");
+    }
+    if (status == DSJE_NOERROR)
+        status = setParams(hJob, request->project, request->job, &(request->params));
+    if (status == DSJE_NOERROR)
+    {
+        status = DSRunJob(hJob, request->mode);
+        if (status != DSJE_NOERROR)
+            fprintf(stderr, "Error running job\n");
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -run sub-command
+ *
+ * With -async the job is started as usual and a token naming the run is
+ * written out, "<project>/<job>/<wave number>", which -join can later wait
+ * on. Names may not contain a '/', so the token splits unambiguously.
+ */
+static const char runTokenColumns[] = "token,project,job,waveNumber";
+
+static void writeRunToken(
+    char *project,              /* Project and job names */
+    char *job,
+    int waveNumber              /* Wave number of the run started */
+)
+{
+    char *token = malloc(strlen(project) + strlen(job) + 16);
+    if (token == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return;
+    }
+    sprintf(token, "%s/%s/%d", project, job, waveNumber);
+    outBeginRecord(&stdoutBuf, runTokenColumns);
+    outStrField(&stdoutBuf, "token", NULL, token);
+    if (outputFormat != FORMAT_TEXT)
+    {
+        outStrField(&stdoutBuf, "project", NULL, project);
+        outStrField(&stdoutBuf, "job", NULL, job);
+        outIntField(&stdoutBuf, "waveNumber", NULL, waveNumber);
+    }
+    outEndRecord(&stdoutBuf);
+    free(token);
+}
+
+static void recordLastRun(DSJOB hJob, char *project, char *job);
+
+static int jobRun(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    DSJOBINFO jobInfo;
+    int status;
+    RUNREQUEST request;
+    /* Report validation problems and exit */
+    if (!parseRunArgs(argc, argv, &request))
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -run\n");
+        fprintf(stderr, "\t\t\t[-mode <NORMAL | RESET | VALIDATE>]\n");
+        fprintf(stderr, "\t\t\t[-param <name>=<value>]\n");
+        fprintf(stderr, "\t\t\t[-paramfile <file> | -]\n");
+        fprintf(stderr, "\t\t\t[-warn <n>]\n");
+        fprintf(stderr, "\t\t\t[-rows <n>]\n");
+        fprintf(stderr, "\t\t\t[-wait | -async]\n");
+        fprintf(stderr, "\t\t\t<project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Attempt to open the project, open the job and lock it */
+    if ((hProject = openProject(request.project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, request.job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            if ((status = DSLockJob(hJob)) != DSJE_NOERROR)
+                fprintf(stderr, "ERROR: Failed to lock job\n");
+            else
+            {
+                /* Now set any job attributes and try running the job */
+                status = startJob(hJob, &request);
+                /* Now wait for the job to finish */
+                if ((status == DSJE_NOERROR) && request.waitForJob)
+                {
+                    outText(&stdoutBuf, "Waiting for job...\n");
+                    outFlush(&stdoutBuf);
+                    status = DSWaitForJob(hJob);
+                    if (status != DSJE_NOERROR)
+                        fprintf(stderr, "Error waiting for job\n");
+                    else
+                        recordLastRun(hJob, request.project, request.job);
+                }
+                /* Or hand back a token for the run that was started */
+                if ((status == DSJE_NOERROR) && request.async)
+                {
+                    status = DSGetJobInfo(hJob, DSJ_JOBWAVENO, &jobInfo);
+                    if (status != DSJE_NOERROR)
+                        fprintf(stderr, "Error %d getting job wave number\n", status);
+                    else
+                        writeRunToken(request.project, request.job, jobInfo.info.jobWaveNumber);
+                }
+                (void) DSUnlockJob(hJob);
+            }
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    freeParams(&(request.params));
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Adaptive concurrency for -runmany and -rundag.
+ *
+ * With -adaptive the worker count is only a ceiling: before a worker
+ * starts a job it takes a slot from the pool of the job's server and
+ * project, and holds it until it has finished with the job. Where it waits
+ * for the run that is when the run is over; without -wait it is as soon as
+ * DSRunJob() returns, so the limit then bounds the starts being made at
+ * once rather than the jobs left running. Each pool's limit is set by
+ * additive increase, multiplicative decrease from how DSRunJob() is going.
+ * It starts at one and grows by one for each run started cleanly (so doubles
+ * with each round of runs) until the first sign of trouble, and from then
+ * on grows by one for each limit's worth of clean starts. A start that
+ * fails with a connection or session error halves the limit, and one that
+ * takes more than ADAPT_SLOW_FACTOR times the best smoothed start latency
+ * seen cuts it by a quarter. A job that can't be opened only counts if the
+ * open failed with a connection error, and its time doesn't count at all.
+ * Only runs started after the last cut can cut it again, so one burst of
+ * trouble is only paid for once. A worker waiting for a slot sleeps on its
+ * pool's event, which is set when a slot is given back or the limit grows
+ * while anyone is waiting, and passed on by a waiter that leaves room.
+ */
+#define ADAPT_DEFAULT_THREADS 16    /* Ceiling when -threads isn't given */
+#define ADAPT_SLOW_FACTOR   2       /* Latency over the best that counts as slow */
+#define ADAPT_SLOW_MIN      100     /* ... as long as it is this many ms over */
+
+typedef struct RUNPOOL
+{
+    char *key;                  /* "server/project", or just the project */
+    double limit;               /* Runs allowed at once */
+    int inUse;                  /* Slots taken */
+    BOOL slowStart;             /* No trouble seen yet */
+    unsigned long nStarted;     /* Slots ever taken */
+    unsigned long lastCut;      /* The value of nStarted at the last cut */
+    double latency;             /* Smoothed start latency, ms, < 0 before */
+    double bestLatency;         /* Lowest smoothed latency seen */
+    int peakLimit;              /* For the report */
+    int nCuts;
+    HANDLE hRoom;               /* Auto-reset, set when a waiter may fit */
+    int nWaiting;               /* Workers waiting for a slot */
+    struct RUNPOOL *next;
+} RUNPOOL;
+
+typedef struct GOVERNOR
+{
+    RUNPOOL *pools;
+    int maxLimit;               /* Ceiling on every pool, the worker count */
+    CRITICAL_SECTION lock;      /* Protects everything above */
+} GOVERNOR;
+
+static void initGovernor(
+    GOVERNOR *gov,
+    int maxLimit                /* Worker count */
+)
+{
+    gov->pools = NULL;
+    gov->maxLimit = maxLimit;
+    InitializeCriticalSection(&(gov->lock));
+}
+
+static void freeGovernor(
+    GOVERNOR *gov
+)
+{
+    while (gov->pools != NULL)
+    {
+        RUNPOOL *pool = gov->pools;
+        gov->pools = pool->next;
+        (void) CloseHandle(pool->hRoom);
+        free(pool->key);
+        free(pool);
+    }
+    DeleteCriticalSection(&(gov->lock));
+}
+
+/*
+ * Wake a worker waiting on the pool if there is a slot for it. Called with
+ * the governor locked.
+ */
+static void wakeRunPool(
+    RUNPOOL *pool
+)
+{
+    if ((pool->nWaiting > 0) && (pool->inUse < (int) pool->limit))
+        (void) SetEvent(pool->hRoom);
+}
+
+/*
+ * Wait for a slot in the pool of a project, creating the pool if need be.
+ * Returns the pool, or NULL if one can't be made, in which case the run
+ * just goes ahead. *ticket is set to identify the run's start.
+ */
+static RUNPOOL *takeRunSlot(
+    GOVERNOR *gov,
+    char *project,              /* Project the job is in */
+    unsigned long *ticket       /* Returned start number */
+)
+{
+    char *server = (serverName != NULL) ? serverName : "";
+    char *key = malloc(strlen(server) + strlen(project) + 2);
+    RUNPOOL *pool;
+    if (key == NULL)
+        return NULL;
+    sprintf(key, "%s%s%s", server, (*server != '\0') ? "/" : "", project);
+    EnterCriticalSection(&(gov->lock));
+    for (pool = gov->pools; pool != NULL; pool = pool->next)
+        if (strcmp(pool->key, key) == 0)
+            break;
+    if ((pool == NULL) && ((pool = calloc(1, sizeof(RUNPOOL))) != NULL))
+    {
+        if ((pool->hRoom = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL)
+        {
+            free(pool);
+            pool = NULL;
+        }
+        else
+        {
+            pool->key = key;
+            key = NULL;
+            pool->limit = 1.0;
+            pool->slowStart = TRUE;
+            pool->latency = pool->bestLatency = -1.0;
+            pool->peakLimit = 1;
+            pool->next = gov->pools;
+            gov->pools = pool;
+        }
+    }
+    free(key);
+    if (pool != NULL)
+    {
+        while (pool->inUse >= (int) pool->limit)
+        {
+            pool->nWaiting++;
+            LeaveCriticalSection(&(gov->lock));
+            (void) WaitForSingleObject(pool->hRoom, INFINITE);
+            EnterCriticalSection(&(gov->lock));
+            pool->nWaiting--;
+        }
+        pool->inUse++;
+        *ticket = ++(pool->nStarted);
+        /* One set of the event may have been for more than one slot */
+        wakeRunPool(pool);
+    }
+    LeaveCriticalSection(&(gov->lock));
+    return pool;
+}
+
+static void cutRunLimit(
+    RUNPOOL *pool,
+    double factor               /* What the limit is multiplied by */
+)
+{
+    pool->slowStart = FALSE;
+    pool->limit *= factor;
+    if (pool->limit < 1.0)
+        pool->limit = 1.0;
+    pool->lastCut = pool->nStarted;
+    pool->nCuts++;
+}
+
+/*
+ * Adjust a pool's limit from how a start went. Without a latency (the job
+ * wasn't even opened) only a connection error counts.
+ */
+static void adaptRunLimit(
+    GOVERNOR *gov,
+    RUNPOOL *pool,              /* From takeRunSlot() */
+    unsigned long ticket,
+    int status,                 /* Result of starting the job */
+    BOOL timed,                 /* There is a latency */
+    DWORD latency               /* Milliseconds it took */
+)
+{
+    BOOL slow = FALSE;
+    EnterCriticalSection(&(gov->lock));
+    if (timed)
+    {
+        if (pool->latency < 0.0)
+            pool->latency = latency;
+        else
+            pool->latency += 0.25 * (latency - pool->latency);
+        if ((pool->bestLatency < 0.0) || (pool->latency < pool->bestLatency))
+            pool->bestLatency = pool->latency;
+        slow = (latency > ADAPT_SLOW_FACTOR * pool->bestLatency) &&
+               (latency > pool->bestLatency + ADAPT_SLOW_MIN);
+    }
+    if (ticket > pool->lastCut)
+    {
+        if (isConnectionError(status))
+            cutRunLimit(pool, 0.5);
+        else if (slow)
+            cutRunLimit(pool, 0.75);
+    }
+    if ((status == DSJE_NOERROR) && !slow)
+    {
+        pool->limit += pool->slowStart ? 1.0 : (1.0 / pool->limit);
+        if (pool->limit > gov->maxLimit)
+            pool->limit = gov->maxLimit;
+        if ((int) pool->limit > pool->peakLimit)
+            pool->peakLimit = (int) pool->limit;
+        wakeRunPool(pool);
+    }
+    LeaveCriticalSection(&(gov->lock));
+}
+
+static void releaseRunSlot(
+    GOVERNOR *gov,
+    RUNPOOL *pool               /* From takeRunSlot() */
+)
+{
+    EnterCriticalSection(&(gov->lock));
+    pool->inUse--;
+    wakeRunPool(pool);
+    LeaveCriticalSection(&(gov->lock));
+}
+
+/*
+ * Write a line per pool saying where its limit ended up (text output only).
+ */
+static void writeGovernor(
+    GOVERNOR *gov
+)
+{
+    RUNPOOL *pool;
+    if (outputFormat != FORMAT_TEXT)
+        return;
+    for (pool = gov->pools; pool != NULL; pool = pool->next)
+    {
+        outStr(&stdoutBuf, "Concurrency\t: ");
+        outStr(&stdoutBuf, pool->key);
+        outStr(&stdoutBuf, " limit ");
+        outInt(&stdoutBuf, (long) pool->limit);
+        outStr(&stdoutBuf, ", peak ");
+        outInt(&stdoutBuf, pool->peakLimit);
+        outStr(&stdoutBuf, ", cut ");
+        outInt(&stdoutBuf, pool->nCuts);
+        outStr(&stdoutBuf, " times\n");
+    }
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -runmany sub-command
+ *
+ * Each line of the manifest holds the arguments of a -run command, i.e.
+ * [<run options>] <project> <job>. The jobs are run by a pool of workers,
+ * each with its own project handle, and a completion table is printed once
+ * they have all finished.
+ */
+typedef struct RUNITEM
+{
+    int lineNo;                 /* Manifest line number */
+    char *line;                 /* Manifest line (argv points into this) */
+    char **argv;
+    RUNREQUEST request;
+    int status;                 /* Result of running the job */
+    int jobStatus;              /* Final DSJ_JOBSTATUS, -1 if not known */
+    time_t startTime;
+    time_t endTime;
+} RUNITEM;
+
+typedef struct RUNMANY
+{
+    RUNITEM *items;
+    int nItems;
+    volatile LONG nextItem;     /* Next item for a worker to take */
+    GOVERNOR *governor;         /* For -adaptive, else NULL */
+} RUNMANY;
+
+/*
+ * Lock, configure and start one job, optionally wait for it, and record
+ * the outcome in the item. With a governor the run first waits for a slot
+ * in its project's pool.
+ */
+static void runItem(
+    WORKER *worker,             /* Worker doing the run */
+    RUNITEM *item,              /* Job to run */
+    GOVERNOR *gov               /* Governor, or NULL */
+)
+{
+    DSJOB hJob;
+    DSJOBINFO jobInfo;
+    RUNREQUEST *request = &(item->request);
+    int status = DSJE_NOERROR;
+    RUNPOOL *pool = NULL;
+    unsigned long ticket = 0;
+    if (gov != NULL)
+        pool = takeRunSlot(gov, request->project, &ticket);
+    item->startTime = time(NULL);
+    if ((hJob = workerJob(worker, request->project, request->job, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open %s/%s\n", request->project, request->job);
+        /* A session that can't be had is a sign of load too */
+        if (pool != NULL)
+            adaptRunLimit(gov, pool, ticket, status, FALSE, 0);
+    }
+    else
+    {
+        if ((status = DSLockJob(hJob)) != DSJE_NOERROR)
+            fprintf(stderr, "ERROR: Failed to lock %s/%s\n", request->project, request->job);
+        else
+        {
+            DWORD started = GetTickCount();
+            status = startJob(hJob, request);
+            if (pool != NULL)
+                adaptRunLimit(gov, pool, ticket, status, TRUE, GetTickCount() - started);
+            if ((status == DSJE_NOERROR) && request->waitForJob)
+            {
+                status = DSWaitForJob(hJob);
+                if (status != DSJE_NOERROR)
+                    fprintf(stderr, "Error waiting for %s/%s\n", request->project, request->job);
+            }
+            if (DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo) == DSJE_NOERROR)
+                item->jobStatus = jobInfo.info.jobStatus;
+            (void) DSUnlockJob(hJob);
+        }
+        (void) DSCloseJob(hJob);
+    }
+    if (pool != NULL)
+        releaseRunSlot(gov, pool);
+    item->status = status;
+    item->endTime = time(NULL);
+}
+
+static void runManyWorker(
+    WORKER *worker              /* This worker */
+)
+{
+    RUNMANY *runMany = worker->context;
+    LONG next;
+    while ((next = InterlockedIncrement(&(runMany->nextItem)) - 1) < runMany->nItems)
+        runItem(worker, &(runMany->items[next]), runMany->governor);
+}
+
+/*
+ * Parse one line of -run arguments into an item. Returns 1 if an item was
+ * parsed, 0 if the line is blank or a comment, or -1 if it is invalid.
+ */
+static int parseRunItem(
+    char *text,                 /* -run arguments, copied into the item */
+    int lineNo,                 /* Line number for messages */
+    RUNITEM *item               /* Returned item */
+)
+{
+    int argc;
+    BOOL valid = TRUE;
+    item->lineNo = lineNo;
+    if (((item->line = copyString(text)) == NULL)
+            || ((item->argv = splitCommandLine(item->line, &argc)) == NULL))
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        free(item->line);
+        return -1;
+    }
+    if ((argc == 0) || (item->argv[0][0] == '#'))
+    {
+        free(item->argv);
+        free(item->line);
+        return 0;
+    }
+    if (!parseRunArgs(argc, item->argv, &(item->request)))
+        valid = FALSE;
+    else if (item->request.async)
+    {
+        /* There is nobody to hand a token back to */
+        freeParams(&(item->request.params));
+        valid = FALSE;
+    }
+    if (!valid)
+    {
+        fprintf(stderr, "Invalid run arguments at line %d\n", lineNo);
+        free(item->argv);
+        free(item->line);
+        return -1;
+    }
+    item->status = DSJE_NOERROR;
+    item->jobStatus = -1;
+    item->startTime = item->endTime = 0;
+    return 1;
+}
+
+/*
+ * Write the fields of the outcome of a job run by -runmany or -rundag.
+ */
+static const char runManyColumns[] =
+    "project,job,result,jobStatus,jobStatusCode,seconds";
+static const char runDagColumns[] =
+    "node,project,job,result,jobStatus,jobStatusCode,seconds";
+
+static void writeRunItem(
+    OUTBUF *buf,                /* Buffer to write to */
+    RUNITEM *item               /* The job */
+)
+{
+    outStrField(buf, "project", NULL, item->request.project);
+    outStrField(buf, "job", NULL, item->request.job);
+    outIntField(buf, "result", NULL, item->status);
+    if (item->jobStatus < 0)
+        outNullCodeField(buf, "jobStatus", NULL, "-");
+    else
+        outCodeField(buf, "jobStatus", NULL, jobStatusName(item->jobStatus), item->jobStatus);
+    outIntField(buf, "seconds", NULL, (long) (item->endTime - item->startTime));
+}
+
+/*
+ * Read a manifest of -run argument lines. Returns the number of items read,
+ * or -(n+1) if the manifest is invalid after n items have been read.
+ */
+static int readRunManifest(
+    char *fileName,             /* Manifest file */
+    BOOL waitForAll,            /* -wait given for every job */
+    RUNITEM **itemsOut          /* Returned items */
+)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t size = 0;
+    int lineNo = 0;
+    int nItems = 0;
+    int maxItems = 0;
+    RUNITEM *items = NULL;
+    int parsed = 0;
+    *itemsOut = NULL;
+    if ((fp = fopen(fileName, "r")) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open manifest '%s'\n", fileName);
+        return -1;
+    }
+    while ((parsed >= 0) && readLine(fp, &line, &size))
+    {
+        if (nItems == maxItems)
+        {
+            RUNITEM *bigger = realloc(items, (maxItems + 64) * sizeof(RUNITEM));
+            if (bigger == NULL)
+            {
+                fprintf(stderr, "ERROR: Out of memory\n");
+                parsed = -1;
+                break;
+            }
+            items = bigger;
+            maxItems += 64;
+        }
+        if ((parsed = parseRunItem(line, ++lineNo, &(items[nItems]))) > 0)
+        {
+            if (waitForAll)
+                items[nItems].request.waitForJob = TRUE;
+            nItems++;
+        }
+    }
+    free(line);
+    fclose(fp);
+    *itemsOut = items;
+    return (parsed >= 0) ? nItems : -(nItems + 1);
+}
+
+static void freeRunItems(
+    RUNITEM *items,             /* Items from readRunManifest() */
+    int nItems
+)
+{
+    int i;
+    for (i = 0; i < nItems; i++)
+    {
+        freeParams(&(items[i].request.params));
+        free(items[i].argv);
+        free(items[i].line);
+    }
+    free(items);
+}
+
+static int jobRunMany(int argc, char *argv[])
+{
+    int i;
+    int nThreads = 0;
+    BOOL waitForAll = FALSE;
+    BOOL adaptive = FALSE;
+    BOOL badOptions = FALSE;
+    RUNMANY runMany;
+    GOVERNOR governor;
+    int status = DSJE_NOERROR;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        if (strcmp(opt, "wait") == 0)
+            waitForAll = TRUE;
+        else if (strcmp(opt, "adaptive") == 0)
+            adaptive = TRUE;
+        else if ((strcmp(opt, "threads") == 0) && (i + 1 < argc))
+        {
+            nThreads = atoi(argv[++i]);
+            if ((nThreads < 1) || (nThreads > MAX_THREADS))
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be one parameter left... the manifest */
+    if (badOptions || ((i+1) != argc))
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -runmany\n");
+        fprintf(stderr, "\t\t\t[-threads <n>]\n");
+        fprintf(stderr, "\t\t\t[-adaptive]\n");
+        fprintf(stderr, "\t\t\t[-wait]\n");
+        fprintf(stderr, "\t\t\t<manifest file>\n");
+        fprintf(stderr, "\nEach manifest line holds -run arguments: [<run options>] <project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    runMany.nItems = readRunManifest(argv[i], waitForAll, &(runMany.items));
+    if (runMany.nItems < 0)
+    {
+        freeRunItems(runMany.items, -(runMany.nItems + 1));
+        return DSJE_DSJOB_ERROR;
+    }
+    runMany.nextItem = 0;
+    runMany.governor = NULL;
+    if (nThreads == 0)
+        nThreads = adaptive ? ADAPT_DEFAULT_THREADS : DEFAULT_THREADS;
+    if (nThreads > runMany.nItems)
+        nThreads = runMany.nItems;
+    if (adaptive)
+    {
+        initGovernor(&governor, nThreads);
+        runMany.governor = &governor;
+    }
+    if (nThreads > 0)
+        runWorkers(nThreads, runManyWorker, &runMany);
+    /* Report how each job got on */
+    outText(&stdoutBuf, "Project\tJob\tResult\tJob Status\tSeconds\n");
+    for (i = 0; i < runMany.nItems; i++)
+    {
+        RUNITEM *item = &(runMany.items[i]);
+        outBeginRecord(&stdoutBuf, runManyColumns);
+        writeRunItem(&stdoutBuf, item);
+        outEndRecord(&stdoutBuf);
+        if ((item->status != DSJE_NOERROR) && (status == DSJE_NOERROR))
+            status = item->status;
+    }
+    if (adaptive)
+    {
+        writeGovernor(&governor);
+        freeGovernor(&governor);
+    }
+    outFlush(&stdoutBuf);
+    freeRunItems(runMany.items, runMany.nItems);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -rundag sub-command
+ *
+ * The DAG file has two kinds of line:
+ *
+ *     <node> = [<run options>] <project> <job>
+ *     <node> -> <node> [-> <node>...]
+ *
+ * The first defines a node (with the same arguments as -run) and the second
+ * says that each node must finish before the next one can start. A node is
+ * started, by one of a pool of workers, as soon as all its predecessors have
+ * finished with RUN OK or RUN with WARNINGS (or the VALIDATE equivalents).
+ * If a predecessor fails, everything downstream of it is skipped.
+ */
+#define DAG_PENDING     0
+#define DAG_RUNNING     1
+#define DAG_DONE        2
+#define DAG_SKIPPED     3
+
+typedef struct DAGNODE
+{
+    char *name;                 /* Node name */
+    RUNITEM item;               /* Job to run and its outcome */
+    int nWaiting;               /* Predecessors not yet finished OK */
+    int *succ;                  /* Successor node indexes */
+    int nSucc;
+    int maxSucc;
+    int state;                  /* DAG_xxx */
+} DAGNODE;
+
+typedef struct DAG
+{
+    DAGNODE *nodes;
+    int nNodes;
+    int *ready;                 /* Queue of nodes ready to run */
+    int readyHead;
+    int readyTail;
+    int nFinished;              /* Nodes done or skipped */
+    CRITICAL_SECTION lock;      /* Protects everything above */
+    HANDLE wakeup;              /* Semaphore: work may be available */
+    int nThreads;
+    GOVERNOR *governor;         /* For -adaptive, else NULL */
+} DAG;
+
+static int findDagNode(
+    DAG *dag,
+    char *name                  /* Node name */
+)
+{
+    int i;
+    for (i = 0; i < dag->nNodes; i++)
+        if (strcmp(dag->nodes[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+static BOOL addDagEdge(
+    DAG *dag,
+    int from,                   /* Node that must finish first */
+    int to                      /* Node that depends on it */
+)
+{
+    DAGNODE *node = &(dag->nodes[from]);
+    if (node->nSucc == node->maxSucc)
+    {
+        int *bigger = realloc(node->succ, (node->maxSucc + 8) * sizeof(int));
+        if (bigger == NULL)
+            return FALSE;
+        node->succ = bigger;
+        node->maxSucc += 8;
+    }
+    node->succ[node->nSucc++] = to;
+    dag->nodes[to].nWaiting++;
+    return TRUE;
+}
+
+static void freeDag(
+    DAG *dag
+)
+{
+    int i;
+    for (i = 0; i < dag->nNodes; i++)
+    {
+        free(dag->nodes[i].name);
+        free(dag->nodes[i].succ);
+        freeParams(&(dag->nodes[i].item.request.params));
+        free(dag->nodes[i].item.argv);
+        free(dag->nodes[i].item.line);
+    }
+    free(dag->nodes);
+    free(dag->ready);
+}
+
+/*
+ * Read the DAG file. Nodes are read on the first pass and edges on the
+ * second, so that edges may refer to nodes defined later in the file.
+ */
+static BOOL readDag(
+    char *fileName,             /* DAG file */
+    DAG *dag                    /* Returned DAG */
+)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t size = 0;
+    int lineNo;
+    int pass;
+    int maxNodes = 0;
+    BOOL ok = TRUE;
+    dag->nodes = NULL;
+    dag->nNodes = 0;
+    dag->ready = NULL;
+    if ((fp = fopen(fileName, "r")) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open DAG file '%s'\n", fileName);
+        return FALSE;
+    }
+    for (pass = 0; ok && (pass < 2); pass++)
+    {
+        rewind(fp);
+        lineNo = 0;
+        while (ok && readLine(fp, &line, &size))
+        {
+            char *p = line;
+            char *name;
+            char *value;
+            lineNo++;
+            while (isspace((unsigned char) *p))
+                p++;
+            if ((*p == '\0') || (*p == '#'))
+                continue;
+            name = p;
+            while ((*p != '\0') && !isspace((unsigned char) *p) && (*p != '='))
+                p++;
+            value = p;
+            while (isspace((unsigned char) *value))
+                value++;
+            if ((p == name) || ((*value != '=') && (strncmp(value, "->", 2) != 0)))
+            {
+                fprintf(stderr, "Invalid line %d of DAG file\n", lineNo);
+                ok = FALSE;
+            }
+            else if (*value == '=')
+            {
+                /* Node definition */
+                DAGNODE *node;
+                *p = '\0';
+                if (pass == 1)
+                    continue;
+                if (findDagNode(dag, name) >= 0)
+                {
+                    fprintf(stderr, "Node '%s' defined twice at line %d\n", name, lineNo);
+                    ok = FALSE;
+                    break;
+                }
+                if (dag->nNodes == maxNodes)
+                {
+                    DAGNODE *bigger = realloc(dag->nodes, (maxNodes + 64) * sizeof(DAGNODE));
+                    if (bigger == NULL)
+                    {
+                        ok = FALSE;
+                        break;
+                    }
+                    dag->nodes = bigger;
+                    maxNodes += 64;
+                }
+                node = &(dag->nodes[dag->nNodes]);
+                if (parseRunItem(value + 1, lineNo, &(node->item)) <= 0)
+                {
+                    fprintf(stderr, "Invalid node '%s' at line %d\n", name, lineNo);
+                    ok = FALSE;
+                    break;
+                }
+                node->item.request.waitForJob = TRUE;
+                if ((node->name = copyString(name)) == NULL)
+                {
+                    freeParams(&(node->item.request.params));
+                    free(node->item.argv);
+                    free(node->item.line);
+                    ok = FALSE;
+                    break;
+                }
+                node->nWaiting = 0;
+                node->succ = NULL;
+                node->nSucc = node->maxSucc = 0;
+                node->state = DAG_PENDING;
+                dag->nNodes++;
+            }
+            else if (pass == 1)
+            {
+                /* Edge chain: a -> b -> c */
+                int argc;
+                int i;
+                int from = -1;
+                char **argv = splitCommandLine(line, &argc);
+                if (argv == NULL)
+                    ok = FALSE;
+                for (i = 0; ok && (i < argc); i++)
+                {
+                    int to;
+                    if ((i % 2) == 1)
+                    {
+                        if ((strcmp(argv[i], "->") != 0) || (i + 1 == argc))
+                            ok = FALSE;
+                        continue;
+                    }
+                    if ((to = findDagNode(dag, argv[i])) < 0)
+                    {
+                        fprintf(stderr, "Unknown node '%s' at line %d\n", argv[i], lineNo);
+                        ok = FALSE;
+                    }
+                    else if ((from >= 0) && !addDagEdge(dag, from, to))
+                        ok = FALSE;
+                    from = to;
+                }
+                if (ok && (argc < 3))
+                    ok = FALSE;
+                if (!ok)
+                    fprintf(stderr, "Invalid edge at line %d of DAG file\n", lineNo);
+                free(argv);
+            }
+        }
+    }
+    free(line);
+    fclose(fp);
+    if (ok && ((dag->ready = malloc((dag->nNodes + 1) * sizeof(int))) == NULL))
+        ok = FALSE;
+    if (!ok)
+        freeDag(dag);
+    return ok;
+}
+
+/*
+ * Check that the graph has no cycles (Kahn's algorithm on a copy of the
+ * predecessor counts).
+ */
+static BOOL dagIsAcyclic(
+    DAG *dag
+)
+{
+    int *waiting = malloc((dag->nNodes + 1) * sizeof(int));
+    int *queue = malloc((dag->nNodes + 1) * sizeof(int));
+    int head = 0;
+    int tail = 0;
+    int i;
+    BOOL acyclic;
+    if ((waiting == NULL) || (queue == NULL))
+    {
+        free(waiting);
+        free(queue);
+        return FALSE;
+    }
+    for (i = 0; i < dag->nNodes; i++)
+        if ((waiting[i] = dag->nodes[i].nWaiting) == 0)
+            queue[tail++] = i;
+    while (head < tail)
+    {
+        DAGNODE *node = &(dag->nodes[queue[head++]]);
+        for (i = 0; i < node->nSucc; i++)
+            if (--waiting[node->succ[i]] == 0)
+                queue[tail++] = node->succ[i];
+    }
+    acyclic = (tail == dag->nNodes);
+    free(waiting);
+    free(queue);
+    return acyclic;
+}
+
+/*
+ * Mark everything downstream of a failed node as skipped. Called with the
+ * DAG lock held.
+ */
+static void skipSuccessors(
+    DAG *dag,
+    int failed                  /* Node that did not finish OK */
+)
+{
+    int i;
+    DAGNODE *node = &(dag->nodes[failed]);
+    for (i = 0; i < node->nSucc; i++)
+    {
+        DAGNODE *succ = &(dag->nodes[node->succ[i]]);
+        if (succ->state == DAG_PENDING)
+        {
+            succ->state = DAG_SKIPPED;
+            dag->nFinished++;
+            skipSuccessors(dag, node->succ[i]);
+        }
+    }
+}
+
+static BOOL jobFinishedOK(
+    RUNITEM *item               /* Finished run */
+)
+{
+    if (item->status != DSJE_NOERROR)
+        return FALSE;
+    switch(item->jobStatus)
+    {
+    case DSJS_RUNOK:
+    case DSJS_RUNWARN:
+    case DSJS_VALOK:
+    case DSJS_VALWARN:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static void dagWorker(
+    WORKER *worker              /* This worker */
+)
+{
+    DAG *dag = worker->context;
+    for (;;)
+    {
+        int next = -1;
+        EnterCriticalSection(&(dag->lock));
+        if (dag->nFinished == dag->nNodes)
+        {
+            LeaveCriticalSection(&(dag->lock));
+            break;
+        }
+        if (dag->readyHead < dag->readyTail)
+        {
+            next = dag->ready[dag->readyHead++];
+            dag->nodes[next].state = DAG_RUNNING;
+        }
+        LeaveCriticalSection(&(dag->lock));
+        if (next < 0)
+        {
+            /* Nothing to do until some running node finishes */
+            (void) WaitForSingleObject(dag->wakeup, INFINITE);
+            continue;
+        }
+        runItem(worker, &(dag->nodes[next].item), dag->governor);
+        /* Release whatever this node was holding up */
+        EnterCriticalSection(&(dag->lock));
+        {
+            DAGNODE *node = &(dag->nodes[next]);
+            int nReady = 0;
+            int i;
+            node->state = DAG_DONE;
+            dag->nFinished++;
+            if (!jobFinishedOK(&(node->item)))
+                skipSuccessors(dag, next);
+            else
+            {
+                for (i = 0; i < node->nSucc; i++)
+                {
+                    DAGNODE *succ = &(dag->nodes[node->succ[i]]);
+                    /* One skipped through another predecessor stays skipped */
+                    if ((succ->state == DAG_PENDING) && (--(succ->nWaiting) == 0))
+                    {
+                        dag->ready[dag->readyTail++] = node->succ[i];
+                        nReady++;
+                    }
+                }
+            }
+            if (dag->nFinished == dag->nNodes)
+                nReady = dag->nThreads;
+            if (nReady > 0)
+                (void) ReleaseSemaphore(dag->wakeup, nReady, NULL);
+        }
+        LeaveCriticalSection(&(dag->lock));
+    }
+}
+
+static int jobRunDag(int argc, char *argv[])
+{
+    int i;
+    int nThreads = 0;
+    BOOL adaptive = FALSE;
+    BOOL badOptions = FALSE;
+    DAG dag;
+    GOVERNOR governor;
+    time_t startTime;
+    int status = DSJE_NOERROR;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        if (strcmp(opt, "adaptive") == 0)
+            adaptive = TRUE;
+        else if ((strcmp(opt, "threads") == 0) && (i + 1 < argc))
+        {
+            nThreads = atoi(argv[++i]);
+            if ((nThreads < 1) || (nThreads > MAX_THREADS))
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be one parameter left... the DAG file */
+    if (badOptions || ((i+1) != argc))
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -rundag\n");
+        fprintf(stderr, "\t\t\t[-threads <n>]\n");
+        fprintf(stderr, "\t\t\t[-adaptive]\n");
+        fprintf(stderr, "\t\t\t<dag file>\n");
+        fprintf(stderr, "\nDAG file lines are either:\n");
+        fprintf(stderr, "\t<node> = [<run options>] <project> <job>\n");
+        fprintf(stderr, "\t<node> -> <node> [-> <node>...]\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    if (!readDag(argv[i], &dag))
+        return DSJE_DSJOB_ERROR;
+    if (!dagIsAcyclic(&dag))
+    {
+        fprintf(stderr, "ERROR: DAG file contains a cycle\n");
+        freeDag(&dag);
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Everything with no predecessors can start straight away */
+    dag.readyHead = dag.readyTail = 0;
+    dag.nFinished = 0;
+    for (i = 0; i < dag.nNodes; i++)
+        if (dag.nodes[i].nWaiting == 0)
+            dag.ready[dag.readyTail++] = i;
+    if (nThreads == 0)
+        nThreads = adaptive ? ADAPT_DEFAULT_THREADS : DEFAULT_THREADS;
+    if (nThreads > dag.nNodes)
+        nThreads = dag.nNodes;
+    dag.nThreads = nThreads;
+    dag.governor = NULL;
+    if (adaptive)
+    {
+        initGovernor(&governor, nThreads);
+        dag.governor = &governor;
+    }
+    InitializeCriticalSection(&(dag.lock));
+    dag.wakeup = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+    startTime = time(NULL);
+    if ((nThreads > 0) && (dag.wakeup != NULL))
+        runWorkers(nThreads, dagWorker, &dag);
+    /* Report how each node got on */
+    outText(&stdoutBuf, "Node\tProject\tJob\tResult\tJob Status\tSeconds\n");
+    for (i = 0; i < dag.nNodes; i++)
+    {
+        DAGNODE *node = &(dag.nodes[i]);
+        RUNITEM *item = &(node->item);
+        outBeginRecord(&stdoutBuf, runDagColumns);
+        outStrField(&stdoutBuf, "node", NULL, node->name);
+        if (node->state == DAG_DONE)
+            writeRunItem(&stdoutBuf, item);
+        else
+        {
+            outStrField(&stdoutBuf, "project", NULL, item->request.project);
+            outStrField(&stdoutBuf, "job", NULL, item->request.job);
+            outNullField(&stdoutBuf, "result", NULL, "-", 1);
+            outStateField(&stdoutBuf, "jobStatus", NULL, "SKIPPED");
+            outNullField(&stdoutBuf, "seconds", NULL, "-", 1);
+        }
+        outEndRecord(&stdoutBuf);
+        if ((status == DSJE_NOERROR) && ((node->state != DAG_DONE) || !jobFinishedOK(item)))
+            status = (item->status != DSJE_NOERROR) ? item->status : DSJE_DSJOB_ERROR;
+    }
+    if (outputFormat == FORMAT_TEXT)
+    {
+        outStr(&stdoutBuf, "Elapsed\t: ");
+        outInt(&stdoutBuf, (long) (time(NULL) - startTime));
+        outStr(&stdoutBuf, " seconds\n");
+    }
+    if (adaptive)
+    {
+        writeGovernor(&governor);
+        freeGovernor(&governor);
+    }
+    outFlush(&stdoutBuf);
+    if (dag.wakeup != NULL)
+        CloseHandle(dag.wakeup);
+    DeleteCriticalSection(&(dag.lock));
+    freeDag(&dag);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Multiplexed job status watcher.
+ *
+ * Rather than blocking a thread in DSWaitForJob() for each job, watchJobs()
+ * polls DSJ_JOBSTATUS and DSJ_JOBWAVENO for any number of jobs from one
+ * thread. Each job has its own poll interval, which adapts to how the run
+ * is going: it grows in proportion to the time the job has been running,
+ * so long runs are polled rarely, but if we know roughly how long the run
+ * should take it is shortened as that time approaches, so the finish is
+ * noticed promptly. A job counts as finished when it is no longer RUNNING,
+ * or when its wave number changes (the run we were watching was replaced
+ * by a later one... the job is then marked superseded).
+ */
+#define WATCH_MIN_INTERVAL      500     /* Milliseconds */
+#define WATCH_MAX_INTERVAL      30000   /* Milliseconds */
+
+typedef struct JOBWATCH
+{
+    char *project;              /* Project name (for reporting) */
+    char *job;                  /* Job name */
+    DSJOB hJob;                 /* Open job handle */
+    int waveNumber;             /* Wave being watched, -1 to take current */
+    int expected;               /* Expected run time, seconds, 0 if unknown */
+    time_t startTime;           /* Start time of the run being watched */
+    int jobStatus;              /* Last DSJ_JOBSTATUS seen, -1 if none */
+    int status;                 /* Error from the last poll */
+    BOOL finished;              /* Run is over (or can't be watched) */
+    BOOL superseded;            /* A later run replaced the watched one */
+    time_t endTime;             /* When we noticed it had finished */
+    DWORD interval;             /* Current poll interval, milliseconds */
+    DWORD nextPoll;             /* GetTickCount() value of next poll */
+} JOBWATCH;
+
+static DWORD minWatchInterval = WATCH_MIN_INTERVAL;
+static DWORD maxWatchInterval = WATCH_MAX_INTERVAL;
+
+/*
+ * Work out when to poll a running job again.
+ */
+static void scheduleWatch(
+    JOBWATCH *watch,            /* Job being watched */
+    DWORD now                   /* Current GetTickCount() */
+)
+{
+    long elapsed = (long) (time(NULL) - watch->startTime);
+    long next;
+    if (elapsed < 0)
+        elapsed = 0;
+    if ((watch->expected > 0) && (elapsed < watch->expected))
+        next = (watch->expected - elapsed) * 1000L / 4;     /* Closing in */
+    else if (watch->expected > 0)
+        next = (long) watch->interval * 3 / 2;              /* Overrunning */
+    else
+        next = elapsed * 1000L / 10;                        /* Unknown */
+    if (next < (long) minWatchInterval)
+        next = minWatchInterval;
+    if (next > (long) maxWatchInterval)
+        next = maxWatchInterval;
+    watch->interval = (DWORD) next;
+    watch->nextPoll = now + watch->interval;
+}
+
+/*
+ * Poll one job and update its watch state.
+ */
+static void pollWatch(
+    JOBWATCH *watch             /* Job to poll */
+)
+{
+    DSJOBINFO jobInfo;
+    int status;
+    if ((status = DSGetJobInfo(watch->hJob, DSJ_JOBWAVENO, &jobInfo)) == DSJE_NOERROR)
+    {
+        if (watch->waveNumber < 0)
+            watch->waveNumber = jobInfo.info.jobWaveNumber;
+        else if (jobInfo.info.jobWaveNumber != watch->waveNumber)
+            watch->superseded = TRUE;
+        /* The status of a later run is of no interest */
+        if (!watch->superseded &&
+                ((status = DSGetJobInfo(watch->hJob, DSJ_JOBSTATUS, &jobInfo)) == DSJE_NOERROR))
+            watch->jobStatus = jobInfo.info.jobStatus;
+    }
+    watch->status = status;
+    if ((status != DSJE_NOERROR) || watch->superseded || (watch->jobStatus != DSJS_RUNNING))
+    {
+        watch->finished = TRUE;
+        watch->endTime = time(NULL);
+        if (!watch->superseded && (status == DSJE_NOERROR) &&
+                (DSGetJobInfo(watch->hJob, DSJ_JOBLASTTIMESTAMP, &jobInfo) == DSJE_NOERROR))
+            watch->endTime = jobInfo.info.jobLastTime;
+    }
+}
+
+/*
+ * Prepare a watch on an open job. The first poll is made straight away so
+ * that jobs that have already finished are noticed at once.
+ */
+static void initWatch(
+    JOBWATCH *watch,            /* Watch to initialise */
+    char *project,              /* Project name */
+    char *job,                  /* Job name */
+    DSJOB hJob,                 /* Open job handle */
+    int waveNumber,             /* Wave to watch, -1 for the current one */
+    int expected                /* Expected run time or 0 */
+)
+{
+    DSJOBINFO jobInfo;
+    watch->project = project;
+    watch->job = job;
+    watch->hJob = hJob;
+    watch->waveNumber = waveNumber;
+    watch->expected = expected;
+    watch->jobStatus = -1;
+    watch->status = DSJE_NOERROR;
+    watch->finished = watch->superseded = FALSE;
+    watch->endTime = 0;
+    watch->interval = minWatchInterval;
+    watch->nextPoll = GetTickCount();
+    if ((hJob != NULL) && (DSGetJobInfo(hJob, DSJ_JOBSTARTTIMESTAMP, &jobInfo) == DSJE_NOERROR))
+        watch->startTime = jobInfo.info.jobStartTime;
+    else
+        watch->startTime = time(NULL);
+}
+
+/*
+ * Watch the jobs until they have all finished, or until the first one
+ * finishes if waitForAny is set, or until the timeout (milliseconds, 0 for
+ * none) expires. Jobs that are already marked finished (those that couldn't be
+ * opened) are ignored, and don't count as the first to finish. Returns
+ * FALSE if the timeout expired first.
+ */
+static BOOL watchJobs(
+    JOBWATCH *watch,            /* Jobs to watch */
+    int nJobs,
+    BOOL waitForAny,            /* Return when the first job finishes */
+    DWORD timeout               /* Give up after this many milliseconds */
+)
+{
+    DWORD started = GetTickCount();
+    int nLeft = 0;
+    BOOL anyFinished = FALSE;
+    int i;
+    for (i = 0; i < nJobs; i++)
+        if (!watch[i].finished)
+            nLeft++;
+    while ((nLeft > 0) && !(waitForAny && anyFinished))
+    {
+        DWORD now = GetTickCount();
+        JOBWATCH *due = NULL;
+        /* Find the job that is due to be polled first */
+        for (i = 0; i < nJobs; i++)
+            if (!watch[i].finished && ((due == NULL) ||
+                    ((LONG) (watch[i].nextPoll - due->nextPoll) < 0)))
+                due = &(watch[i]);
+        if ((LONG) (due->nextPoll - now) > 0)
+        {
+            DWORD delay = due->nextPoll - now;
+            if (timeout > 0)
+            {
+                LONG left = (LONG) (started + timeout - now);
+                if (left <= 0)
+                    break;
+                if ((DWORD) left < delay)
+                    delay = left;
+            }
+            Sleep(delay);
+            continue;
+        }
+        pollWatch(due);
+        if (due->finished)
+        {
+            nLeft--;
+            anyFinished = TRUE;
+        }
+        else
+            scheduleWatch(due, GetTickCount());
+    }
+    return (nLeft == 0) || (waitForAny && anyFinished);
+}
+
+/*
+ * Write a table of the outcome of the watched jobs.
+ */
+static const char watchColumns[] = "job,jobStatus,jobStatusCode,wave,seconds,status";
+
+static void printWatchTable(
+    JOBWATCH *watch,
+    int nJobs
+)
+{
+    int i;
+    outText(&stdoutBuf, "Job\tJob Status\tWave\tSeconds\n");
+    for (i = 0; i < nJobs; i++)
+    {
+        outBeginRecord(&stdoutBuf, watchColumns);
+        outStrField(&stdoutBuf, "job", NULL, watch[i].job);
+        if (watch[i].hJob == NULL)
+        {
+            outStateField(&stdoutBuf, "jobStatus", NULL, "not opened");
+            outNullField(&stdoutBuf, "wave", NULL, "-", 1);
+            outNullField(&stdoutBuf, "seconds", NULL, "-", 1);
+        }
+        else if (!watch[i].finished)
+        {
+            outCodeField(&stdoutBuf, "jobStatus", NULL, jobStatusName(DSJS_RUNNING), DSJS_RUNNING);
+            outIntField(&stdoutBuf, "wave", NULL, watch[i].waveNumber);
+            outNullField(&stdoutBuf, "seconds", NULL, "-", 1);
+        }
+        else
+        {
+            if (watch[i].superseded)
+                outStateField(&stdoutBuf, "jobStatus", NULL, "SUPERSEDED");
+            else if (watch[i].status != DSJE_NOERROR)
+            {
+                char text[32];
+                sprintf(text, "Error %d", watch[i].status);
+                outStateField(&stdoutBuf, "jobStatus", NULL, text);
+            }
+            else
+                outCodeField(&stdoutBuf, "jobStatus", NULL,
+                             jobStatusName(watch[i].jobStatus), watch[i].jobStatus);
+            outIntField(&stdoutBuf, "wave", NULL, watch[i].waveNumber);
+            /* How long a superseded run took is not known */
+            if (watch[i].superseded)
+                outNullField(&stdoutBuf, "seconds", NULL, "-", 1);
+            else
+                outIntField(&stdoutBuf, "seconds", NULL,
+                            (long) (watch[i].endTime - watch[i].startTime));
+        }
+        /* The API status is only shown in the machine-readable formats */
+        if (outputFormat != FORMAT_TEXT)
+            outIntField(&stdoutBuf, "status", NULL, watch[i].status);
+        outEndRecord(&stdoutBuf);
+    }
+    outFlush(&stdoutBuf);
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -waitall sub-command
+ */
+static int jobWaitAll(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    int status = DSJE_NOERROR;
+    int i;
+    int j;
+    char *project;
+    BOOL waitForAny = FALSE;
+    int timeout = 0;
+    int expected = 0;
+    BOOL badOptions = FALSE;
+    JOBWATCH *watch;
+    int nJobs;
+    BOOL done;
+    maxWatchInterval = WATCH_MAX_INTERVAL;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        if (strcmp(opt, "any") == 0)
+            waitForAny = TRUE;
+        else
+        {
+            char *arg = argv[i+1];
+            if (++i >= argc)
+                badOptions = TRUE;
+            else if (strcmp(opt, "timeout") == 0)
+                timeout = atoi(arg);
+            else if (strcmp(opt, "expect") == 0)
+                expected = atoi(arg);
+            else if (strcmp(opt, "maxpoll") == 0)
+                maxWatchInterval = atoi(arg) * 1000;
+            else
+                badOptions = TRUE;
+        }
+    }
+    /* Must be a project and at least one job left */
+    if (badOptions || ((i+2) > argc) || (maxWatchInterval < minWatchInterval))
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -waitall\n");
+        fprintf(stderr, "\t\t\t[-any]\n");
+        fprintf(stderr, "\t\t\t[-timeout <seconds>]\n");
+        fprintf(stderr, "\t\t\t[-expect <seconds>]\n");
+        fprintf(stderr, "\t\t\t[-maxpoll <seconds>]\n");
+        fprintf(stderr, "\t\t\t<project> <job> [<job>...]\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    project = argv[i++];
+    nJobs = argc - i;
+    if ((watch = malloc(nJobs * sizeof(JOBWATCH))) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Attempt to open the project and the jobs */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        for (j = 0; j < nJobs; j++)
+        {
+            int openStatus;
+            DSJOB hJob = openJob(hProject, argv[i + j], &openStatus);
+            initWatch(&(watch[j]), project, argv[i + j], hJob, -1, expected);
+            if (hJob == NULL)
+            {
+                status = openStatus;
+                fprintf(stderr, "ERROR: Failed to open job %s\n", argv[i + j]);
+                watch[j].status = status;
+                watch[j].finished = TRUE;
+            }
+        }
+        done = watchJobs(watch, nJobs, waitForAny, timeout * 1000UL);
+        printWatchTable(watch, nJobs);
+        if ((status == DSJE_NOERROR) && !done)
+        {
+            fprintf(stderr, "Timed out waiting for jobs\n");
+            status = DSJE_DSJOB_ERROR;
+        }
+        for (j = 0; j < nJobs; j++)
+        {
+            if ((status == DSJE_NOERROR) && (watch[j].status != DSJE_NOERROR))
+                status = watch[j].status;
+            if (watch[j].hJob != NULL)
+                (void) closeJob(watch[j].hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    free(watch);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -join sub-command
+ *
+ * Wait on the runs named by tokens from -run -async, which may be in
+ * different projects, through the same multiplexed watcher as -waitall.
+ * A run is only polled for its wave number until that moves on: a job
+ * that has been run again since is reported as superseded without its
+ * status being fetched at all.
+ */
+static BOOL parseRunToken(
+    char *token,                /* Token, split up in place */
+    char **project,             /* Returned names, pointing into the token */
+    char **job,
+    int *waveNumber             /* Returned wave number */
+)
+{
+    char *first = strchr(token, '/');
+    char *last = strrchr(token, '/');
+    char *digit;
+    if ((first == NULL) || (first == token) || (last == first + 1) || (last[1] == '\0'))
+        return FALSE;
+    for (digit = last + 1; *digit != '\0'; digit++)
+        if (!isdigit((unsigned char) *digit))
+            return FALSE;
+    *first = *last = '\0';
+    *project = token;
+    *job = first + 1;
+    *waveNumber = atoi(last + 1);
+    return TRUE;
+}
+
+static int jobJoin(int argc, char *argv[])
+{
+    int status = DSJE_NOERROR;
+    int i;
+    int j;
+    int k;
+    BOOL waitForAny = FALSE;
+    int timeout = 0;
+    BOOL badOptions = FALSE;
+    JOBWATCH *watch;
+    char **tokens;
+    DSPROJECT *projects;
+    int nJobs;
+    BOOL done;
+    maxWatchInterval = WATCH_MAX_INTERVAL;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        if (strcmp(opt, "any") == 0)
+            waitForAny = TRUE;
+        else
+        {
+            char *arg = argv[i+1];
+            if (++i >= argc)
+                badOptions = TRUE;
+            else if (strcmp(opt, "timeout") == 0)
+                timeout = atoi(arg);
+            else if (strcmp(opt, "maxpoll") == 0)
+                maxWatchInterval = atoi(arg) * 1000;
+            else
+                badOptions = TRUE;
+        }
+    }
+    /* Must be at least one token left */
+    if (badOptions || (i >= argc) || (maxWatchInterval < minWatchInterval))
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -join\n");
+        fprintf(stderr, "\t\t\t[-any]\n");
+        fprintf(stderr, "\t\t\t[-timeout <seconds>]\n");
+        fprintf(stderr, "\t\t\t[-maxpoll <seconds>]\n");
+        fprintf(stderr, "\t\t\t<token> [<token>...]\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    nJobs = argc - i;
+    watch = malloc(nJobs * sizeof(JOBWATCH));
+    tokens = calloc(nJobs, sizeof(char *));
+    projects = calloc(nJobs, sizeof(DSPROJECT));
+    if ((watch == NULL) || (tokens == NULL) || (projects == NULL))
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        free(watch);
+        free(tokens);
+        free(projects);
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Split up all the tokens before opening anything */
+    for (j = 0; (j < nJobs) && (status == DSJE_NOERROR); j++)
+    {
+        char *project;
+        char *job;
+        int waveNumber;
+        if ((tokens[j] = copyString(argv[i + j])) == NULL)
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            status = DSJE_DSJOB_ERROR;
+        }
+        else if (!parseRunToken(tokens[j], &project, &job, &waveNumber))
+        {
+            fprintf(stderr, "ERROR: '%s' is not a -run -async token\n", argv[i + j]);
+            status = DSJE_DSJOB_ERROR;
+        }
+        else
+            initWatch(&(watch[j]), project, job, NULL, waveNumber, 0);
+    }
+    if (status == DSJE_NOERROR)
+    {
+        /* Open each project once, and the jobs through it */
+        for (j = 0; j < nJobs; j++)
+        {
+            for (k = 0; k < j; k++)
+                if (strcmp(watch[k].project, watch[j].project) == 0)
+                    break;
+            if (k < j)
+            {
+                if ((projects[j] = projects[k]) == NULL)
+                    watch[j].status = watch[k].status;
+            }
+            else if ((projects[j] = openProject(watch[j].project, &(watch[j].status))) == NULL)
+            {
+                fprintf(stderr, "ERROR: Failed to open project %s\n", watch[j].project);
+            }
+            if ((projects[j] != NULL) &&
+                    ((watch[j].hJob = openJob(projects[j], watch[j].job, &(watch[j].status))) == NULL))
+            {
+                fprintf(stderr, "ERROR: Failed to open job %s\n", watch[j].job);
+            }
+            if (watch[j].hJob == NULL)
+                watch[j].finished = TRUE;
+            else
+                initWatch(&(watch[j]), watch[j].project, watch[j].job, watch[j].hJob,
+                          watch[j].waveNumber, 0);
+        }
+        done = watchJobs(watch, nJobs, waitForAny, timeout * 1000UL);
+        printWatchTable(watch, nJobs);
+        if (!done)
+        {
+            fprintf(stderr, "Timed out waiting for jobs\n");
+            status = DSJE_DSJOB_ERROR;
+        }
+        for (j = 0; j < nJobs; j++)
+        {
+            if ((status == DSJE_NOERROR) && (watch[j].status != DSJE_NOERROR))
+                status = watch[j].status;
+            if (watch[j].hJob != NULL)
+                (void) closeJob(watch[j].hJob);
+        }
+        /* Each project handle is closed once, by the first job that used it */
+        for (j = 0; j < nJobs; j++)
+        {
+            for (k = 0; k < j; k++)
+                if (projects[k] == projects[j])
+                    break;
+            if ((k == j) && (projects[j] != NULL))
+                (void) closeProject(projects[j]);
+        }
+    }
+    for (j = 0; j < nJobs; j++)
+        free(tokens[j]);
+    free(tokens);
+    free(projects);
+    free(watch);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -stop sub-command
+ */
+static int jobStop(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    char *project;
+    char *job;
+    /* Validate arguments and extract optional arguments */
+    /* Must be two parameters left... project and job */
+    if (argc != 2)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -stop <project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    project = argv[0];
+    job = argv[1];
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /* Now stop the job */
+            status = DSStopJob(hJob);
+            if (status != DSJE_NOERROR)
+                fprintf(stderr, "Error stopping job\n");
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -lprojects sub-command
+ */
+static int jobLProjects(int argc, char *argv[])
+{
+    int result = DSJE_NOERROR;
+    char *list;
+    /* Validate arguments */
+    if (argc != 0)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -lproject\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Action request */
+    list = DSGetProjectList();
+    if (list == NULL)
+        result = DSGetLastError();
+    else
+        outListRecords(&stdoutBuf, "project", list);
+    return result;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -ljobs sub-command
+ */
+static int jobLJobs(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSPROJECTINFO pInfo;
+    int status;
+    /* Validate arguments */
+    if (argc != 1)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -ljobs <project>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Action request */
+    hProject = openProject(argv[0], &status);
+    if (hProject != NULL)
+    {
+        status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &pInfo);
+        if (status == DSJE_NOT_AVAILABLE)
+        {
+            outText(&stdoutBuf, "<none>\n");
+            status = DSJE_NOERROR;
+        }
+        else if (status == DSJE_NOERROR)
+            outListRecords(&stdoutBuf, "job", pInfo.info.jobList);
+        closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -lstages sub-command
+ */
+static int jobLStages(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    char *project;
+    char *job;
+    DSJOBINFO jobInfo;
+    /* Validate arguments and extract optional arguments */
+    /* Must be two parameters left... project and job */
+    if (argc != 2)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -lstages <project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    project = argv[0];
+    job = argv[1];
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+		{
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /* Get the list of stages */
+            status = metaGetJobInfo(hJob, project, job, DSJ_STAGELIST, &jobInfo);
+            if (status == DSJE_NOT_AVAILABLE)
+            {
+                outText(&stdoutBuf, "<none>\n");
+                status = DSJE_NOERROR;
+            }
+            else if (status != DSJE_NOERROR)
+                fprintf(stderr, "Error %d getting stage list\n", status);
+            else
+                outListRecords(&stdoutBuf, "stage", jobInfo.info.stageList);
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -llinks sub-command
+ */
+static int jobLLinks(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    char *project;
+    char *job;
+    char *stage;
+    DSSTAGEINFO stageInfo;
+    /* Validate arguments and extract optional arguments */
+    /* Must be three parameters left... project, job and stage */
+    if (argc != 3)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -llinks <project> <job> <stage>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    project = argv[0];
+    job = argv[1];
+    stage = argv[2];
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+		{
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /* Get the list of stages */
+            status = metaGetLinkList(hJob, project, job, stage, &stageInfo);
+            if (status == DSJE_NOT_AVAILABLE)
+            {
+                outText(&stdoutBuf, "<none>\n");
+                status = DSJE_NOERROR;
+            }
+            else if (status != DSJE_NOERROR)
+                fprintf(stderr, "Error %d getting link list\n", status);
+            else
+                outListRecords(&stdoutBuf, "link", stageInfo.info.linkList);
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Shared status segment.
+ *
+ * A daemon started with -publish polls the status of every job in the
+ * given projects and publishes it, with the row counts of the jobs' links,
+ * in a named shared memory segment (DSJOB_SEGMENT, by default
+ * "dsjob.status"). -jobinfo -cached and -linkinfo -cached then answer from
+ * the segment instead of asking the server, so any number of tools on the
+ * host can share one poller.
+ *
+ * The segment is a STATUSSEGMENT: a header and a fixed table of slots, one
+ * per job, found by hashing "server/project/job" and probing on from
+ * there. A slot is given back when its job leaves the project's job list,
+ * by setting its key to STATUS_FREED, which no job has, so that probes for
+ * the jobs after it still go on past it. The daemon's
+ * publishing thread is the only writer and readers take no lock: the
+ * writer makes a slot's sequence number odd before it changes the slot
+ * and even again after, and a reader keeps its copy of a slot only if the
+ * sequence was even and the same before and after the copy. A slot that is
+ * older than the reader will accept (by default twice the polling
+ * interval), or that does not hold what was asked for, sends the reader
+ * to the server as usual.
+ */
+#define STATUS_MAGIC    "DSJSTAT1"
+#define STATUS_SLOTS    2048    /* Jobs a segment holds */
+#define STATUS_LINKS    32      /* Link list entries kept per job */
+#define STATUS_KEY      192     /* Longest "server/project/job", with the NUL */
+#define STATUS_NAME     64      /* Longest "stage.link", with the NUL */
+#define STATUS_TEXT     256     /* Longest controller or user status, with the NUL */
+#define STATUS_FREED    "/"     /* Key of a slot that has been given back */
+
+#define STATUS_JOBINFO      0x01    /* Every -jobinfo item is held */
+#define STATUS_CONTROLLER   0x02    /* The job has a controller */
+#define STATUS_STARTTIME    0x04    /* The job has a start time */
+#define STATUS_USERSTATUS   0x08    /* The job has a user status */
+
+typedef struct STATUSLINK
+{
+    char name[STATUS_NAME];     /* "stage.link", empty if it didn't fit */
+    int rowCount;               /* DSJ_LINKROWCOUNT, -1 if not known */
+    BOOL noError;               /* DSJ_LINKLASTERR was not available */
+} STATUSLINK;
+
+typedef struct STATUSSLOT
+{
+    volatile LONG sequence;     /* Odd while the slot is being written */
+    unsigned int published;     /* When the slot was written, 0 if never */
+    char key[STATUS_KEY];       /* "server/project/job", empty if never used */
+    int flags;                  /* STATUS_xxx */
+    int jobStatus;              /* DSJ_JOBSTATUS */
+    int waveNumber;             /* DSJ_JOBWAVENO */
+    unsigned int startTime;     /* DSJ_JOBSTARTTIMESTAMP */
+    char controller[STATUS_TEXT];   /* DSJ_JOBCONTROLLER */
+    char userStatus[STATUS_TEXT];   /* DSJ_USERSTATUS */
+    int nLinks;
+    STATUSLINK link[STATUS_LINKS];  /* In link list order, as findMonLinks() */
+} STATUSSLOT;
+
+typedef struct STATUSSEGMENT
+{
+    char magic[8];              /* STATUS_MAGIC, not NUL terminated */
+    unsigned int interval;      /* Seconds between polls */
+    unsigned int nSlots;        /* STATUS_SLOTS */
+    STATUSSLOT slot[STATUS_SLOTS];
+} STATUSSEGMENT;
+
+static const char *statusSegmentName(void)
+{
+    char *env = getenv("DSJOB_SEGMENT");
+    return ((env != NULL) && (*env != '\0')) ? env : "dsjob.status";
+}
+
+/*
+ * Build the key of a job's slot. Returns FALSE if it doesn't fit.
+ */
+static BOOL statusKey(
+    char *key,                  /* Space for STATUS_KEY characters */
+    const char *project,        /* Project and job names */
+    const char *job
+)
+{
+    const char *server = (serverName != NULL) ? serverName : "";
+    if (strlen(server) + strlen(project) + strlen(job) + 3 > STATUS_KEY)
+        return FALSE;
+    sprintf(key, "%s/%s/%s", server, project, job);
+    return TRUE;
+}
+
+/*
+ * Copy a slot out of the segment, trying again while the writer is part
+ * way through changing it. Returns FALSE if no clean copy could be had.
+ */
+static BOOL copyStatusSlot(
+    STATUSSLOT *slot,           /* Slot in the segment */
+    STATUSSLOT *copy            /* Returned copy */
+)
+{
+    int tries;
+    for (tries = 0; tries < 100; tries++)
+    {
+        LONG sequence = slot->sequence;
+        if ((sequence & 1) == 0)
+        {
+            MemoryBarrier();
+            memcpy(copy, slot, sizeof(STATUSSLOT));
+            MemoryBarrier();
+            if (slot->sequence == sequence)
+                return TRUE;
+        }
+        Sleep(0);
+    }
+    return FALSE;
+}
+
+/*
+ * Look up the published status of a job. Returns FALSE if no segment is
+ * being published, the job isn't in it or its slot was written more than
+ * maxAge seconds ago (0 for twice the polling interval).
+ */
+static BOOL readStatus(
+    const char *project,        /* Project and job names */
+    const char *job,
+    int maxAge,                 /* Oldest status accepted, in seconds */
+    STATUSSLOT *copy            /* Returned copy of the job's slot */
+)
+{
+    char key[STATUS_KEY];
+    HANDLE hMap;
+    STATUSSEGMENT *segment;
+    BOOL found = FALSE;
+    unsigned int n;
+    unsigned int i;
+    if (!statusKey(key, project, job) ||
+            ((hMap = OpenFileMappingA(FILE_MAP_READ, FALSE, statusSegmentName())) == NULL))
+        return FALSE;
+    /*
+     * The segment is mapped afresh each time, so that a batch session does
+     * not keep one alive after its daemon has gone.
+     */
+    segment = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, sizeof(STATUSSEGMENT));
+    if ((segment != NULL) && (memcmp(segment->magic, STATUS_MAGIC, 8) == 0) &&
+            (segment->nSlots == STATUS_SLOTS))
+    {
+        if (maxAge <= 0)
+            maxAge = 2 * segment->interval;
+        n = fnvHash(key) % STATUS_SLOTS;
+        for (i = 0; i < STATUS_SLOTS; i++, n = (n + 1) % STATUS_SLOTS)
+        {
+            if (!copyStatusSlot(&(segment->slot[n]), copy) || (copy->key[0] == '\0'))
+                break;
+            if (strcmp(copy->key, key) == 0)
+            {
+                found = (copy->published != 0) &&
+                        (difftime(time(NULL), (time_t) copy->published) <= maxAge);
+                break;
+            }
+        }
+    }
+    if (segment != NULL)
+        (void) UnmapViewOfFile(segment);
+    (void) CloseHandle(hMap);
+    return found;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -jobinfo sub-command
+ */
+static const char jobInfoColumns[] =
+    "jobStatus,jobStatusCode,controller,startTime,waveNumber,userStatus";
+
+/*
+ * Write the -jobinfo record of a job from its published status.
+ */
+static void writeCachedJobInfo(
+    STATUSSLOT *slot            /* Copy of the job's slot */
+)
+{
+    outBeginRecord(&stdoutBuf, jobInfoColumns);
+    outCodeField(&stdoutBuf, "jobStatus", "Job Status\t: ",
+            jobStatusName(slot->jobStatus), slot->jobStatus);
+    if (slot->flags & STATUS_CONTROLLER)
+        outStrField(&stdoutBuf, "controller", "Job Controller\t: ", slot->controller);
+    else
+        outNullField(&stdoutBuf, "controller", "Job Controller\t: ", "not available", 1);
+    if (slot->flags & STATUS_STARTTIME)
+        outTimeField(&stdoutBuf, "startTime", "Job Start Time\t: ", (time_t) slot->startTime);
+    else
+        outNullField(&stdoutBuf, "startTime", "Job Start Time\t: ", "not available", 1);
+    outIntField(&stdoutBuf, "waveNumber", "Job Wave Number\t: ", slot->waveNumber);
+    if (slot->flags & STATUS_USERSTATUS)
+        outStrField(&stdoutBuf, "userStatus", "User Status\t: ", slot->userStatus);
+    else
+        outNullField(&stdoutBuf, "userStatus", "User Status\t: ", "not available", 1);
+    outEndRecord(&stdoutBuf);
+}
+
+static int jobJobInfo(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    int i;
+    char *project;
+    char *job;
+    DSJOBINFO jobInfo;
+    STATUSSLOT slot;
+    BOOL cached = FALSE;
+    int maxAge = 0;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (strcmp(opt, "cached") == 0)
+            cached = TRUE;
+        else if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "maxage") == 0)
+        {
+            if ((maxAge = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be two parameters left... project and job */
+    if (((i+2) != argc) || ((maxAge > 0) && !cached))
+        badOptions = TRUE;
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -jobinfo\n");
+        fprintf(stderr, "\t\t\t[-cached [-maxage <seconds>]]\n");
+        fprintf(stderr, "\t\t\t<project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    project = argv[i];
+    job = argv[i+1];
+    /* A fresh enough published status saves going to the server at all */
+    if (cached && readStatus(project, job, maxAge, &slot) && (slot.flags & STATUS_JOBINFO))
+    {
+        writeCachedJobInfo(&slot);
+        return DSJE_NOERROR;
+    }
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+	{
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /*
+             * Try getting all the job info (except the stage and
+             * parameter lists which we deal with elsewhere)
+             */
+            outBeginRecord(&stdoutBuf, jobInfoColumns);
+            status = DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo);
+            if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting job status\n", status);
+                outNullCodeField(&stdoutBuf, "jobStatus", NULL, NULL);
+            }
+            else
+            {
+                outCodeField(&stdoutBuf, "jobStatus", "Job Status\t: ",
+                        jobStatusName(jobInfo.info.jobStatus), jobInfo.info.jobStatus);
+            }
+            status = DSGetJobInfo(hJob, DSJ_JOBCONTROLLER, &jobInfo);
+            if (status == DSJE_NOT_AVAILABLE)
+                outNullField(&stdoutBuf, "controller", "Job Controller\t: ", "not available", 1);
+            else if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting job controller\n", status);
+                outNullField(&stdoutBuf, "controller", NULL, NULL, 1);
+            }
+            else
+                outStrField(&stdoutBuf, "controller", "Job Controller\t: ", jobInfo.info.jobController);
+            status = DSGetJobInfo(hJob, DSJ_JOBSTARTTIMESTAMP, &jobInfo);
+            if (status == DSJE_NOT_AVAILABLE)
+                outNullField(&stdoutBuf, "startTime", "Job Start Time\t: ", "not available", 1);
+            else if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting job start time\n", status);
+                outNullField(&stdoutBuf, "startTime", NULL, NULL, 1);
+            }
+            else
+                outTimeField(&stdoutBuf, "startTime", "Job Start Time\t: ", jobInfo.info.jobStartTime);
+            status = DSGetJobInfo(hJob, DSJ_JOBWAVENO, &jobInfo);
+            if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting job wave number\n", status);
+                outNullField(&stdoutBuf, "waveNumber", NULL, NULL, 1);
+            }
+            else
+                outIntField(&stdoutBuf, "waveNumber", "Job Wave Number\t: ", jobInfo.info.jobWaveNumber);
+            status = DSGetJobInfo(hJob, DSJ_USERSTATUS, &jobInfo);
+            if (status == DSJE_NOT_AVAILABLE)
+                outNullField(&stdoutBuf, "userStatus", "User Status\t: ", "not available", 1);
+            else if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting job user status\n", status);
+                outNullField(&stdoutBuf, "userStatus", NULL, NULL, 1);
+            }
+            else
+                outStrField(&stdoutBuf, "userStatus", "User Status\t: ", jobInfo.info.userStatus);
+            outEndRecord(&stdoutBuf);
+            if (status == DSJE_NOT_AVAILABLE)
+                status = DSJE_NOERROR;
+            (void) closeJob(hJob);    
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -projectstatus sub-command
+ *
+ * Report the status of every job in a project, as -jobinfo would, in one
+ * table. The job list is read once and the jobs are then shared out among
+ * a pool of workers, each with its own connection, which fetch the four
+ * status items for a job at a time. Everything is written out at the end,
+ * in job list order.
+ */
+typedef struct JOBSNAPSHOT
+{
+    char *job;                  /* Job name, in the job list */
+    int status;                 /* Error getting the job's status */
+    int jobStatus;              /* DSJS_xxx status */
+    BOOL hasStartTime;
+    time_t startTime;
+    int waveNumber;
+    char *userStatus;           /* malloc'ed, NULL if not available */
+} JOBSNAPSHOT;
+
+typedef struct PROJECTSTATUS
+{
+    char *project;
+    JOBSNAPSHOT *jobs;
+    int nJobs;
+    volatile LONG nextJob;      /* Next job to be claimed */
+} PROJECTSTATUS;
+
+static const char projectStatusColumns[] =
+    "job,jobStatus,jobStatusCode,startTime,waveNumber,userStatus,status";
+
+/*
+ * Get the status items of one job on the worker's connection.
+ */
+static void snapshotJob(
+    WORKER *worker,             /* Calling worker */
+    char *project,              /* Project the job is in */
+    JOBSNAPSHOT *snap           /* Job to fill in */
+)
+{
+    DSJOB hJob;
+    DSJOBINFO jobInfo;
+    int status;
+    if ((hJob = workerJob(worker, project, snap->job, &(snap->status))) == NULL)
+        return;
+    if ((status = DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo)) == DSJE_NOERROR)
+        snap->jobStatus = jobInfo.info.jobStatus;
+    else
+        snap->status = status;
+    if ((status = DSGetJobInfo(hJob, DSJ_JOBSTARTTIMESTAMP, &jobInfo)) == DSJE_NOERROR)
+    {
+        snap->hasStartTime = TRUE;
+        snap->startTime = jobInfo.info.jobStartTime;
+    }
+    else if ((status != DSJE_NOT_AVAILABLE) && (snap->status == DSJE_NOERROR))
+        snap->status = status;
+    if ((status = DSGetJobInfo(hJob, DSJ_JOBWAVENO, &jobInfo)) == DSJE_NOERROR)
+        snap->waveNumber = jobInfo.info.jobWaveNumber;
+    else if (snap->status == DSJE_NOERROR)
+        snap->status = status;
+    if ((status = DSGetJobInfo(hJob, DSJ_USERSTATUS, &jobInfo)) == DSJE_NOERROR)
+        snap->userStatus = copyString(jobInfo.info.userStatus);
+    else if ((status != DSJE_NOT_AVAILABLE) && (snap->status == DSJE_NOERROR))
+        snap->status = status;
+    (void) DSCloseJob(hJob);
+}
+
+static void projectStatusWorker(
+    WORKER *worker              /* Calling worker */
+)
+{
+    PROJECTSTATUS *ps = worker->context;
+    LONG i;
+    while ((i = InterlockedIncrement(&(ps->nextJob)) - 1) < ps->nJobs)
+        snapshotJob(worker, ps->project, &(ps->jobs[i]));
+}
+
+static int jobProjectStatus(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSPROJECTINFO pInfo;
+    PROJECTSTATUS ps;
+    int status;
+    int i;
+    int nThreads = DEFAULT_THREADS;
+    char *str;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "threads") == 0)
+        {
+            if ((nThreads = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be one parameter left... the project */
+    if ((i+1) != argc)
+        badOptions = TRUE;
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -projectstatus [-threads <n>] <project>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    memset(&ps, 0, sizeof(ps));
+    ps.project = argv[i];
+    /* Get the job list */
+    if ((hProject = openProject(ps.project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+        return status;
+    }
+    status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &pInfo);
+    if (status == DSJE_NOT_AVAILABLE)
+    {
+        outText(&stdoutBuf, "<none>\n");
+        (void) closeProject(hProject);
+        return DSJE_NOERROR;
+    }
+    if (status != DSJE_NOERROR)
+    {
+        fprintf(stderr, "Error %d getting job list\n", status);
+        (void) closeProject(hProject);
+        return status;
+    }
+    for (str = pInfo.info.jobList; *str != '\0'; str += strlen(str) + 1)
+        ps.nJobs++;
+    if ((ps.jobs = calloc(ps.nJobs + 1, sizeof(JOBSNAPSHOT))) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        (void) closeProject(hProject);
+        return DSJE_DSJOB_ERROR;
+    }
+    /* The list belongs to the project handle, so the names are copied */
+    for (i = 0, str = pInfo.info.jobList; i < ps.nJobs; i++, str += strlen(str) + 1)
+    {
+        ps.jobs[i].jobStatus = -1;
+        if ((ps.jobs[i].job = copyString(str)) == NULL)
+            ps.nJobs = i;
+    }
+    (void) closeProject(hProject);
+
+    /* Get the status of each job */
+    if (nThreads > ps.nJobs)
+        nThreads = ps.nJobs;
+    if (nThreads > 0)
+        runWorkers(nThreads, projectStatusWorker, &ps);
+
+    /* Report them */
+    outText(&stdoutBuf, "Job\tJob Status\tStart Time\tWave\tUser Status\n");
+    for (i = 0; i < ps.nJobs; i++)
+    {
+        JOBSNAPSHOT *snap = &(ps.jobs[i]);
+        outBeginRecord(&stdoutBuf, projectStatusColumns);
+        outStrField(&stdoutBuf, "job", NULL, snap->job);
+        if (snap->jobStatus >= 0)
+            outCodeField(&stdoutBuf, "jobStatus", NULL, jobStatusName(snap->jobStatus), snap->jobStatus);
+        else
+        {
+            char text[32];
+            sprintf(text, "Error %d", snap->status);
+            outStateField(&stdoutBuf, "jobStatus", NULL, text);
+        }
+        if (snap->hasStartTime)
+        {
+            char text[32];
+            formatTime(text, snap->startTime);
+            outStrField(&stdoutBuf, "startTime", NULL, text);
+        }
+        else
+            outNullField(&stdoutBuf, "startTime", NULL, "-", 1);
+        if (snap->jobStatus >= 0)
+            outIntField(&stdoutBuf, "waveNumber", NULL, snap->waveNumber);
+        else
+            outNullField(&stdoutBuf, "waveNumber", NULL, "-", 1);
+        if (snap->userStatus != NULL)
+            outStrField(&stdoutBuf, "userStatus", NULL, snap->userStatus);
+        else
+            outNullField(&stdoutBuf, "userStatus", NULL, "-", 1);
+        /* The API status is only shown in the machine-readable formats */
+        if (outputFormat != FORMAT_TEXT)
+            outIntField(&stdoutBuf, "status", NULL, snap->status);
+        outEndRecord(&stdoutBuf);
+        if ((snap->status != DSJE_NOERROR) && (status == DSJE_NOERROR))
+            status = snap->status;
+        free(snap->job);
+        free(snap->userStatus);
+    }
+    outFlush(&stdoutBuf);
+    free(ps.jobs);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -stageinfo sub-command
+ */
+static const char stageInfoColumns[] =
+    "stageType,inRowNum,lastError.eventId,lastError.time,lastError.type,"
+    "lastError.typeCode,lastError.message";
+
+static int jobStageInfo(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    char *project;
+    char *job;
+    char *stage;
+    DSSTAGEINFO stageInfo;
+    /* Validate arguments and extract optional arguments */
+    /* Must be three parameters left... project, job and stage */
+    if (argc != 3)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -stageinfo <project> <job> <stage>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    project = argv[0];
+    job = argv[1];
+    stage = argv[2];
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /*
+             * Try getting all the stage info (except the link
+             * lists which we deal with elsewhere)
+             */
+            outBeginRecord(&stdoutBuf, stageInfoColumns);
+            status = DSGetStageInfo(hJob, stage, DSJ_STAGETYPE, &stageInfo);
+            if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting stage type\n", status);
+                outNullField(&stdoutBuf, "stageType", NULL, NULL, 1);
+            }
+            else
+                outStrField(&stdoutBuf, "stageType", "Stage Type\t: ", stageInfo.info.typeName);
+            status = DSGetStageInfo(hJob, stage, DSJ_STAGEINROWNUM, &stageInfo);
+            if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting stage row number\n", status);
+                outNullField(&stdoutBuf, "inRowNum", NULL, NULL, 1);
+            }
+            else
+                outIntField(&stdoutBuf, "inRowNum", "In Row Number\t: ", stageInfo.info.inRowNum);
+            status = DSGetStageInfo(hJob, stage, DSJ_STAGELASTERR, &stageInfo);
+            if (status == DSJE_NOT_AVAILABLE)
+                outNullField(&stdoutBuf, "lastError", "Stage Last Error:", " <none>", LOGDETAIL_FIELDS);
+            else if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting stage last error\n", status);
+                outNullField(&stdoutBuf, "lastError", NULL, NULL, LOGDETAIL_FIELDS);
+            }
+            else
+            {
+                outBeginObject(&stdoutBuf, "lastError", "Stage Last Error:\n");
+                writeLogDetail(&stdoutBuf, 1, &(stageInfo.info.lastError));
+                outEndObject(&stdoutBuf);
+            }
+            outEndRecord(&stdoutBuf);
+            if (status == DSJE_NOT_AVAILABLE)
+                status = DSJE_NOERROR;
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -linkinfo sub-command
+ */
+static const char linkInfoColumns[] =
+    "rowCount,lastError.eventId,lastError.time,lastError.type,"
+    "lastError.typeCode,lastError.message";
+
+/*
+ * Find a link in a job's published status. Its row count is only of use
+ * if the link has no last error, which isn't published.
+ */
+static STATUSLINK *findStatusLink(
+    STATUSSLOT *slot,           /* Copy of the job's slot */
+    const char *stage,          /* Stage and link names */
+    const char *link
+)
+{
+    size_t len = strlen(stage);
+    int i;
+    for (i = 0; i < slot->nLinks; i++)
+    {
+        STATUSLINK *entry = &(slot->link[i]);
+        if ((strncmp(entry->name, stage, len) == 0) && (entry->name[len] == '.') &&
+                (strcmp(entry->name + len + 1, link) == 0))
+            return ((entry->rowCount >= 0) && entry->noError) ? entry : NULL;
+    }
+    return NULL;
+}
+
+static int jobLinkInfo(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    int i;
+    char *project;
+    char *job;
+    char *stage;
+    char *link;
+    DSLINKINFO linkInfo;
+    STATUSSLOT slot;
+    STATUSLINK *entry;
+    BOOL cached = FALSE;
+    int maxAge = 0;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (strcmp(opt, "cached") == 0)
+            cached = TRUE;
+        else if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "maxage") == 0)
+        {
+            if ((maxAge = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be four parameters left... project, job, stage and link names */
+    if (((i+4) != argc) || ((maxAge > 0) && !cached))
+        badOptions = TRUE;
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -linkinfo\n");
+        fprintf(stderr, "\t\t\t[-cached [-maxage <seconds>]]\n");
+        fprintf(stderr, "\t\t\t<project> <job> <stage> <link>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    project = argv[i];
+    job = argv[i+1];
+    stage = argv[i+2];
+    link = argv[i+3];
+    if (cached && readStatus(project, job, maxAge, &slot) &&
+            ((entry = findStatusLink(&slot, stage, link)) != NULL))
+    {
+        outBeginRecord(&stdoutBuf, linkInfoColumns);
+        outIntField(&stdoutBuf, "rowCount", "Link Row Count\t: ", entry->rowCount);
+        outNullField(&stdoutBuf, "lastError", "Link Last Error\t:", " <none>", LOGDETAIL_FIELDS);
+        outEndRecord(&stdoutBuf);
+        return DSJE_NOERROR;
+    }
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /* Try getting all the link info */
+            outBeginRecord(&stdoutBuf, linkInfoColumns);
+            status = DSGetLinkInfo(hJob, stage, link, DSJ_LINKROWCOUNT, &linkInfo);
+            if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting link row count\n", status);
+                outNullField(&stdoutBuf, "rowCount", NULL, NULL, 1);
+            }
+            else
+                outIntField(&stdoutBuf, "rowCount", "Link Row Count\t: ", linkInfo.info.rowCount);
+            status = DSGetLinkInfo(hJob, stage, link, DSJ_LINKLASTERR, &linkInfo);
+            if (status == DSJE_NOT_AVAILABLE)
+            {
+                outNullField(&stdoutBuf, "lastError", "Link Last Error\t:", " <none>", LOGDETAIL_FIELDS);
+                status = DSJE_NOERROR;
+            }
+            else if (status != DSJE_NOERROR)
+            {
+                fprintf(stderr, "Error %d getting link last error\n", status);
+                outNullField(&stdoutBuf, "lastError", NULL, NULL, LOGDETAIL_FIELDS);
+            }
+            else
+            {
+                outBeginObject(&stdoutBuf, "lastError", "Link Last Error\t:\n");
+                writeLogDetail(&stdoutBuf, 1, &(linkInfo.info.lastError));
+                outEndObject(&stdoutBuf);
+            }
+            outEndRecord(&stdoutBuf);
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -monitor sub-command
+ *
+ * Sample the row count of every link in a job at a fixed interval while it
+ * runs and report the rate each is flowing at. The stage and link lists
+ * are only walked once (and come from the metadata cache when they can),
+ * so each sample costs one DSGetLinkInfo() per link plus a status check.
+ *
+ * A link whose rate has fallen below dropPercent of the best it has done
+ * is flagged SLOW. If other links of one of its stages are still flowing
+ * at their usual rate, that stage is holding the rows up, and the link is
+ * flagged BOTTLENECK instead. The API does not say which way a link
+ * points, so "upstream" here means the other links of the same stage.
+ */
+#define DEFAULT_DROP_PERCENT 50
+
+typedef struct MONLINK
+{
+    char *stage;                /* Stage the link was listed under */
+    char *link;                 /* Link name */
+    int sampled;                /* Entry sampled for this link (may be self) */
+    long rows;                  /* Latest row count, -1 if not known */
+    double rate;                /* Rows per second over the last interval */
+    double peakRate;            /* Best rate seen */
+    BOOL slow;                  /* Rate has fallen away from the peak */
+} MONLINK;
+
+static void freeMonLinks(
+    MONLINK *links,
+    int nLinks
+)
+{
+    int i;
+    for (i = 0; i < nLinks; i++)
+    {
+        free(links[i].stage);
+        free(links[i].link);
+    }
+    free(links);
+}
+
+/*
+ * Walk the stages of a job and build the list of links to sample. A link
+ * joins two stages so it is usually listed twice; it is only sampled once,
+ * under the first stage it is listed for. If stageListOut is not NULL the
+ * stage list is returned there too, malloc'ed (or NULL if the job has no
+ * stages).
+ */
+static int findMonLinks(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job,
+    MONLINK **linksOut,         /* Returned links */
+    int *nLinksOut,
+    char **stageListOut         /* Returned stage list, or NULL */
+)
+{
+    DSJOBINFO jobInfo;
+    DSSTAGEINFO stageInfo;
+    MONLINK *links = NULL;
+    int nLinks = 0;
+    int maxLinks = 0;
+    char *stageList = NULL;
+    char *stage;
+    int status;
+    *linksOut = NULL;
+    *nLinksOut = 0;
+    if (stageListOut != NULL)
+        *stageListOut = NULL;
+    status = metaGetJobInfo(hJob, project, job, DSJ_STAGELIST, &jobInfo);
+    if (status == DSJE_NOT_AVAILABLE)
+        return DSJE_NOERROR;
+    if (status != DSJE_NOERROR)
+    {
+        fprintf(stderr, "Error %d getting stage list\n", status);
+        return status;
+    }
+    /* Keep a copy of the list, as the link list calls may reuse it */
+    for (stage = jobInfo.info.stageList; *stage != '\0'; stage += strlen(stage) + 1)
+        ;
+    if ((stageList = malloc(stage - jobInfo.info.stageList + 1)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    memcpy(stageList, jobInfo.info.stageList, stage - jobInfo.info.stageList + 1);
+    for (stage = stageList; (status == DSJE_NOERROR) && (*stage != '\0');
+            stage += strlen(stage) + 1)
+    {
+        char *link;
+        status = metaGetLinkList(hJob, project, job, stage, &stageInfo);
+        if (status == DSJE_NOT_AVAILABLE)
+        {
+            status = DSJE_NOERROR;
+            continue;
+        }
+        if (status != DSJE_NOERROR)
+        {
+            fprintf(stderr, "Error %d getting link list of stage '%s'\n", status, stage);
+            break;
+        }
+        for (link = stageInfo.info.linkList; *link != '\0'; link += strlen(link) + 1)
+        {
+            MONLINK *entry;
+            int i;
+            if (nLinks == maxLinks)
+            {
+                MONLINK *bigger = realloc(links, (maxLinks + 32) * sizeof(MONLINK));
+                if (bigger == NULL)
+                {
+                    status = DSJE_DSJOB_ERROR;
+                    break;
+                }
+                links = bigger;
+                maxLinks += 32;
+            }
+            entry = &(links[nLinks]);
+            entry->stage = copyString(stage);
+            entry->link = copyString(link);
+            if ((entry->stage == NULL) || (entry->link == NULL))
+            {
+                free(entry->stage);
+                free(entry->link);
+                status = DSJE_DSJOB_ERROR;
+                break;
+            }
+            entry->sampled = nLinks;
+            for (i = 0; i < nLinks; i++)
+            {
+                if ((links[i].sampled == i) && (strcmp(links[i].link, link) == 0))
+                {
+                    entry->sampled = i;
+                    break;
+                }
+            }
+            entry->rows = -1;
+            entry->rate = entry->peakRate = 0.0;
+            entry->slow = FALSE;
+            nLinks++;
+        }
+        if (status == DSJE_DSJOB_ERROR)
+            fprintf(stderr, "ERROR: Out of memory\n");
+    }
+    if (status != DSJE_NOERROR)
+    {
+        free(stageList);
+        freeMonLinks(links, nLinks);
+    }
+    else
+    {
+        *linksOut = links;
+        *nLinksOut = nLinks;
+        if (stageListOut != NULL)
+            *stageListOut = stageList;
+        else
+            free(stageList);
+    }
+    return status;
+}
+
+/*
+ * Take one sample: read the row count of each link and work out its rate
+ * and whether it has slowed.
+ */
+static void sampleMonLinks(
+    DSJOB hJob,                 /* Open job */
+    MONLINK *links,
+    int nLinks,
+    DWORD elapsed,              /* Milliseconds since the last sample */
+    int dropPercent             /* Share of the peak rate that counts as slow */
+)
+{
+    DSLINKINFO linkInfo;
+    int i;
+    for (i = 0; i < nLinks; i++)
+    {
+        MONLINK *entry = &(links[i]);
+        long rows;
+        int status;
+        if (entry->sampled != i)
+        {
+            /* Listed before under another stage... copy that sample */
+            MONLINK *sampled = &(links[entry->sampled]);
+            entry->rows = sampled->rows;
+            entry->rate = sampled->rate;
+            entry->peakRate = sampled->peakRate;
+            entry->slow = sampled->slow;
+            continue;
+        }
+        status = DSGetLinkInfo(hJob, entry->stage, entry->link, DSJ_LINKROWCOUNT, &linkInfo);
+        if (status != DSJE_NOERROR)
+        {
+            fprintf(stderr, "Error %d getting row count of link '%s'\n", status, entry->link);
+            rows = -1;
+        }
+        else
+            rows = linkInfo.info.rowCount;
+        if ((rows >= 0) && (entry->rows >= 0) && (elapsed > 0))
+        {
+            entry->rate = (rows - entry->rows) * 1000.0 / elapsed;
+            if (entry->rate > entry->peakRate)
+                entry->peakRate = entry->rate;
+            entry->slow = (entry->peakRate > 0.0) &&
+                (entry->rate * 100.0 < entry->peakRate * dropPercent);
+        }
+        entry->rows = rows;
+    }
+}
+
+/*
+ * Decide whether a slow link is a bottleneck, i.e. whether some other link
+ * of either of its stages is still flowing.
+ */
+static BOOL isBottleneck(
+    MONLINK *links,
+    int nLinks,
+    int index                   /* The slow link */
+)
+{
+    char *link = links[index].link;
+    int i;
+    int j;
+    for (i = 0; i < nLinks; i++)
+    {
+        if (strcmp(links[i].link, link) != 0)
+            continue;
+        /* links[i].stage is one of the link's stages */
+        for (j = 0; j < nLinks; j++)
+        {
+            if ((strcmp(links[j].stage, links[i].stage) == 0) &&
+                    (strcmp(links[j].link, link) != 0) &&
+                    !links[j].slow && (links[j].rate > 0.0))
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static const char monitorColumns[] = "sample,seconds,stage,link,rows,rate,flag";
+
+static void printMonSample(
+    MONLINK *links,
+    int nLinks,
+    int sample,                 /* Sample number, from 1 */
+    DWORD seconds,              /* Seconds since monitoring started */
+    int jobStatus               /* DSJ_JOBSTATUS at the sample */
+)
+{
+    char text[64];
+    int i;
+    if (outputFormat == FORMAT_TEXT)
+    {
+        sprintf(text, "Sample %d at %lu seconds: ", sample, (unsigned long) seconds);
+        outStr(&stdoutBuf, text);
+        outStr(&stdoutBuf, jobStatusName(jobStatus));
+        outStr(&stdoutBuf, "\nStage\tLink\tRows\tRows/sec\tFlag\n");
+    }
+    for (i = 0; i < nLinks; i++)
+    {
+        MONLINK *entry = &(links[i]);
+        outBeginRecord(&stdoutBuf, monitorColumns);
+        if (outputFormat != FORMAT_TEXT)
+        {
+            /* Text mode shows these in the heading instead */
+            outIntField(&stdoutBuf, "sample", NULL, sample);
+            outIntField(&stdoutBuf, "seconds", NULL, (long) seconds);
+        }
+        outStrField(&stdoutBuf, "stage", NULL, entry->stage);
+        outStrField(&stdoutBuf, "link", NULL, entry->link);
+        if (entry->rows < 0)
+            outNullField(&stdoutBuf, "rows", NULL, "-", 1);
+        else
+            outIntField(&stdoutBuf, "rows", NULL, entry->rows);
+        if (sample == 1)
+            outNullField(&stdoutBuf, "rate", NULL, "-", 1);
+        else
+        {
+            sprintf(text, "%.1f", entry->rate);
+            outNumberField(&stdoutBuf, "rate", NULL, text);
+        }
+        if (!entry->slow)
+            outNullField(&stdoutBuf, "flag", NULL, "", 1);
+        else
+            outStrField(&stdoutBuf, "flag", NULL,
+                        isBottleneck(links, nLinks, i) ? "BOTTLENECK" : "SLOW");
+        outEndRecord(&stdoutBuf);
+    }
+    outText(&stdoutBuf, "\n");
+    outFlush(&stdoutBuf);
+}
+
+static int jobMonitor(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status = DSJE_NOERROR;
+    int i;
+    char *project;
+    char *job;
+    int interval = 5;
+    int maxSamples = 0;
+    int dropPercent = DEFAULT_DROP_PERCENT;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "interval") == 0)
+        {
+            if ((interval = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "samples") == 0)
+        {
+            if ((maxSamples = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "drop") == 0)
+        {
+            if (((dropPercent = atoi(arg)) < 1) || (dropPercent > 99))
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be two parameters left... project and job */
+    if ((i+2) == argc)
+    {
+        project = argv[i];
+        job = argv[i+1];
+    }
+    else
+        badOptions = TRUE;
+    /* Report validation problems and exit */
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -monitor\n");
+        fprintf(stderr, "\t\t\t[-interval <seconds>]\n");
+        fprintf(stderr, "\t\t\t[-samples <n>]\n");
+        fprintf(stderr, "\t\t\t[-drop <percent of peak rate>]\n");
+        fprintf(stderr, "\t\t\t<project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            MONLINK *links;
+            int nLinks;
+            status = findMonLinks(hJob, project, job, &links, &nLinks, NULL);
+            if ((status == DSJE_NOERROR) && (nLinks == 0))
+                outText(&stdoutBuf, "<none>\n");
+            else if (status == DSJE_NOERROR)
+            {
+                DWORD startTime = GetTickCount();
+                DWORD lastTime = startTime;
+                int sample;
+                for (sample = 1; ; sample++)
+                {
+                    DSJOBINFO jobInfo;
+                    DWORD now;
+                    /*
+                     * Check the status before the row counts, so that the
+                     * last sample has the counts the job finished with.
+                     */
+                    status = DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo);
+                    if (status != DSJE_NOERROR)
+                    {
+                        fprintf(stderr, "Error %d getting job status\n", status);
+                        break;
+                    }
+                    now = GetTickCount();
+                    sampleMonLinks(hJob, links, nLinks, now - lastTime, dropPercent);
+                    lastTime = now;
+                    printMonSample(links, nLinks, sample, (now - startTime) / 1000,
+                                   jobInfo.info.jobStatus);
+                    if ((jobInfo.info.jobStatus != DSJS_RUNNING) || (sample == maxSamples))
+                        break;
+                    Sleep(interval * 1000);
+                }
+            }
+            freeMonLinks(links, nLinks);
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -graph sub-command
+ *
+ * Write the data flow of a job, or of every job in a project, as a graph
+ * whose nodes are the stages and whose edges are the links, each labelled
+ * with the rows it carried in the latest run. In text mode the graph is
+ * written in the DOT language, with a cluster per job for a project;
+ * otherwise each stage and each link is written as a record.
+ *
+ * A job is crawled over a single handle: the walk that -monitor makes (so
+ * the stage and link lists come from the metadata cache when they can),
+ * the type of each stage, also cached, and one DSGetLinkInfo() per link
+ * for its row count. For a project the jobs are shared out among a pool of
+ * workers, so the crawls of different jobs overlap, and the graphs are
+ * written out at the end in job list order.
+ *
+ * The API does not say which way a link points, so the edges have no
+ * direction. A link joins the first two stages that list it; one listed
+ * by a single stage (such as a link to a container) is drawn to a point.
+ */
+typedef struct JOBGRAPH
+{
+    char *job;                  /* Job name */
+    int status;                 /* Error crawling the job */
+    char *stageList;            /* Its stages, malloc'ed, NULL if none */
+    char **stageTypes;          /* Type of each stage, NULL if not known */
+    int nStages;
+    MONLINK *links;             /* Its links, as listed by findMonLinks() */
+    int nLinks;
+} JOBGRAPH;
+
+typedef struct GRAPHCRAWL
+{
+    char *project;
+    JOBGRAPH *jobs;
+    int nJobs;
+    volatile LONG nextJob;      /* Next job to be claimed */
+} GRAPHCRAWL;
+
+static const char graphStageColumns[] = "job,stage,stageType";
+static const char graphLinkColumns[] = "job,link,stage,otherStage,rowCount";
+
+static void freeJobGraph(
+    JOBGRAPH *graph             /* Graph to free, but not its job name */
+)
+{
+    int i;
+    if (graph->stageTypes != NULL)
+    {
+        for (i = 0; i < graph->nStages; i++)
+            free(graph->stageTypes[i]);
+        free(graph->stageTypes);
+    }
+    free(graph->stageList);
+    freeMonLinks(graph->links, graph->nLinks);
+}
+
+/*
+ * Crawl a job's stages and links, and get the row count of each link.
+ */
+static void crawlJob(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project the job is in */
+    JOBGRAPH *graph             /* Graph to fill in, job name set */
+)
+{
+    DSSTAGEINFO stageInfo;
+    DSLINKINFO linkInfo;
+    char *stage;
+    int i;
+    graph->status = findMonLinks(hJob, project, graph->job, &(graph->links),
+                                 &(graph->nLinks), &(graph->stageList));
+    if ((graph->status != DSJE_NOERROR) || (graph->stageList == NULL))
+        return;
+    for (stage = graph->stageList; *stage != '\0'; stage += strlen(stage) + 1)
+        graph->nStages++;
+    if ((graph->stageTypes = calloc(graph->nStages + 1, sizeof(char *))) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        graph->nStages = 0;
+        graph->status = DSJE_DSJOB_ERROR;
+        return;
+    }
+    for (i = 0, stage = graph->stageList; i < graph->nStages; i++, stage += strlen(stage) + 1)
+        if (metaGetStageType(hJob, project, graph->job, stage, &stageInfo) == DSJE_NOERROR)
+            graph->stageTypes[i] = copyString(stageInfo.info.typeName);
+    /* Each link is counted under the first stage it is listed for */
+    for (i = 0; i < graph->nLinks; i++)
+    {
+        MONLINK *link = &(graph->links[i]);
+        if ((link->sampled == i) && (DSGetLinkInfo(hJob, link->stage, link->link,
+                                     DSJ_LINKROWCOUNT, &linkInfo) == DSJE_NOERROR))
+            link->rows = linkInfo.info.rowCount;
+    }
+}
+
+static void graphWorker(
+    WORKER *worker              /* Calling worker */
+)
+{
+    GRAPHCRAWL *crawl = worker->context;
+    LONG i;
+    while ((i = InterlockedIncrement(&(crawl->nextJob)) - 1) < crawl->nJobs)
+    {
+        JOBGRAPH *graph = &(crawl->jobs[i]);
+        DSJOB hJob = workerJob(worker, crawl->project, graph->job, &(graph->status));
+        if (hJob != NULL)
+        {
+            crawlJob(hJob, crawl->project, graph);
+            (void) DSCloseJob(hJob);
+        }
+    }
+}
+
+/*
+ * Return the stage at the other end of a link, or NULL if only one stage
+ * lists it.
+ */
+static char *otherStage(
+    JOBGRAPH *graph,            /* The job's graph */
+    int i                       /* Link, as first listed */
+)
+{
+    int j;
+    for (j = i + 1; j < graph->nLinks; j++)
+        if (graph->links[j].sampled == i)
+            return graph->links[j].stage;
+    return NULL;
+}
+
+/*
+ * Write text inside a DOT string, escaping quotes and backslashes.
+ */
+static void writeDotText(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *text            /* Text to write */
+)
+{
+    for (; *text != '\0'; text++)
+    {
+        if ((*text == '"') || (*text == '\\'))
+            outChar(buf, '\\');
+        outChar(buf, *text);
+    }
+}
+
+/*
+ * Write a DOT node name. In a project graph node names are prefixed by the
+ * job, as stage names are only unique within a job.
+ */
+static void writeDotNode(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *job,            /* Job name prefix, or NULL */
+    const char *name,           /* Node name */
+    const char *suffix          /* Added with a '.', or NULL */
+)
+{
+    outChar(buf, '"');
+    if (job != NULL)
+    {
+        writeDotText(buf, job);
+        outChar(buf, '/');
+    }
+    writeDotText(buf, name);
+    if (suffix != NULL)
+    {
+        outChar(buf, '.');
+        writeDotText(buf, suffix);
+    }
+    outChar(buf, '"');
+}
+
+/*
+ * Write the nodes and edges of a job's graph in DOT. For a project graph
+ * they are written as a cluster.
+ */
+static void writeDotGraph(
+    OUTBUF *buf,                /* Buffer to write to */
+    JOBGRAPH *graph,            /* The job's graph */
+    BOOL inProject              /* Part of a project graph */
+)
+{
+    const char *indent = inProject ? "\t\t" : "\t";
+    const char *prefix = inProject ? graph->job : NULL;
+    char *stage;
+    int i;
+    if (inProject)
+    {
+        outStr(buf, "\tsubgraph \"cluster_");
+        writeDotText(buf, graph->job);
+        outStr(buf, "\" {\n\t\tlabel=\"");
+        writeDotText(buf, graph->job);
+        outStr(buf, "\";\n");
+    }
+    for (i = 0, stage = graph->stageList; i < graph->nStages; i++, stage += strlen(stage) + 1)
+    {
+        outStr(buf, indent);
+        writeDotNode(buf, prefix, stage, NULL);
+        outStr(buf, " [label=\"");
+        writeDotText(buf, stage);
+        if (graph->stageTypes[i] != NULL)
+        {
+            outStr(buf, "\\n");
+            writeDotText(buf, graph->stageTypes[i]);
+        }
+        outStr(buf, "\"];\n");
+    }
+    for (i = 0; i < graph->nLinks; i++)
+    {
+        MONLINK *link = &(graph->links[i]);
+        char *other;
+        if (link->sampled != i)
+            continue;
+        if ((other = otherStage(graph, i)) == NULL)
+        {
+            outStr(buf, indent);
+            writeDotNode(buf, prefix, link->stage, link->link);
+            outStr(buf, " [shape=point];\n");
+        }
+        outStr(buf, indent);
+        writeDotNode(buf, prefix, link->stage, NULL);
+        outStr(buf, " -- ");
+        if (other != NULL)
+            writeDotNode(buf, prefix, other, NULL);
+        else
+            writeDotNode(buf, prefix, link->stage, link->link);
+        outStr(buf, " [label=\"");
+        writeDotText(buf, link->link);
+        if (link->rows >= 0)
+        {
+            outStr(buf, "\\n");
+            outInt(buf, link->rows);
+            outStr(buf, " rows");
+        }
+        outStr(buf, "\"];\n");
+    }
+    if (inProject)
+        outStr(buf, "\t}\n");
+}
+
+/*
+ * Write a job's graph as a record per stage and a record per link.
+ */
+static void writeGraphRecords(
+    OUTBUF *buf,                /* Buffer to write to */
+    JOBGRAPH *graph             /* The job's graph */
+)
+{
+    char *stage;
+    int i;
+    for (i = 0, stage = graph->stageList; i < graph->nStages; i++, stage += strlen(stage) + 1)
+    {
+        outBeginRecord(buf, graphStageColumns);
+        outStrField(buf, "job", NULL, graph->job);
+        outStrField(buf, "stage", NULL, stage);
+        if (graph->stageTypes[i] != NULL)
+            outStrField(buf, "stageType", NULL, graph->stageTypes[i]);
+        else
+            outNullField(buf, "stageType", NULL, NULL, 1);
+        outEndRecord(buf);
+    }
+    for (i = 0; i < graph->nLinks; i++)
+    {
+        MONLINK *link = &(graph->links[i]);
+        char *other;
+        if (link->sampled != i)
+            continue;
+        outBeginRecord(buf, graphLinkColumns);
+        outStrField(buf, "job", NULL, graph->job);
+        outStrField(buf, "link", NULL, link->link);
+        outStrField(buf, "stage", NULL, link->stage);
+        if ((other = otherStage(graph, i)) != NULL)
+            outStrField(buf, "otherStage", NULL, other);
+        else
+            outNullField(buf, "otherStage", NULL, NULL, 1);
+        if (link->rows >= 0)
+            outIntField(buf, "rowCount", NULL, link->rows);
+        else
+            outNullField(buf, "rowCount", NULL, NULL, 1);
+        outEndRecord(buf);
+    }
+}
+
+static int jobGraph(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    DSPROJECTINFO pInfo;
+    GRAPHCRAWL crawl;
+    int status;
+    int i;
+    int nThreads = DEFAULT_THREADS;
+    char *str;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "threads") == 0)
+        {
+            if ((nThreads = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be one or two parameters left... project and optional job */
+    if ((i+1 != argc) && (i+2 != argc))
+        badOptions = TRUE;
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -graph [-threads <n>] <project> [<job>]\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    memset(&crawl, 0, sizeof(crawl));
+    crawl.project = argv[i];
+    if ((hProject = openProject(crawl.project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+        return status;
+    }
+
+    /* A single job is crawled here, over the one handle */
+    if (i+2 == argc)
+    {
+        JOBGRAPH graph;
+        memset(&graph, 0, sizeof(graph));
+        graph.job = argv[i+1];
+        if ((hJob = openJob(hProject, graph.job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            crawlJob(hJob, crawl.project, &graph);
+            if ((status = graph.status) == DSJE_NOERROR)
+            {
+                if (outputFormat == FORMAT_TEXT)
+                {
+                    outStr(&stdoutBuf, "graph ");
+                    writeDotNode(&stdoutBuf, NULL, graph.job, NULL);
+                    outStr(&stdoutBuf, " {\n");
+                    writeDotGraph(&stdoutBuf, &graph, FALSE);
+                    outStr(&stdoutBuf, "}\n");
+                }
+                else
+                    writeGraphRecords(&stdoutBuf, &graph);
+            }
+            freeJobGraph(&graph);
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+        return status;
+    }
+
+    /* Otherwise get the job list and share the jobs out among the workers */
+    status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &pInfo);
+    if ((status != DSJE_NOERROR) && (status != DSJE_NOT_AVAILABLE))
+    {
+        fprintf(stderr, "Error %d getting job list\n", status);
+        (void) closeProject(hProject);
+        return status;
+    }
+    if (status == DSJE_NOERROR)
+    {
+        for (str = pInfo.info.jobList; *str != '\0'; str += strlen(str) + 1)
+            crawl.nJobs++;
+    }
+    if ((crawl.jobs = calloc(crawl.nJobs + 1, sizeof(JOBGRAPH))) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        (void) closeProject(hProject);
+        return DSJE_DSJOB_ERROR;
+    }
+    /* The list belongs to the project handle, so the names are copied */
+    if (crawl.nJobs > 0)
+    {
+        for (i = 0, str = pInfo.info.jobList; i < crawl.nJobs; i++, str += strlen(str) + 1)
+            if ((crawl.jobs[i].job = copyString(str)) == NULL)
+                crawl.nJobs = i;
+    }
+    (void) closeProject(hProject);
+    status = DSJE_NOERROR;
+    if (nThreads > crawl.nJobs)
+        nThreads = crawl.nJobs;
+    if (nThreads > 0)
+        runWorkers(nThreads, graphWorker, &crawl);
+
+    /* Write them out */
+    if (outputFormat == FORMAT_TEXT)
+    {
+        outStr(&stdoutBuf, "graph ");
+        writeDotNode(&stdoutBuf, NULL, crawl.project, NULL);
+        outStr(&stdoutBuf, " {\n");
+    }
+    for (i = 0; i < crawl.nJobs; i++)
+    {
+        JOBGRAPH *graph = &(crawl.jobs[i]);
+        if (graph->status != DSJE_NOERROR)
+        {
+            fprintf(stderr, "Error %d getting the graph of job '%s'\n", graph->status, graph->job);
+            if (status == DSJE_NOERROR)
+                status = graph->status;
+        }
+        else if (outputFormat == FORMAT_TEXT)
+            writeDotGraph(&stdoutBuf, graph, TRUE);
+        else
+            writeGraphRecords(&stdoutBuf, graph);
+        freeJobGraph(graph);
+        free(graph->job);
+    }
+    if (outputFormat == FORMAT_TEXT)
+        outStr(&stdoutBuf, "}\n");
+    outFlush(&stdoutBuf);
+    free(crawl.jobs);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Run history.
+ *
+ * -run -wait and -harvest append a record of each finished run to a
+ * history file, DSJOB_HISTORY or by default dsjob.hist in the cache
+ * directory, and -perfreport reads it back to find runs that took longer
+ * (or moved more or fewer rows) than usual.
+ *
+ * The file is a HISTHEADER followed by records, each a HISTRECORD then the
+ * row count of each link and the NUL terminated server, project and job
+ * names and "stage.link" name of each link, padded to a multiple of four
+ * bytes. The file is created with its header in place and records are
+ * only ever appended, with a single write each, so that several dsjob
+ * processes can share a file, and the layout is meant to be read in place
+ * by mapping the file. The hash lets a search for a job's runs skip the
+ * names of other jobs' records. Times are kept as unsigned 32-bit numbers,
+ * good until 2106.
+ */
+#define HISTORY_MAGIC   "DSJHIST1"
+
+typedef struct HISTHEADER
+{
+    char magic[8];              /* HISTORY_MAGIC, not NUL terminated */
+} HISTHEADER;
+
+typedef struct HISTRECORD
+{
+    unsigned int size;          /* Bytes in the record, a multiple of 4 */
+    unsigned int hash;          /* fnvHash() of "server/project/job" */
+    int waveNumber;
+    unsigned int startTime;     /* DSJ_JOBSTARTTIMESTAMP */
+    unsigned int endTime;       /* DSJ_JOBLASTTIMESTAMP */
+    int jobStatus;              /* DSJ_JOBSTATUS as the run finished */
+    int nLinks;                 /* Link row counts that follow */
+} HISTRECORD;
+
+typedef struct FILEVIEW
+{
+    HANDLE hFile;
+    HANDLE hMap;
+    char *base;                 /* The mapped file */
+    size_t size;
+} FILEVIEW;
+
+/*
+ * Return the name of the history file, or NULL if it doesn't fit.
+ */
+static char *historyFileName(
+    char *name                  /* Space for the name, MAX_PATH characters */
+)
+{
+    char *env = getenv("DSJOB_HISTORY");
+    if (env != NULL)
+    {
+        if (strlen(env) >= MAX_PATH)
+            return NULL;
+        return strcpy(name, env);
+    }
+    if (!getCacheDir(name) || (strlen(name) + sizeof(PATH_SEPARATOR "dsjob.hist") > MAX_PATH))
+        return NULL;
+    return strcat(name, PATH_SEPARATOR "dsjob.hist");
+}
+
+/*
+ * Map a file for reading. Returns FALSE if it could not be opened; an empty
+ * file maps as a size of zero.
+ */
+static BOOL mapFile(
+    const char *name,           /* File to map */
+    FILEVIEW *view              /* Returned view, free with unmapFile() */
+)
+{
+    LARGE_INTEGER size;
+    view->hMap = NULL;
+    view->base = NULL;
+    view->size = 0;
+    if ((view->hFile = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                   NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL))
+            == INVALID_HANDLE_VALUE)
+        return FALSE;
+    if (GetFileSizeEx(view->hFile, &size) && (size.QuadPart > 0) &&
+            ((view->hMap = CreateFileMappingA(view->hFile, NULL, PAGE_READONLY, 0, 0, NULL)) != NULL) &&
+            ((view->base = MapViewOfFile(view->hMap, FILE_MAP_READ, 0, 0, 0)) != NULL))
+        view->size = (size_t) size.QuadPart;
+    return TRUE;
+}
+
+/*
+ * Map the history file. An empty or missing file maps as no records and
+ * FALSE is returned only if the file is not a history file.
+ */
+static BOOL mapHistory(
+    FILEVIEW *view              /* Returned view, free with unmapFile() */
+)
+{
+    char name[MAX_PATH];
+    view->hFile = INVALID_HANDLE_VALUE;
+    view->hMap = NULL;
+    view->base = NULL;
+    view->size = 0;
+    if ((historyFileName(name) == NULL) || !mapFile(name, view))
+        return TRUE;
+    if ((view->size > 0) && ((view->size < sizeof(HISTHEADER)) ||
+                             (memcmp(view->base, HISTORY_MAGIC, 8) != 0)))
+    {
+        fprintf(stderr, "ERROR: '%s' is not a dsjob history file\n", name);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void unmapFile(
+    FILEVIEW *view              /* View from mapFile() */
+)
+{
+    if (view->base != NULL)
+        (void) UnmapViewOfFile(view->base);
+    if (view->hMap != NULL)
+        (void) CloseHandle(view->hMap);
+    if (view->hFile != INVALID_HANDLE_VALUE)
+        (void) CloseHandle(view->hFile);
+}
+
+/*
+ * Step through the records of a mapped history. Returns the record after
+ * prev (the first if prev is NULL), or NULL at the end of the records or
+ * at a record that is damaged or still being written.
+ */
+static HISTRECORD *nextHistRecord(
+    FILEVIEW *view,
+    HISTRECORD *prev
+)
+{
+    size_t offset = (prev == NULL) ? sizeof(HISTHEADER) :
+                    (size_t) ((char *) prev - view->base) + prev->size;
+    HISTRECORD *record = (HISTRECORD *) (view->base + offset);
+    if ((view->size < sizeof(HISTHEADER)) || (offset + sizeof(HISTRECORD) > view->size) ||
+            (record->size < sizeof(HISTRECORD)) || ((record->size % 4) != 0) ||
+            (record->size > view->size - offset) || (record->nLinks < 0) ||
+            ((size_t) record->nLinks > (record->size - sizeof(HISTRECORD)) / sizeof(int)) ||
+            (view->base[offset + record->size - 1] != '\0'))
+        return NULL;
+    return record;
+}
+
+/*
+ * The names that follow a record's row counts: server, project, job, then
+ * the links.
+ */
+static char *histNames(
+    HISTRECORD *record
+)
+{
+    return (char *) (record + 1) + record->nLinks * sizeof(int);
+}
+
+static char *nextName(
+    char *name
+)
+{
+    return name + strlen(name) + 1;
+}
+
+/*
+ * Work out the hash a record of a job's run carries. Returns FALSE if out
+ * of memory.
+ */
+static BOOL histJobHash(
+    char *server,               /* Server, project and job names */
+    char *project,
+    char *job,
+    unsigned int *hash          /* Returned hash */
+)
+{
+    char *key = malloc(strlen(server) + strlen(project) + strlen(job) + 3);
+    if (key == NULL)
+        return FALSE;
+    sprintf(key, "%s/%s/%s", server, project, job);
+    *hash = (unsigned int) fnvHash(key);
+    free(key);
+    return TRUE;
+}
+
+/*
+ * Find whether a record is for the given job. The names are only compared
+ * if the record has the job's hash.
+ */
+static BOOL isHistJob(
+    HISTRECORD *record,
+    unsigned int hash,          /* From histJobHash() */
+    char *server,               /* Server, project and job names */
+    char *project,
+    char *job
+)
+{
+    char *name = histNames(record);
+    if ((record->hash != hash) || (strcmp(name, server) != 0))
+        return FALSE;
+    name = nextName(name);
+    return (strcmp(name, project) == 0) && (strcmp(nextName(name), job) == 0);
+}
+
+/*
+ * The last run of a job, as read by getLastRun().
+ */
+typedef struct HISTRUN
+{
+    int waveNumber;
+    int jobStatus;
+    time_t startTime;
+    time_t endTime;
+} HISTRUN;
+
+static int getLastRun(
+    DSJOB hJob,                 /* Open job */
+    HISTRUN *run                /* Returned run */
+)
+{
+    DSJOBINFO jobInfo;
+    int status;
+    if ((status = DSGetJobInfo(hJob, DSJ_JOBWAVENO, &jobInfo)) != DSJE_NOERROR)
+        return status;
+    run->waveNumber = jobInfo.info.jobWaveNumber;
+    if ((status = DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo)) != DSJE_NOERROR)
+        return status;
+    run->jobStatus = jobInfo.info.jobStatus;
+    if ((status = DSGetJobInfo(hJob, DSJ_JOBSTARTTIMESTAMP, &jobInfo)) != DSJE_NOERROR)
+        return status;
+    run->startTime = jobInfo.info.jobStartTime;
+    if (DSGetJobInfo(hJob, DSJ_JOBLASTTIMESTAMP, &jobInfo) == DSJE_NOERROR)
+        run->endTime = jobInfo.info.jobLastTime;
+    else
+        run->endTime = time(NULL);
+    return DSJE_NOERROR;
+}
+
+/*
+ * Create the history file, with its header, unless it exists already. The
+ * header is written to a file of our own which is then moved into place,
+ * failing if another process got there first, so the file is never seen
+ * without its header. Returns FALSE if it can't be created.
+ */
+static BOOL createHistory(
+    const char *name            /* History file name */
+)
+{
+    char tempName[MAX_PATH + 32];
+    FILE *fp;
+    BOOL written;
+    if ((fp = fopen(name, "rb")) != NULL)
+    {
+        fclose(fp);
+        return TRUE;
+    }
+    sprintf(tempName, "%.*s.%lu.%lu", MAX_PATH, name,
+            (unsigned long) GetCurrentProcessId(), (unsigned long) GetCurrentThreadId());
+    if ((fp = fopen(tempName, "wb")) == NULL)
+        return FALSE;
+    written = (fwrite(HISTORY_MAGIC, 8, 1, fp) == 1);
+    if ((fclose(fp) == 0) && written && MoveFileExA(tempName, name, 0))
+        return TRUE;
+    (void) DeleteFileA(tempName);
+    /* Fine if someone else created it meanwhile */
+    if ((fp = fopen(name, "rb")) == NULL)
+        return FALSE;
+    fclose(fp);
+    return TRUE;
+}
+
+/*
+ * Read the link row counts of a finished run and append its record to the
+ * history file.
+ */
+static int recordRun(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job,
+    HISTRUN *run                /* The run, from getLastRun() */
+)
+{
+    char name[MAX_PATH];
+    char *server = (serverName != NULL) ? serverName : "";
+    unsigned int hash;
+    MONLINK *links;
+    int nLinks;
+    int nSampled = 0;
+    size_t size;
+    char *block;
+    HISTRECORD *record;
+    int *rows;
+    char *names;
+    FILE *fp;
+    int status;
+    int i;
+    if ((status = findMonLinks(hJob, project, job, &links, &nLinks, NULL)) != DSJE_NOERROR)
+        return status;
+    sampleMonLinks(hJob, links, nLinks, 0, DEFAULT_DROP_PERCENT);
+    /* Lay out the record */
+    size = sizeof(HISTRECORD) + strlen(server) + strlen(project) + strlen(job) + 3;
+    for (i = 0; i < nLinks; i++)
+    {
+        if (links[i].sampled == i)
+        {
+            size += sizeof(int) + strlen(links[i].stage) + strlen(links[i].link) + 2;
+            nSampled++;
+        }
+    }
+    size = (size + 3) & ~(size_t) 3;
+    if (!histJobHash(server, project, job, &hash) || ((block = calloc(1, size)) == NULL))
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        freeMonLinks(links, nLinks);
+        return DSJE_DSJOB_ERROR;
+    }
+    record = (HISTRECORD *) block;
+    record->size = (unsigned int) size;
+    record->hash = hash;
+    record->waveNumber = run->waveNumber;
+    record->startTime = (unsigned int) run->startTime;
+    record->endTime = (unsigned int) run->endTime;
+    record->jobStatus = run->jobStatus;
+    record->nLinks = nSampled;
+    rows = (int *) (record + 1);
+    names = histNames(record);
+    names += sprintf(names, "%s", server) + 1;
+    names += sprintf(names, "%s", project) + 1;
+    names += sprintf(names, "%s", job) + 1;
+    for (i = 0; i < nLinks; i++)
+    {
+        if (links[i].sampled == i)
+        {
+            *rows++ = (int) links[i].rows;
+            names += sprintf(names, "%s.%s", links[i].stage, links[i].link) + 1;
+        }
+    }
+    freeMonLinks(links, nLinks);
+    /* Append it, unbuffered so that it goes in one write */
+    if ((historyFileName(name) == NULL) || !createHistory(name) ||
+            ((fp = fopen(name, "ab")) == NULL))
+    {
+        fprintf(stderr, "ERROR: Failed to open history file\n");
+        free(block);
+        return DSJE_DSJOB_ERROR;
+    }
+    (void) setvbuf(fp, NULL, _IONBF, 0);
+    if (fwrite(block, size, 1, fp) != 1)
+    {
+        fprintf(stderr, "ERROR: Failed to write history file '%s'\n", name);
+        status = DSJE_DSJOB_ERROR;
+    }
+    fclose(fp);
+    free(block);
+    return status;
+}
+
+/*
+ * Record the run a job has just finished, as -run -wait does. Failures are
+ * reported but otherwise ignored.
+ */
+static void recordLastRun(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job
+)
+{
+    HISTRUN run;
+    int status = getLastRun(hJob, &run);
+    if (status != DSJE_NOERROR)
+        fprintf(stderr, "Error %d getting run to record in history\n", status);
+    else
+        (void) recordRun(hJob, project, job, &run);
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -harvest sub-command
+ *
+ * Record the last run of each of the given jobs (or of every job in the
+ * project) in the history, unless the job is still running, has never
+ * run, or the run is already there.
+ */
+static const char harvestColumns[] = "job,waveNumber,result";
+
+static int harvestJob(
+    DSPROJECT hProject,         /* Open project */
+    char *project,              /* Project name */
+    char *job,                  /* Job name */
+    FILEVIEW *view              /* The history as it was */
+)
+{
+    DSJOB hJob;
+    HISTRUN run;
+    char *server = (serverName != NULL) ? serverName : "";
+    char *result = "recorded";
+    unsigned int hash;
+    int status;
+    outBeginRecord(&stdoutBuf, harvestColumns);
+    outStrField(&stdoutBuf, "job", NULL, job);
+    if ((hJob = openJob(hProject, job, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open job '%s'\n", job);
+        outNullField(&stdoutBuf, "waveNumber", NULL, "-", 1);
+        outStrField(&stdoutBuf, "result", NULL, "not opened");
+        outEndRecord(&stdoutBuf);
+        return status;
+    }
+    if ((status = getLastRun(hJob, &run)) == DSJE_NOT_AVAILABLE)
+    {
+        status = DSJE_NOERROR;
+        run.waveNumber = 0;
+        run.jobStatus = DSJS_NOTRUNNING;
+    }
+    if (status != DSJE_NOERROR)
+    {
+        fprintf(stderr, "Error %d getting last run of '%s'\n", status, job);
+        result = "error";
+    }
+    else if ((run.jobStatus == DSJS_RUNNING) || (run.jobStatus == DSJS_NOTRUNNING) ||
+             (run.waveNumber <= 0))
+        result = (run.jobStatus == DSJS_RUNNING) ? "running" : "not run";
+    else if (!histJobHash(server, project, job, &hash))
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        status = DSJE_DSJOB_ERROR;
+        result = "error";
+    }
+    else
+    {
+        HISTRECORD *record = NULL;
+        while ((record = nextHistRecord(view, record)) != NULL)
+            if ((record->waveNumber == run.waveNumber) &&
+                    (record->startTime == (unsigned int) run.startTime) &&
+                    isHistJob(record, hash, server, project, job))
+                break;
+        if (record != NULL)
+            result = "already recorded";
+        else if ((status = recordRun(hJob, project, job, &run)) != DSJE_NOERROR)
+            result = "error";
+    }
+    if (status != DSJE_NOERROR)
+        outNullField(&stdoutBuf, "waveNumber", NULL, "-", 1);
+    else
+        outIntField(&stdoutBuf, "waveNumber", NULL, run.waveNumber);
+    outStrField(&stdoutBuf, "result", NULL, result);
+    outEndRecord(&stdoutBuf);
+    (void) closeJob(hJob);
+    return status;
+}
+
+static int jobHarvest(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSPROJECTINFO pInfo;
+    FILEVIEW view;
+    int status = DSJE_NOERROR;
+    int i;
+    /* Must be at least one parameter... the project */
+    if (argc < 1)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -harvest <project> [<job>...]\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    if (!mapHistory(&view))
+    {
+        unmapFile(&view);
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Attempt to open the project */
+    if ((hProject = openProject(argv[0], &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        outText(&stdoutBuf, "Job\tWave\tResult\n");
+        if (argc > 1)
+        {
+            for (i = 1; i < argc; i++)
+            {
+                int jobStatus = harvestJob(hProject, argv[0], argv[i], &view);
+                if (status == DSJE_NOERROR)
+                    status = jobStatus;
+            }
+        }
+        else if ((status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &pInfo)) == DSJE_NOT_AVAILABLE)
+            status = DSJE_NOERROR;
+        else if (status != DSJE_NOERROR)
+            fprintf(stderr, "Error %d getting job list\n", status);
+        else
+        {
+            /* Keep a copy of the list, as the calls below may reuse it */
+            char *jobList;
+            char *job;
+            for (job = pInfo.info.jobList; *job != '\0'; job += strlen(job) + 1)
+                ;
+            if ((jobList = malloc(job - pInfo.info.jobList + 1)) == NULL)
+            {
+                fprintf(stderr, "ERROR: Out of memory\n");
+                status = DSJE_DSJOB_ERROR;
+            }
+            else
+            {
+                memcpy(jobList, pInfo.info.jobList, job - pInfo.info.jobList + 1);
+                for (job = jobList; *job != '\0'; job += strlen(job) + 1)
+                {
+                    int jobStatus = harvestJob(hProject, argv[0], job, &view);
+                    if (status == DSJE_NOERROR)
+                        status = jobStatus;
+                }
+                free(jobList);
+            }
+        }
+        (void) closeProject(hProject);
+    }
+    unmapFile(&view);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -perfreport sub-command
+ *
+ * For each job in the history, work out the percentiles of how long its
+ * runs took and how many rows they moved, and report its latest runs. A
+ * run is flagged when it lies outside the Tukey fences of the job's runs
+ * (more than 1.5 times the interquartile range beyond the quartiles) and
+ * is also more than HIST_MARGIN percent away from the median, so that
+ * jobs that always take the same time are not flagged for a second. Jobs
+ * with fewer than HIST_MIN_RUNS runs are reported but not flagged.
+ */
+#define HIST_MIN_RUNS   5
+#define HIST_MARGIN     10
+#define DEFAULT_REPORT_RUNS 10
+
+static const char perfReportColumns[] =
+    "project,job,waveNumber,startTime,seconds,rows,jobStatus,jobStatusCode,flag,"
+    "runs,p50Seconds,p90Seconds,p99Seconds,p50Rows";
+
+/*
+ * Order records by server, project and job name.
+ */
+static int compareHistJobs(
+    HISTRECORD *ra,
+    HISTRECORD *rb
+)
+{
+    char *na = histNames(ra);
+    char *nb = histNames(rb);
+    int i;
+    int diff;
+    for (i = 0; i < 3; i++, na = nextName(na), nb = nextName(nb))
+        if ((diff = strcmp(na, nb)) != 0)
+            return diff;
+    return 0;
+}
+
+/*
+ * Order records by job and then by start time, for qsort().
+ */
+static int compareHistRecords(
+    const void *a,
+    const void *b
+)
+{
+    HISTRECORD *ra = *(HISTRECORD **) a;
+    HISTRECORD *rb = *(HISTRECORD **) b;
+    int diff = compareHistJobs(ra, rb);
+    if (diff != 0)
+        return diff;
+    return (ra->startTime < rb->startTime) ? -1 : (ra->startTime > rb->startTime);
+}
+
+static int compareDoubles(
+    const void *a,
+    const void *b
+)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+    return (da < db) ? -1 : (da > db);
+}
+
+/*
+ * The nearest-rank percentile of a sorted array.
+ */
+static double percentile(
+    double *sorted,
+    int n,
+    int pct                     /* Percentile, 1 to 100 */
+)
+{
+    int rank = (int) ((pct * (long) n + 99) / 100);
+    return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+/*
+ * Decide whether a value lies outside a sorted distribution: returns 1 if
+ * it is high, -1 if it is low, otherwise 0.
+ */
+static int outlier(
+    double *sorted,
+    int n,
+    double value
+)
+{
+    double q1 = percentile(sorted, n, 25);
+    double q3 = percentile(sorted, n, 75);
+    double median = percentile(sorted, n, 50);
+    double margin = median * HIST_MARGIN / 100;
+    if (n < HIST_MIN_RUNS)
+        return 0;
+    if ((value > q3 + 1.5 * (q3 - q1)) && (value > median + margin))
+        return 1;
+    if ((value < q1 - 1.5 * (q3 - q1)) && (value < median - margin))
+        return -1;
+    return 0;
+}
+
+/*
+ * The total rows moved by a run, counting each link once.
+ */
+static double histRows(
+    HISTRECORD *record
+)
+{
+    int *rows = (int *) (record + 1);
+    double total = 0.0;
+    int i;
+    for (i = 0; i < record->nLinks; i++)
+        if (rows[i] > 0)
+            total += rows[i];
+    return total;
+}
+
+/*
+ * Report on the runs of one job, records[0] to records[n-1].
+ */
+static void reportJob(
+    HISTRECORD **records,       /* The job's runs, oldest first */
+    int n,
+    int nReport,                /* How many of the latest runs to list */
+    double *seconds,            /* Work space for n values */
+    double *rows                /* Work space for n values */
+)
+{
+    char *project = nextName(histNames(records[0]));
+    char *job = nextName(project);
+    char text[256];             /* Big enough for the heading */
+    char p50Seconds[32];
+    char p90Seconds[32];
+    char p99Seconds[32];
+    char p50Rows[32];
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        seconds[i] = (double) records[i]->endTime - (double) records[i]->startTime;
+        rows[i] = histRows(records[i]);
+    }
+    qsort(seconds, n, sizeof(double), compareDoubles);
+    qsort(rows, n, sizeof(double), compareDoubles);
+    sprintf(p50Seconds, "%.0f", percentile(seconds, n, 50));
+    sprintf(p90Seconds, "%.0f", percentile(seconds, n, 90));
+    sprintf(p99Seconds, "%.0f", percentile(seconds, n, 99));
+    sprintf(p50Rows, "%.0f", percentile(rows, n, 50));
+    if (outputFormat == FORMAT_TEXT)
+    {
+        outStr(&stdoutBuf, project);
+        outChar(&stdoutBuf, '/');
+        outStr(&stdoutBuf, job);
+        snprintf(text, sizeof(text), ": %d runs, seconds p50 %s p90 %s p99 %s, rows p50 %s\n",
+                 n, p50Seconds, p90Seconds, p99Seconds, p50Rows);
+        outStr(&stdoutBuf, text);
+        outStr(&stdoutBuf, "Wave\tStart Time\tSeconds\tRows\tJob Status\tFlag\n");
+    }
+    for (i = (n > nReport) ? n - nReport : 0; i < n; i++)
+    {
+        HISTRECORD *record = records[i];
+        double runSeconds = (double) record->endTime - (double) record->startTime;
+        double runRows = histRows(record);
+        int slow = outlier(seconds, n, runSeconds);
+        int more = outlier(rows, n, runRows);
+        outBeginRecord(&stdoutBuf, perfReportColumns);
+        if (outputFormat != FORMAT_TEXT)
+        {
+            /* Text mode shows these in the heading instead */
+            outStrField(&stdoutBuf, "project", NULL, project);
+            outStrField(&stdoutBuf, "job", NULL, job);
+        }
+        outIntField(&stdoutBuf, "waveNumber", NULL, record->waveNumber);
+        formatTime(text, (time_t) record->startTime);
+        outStrField(&stdoutBuf, "startTime", NULL, text);
+        sprintf(text, "%.0f", runSeconds);
+        outNumberField(&stdoutBuf, "seconds", NULL, text);
+        sprintf(text, "%.0f", runRows);
+        outNumberField(&stdoutBuf, "rows", NULL, text);
+        outCodeField(&stdoutBuf, "jobStatus", NULL, jobStatusName(record->jobStatus),
+                     record->jobStatus);
+        if ((slow == 0) && (more == 0))
+            outNullField(&stdoutBuf, "flag", NULL, "", 1);
+        else
+        {
+            sprintf(text, "%s%s%s", (slow > 0) ? "SLOW" : (slow < 0) ? "FAST" : "",
+                    ((slow != 0) && (more != 0)) ? " " : "",
+                    (more > 0) ? "MORE ROWS" : (more < 0) ? "FEWER ROWS" : "");
+            outStrField(&stdoutBuf, "flag", NULL, text);
+        }
+        if (outputFormat != FORMAT_TEXT)
+        {
+            outIntField(&stdoutBuf, "runs", NULL, n);
+            outNumberField(&stdoutBuf, "p50Seconds", NULL, p50Seconds);
+            outNumberField(&stdoutBuf, "p90Seconds", NULL, p90Seconds);
+            outNumberField(&stdoutBuf, "p99Seconds", NULL, p99Seconds);
+            outNumberField(&stdoutBuf, "p50Rows", NULL, p50Rows);
+        }
+        outEndRecord(&stdoutBuf);
+    }
+    outText(&stdoutBuf, "\n");
+}
+
+static int jobPerfReport(int argc, char *argv[])
+{
+    FILEVIEW view;
+    HISTRECORD *record = NULL;
+    HISTRECORD **records = NULL;
+    double *work = NULL;
+    char *server = (serverName != NULL) ? serverName : "";
+    char *project = NULL;
+    char *job = NULL;
+    int nRecords = 0;
+    int maxRecords = 0;
+    int nReport = DEFAULT_REPORT_RUNS;
+    int status = DSJE_NOERROR;
+    int i;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        if ((strcmp(opt, "runs") == 0) && (i + 1 < argc))
+        {
+            if ((nReport = atoi(argv[++i])) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* May be a project and a job left */
+    if (badOptions || (i + 2 < argc))
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -perfreport\n");
+        fprintf(stderr, "\t\t\t[-runs <n>]\n");
+        fprintf(stderr, "\t\t\t[<project> [<job>]]\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    if (i < argc)
+        project = argv[i];
+    if (i + 1 < argc)
+        job = argv[i + 1];
+    if (!mapHistory(&view))
+    {
+        unmapFile(&view);
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Pick out the records we want */
+    while ((record = nextHistRecord(&view, record)) != NULL)
+    {
+        char *name = histNames(record);
+        if ((strcmp(name, server) != 0) ||
+                ((project != NULL) && (strcmp(nextName(name), project) != 0)) ||
+                ((job != NULL) && (strcmp(nextName(nextName(name)), job) != 0)))
+            continue;
+        if (nRecords == maxRecords)
+        {
+            HISTRECORD **bigger = realloc(records, (maxRecords + 1024) * sizeof(HISTRECORD *));
+            if (bigger == NULL)
+            {
+                status = DSJE_DSJOB_ERROR;
+                break;
+            }
+            records = bigger;
+            maxRecords += 1024;
+        }
+        records[nRecords++] = record;
+    }
+    if ((status == DSJE_NOERROR) && (nRecords > 0) &&
+            ((work = malloc(2 * nRecords * sizeof(double))) == NULL))
+        status = DSJE_DSJOB_ERROR;
+    if (status != DSJE_NOERROR)
+        fprintf(stderr, "ERROR: Out of memory\n");
+    else if (nRecords == 0)
+        outText(&stdoutBuf, "<none>\n");
+    else
+    {
+        int first = 0;
+        qsort(records, nRecords, sizeof(HISTRECORD *), compareHistRecords);
+        for (i = 1; i <= nRecords; i++)
+        {
+            /* Report each run of records for the same job */
+            if ((i == nRecords) || (compareHistJobs(records[first], records[i]) != 0))
+            {
+                reportJob(records + first, i - first, nReport, work, work + nRecords);
+                first = i;
+            }
+        }
+    }
+    free(work);
+    free(records);
+    unmapFile(&view);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -lparams sub-command
+ */
+static int jobLParams(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    char *project;
+    char *job;
+    DSJOBINFO jobInfo;
+    /* Validate arguments and extract optional arguments */
+    /* Must be two parameters left... project and job names */
+    if (argc != 2)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -lparams <project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    project = argv[0];
+    job = argv[1];
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /* Get the list of parameter names */
+            status = metaGetJobInfo(hJob, project, job, DSJ_PARAMLIST, &jobInfo);
+            if (status == DSJE_NOT_AVAILABLE)
+            {
+                outText(&stdoutBuf, "<none>\n");
+                status = DSJE_NOERROR;
+            }
+            else if (status != DSJE_NOERROR)
+                fprintf(stderr, "Error %d getting parameter list\n", status);
+            else
+                outListRecords(&stdoutBuf, "param", jobInfo.info.paramList);
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -paraminfo sub-command
+ */
+static const char paramInfoColumns[] =
+    "type,typeCode,helpText,prompt,promptAtRun,defaultValue,originalDefault,"
+    "listValues,originalList";
+
+static const CODENAME paramTypeNames[] =
+{
+    { DSJ_PARAMTYPE_STRING,     "String" },
+    { DSJ_PARAMTYPE_ENCRYPTED,  "Encrypted" },
+    { DSJ_PARAMTYPE_INTEGER,    "Integer" },
+    { DSJ_PARAMTYPE_FLOAT,      "Float" },
+    { DSJ_PARAMTYPE_PATHNAME,   "Pathname" },
+    { DSJ_PARAMTYPE_LIST,       "list" },
+    { DSJ_PARAMTYPE_DATE,       "Date" },
+    { DSJ_PARAMTYPE_TIME,       "Time" }
+};
+
+static char *paramTypeName(
+    int paramType               /* DSJ_PARAMTYPE_xxx code */
+)
+{
+    return codeName(paramTypeNames, N_CODES(paramTypeNames), paramType,
+                    "*** ERROR - UNKNOWN TYPE ***");
+}
+
+static void writeValueField(
+    OUTBUF *buf,                /* Buffer to write to */
+    const char *key,            /* Field name */
+    const char *label,          /* Text label */
+    DSPARAM *param              /* The value */
+)
+{
+    char number[32];
+    switch(param->paramType)
+    {
+    case DSJ_PARAMTYPE_STRING:
+        outStrField(buf, key, label, param->paramValue.pString);
+        break;
+    case DSJ_PARAMTYPE_ENCRYPTED:
+        outStrField(buf, key, label, param->paramValue.pEncrypt);
+        break;
+    case DSJ_PARAMTYPE_INTEGER:
+        outIntField(buf, key, label, param->paramValue.pInt);
+        break;
+    case DSJ_PARAMTYPE_FLOAT:
+        sprintf(number, "%G", param->paramValue.pFloat);
+        outNumberField(buf, key, label, number);
+        break;
+    case DSJ_PARAMTYPE_PATHNAME:
+        outStrField(buf, key, label, param->paramValue.pPath);
+        break;
+    case DSJ_PARAMTYPE_LIST:
+        outStrField(buf, key, label, param->paramValue.pListValue);
+        break;
+    case DSJ_PARAMTYPE_DATE:
+        outStrField(buf, key, label, param->paramValue.pDate);
+        break;
+    case DSJ_PARAMTYPE_TIME:
+        outStrField(buf, key, label, param->paramValue.pTime);
+        break;
+    default:
+        outNullField(buf, key, label, "", 1);
+        break;
+    }
+}
+
+/*
+ * Write the fields of a parameter's information, as listed in
+ * paramInfoColumns.
+ */
+static void writeParamInfo(
+    OUTBUF *buf,                /* Buffer to write to */
+    DSPARAMINFO *paramInfo      /* The information */
+)
+{
+    outCodeField(buf, "type", "Type\t\t: ",
+            paramTypeName(paramInfo->paramType), paramInfo->paramType);
+    outStrField(buf, "helpText", "Help Text\t: ", paramInfo->helpText);
+    outStrField(buf, "prompt", "Prompt\t\t: ", paramInfo->paramPrompt);
+    outIntField(buf, "promptAtRun", "Prompt At Run\t: ", paramInfo->promptAtRun);
+    writeValueField(buf, "defaultValue", "Default Value\t: ",
+            &(paramInfo->defaultValue));
+    writeValueField(buf, "originalDefault", "Original Default: ",
+            &(paramInfo->desDefaultValue));
+    if (paramInfo->paramType == DSJ_PARAMTYPE_LIST)
+    {
+        outListField(buf, "listValues", "List Values\t:\n", 2,
+                paramInfo->listValues);
+        outListField(buf, "originalList", "Original List\t:\n", 2,
+                paramInfo->desListValues);
+    }
+    else
+    {
+        outNullField(buf, "listValues", NULL, NULL, 1);
+        outNullField(buf, "originalList", NULL, NULL, 1);
+    }
+}
+
+static int jobParamInfo(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    char *project;
+    char *job;
+    char *param;
+    DSPARAMINFO paramInfo;
+    /* Validate arguments and extract optional arguments */
+    /* Must be three parameters left... project, job and parameter names */
+    if (argc != 3)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -paraminfo <project> <job> <param>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    project = argv[0];
+    job = argv[1];
+    param = argv[2];
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /* Get the parameter information */
+            status = metaGetParamInfo(hJob, project, job, param, &paramInfo);
+            if (status != DSJE_NOERROR)
+                fprintf(stderr, "Error %d getting info for parameter\n", status);
+            else
+            {
+                outBeginRecord(&stdoutBuf, paramInfoColumns);
+                writeParamInfo(&stdoutBuf, &paramInfo);
+                outText(&stdoutBuf, "\n");
+                outEndRecord(&stdoutBuf);
+            }
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Configuration snapshots: -snapshot and -verify.
+ *
+ * -snapshot writes the configuration of every job in a project (or of the
+ * jobs named) to a file: the parameter list with the type and default of
+ * each parameter, the stage list, and an FNV-1a hash of each. -verify then
+ * compares a project against the file and writes a record for each
+ * difference, so that a pre-flight check can confirm that nothing has
+ * moved from an approved baseline.
+ *
+ * The API has no compile counter, so, as in the metadata cache, the job's
+ * wave number stands in for one: a job whose wave number is still the one
+ * in the file is taken to be unchanged, which costs two calls. A compile
+ * doesn't move the wave number, but it does leave the job not running
+ * until its next run, so a job with that status is read again whatever its
+ * wave. Only the jobs whose wave has moved, or that may have been compiled
+ * since, are read again and hashed, and only those whose hashes differ are
+ * compared item by item. -verify -refresh records the new wave number of
+ * each job that was read again and still matched, so that the next check
+ * can skip it too. The wave number means nothing on another server or in
+ * another project, so there every job is read.
+ *
+ * The lists are read from the server rather than the metadata cache, which
+ * trusts the same wave number and so could hand back what a baseline is
+ * meant to catch.
+ *
+ * The file is a version line, then "server", "project" and "scope" lines
+ * (the scope being "all" if it holds every job in the project), then for
+ * each job a "job" line with its name, wave number and hashes, followed by
+ * a "param" line with the name, type and default of each parameter and a
+ * "stage" line for each stage. Fields are separated by tabs, escaped as in
+ * the metadata cache. The jobs are read by a pool of workers.
+ */
+#define SNAPSHOT_VERSION "dsjob snapshot 1"
+
+typedef struct JOBCONFIG
+{
+    int waveNumber;
+    unsigned long paramHash;    /* Hash of params */
+    unsigned long stageHash;    /* Hash of stages */
+    char *params;               /* Name, type and default of each parameter, then a NUL */
+    char *stages;               /* Stage list */
+} JOBCONFIG;
+
+/* What -verify found */
+#define SNAP_UNCHANGED  0       /* Wave number has not moved, not compiled */
+#define SNAP_MATCHED    1       /* Read again, and the same */
+#define SNAP_CHANGED    2       /* Read again, and different */
+#define SNAP_REMOVED    3       /* No longer in the project */
+#define SNAP_ADDED      4       /* Not in the snapshot */
+
+typedef struct SNAPJOB
+{
+    char *job;                  /* Job name */
+    int status;                 /* Error reading the job */
+    int state;                  /* SNAP_xxx */
+    JOBCONFIG snapshot;         /* As in the file, or as read by -snapshot */
+    JOBCONFIG current;          /* As read by -verify */
+} SNAPJOB;
+
+typedef struct SNAPSHOT
+{
+    char *project;              /* Project being read */
+    char *fileServer;           /* Server and project in the file */
+    char *fileProject;
+    BOOL allJobs;               /* File holds every job in the project */
+    BOOL verify;                /* -verify rather than -snapshot */
+    BOOL trustWave;             /* Wave numbers in the file apply */
+    SNAPJOB *jobs;
+    int nJobs;
+    volatile LONG nextJob;      /* Next job to be claimed */
+} SNAPSHOT;
+
+static const char snapshotColumns[] = "job,waveNumber,parameters,stages,paramHash,stageHash";
+static const char verifyColumns[] = "job,difference,name,snapshot,current";
+
+/*
+ * Return a malloc'ed copy of a string list, or NULL if out of memory.
+ */
+static char *copyList(
+    const char *list            /* List to copy */
+)
+{
+    const char *str;
+    char *copy;
+    for (str = list; *str != '\0'; str += strlen(str) + 1)
+        ;
+    if ((copy = malloc(str - list + 1)) != NULL)
+        memcpy(copy, list, str - list + 1);
+    return copy;
+}
+
+/*
+ * The length of a string list, including the NUL that ends it.
+ */
+static size_t listSize(
+    const char *list
+)
+{
+    const char *str;
+    for (str = list; *str != '\0'; str += strlen(str) + 1)
+        ;
+    return str - list + 1;
+}
+
+static void freeJobConfig(
+    JOBCONFIG *config
+)
+{
+    free(config->params);
+    free(config->stages);
+    config->params = config->stages = NULL;
+}
+
+/*
+ * Get a copy of the stage list or parameter list of a job, which is an
+ * empty list if it has none.
+ */
+static int getConfigList(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job,
+    int infoType,               /* DSJ_STAGELIST or DSJ_PARAMLIST */
+    BOOL fresh,                 /* Bypass the metadata cache */
+    char **list                 /* Returned list, malloc'ed */
+)
+{
+    DSJOBINFO jobInfo;
+    int status = fresh ? DSGetJobInfo(hJob, infoType, &jobInfo) :
+                         metaGetJobInfo(hJob, project, job, infoType, &jobInfo);
+    *list = NULL;
+    if (status == DSJE_NOT_AVAILABLE)
+    {
+        *list = copyList("");
+        status = DSJE_NOERROR;
+    }
+    else if (status == DSJE_NOERROR)
+        *list = copyList((infoType == DSJ_STAGELIST) ? jobInfo.info.stageList : jobInfo.info.paramList);
+    if ((status == DSJE_NOERROR) && (*list == NULL))
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        status = DSJE_DSJOB_ERROR;
+    }
+    return status;
+}
+
+/*
+ * Read the configuration of a job, whose wave number has been filled in,
+ * from the server.
+ */
+static int readJobConfig(
+    DSJOB hJob,                 /* Open job */
+    char *project,              /* Project and job names */
+    char *job,
+    JOBCONFIG *config           /* Returned configuration */
+)
+{
+    OUTBUF params = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    DSPARAMINFO paramInfo;
+    char number[32];
+    char *paramList;
+    char *param;
+    char *value;
+    int status;
+    if ((status = getConfigList(hJob, project, job, DSJ_PARAMLIST, TRUE, &paramList)) != DSJE_NOERROR)
+        return status;
+    for (param = paramList; (*param != '\0') && (status == DSJE_NOERROR); param += strlen(param) + 1)
+    {
+        if ((status = DSGetParamInfo(hJob, param, &paramInfo)) != DSJE_NOERROR)
+            break;
+        outMem(&params, param, strlen(param) + 1);
+        outInt(&params, paramInfo.paramType);
+        outChar(&params, '\0');
+        value = paramValueText(&(paramInfo.defaultValue), number);
+        outMem(&params, value, strlen(value) + 1);
+    }
+    outChar(&params, '\0');
+    free(paramList);
+    if (status == DSJE_NOERROR)
+        status = getConfigList(hJob, project, job, DSJ_STAGELIST, TRUE, &(config->stages));
+    if ((status == DSJE_NOERROR) && (params.data == NULL))
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        status = DSJE_DSJOB_ERROR;
+    }
+    if (status != DSJE_NOERROR)
+    {
+        free(params.data);
+        freeJobConfig(config);
+        return status;
+    }
+    config->params = params.data;
+    config->paramHash = fnvHashBytes(config->params, params.len);
+    config->stageHash = fnvHashBytes(config->stages, listSize(config->stages));
+    return DSJE_NOERROR;
+}
+
+static void snapshotWorker(
+    WORKER *worker              /* Calling worker */
+)
+{
+    SNAPSHOT *snap = worker->context;
+    DSJOBINFO jobInfo;
+    LONG i;
+    while ((i = InterlockedIncrement(&(snap->nextJob)) - 1) < snap->nJobs)
+    {
+        SNAPJOB *sj = &(snap->jobs[i]);
+        JOBCONFIG *config = snap->verify ? &(sj->current) : &(sj->snapshot);
+        DSJOB hJob;
+        if ((sj->state == SNAP_REMOVED) || (sj->state == SNAP_ADDED))
+            continue;
+        if ((hJob = workerJob(worker, snap->project, sj->job, &(sj->status))) == NULL)
+            continue;
+        sj->status = DSGetJobInfo(hJob, DSJ_JOBWAVENO, &jobInfo);
+        if (sj->status == DSJE_NOERROR)
+        {
+            config->waveNumber = jobInfo.info.jobWaveNumber;
+            if (snap->verify && snap->trustWave &&
+                    (config->waveNumber == sj->snapshot.waveNumber) &&
+                    (DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo) == DSJE_NOERROR) &&
+                    (jobInfo.info.jobStatus != DSJS_NOTRUNNING))
+                sj->state = SNAP_UNCHANGED;
+            else
+                sj->status = readJobConfig(hJob, snap->project, sj->job, config);
+            if (snap->verify && (sj->status == DSJE_NOERROR) && (config->params != NULL))
+                sj->state = ((config->paramHash == sj->snapshot.paramHash) &&
+                             (config->stageHash == sj->snapshot.stageHash)) ? SNAP_MATCHED : SNAP_CHANGED;
+        }
+        (void) DSCloseJob(hJob);
+    }
+}
+
+static void freeSnapshot(
+    SNAPSHOT *snap
+)
+{
+    int i;
+    for (i = 0; i < snap->nJobs; i++)
+    {
+        free(snap->jobs[i].job);
+        freeJobConfig(&(snap->jobs[i].snapshot));
+        freeJobConfig(&(snap->jobs[i].current));
+    }
+    free(snap->jobs);
+    free(snap->fileServer);
+    free(snap->fileProject);
+}
+
+/*
+ * Add a job to a snapshot. Returns NULL if out of memory.
+ */
+static SNAPJOB *addSnapJob(
+    SNAPSHOT *snap,
+    char *job,                  /* Job name */
+    int *maxJobs                /* Size of snap->jobs */
+)
+{
+    SNAPJOB *sj;
+    if (snap->nJobs == *maxJobs)
+    {
+        SNAPJOB *bigger = realloc(snap->jobs, (*maxJobs + 256) * sizeof(SNAPJOB));
+        if (bigger == NULL)
+            return NULL;
+        snap->jobs = bigger;
+        *maxJobs += 256;
+    }
+    sj = &(snap->jobs[snap->nJobs]);
+    memset(sj, 0, sizeof(SNAPJOB));
+    if ((sj->job = copyString(job)) == NULL)
+        return NULL;
+    snap->nJobs++;
+    return sj;
+}
+
+/*
+ * Split a line of a snapshot file into its fields in place, returning how
+ * many there are.
+ */
+static int splitSnapLine(
+    char *line,                 /* Line to split */
+    char **field,               /* Returned fields */
+    int maxFields
+)
+{
+    int n = 0;
+    while ((line != NULL) && (n < maxFields))
+    {
+        field[n] = line;
+        if ((line = strchr(line, '\t')) != NULL)
+            *line++ = '\0';
+        unescapeField(field[n++]);
+    }
+    return n;
+}
+
+/*
+ * Read a snapshot file. Returns FALSE, having said why, if it can't be
+ * read.
+ */
+static BOOL readSnapshot(
+    char *fileName,             /* File to read */
+    SNAPSHOT *snap              /* Snapshot to fill in */
+)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t size = 0;
+    char *field[5];
+    OUTBUF params = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    OUTBUF stages = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    SNAPJOB *sj = NULL;
+    int maxJobs = 0;
+    int n;
+    BOOL valid;
+    if ((fp = fopen(fileName, "r")) == NULL)
+    {
+        fprintf(stderr, "ERROR: Cannot open snapshot file '%s'\n", fileName);
+        return FALSE;
+    }
+    valid = readLine(fp, &line, &size) && (strcmp(line, SNAPSHOT_VERSION) == 0);
+    while (valid)
+    {
+        BOOL more = readLine(fp, &line, &size);
+        n = more ? splitSnapLine(line, field, 5) : 0;
+        if ((sj != NULL) && (!more || (strcmp(field[0], "job") == 0)))
+        {
+            /* That's the end of the job before */
+            outChar(&params, '\0');
+            outChar(&stages, '\0');
+            sj->snapshot.params = params.data;
+            sj->snapshot.stages = stages.data;
+            valid = (params.data != NULL) && (stages.data != NULL);
+            params.data = stages.data = NULL;
+            params.len = params.size = stages.len = stages.size = 0;
+            sj = NULL;
+        }
+        if (!more || !valid)
+            break;
+        if ((n == 2) && (strcmp(field[0], "server") == 0))
+            valid = ((snap->fileServer = copyString(field[1])) != NULL);
+        else if ((n == 2) && (strcmp(field[0], "project") == 0))
+            valid = ((snap->fileProject = copyString(field[1])) != NULL);
+        else if ((n == 2) && (strcmp(field[0], "scope") == 0))
+            snap->allJobs = (strcmp(field[1], "all") == 0);
+        else if ((n == 5) && (strcmp(field[0], "job") == 0))
+        {
+            if ((valid = ((sj = addSnapJob(snap, field[1], &maxJobs)) != NULL)) != FALSE)
+            {
+                sj->snapshot.waveNumber = atoi(field[2]);
+                sj->snapshot.paramHash = strtoul(field[3], NULL, 16);
+                sj->snapshot.stageHash = strtoul(field[4], NULL, 16);
+            }
+        }
+        else if ((n == 4) && (strcmp(field[0], "param") == 0) && (sj != NULL))
+        {
+            outMem(&params, field[1], strlen(field[1]) + 1);
+            outMem(&params, field[2], strlen(field[2]) + 1);
+            outMem(&params, field[3], strlen(field[3]) + 1);
+        }
+        else if ((n == 2) && (strcmp(field[0], "stage") == 0) && (sj != NULL))
+            outMem(&stages, field[1], strlen(field[1]) + 1);
+        else
+            valid = FALSE;
+    }
+    free(params.data);
+    free(stages.data);
+    free(line);
+    fclose(fp);
+    if (!valid || (snap->fileServer == NULL) || (snap->fileProject == NULL))
+    {
+        fprintf(stderr, "ERROR: '%s' is not a snapshot file\n", fileName);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Write a snapshot file, by way of a temporary file so that a reader never
+ * sees half a file. Returns FALSE, having said why, if it can't be written.
+ */
+static BOOL writeSnapshot(
+    char *fileName,             /* File to write */
+    SNAPSHOT *snap              /* What to write */
+)
+{
+    char tempName[MAX_PATH + 32];
+    FILE *fp;
+    char *str;
+    int i;
+    sprintf(tempName, "%.*s.%lu", MAX_PATH, fileName, (unsigned long) GetCurrentProcessId());
+    if ((fp = fopen(tempName, "w")) == NULL)
+    {
+        fprintf(stderr, "ERROR: Cannot create snapshot file '%s'\n", fileName);
+        return FALSE;
+    }
+    fprintf(fp, "%s\nserver\t", SNAPSHOT_VERSION);
+    writeEscaped(fp, snap->fileServer);
+    fputs("\nproject\t", fp);
+    writeEscaped(fp, snap->fileProject);
+    fprintf(fp, "\nscope\t%s\n", snap->allJobs ? "all" : "jobs");
+    for (i = 0; i < snap->nJobs; i++)
+    {
+        JOBCONFIG *config = &(snap->jobs[i].snapshot);
+        if (config->params == NULL)
+            continue;
+        fputs("job\t", fp);
+        writeEscaped(fp, snap->jobs[i].job);
+        fprintf(fp, "\t%d\t%08lx\t%08lx\n", config->waveNumber, config->paramHash, config->stageHash);
+        for (str = config->params; *str != '\0'; )
+        {
+            int j;
+            fputs("param", fp);
+            for (j = 0; j < 3; j++, str += strlen(str) + 1)
+            {
+                putc('\t', fp);
+                writeEscaped(fp, str);
+            }
+            putc('\n', fp);
+        }
+        for (str = config->stages; *str != '\0'; str += strlen(str) + 1)
+        {
+            fputs("stage\t", fp);
+            writeEscaped(fp, str);
+            putc('\n', fp);
+        }
+    }
+    if ((fclose(fp) != 0) || !MoveFileExA(tempName, fileName, MOVEFILE_REPLACE_EXISTING))
+    {
+        fprintf(stderr, "ERROR: Cannot write snapshot file '%s'\n", fileName);
+        (void) DeleteFileA(tempName);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Get the project's job list, mark the jobs already in the snapshot that
+ * are no longer in the project and, if the snapshot is of the whole
+ * project, add the jobs it doesn't have. Returns the status of the call.
+ */
+static int listSnapJobs(
+    DSPROJECT hProject,         /* Open project */
+    SNAPSHOT *snap
+)
+{
+    DSPROJECTINFO pInfo;
+    char *str;
+    int nSnapJobs = snap->nJobs;
+    int maxJobs = snap->nJobs;
+    int status;
+    int i;
+    status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &pInfo);
+    if (status == DSJE_NOT_AVAILABLE)
+    {
+        pInfo.info.jobList = "";
+        status = DSJE_NOERROR;
+    }
+    if (status != DSJE_NOERROR)
+    {
+        fprintf(stderr, "Error %d getting job list\n", status);
+        return status;
+    }
+    for (i = 0; i < nSnapJobs; i++)
+    {
+        for (str = pInfo.info.jobList; *str != '\0'; str += strlen(str) + 1)
+            if (strcmp(str, snap->jobs[i].job) == 0)
+                break;
+        if (*str == '\0')
+            snap->jobs[i].state = SNAP_REMOVED;
+    }
+    if (!snap->allJobs)
+        return DSJE_NOERROR;
+    for (str = pInfo.info.jobList; *str != '\0'; str += strlen(str) + 1)
+    {
+        SNAPJOB *sj;
+        for (i = 0; i < nSnapJobs; i++)
+            if (strcmp(str, snap->jobs[i].job) == 0)
+                break;
+        if (i < nSnapJobs)
+            continue;
+        if ((sj = addSnapJob(snap, str, &maxJobs)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            return DSJE_DSJOB_ERROR;
+        }
+        sj->state = snap->verify ? SNAP_ADDED : SNAP_UNCHANGED;
+    }
+    return DSJE_NOERROR;
+}
+
+/*
+ * Open the project and read the jobs. Returns the first error.
+ */
+static int readSnapJobs(
+    SNAPSHOT *snap,
+    int nThreads                /* Number of workers */
+)
+{
+    DSPROJECT hProject;
+    int status;
+    int i;
+    if ((hProject = openProject(snap->project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+        return status;
+    }
+    status = listSnapJobs(hProject, snap);
+    (void) closeProject(hProject);
+    if (status != DSJE_NOERROR)
+        return status;
+    if (nThreads > snap->nJobs)
+        nThreads = snap->nJobs;
+    if (nThreads > 0)
+        runWorkers(nThreads, snapshotWorker, snap);
+    for (i = 0; i < snap->nJobs; i++)
+    {
+        SNAPJOB *sj = &(snap->jobs[i]);
+        if ((sj->status != DSJE_NOERROR) && (status == DSJE_NOERROR))
+            status = sj->status;
+        if (sj->status != DSJE_NOERROR)
+            fprintf(stderr, "Error %d reading job '%s'\n", sj->status, sj->job);
+        else if (!snap->verify && (sj->state == SNAP_REMOVED))
+        {
+            fprintf(stderr, "ERROR: Job '%s' is not in the project\n", sj->job);
+            status = DSJE_DSJOB_ERROR;
+        }
+    }
+    return status;
+}
+
+static int jobSnapshot(int argc, char *argv[])
+{
+    SNAPSHOT snap;
+    char *fileName;
+    char hash[16];
+    char *str;
+    int nThreads = DEFAULT_THREADS;
+    int maxJobs = 0;
+    int status = DSJE_NOERROR;
+    int i;
+    int j;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "threads") == 0)
+        {
+            if ((nThreads = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be at least two parameters left... project and file name */
+    if (badOptions || (i + 2 > argc))
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -snapshot [-threads <n>] <project> <snapshot file> [<job>...]\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    memset(&snap, 0, sizeof(snap));
+    snap.project = argv[i];
+    fileName = argv[i + 1];
+    snap.allJobs = (i + 2 == argc);
+    snap.fileServer = copyString((serverName != NULL) ? serverName : "");
+    snap.fileProject = copyString(snap.project);
+    for (j = i + 2; (j < argc) && (status == DSJE_NOERROR); j++)
+        if (addSnapJob(&snap, argv[j], &maxJobs) == NULL)
+            status = DSJE_DSJOB_ERROR;
+    if ((snap.fileServer == NULL) || (snap.fileProject == NULL) || (status != DSJE_NOERROR))
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        freeSnapshot(&snap);
+        return DSJE_DSJOB_ERROR;
+    }
+    if (((status = readSnapJobs(&snap, nThreads)) == DSJE_NOERROR) && !writeSnapshot(fileName, &snap))
+        status = DSJE_DSJOB_ERROR;
+    if (status == DSJE_NOERROR)
+    {
+        outText(&stdoutBuf, "Job\tWave\tParameters\tStages\tParameter Hash\tStage Hash\n");
+        for (i = 0; i < snap.nJobs; i++)
+        {
+            JOBCONFIG *config = &(snap.jobs[i].snapshot);
+            int n = 0;
+            outBeginRecord(&stdoutBuf, snapshotColumns);
+            outStrField(&stdoutBuf, "job", NULL, snap.jobs[i].job);
+            outIntField(&stdoutBuf, "waveNumber", NULL, config->waveNumber);
+            for (str = config->params; *str != '\0'; str += strlen(str) + 1)
+                n++;
+            outIntField(&stdoutBuf, "parameters", NULL, n / 3);
+            for (n = 0, str = config->stages; *str != '\0'; str += strlen(str) + 1)
+                n++;
+            outIntField(&stdoutBuf, "stages", NULL, n);
+            sprintf(hash, "%08lx", config->paramHash);
+            outStrField(&stdoutBuf, "paramHash", NULL, hash);
+            sprintf(hash, "%08lx", config->stageHash);
+            outStrField(&stdoutBuf, "stageHash", NULL, hash);
+            outEndRecord(&stdoutBuf);
+        }
+    }
+    freeSnapshot(&snap);
+    return status;
+}
+
+/*
+ * Write a difference found by -verify.
+ */
+static void writeDifference(
+    const char *job,            /* Job name */
+    const char *difference,     /* What is different */
+    const char *name,           /* Parameter or stage, or NULL */
+    const char *was,            /* Value in the snapshot, or NULL */
+    const char *now             /* Value now, or NULL */
+)
+{
+    outBeginRecord(&stdoutBuf, verifyColumns);
+    outStrField(&stdoutBuf, "job", NULL, job);
+    outStrField(&stdoutBuf, "difference", NULL, difference);
+    if (name != NULL)
+        outStrField(&stdoutBuf, "name", NULL, name);
+    else
+        outNullField(&stdoutBuf, "name", NULL, "-", 1);
+    if (was != NULL)
+        outStrField(&stdoutBuf, "snapshot", NULL, was);
+    else
+        outNullField(&stdoutBuf, "snapshot", NULL, "-", 1);
+    if (now != NULL)
+        outStrField(&stdoutBuf, "current", NULL, now);
+    else
+        outNullField(&stdoutBuf, "current", NULL, "-", 1);
+    outEndRecord(&stdoutBuf);
+}
+
+/*
+ * Find a parameter in a JOBCONFIG parameter block, returning its name
+ * field or NULL.
+ */
+static char *findConfigParam(
+    char *params,               /* Parameter block */
+    const char *name            /* Parameter name */
+)
+{
+    while (*params != '\0')
+    {
+        if (strcmp(params, name) == 0)
+            return params;
+        params += strlen(params) + 1;
+        params += strlen(params) + 1;
+        params += strlen(params) + 1;
+    }
+    return NULL;
+}
+
+/*
+ * Return TRUE if a string list holds the string.
+ */
+static BOOL inList(
+    const char *list,
+    const char *str
+)
+{
+    for (; *list != '\0'; list += strlen(list) + 1)
+        if (strcmp(list, str) == 0)
+            return TRUE;
+    return FALSE;
+}
+
+/*
+ * Write the differences between the snapshot of a job and what it is now.
+ */
+static void writeJobDifferences(
+    SNAPJOB *sj
+)
+{
+    char *was;
+    char *now;
+    char *str;
+    for (was = sj->snapshot.params; *was != '\0'; )
+    {
+        char *wasType = was + strlen(was) + 1;
+        char *wasValue = wasType + strlen(wasType) + 1;
+        if ((now = findConfigParam(sj->current.params, was)) == NULL)
+            writeDifference(sj->job, "parameter removed", was, wasValue, NULL);
+        else
+        {
+            char *nowType = now + strlen(now) + 1;
+            char *nowValue = nowType + strlen(nowType) + 1;
+            if (strcmp(wasType, nowType) != 0)
+                writeDifference(sj->job, "type changed", was,
+                                paramTypeName(atoi(wasType)), paramTypeName(atoi(nowType)));
+            else if (strcmp(wasValue, nowValue) != 0)
+                writeDifference(sj->job, "default changed", was, wasValue, nowValue);
+        }
+        was = wasValue + strlen(wasValue) + 1;
+    }
+    for (now = sj->current.params; *now != '\0'; )
+    {
+        char *nowType = now + strlen(now) + 1;
+        char *nowValue = nowType + strlen(nowType) + 1;
+        if (findConfigParam(sj->snapshot.params, now) == NULL)
+            writeDifference(sj->job, "parameter added", now, NULL, nowValue);
+        now = nowValue + strlen(nowValue) + 1;
+    }
+    for (str = sj->snapshot.stages; *str != '\0'; str += strlen(str) + 1)
+        if (!inList(sj->current.stages, str))
+            writeDifference(sj->job, "stage removed", str, NULL, NULL);
+    for (str = sj->current.stages; *str != '\0'; str += strlen(str) + 1)
+        if (!inList(sj->snapshot.stages, str))
+            writeDifference(sj->job, "stage added", str, NULL, NULL);
+}
+
+static int jobVerify(int argc, char *argv[])
+{
+    SNAPSHOT snap;
+    char *fileName;
+    char text[160];
+    int nThreads = DEFAULT_THREADS;
+    int count[SNAP_ADDED + 1];
+    int nRefreshed = 0;
+    int status;
+    int i;
+    BOOL refresh = FALSE;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (strcmp(opt, "refresh") == 0)
+            refresh = TRUE;
+        else if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "threads") == 0)
+        {
+            if ((nThreads = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be two parameters left... project and file name */
+    if (badOptions || (i + 2 != argc))
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -verify [-threads <n>] [-refresh] <project> <snapshot file>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    memset(&snap, 0, sizeof(snap));
+    snap.project = argv[i];
+    fileName = argv[i + 1];
+    snap.verify = TRUE;
+    if (!readSnapshot(fileName, &snap))
+    {
+        freeSnapshot(&snap);
+        return DSJE_DSJOB_ERROR;
+    }
+    snap.trustWave = (strcmp(snap.fileServer, (serverName != NULL) ? serverName : "") == 0) &&
+                     (strcmp(snap.fileProject, snap.project) == 0);
+    if ((status = readSnapJobs(&snap, nThreads)) != DSJE_NOERROR)
+    {
+        freeSnapshot(&snap);
+        return status;
+    }
+
+    /* Write the differences in the order of the file */
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < snap.nJobs; i++)
+        count[snap.jobs[i].state]++;
+    if (count[SNAP_CHANGED] + count[SNAP_REMOVED] + count[SNAP_ADDED] > 0)
+        outText(&stdoutBuf, "Job\tDifference\tName\tSnapshot\tCurrent\n");
+    for (i = 0; i < snap.nJobs; i++)
+    {
+        SNAPJOB *sj = &(snap.jobs[i]);
+        if (sj->state == SNAP_REMOVED)
+            writeDifference(sj->job, "job removed", NULL, NULL, NULL);
+        else if (sj->state == SNAP_ADDED)
+            writeDifference(sj->job, "job added", NULL, NULL, NULL);
+        else if (sj->state == SNAP_CHANGED)
+            writeJobDifferences(sj);
+        else if ((sj->state == SNAP_MATCHED) && snap.trustWave &&
+                 (sj->snapshot.waveNumber != sj->current.waveNumber))
+        {
+            sj->snapshot.waveNumber = sj->current.waveNumber;
+            nRefreshed++;
+        }
+    }
+    sprintf(text, "%d jobs checked: %d unchanged, %d read again and matching, %d changed, %d removed, %d added\n",
+            snap.nJobs, count[SNAP_UNCHANGED], count[SNAP_MATCHED], count[SNAP_CHANGED],
+            count[SNAP_REMOVED], count[SNAP_ADDED]);
+    outText(&stdoutBuf, text);
+    if (refresh && (nRefreshed > 0) && !writeSnapshot(fileName, &snap))
+        status = DSJE_DSJOB_ERROR;
+    if ((status == DSJE_NOERROR) &&
+            ((count[SNAP_CHANGED] > 0) || (count[SNAP_REMOVED] > 0) || (count[SNAP_ADDED] > 0)))
+    {
+        fprintf(stderr, "%d jobs differ from the snapshot\n",
+                count[SNAP_CHANGED] + count[SNAP_REMOVED] + count[SNAP_ADDED]);
+        status = DSJE_DSJOB_ERROR;
+    }
+    freeSnapshot(&snap);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * -export-inventory: write every project, job, stage, link and parameter
+ * to one file, as JSON lines whatever -format says.
+ *
+ * The crawl is in two rounds over a pool of workers, each with its own
+ * project and job handles: first the job list of each project is fetched,
+ * then the jobs of all the projects are shared out, so a worker that
+ * finishes a small project goes straight on to the jobs of a big one. A
+ * worker builds the records of a job in a buffer of its own and appends
+ * them to the file in one go under inventoryLock, so the records of a job
+ * are always together. The stage, link and parameter details come from
+ * the metadata cache when they can.
+ *
+ * After each project or job is written a line with the size of the file
+ * is added to a checkpoint file, the file name with ".ckpt" added. With
+ * -resume the file is cut back to the size of the last checkpoint (which
+ * drops anything written after it) and the crawl skips what the
+ * checkpoint file lists. The checkpoint file is deleted once everything
+ * has been written. A progress line is written to stderr every -progress
+ * seconds.
+ */
+#define DEFAULT_PROGRESS_INTERVAL 30
+
+typedef struct INVPROJECT
+{
+    char *project;              /* Project name */
+    int status;                 /* Error getting the job list */
+    char *jobList;              /* Its jobs, malloc'ed */
+    BOOL done;                  /* Already written */
+} INVPROJECT;
+
+typedef struct INVJOB
+{
+    char *project;              /* Project name, belonging to an INVPROJECT */
+    char *job;                  /* Job name, in the project's job list */
+    int status;                 /* Error exporting it */
+} INVJOB;
+
+typedef struct INVENTORY
+{
+    INVPROJECT *projects;
+    int nProjects;
+    volatile LONG nextProject;  /* Next project to be claimed */
+    INVJOB *jobs;
+    int nJobs;
+    volatile LONG nextJob;      /* Next job to be claimed */
+    char **done;                /* "project\tjob" of each job already written, sorted */
+    int nDone;
+    FILE *fp;                   /* The file */
+    FILE *ckpt;                 /* Its checkpoint file */
+    double size;                /* Bytes in the file */
+    int nWritten;               /* Jobs written by this run */
+    volatile LONG nFailed;      /* Jobs that could not be exported */
+    int interval;               /* Seconds between progress lines */
+    time_t startTime;
+    time_t lastProgress;
+} INVENTORY;
+
+static CRITICAL_SECTION inventoryLock;
+
+static const char inventoryProjectColumns[] = "record,project,jobs";
+static const char inventoryJobColumns[] = "record,project,job,waveNumber,stages,params";
+static const char inventoryStageColumns[] = "record,project,job,stage,stageType";
+static const char inventoryLinkColumns[] = "record,project,job,stage,link";
+static const char inventoryParamColumns[] =
+    "record,project,job,param,type,typeCode,helpText,prompt,promptAtRun,defaultValue,"
+    "originalDefault,listValues,originalList";
+
+static int compareStrings(
+    const void *a,
+    const void *b
+)
+{
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+/*
+ * Cut a file back to the given size. Returns FALSE if it can't be done,
+ * or the file is smaller than that.
+ */
+static BOOL truncateFile(
+    const char *fileName,
+    double size
+)
+{
+    HANDLE hFile;
+    LARGE_INTEGER fileSize;
+    LONG high = (LONG) (size / 4294967296.0);
+    BOOL done = FALSE;
+    hFile = CreateFileA(fileName, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+    if (GetFileSizeEx(hFile, &fileSize) && ((double) fileSize.QuadPart >= size) &&
+            ((SetFilePointer(hFile, (LONG) (DWORD) (size - high * 4294967296.0), &high, FILE_BEGIN)
+              != 0xFFFFFFFF) || (GetLastError() == NO_ERROR)))
+        done = SetEndOfFile(hFile);
+    (void) CloseHandle(hFile);
+    return done;
+}
+
+/*
+ * Read the checkpoint file to pick up where an earlier run left off, and
+ * cut both files back to the last checkpoint in it. Returns FALSE, having
+ * said why, if that can't be done.
+ */
+static BOOL readCheckpoint(
+    INVENTORY *inv,
+    const char *fileName,       /* The inventory file */
+    const char *ckptName        /* Its checkpoint file */
+)
+{
+    FILE *fp;
+    char *line = NULL;
+    size_t size = 0;
+    char *field[4];
+    double ckptSize = 0.0;
+    int maxDone = 0;
+    int n;
+    if ((fp = fopen(ckptName, "rb")) == NULL)
+    {
+        fprintf(stderr, "ERROR: There is no checkpoint file '%s' to resume from\n", ckptName);
+        return FALSE;
+    }
+    while (readLine(fp, &line, &size))
+    {
+        /* A line cut short by a crash has no newline, and is ignored */
+        if (feof(fp))
+            break;
+        n = splitSnapLine(line, field, 4);
+        if ((n == 3) && (strcmp(field[0], "project") == 0))
+        {
+            for (n = 0; n < inv->nProjects; n++)
+                if (strcmp(inv->projects[n].project, field[2]) == 0)
+                    inv->projects[n].done = TRUE;
+        }
+        else if ((n == 4) && (strcmp(field[0], "job") == 0))
+        {
+            char *key;
+            if (inv->nDone == maxDone)
+            {
+                char **bigger = realloc(inv->done, (maxDone + 1024) * sizeof(char *));
+                if (bigger == NULL)
+                    break;
+                inv->done = bigger;
+                maxDone += 1024;
+            }
+            if ((key = malloc(strlen(field[2]) + strlen(field[3]) + 2)) == NULL)
+                break;
+            sprintf(key, "%s\t%s", field[2], field[3]);
+            inv->done[inv->nDone++] = key;
+        }
+        else
+            break;
+        inv->size = strtod(field[1], NULL);
+        ckptSize = (double) ftell(fp);
+    }
+    free(line);
+    fclose(fp);
+    if (inv->nDone > 0)
+        qsort(inv->done, inv->nDone, sizeof(char *), compareStrings);
+    if (!truncateFile(fileName, inv->size) || !truncateFile(ckptName, ckptSize))
+    {
+        fprintf(stderr, "ERROR: '%s' does not match its checkpoint file\n", fileName);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Compare a job with a "project<tab>job" key from the checkpoint file, in
+ * the order strcmp() would put the job's own key in, without building it.
+ */
+static int compareDoneJob(
+    const void *a,              /* The INVJOB */
+    const void *b               /* The key */
+)
+{
+    const INVJOB *ij = a;
+    const unsigned char *p = (const unsigned char *) ij->project;
+    const unsigned char *key = *(const unsigned char **) b;
+    for (; (*p != '\0') && (*p == *key); p++, key++)
+        ;
+    if (*p != '\0')
+        return *p - *key;
+    if (*key != '\t')
+        return '\t' - *key;
+    return strcmp(ij->job, (const char *) key + 1);
+}
+
+/*
+ * Return TRUE if the checkpoint file says the job has been written.
+ */
+static BOOL jobExported(
+    INVENTORY *inv,
+    INVJOB *ij
+)
+{
+    if (inv->nDone == 0)
+        return FALSE;
+    return (bsearch(ij, inv->done, inv->nDone, sizeof(char *), compareDoneJob) != NULL);
+}
+
+/*
+ * Append records to the file, add a checkpoint for them, and write a
+ * progress line if one is due. Returns FALSE if the file can't be written.
+ */
+static BOOL appendInventory(
+    INVENTORY *inv,
+    OUTBUF *buf,                /* The records */
+    const char *project,        /* What they are */
+    const char *job             /* NULL for a project record */
+)
+{
+    BOOL written;
+    time_t now;
+    EnterCriticalSection(&inventoryLock);
+    written = (fwrite(buf->data, 1, buf->len, inv->fp) == buf->len) && (fflush(inv->fp) == 0);
+    if (written)
+    {
+        inv->size += (double) buf->len;
+        fprintf(inv->ckpt, "%s\t%.0f\t", (job == NULL) ? "project" : "job", inv->size);
+        writeEscaped(inv->ckpt, project);
+        if (job != NULL)
+        {
+            putc('\t', inv->ckpt);
+            writeEscaped(inv->ckpt, job);
+            inv->nWritten++;
+        }
+        putc('\n', inv->ckpt);
+        (void) fflush(inv->ckpt);
+    }
+    now = time(NULL);
+    if ((job != NULL) && (now - inv->lastProgress >= inv->interval))
+    {
+        long seconds = (long) (now - inv->startTime);
+        fprintf(stderr, "Exported %d of %d jobs (%d%%), %ld failed, %.1f jobs a second\n",
+                inv->nWritten, inv->nJobs, (int) (inv->nWritten * 100.0 / inv->nJobs),
+                (long) inv->nFailed, (seconds > 0) ? (double) inv->nWritten / seconds : 0.0);
+        inv->lastProgress = now;
+    }
+    LeaveCriticalSection(&inventoryLock);
+    return written;
+}
+
+static void inventoryProjectWorker(
+    WORKER *worker              /* Calling worker */
+)
+{
+    INVENTORY *inv = worker->context;
+    DSPROJECTINFO pInfo;
+    DSPROJECT hProject;
+    LONG i;
+    while ((i = InterlockedIncrement(&(inv->nextProject)) - 1) < inv->nProjects)
+    {
+        INVPROJECT *ip = &(inv->projects[i]);
+        if ((hProject = workerProject(worker, ip->project, &(ip->status))) == NULL)
+            continue;
+        ip->status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &pInfo);
+        if (ip->status == DSJE_NOT_AVAILABLE)
+        {
+            pInfo.info.jobList = "";
+            ip->status = DSJE_NOERROR;
+        }
+        if ((ip->status == DSJE_NOERROR) && ((ip->jobList = copyList(pInfo.info.jobList)) == NULL))
+            ip->status = DSJE_DSJOB_ERROR;
+    }
+}
+
+/*
+ * Build the records of a job: the job itself, then its stages, links and
+ * parameters.
+ */
+static int exportJob(
+    DSJOB hJob,                 /* Open job */
+    INVJOB *ij,
+    OUTBUF *buf                 /* Buffer to build them in */
+)
+{
+    DSJOBINFO jobInfo;
+    DSSTAGEINFO stageInfo;
+    DSPARAMINFO paramInfo;
+    char *stages = NULL;
+    char *params = NULL;
+    char *str;
+    char *link;
+    int nStages = 0;
+    int nParams = 0;
+    int status;
+    if (((status = DSGetJobInfo(hJob, DSJ_JOBWAVENO, &jobInfo)) != DSJE_NOERROR) ||
+            ((status = getConfigList(hJob, ij->project, ij->job, DSJ_STAGELIST, FALSE, &stages)) != DSJE_NOERROR) ||
+            ((status = getConfigList(hJob, ij->project, ij->job, DSJ_PARAMLIST, FALSE, &params)) != DSJE_NOERROR))
+    {
+        free(stages);
+        return status;
+    }
+    for (str = stages; *str != '\0'; str += strlen(str) + 1)
+        nStages++;
+    for (str = params; *str != '\0'; str += strlen(str) + 1)
+        nParams++;
+    outBeginRecord(buf, inventoryJobColumns);
+    outStrField(buf, "record", NULL, "job");
+    outStrField(buf, "project", NULL, ij->project);
+    outStrField(buf, "job", NULL, ij->job);
+    outIntField(buf, "waveNumber", NULL, jobInfo.info.jobWaveNumber);
+    outIntField(buf, "stages", NULL, nStages);
+    outIntField(buf, "params", NULL, nParams);
+    outEndRecord(buf);
+    for (str = stages; (*str != '\0') && (status == DSJE_NOERROR); str += strlen(str) + 1)
+    {
+        outBeginRecord(buf, inventoryStageColumns);
+        outStrField(buf, "record", NULL, "stage");
+        outStrField(buf, "project", NULL, ij->project);
+        outStrField(buf, "job", NULL, ij->job);
+        outStrField(buf, "stage", NULL, str);
+        if (metaGetStageType(hJob, ij->project, ij->job, str, &stageInfo) == DSJE_NOERROR)
+            outStrField(buf, "stageType", NULL, stageInfo.info.typeName);
+        else
+            outNullField(buf, "stageType", NULL, NULL, 1);
+        outEndRecord(buf);
+        status = metaGetLinkList(hJob, ij->project, ij->job, str, &stageInfo);
+        if (status == DSJE_NOT_AVAILABLE)
+        {
+            status = DSJE_NOERROR;
+            continue;
+        }
+        for (link = stageInfo.info.linkList; (status == DSJE_NOERROR) && (*link != '\0');
+                link += strlen(link) + 1)
+        {
+            outBeginRecord(buf, inventoryLinkColumns);
+            outStrField(buf, "record", NULL, "link");
+            outStrField(buf, "project", NULL, ij->project);
+            outStrField(buf, "job", NULL, ij->job);
+            outStrField(buf, "stage", NULL, str);
+            outStrField(buf, "link", NULL, link);
+            outEndRecord(buf);
+        }
+    }
+    for (str = params; (*str != '\0') && (status == DSJE_NOERROR); str += strlen(str) + 1)
+    {
+        if ((status = metaGetParamInfo(hJob, ij->project, ij->job, str, &paramInfo)) != DSJE_NOERROR)
+            break;
+        outBeginRecord(buf, inventoryParamColumns);
+        outStrField(buf, "record", NULL, "param");
+        outStrField(buf, "project", NULL, ij->project);
+        outStrField(buf, "job", NULL, ij->job);
+        outStrField(buf, "param", NULL, str);
+        writeParamInfo(buf, &paramInfo);
+        outEndRecord(buf);
+    }
+    free(stages);
+    free(params);
+    return status;
+}
+
+static void inventoryJobWorker(
+    WORKER *worker              /* Calling worker */
+)
+{
+    INVENTORY *inv = worker->context;
+    OUTBUF buf = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    DSJOB hJob;
+    LONG i;
+    while ((i = InterlockedIncrement(&(inv->nextJob)) - 1) < inv->nJobs)
+    {
+        INVJOB *ij = &(inv->jobs[i]);
+        buf.len = 0;
+        if ((hJob = workerJob(worker, ij->project, ij->job, &(ij->status))) != NULL)
+        {
+            ij->status = exportJob(hJob, ij, &buf);
+            (void) DSCloseJob(hJob);
+        }
+        if ((ij->status == DSJE_NOERROR) && ((buf.data == NULL) || !appendInventory(inv, &buf, ij->project, ij->job)))
+            ij->status = DSJE_DSJOB_ERROR;
+        if (ij->status != DSJE_NOERROR)
+            (void) InterlockedIncrement(&(inv->nFailed));
+    }
+    free(buf.data);
+}
+
+static void freeInventory(
+    INVENTORY *inv
+)
+{
+    int i;
+    for (i = 0; i < inv->nProjects; i++)
+    {
+        free(inv->projects[i].project);
+        free(inv->projects[i].jobList);
+    }
+    for (i = 0; i < inv->nDone; i++)
+        free(inv->done[i]);
+    free(inv->projects);
+    free(inv->jobs);
+    free(inv->done);
+}
+
+/*
+ * Write the project records, and share out the jobs not yet written.
+ * Returns the first error.
+ */
+static int listInventoryJobs(
+    INVENTORY *inv
+)
+{
+    OUTBUF buf = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    char *str;
+    int status = DSJE_NOERROR;
+    int nJobs = 0;
+    int i;
+    for (i = 0; i < inv->nProjects; i++)
+    {
+        INVPROJECT *ip = &(inv->projects[i]);
+        int n = 0;
+        if (ip->status != DSJE_NOERROR)
+        {
+            fprintf(stderr, "Error %d getting the job list of project '%s'\n", ip->status, ip->project);
+            if (status == DSJE_NOERROR)
+                status = ip->status;
+            continue;
+        }
+        for (str = ip->jobList; *str != '\0'; str += strlen(str) + 1)
+            n++;
+        nJobs += n;
+        if (ip->done)
+            continue;
+        buf.len = 0;
+        outBeginRecord(&buf, inventoryProjectColumns);
+        outStrField(&buf, "record", NULL, "project");
+        outStrField(&buf, "project", NULL, ip->project);
+        outIntField(&buf, "jobs", NULL, n);
+        outEndRecord(&buf);
+        if ((buf.data == NULL) || !appendInventory(inv, &buf, ip->project, NULL))
+        {
+            fprintf(stderr, "ERROR: Cannot write inventory file\n");
+            free(buf.data);
+            return DSJE_DSJOB_ERROR;
+        }
+    }
+    free(buf.data);
+    if ((inv->jobs = calloc(nJobs + 1, sizeof(INVJOB))) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    for (i = 0; i < inv->nProjects; i++)
+    {
+        INVPROJECT *ip = &(inv->projects[i]);
+        if (ip->status != DSJE_NOERROR)
+            continue;
+        for (str = ip->jobList; *str != '\0'; str += strlen(str) + 1)
+        {
+            INVJOB *ij = &(inv->jobs[inv->nJobs]);
+            ij->project = ip->project;
+            ij->job = str;
+            if (!jobExported(inv, ij))
+                inv->nJobs++;
+        }
+    }
+    fprintf(stderr, "%d jobs in %d projects, %d to export\n", nJobs, inv->nProjects, inv->nJobs);
+    return status;
+}
+
+static int jobExportInventory(int argc, char *argv[])
+{
+    INVENTORY inv;
+    char *fileName;
+    char *ckptName = NULL;
+    char *projectList = NULL;
+    char *str;
+    char text[160];
+    int savedFormat = outputFormat;
+    int nThreads = DEFAULT_THREADS;
+    int status = DSJE_NOERROR;
+    int i;
+    int j;
+    BOOL resume = FALSE;
+    BOOL badOptions = FALSE;
+    memset(&inv, 0, sizeof(inv));
+    inv.interval = DEFAULT_PROGRESS_INTERVAL;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (strcmp(opt, "resume") == 0)
+            resume = TRUE;
+        else if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "threads") == 0)
+        {
+            if ((nThreads = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "progress") == 0)
+        {
+            if ((inv.interval = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be at least one parameter left... the file name */
+    if (badOptions || (i >= argc))
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -export-inventory\n");
+        fprintf(stderr, "\t\t\t[-threads <n>] [-resume] [-progress <seconds>]\n");
+        fprintf(stderr, "\t\t\t<inventory file> [<project>...]\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    fileName = argv[i++];
+
+    /* The projects named, or every project */
+    if ((i == argc) && ((projectList = DSGetProjectList()) == NULL))
+    {
+        status = DSGetLastError();
+        fprintf(stderr, "ERROR: Failed to get project list\n");
+        return status;
+    }
+    if (i < argc)
+        inv.nProjects = argc - i;
+    else
+    {
+        for (str = projectList; *str != '\0'; str += strlen(str) + 1)
+            inv.nProjects++;
+    }
+    if ((inv.projects = calloc(inv.nProjects + 1, sizeof(INVPROJECT))) == NULL)
+        status = DSJE_DSJOB_ERROR;
+    for (j = 0, str = projectList; (j < inv.nProjects) && (status == DSJE_NOERROR); j++)
+    {
+        if ((inv.projects[j].project = copyString((i < argc) ? argv[i + j] : str)) == NULL)
+            status = DSJE_DSJOB_ERROR;
+        if (i == argc)
+            str += strlen(str) + 1;
+    }
+    if ((status == DSJE_NOERROR) && ((ckptName = malloc(strlen(fileName) + 6)) == NULL))
+        status = DSJE_DSJOB_ERROR;
+    if (status != DSJE_NOERROR)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        freeInventory(&inv);
+        return status;
+    }
+    sprintf(ckptName, "%s.ckpt", fileName);
+    if (resume && !readCheckpoint(&inv, fileName, ckptName))
+        status = DSJE_DSJOB_ERROR;
+    else if (((inv.fp = fopen(fileName, resume ? "ab" : "wb")) == NULL) ||
+             ((inv.ckpt = fopen(ckptName, resume ? "ab" : "wb")) == NULL))
+    {
+        fprintf(stderr, "ERROR: Cannot create inventory file '%s'\n", (inv.fp == NULL) ? fileName : ckptName);
+        status = DSJE_DSJOB_ERROR;
+    }
+    if (status != DSJE_NOERROR)
+    {
+        if (inv.fp != NULL)
+            fclose(inv.fp);
+        free(ckptName);
+        freeInventory(&inv);
+        return status;
+    }
+
+    /* The records are JSON lines, so the format is switched for the crawl */
+    setOutputFormat(FORMAT_JSON);
+    inv.startTime = inv.lastProgress = time(NULL);
+    if (inv.nProjects > 0)
+        runWorkers((nThreads < inv.nProjects) ? nThreads : inv.nProjects, inventoryProjectWorker, &inv);
+    status = listInventoryJobs(&inv);
+    if (inv.nJobs > 0)
+        runWorkers((nThreads < inv.nJobs) ? nThreads : inv.nJobs, inventoryJobWorker, &inv);
+    setOutputFormat(savedFormat);
+    for (i = 0; i < inv.nJobs; i++)
+    {
+        INVJOB *ij = &(inv.jobs[i]);
+        if (ij->status == DSJE_NOERROR)
+            continue;
+        fprintf(stderr, "Error %d exporting job '%s' in project '%s'\n", ij->status, ij->job, ij->project);
+        if (status == DSJE_NOERROR)
+            status = ij->status;
+    }
+    if (fclose(inv.fp) != 0)
+        status = DSJE_DSJOB_ERROR;
+    fclose(inv.ckpt);
+    /* Once it's all there the checkpoint file has done its job */
+    if (status == DSJE_NOERROR)
+        (void) DeleteFileA(ckptName);
+    else
+        fprintf(stderr, "Run again with -resume to export the rest\n");
+    sprintf(text, "Exported %d jobs, %ld failed\n", inv.nWritten, (long) inv.nFailed);
+    outText(&stdoutBuf, text);
+    free(ckptName);
+    freeInventory(&inv);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * -log -stream: log each record read from stdin as an entry of its own.
+ *
+ * A reader thread reads stdin in large blocks, splits it into records at
+ * the delimiter and puts them on a bounded queue, from which the calling
+ * thread takes them and passes them to DSLogEvent() on its one job handle,
+ * so reading carries on while each call is in flight. When the queue is
+ * full the reader waits, which holds up whatever is writing to the pipe.
+ * With -batch, records that are queued up together go into one entry, up
+ * to that many a line each, and -rate caps the entries logged per second
+ * so that a burst doesn't flood the engine. A record may be any length and
+ * is logged as it was read, less a trailing carriage return; empty records
+ * are skipped. If logging fails the reader is left behind rather than
+ * waited for, as it may be blocked on a producer that never closes the
+ * pipe; it throws away whatever else it reads, and whichever of the two
+ * threads finishes last frees the stream.
+ */
+#define STREAM_CHUNK    65536   /* Bytes read from stdin at a time */
+#define STREAM_QUEUE    256     /* Records queued, by default */
+
+typedef struct LOGSTREAM
+{
+    int fd;                     /* Input */
+    char delimiter;             /* Ends a record */
+    char **record;              /* Ring of queued records, NULL for the end */
+    int size;                   /* Slots in the ring */
+    int head;                   /* Next slot to take from */
+    int tail;                   /* Next slot to fill */
+    HANDLE slotFree;            /* Counts the free slots */
+    HANDLE slotFilled;          /* Counts the queued records */
+    volatile LONG stop;         /* Set to make the reader give up */
+    volatile LONG refs;         /* Threads still using the stream */
+    BOOL failed;                /* Reader ran out of memory */
+} LOGSTREAM;
+
+static const char logStreamColumns[] = "records,entries,bytes";
+
+/*
+ * Queue a copy of a record, unless it is empty, waiting for a free slot.
+ * NULL queues the end of the stream. Returns FALSE if out of memory.
+ */
+static BOOL queueRecord(
+    LOGSTREAM *stream,          /* The stream */
+    const char *data,           /* Record, not NUL terminated, or NULL */
+    size_t len                  /* Its length */
+)
+{
+    char *copy = NULL;
+    if ((data != NULL) && (len > 0) && (data[len - 1] == '\r'))
+        len--;
+    if ((data != NULL) && (len == 0))
+        return TRUE;
+    if ((data != NULL) && ((copy = malloc(len + 1)) == NULL))
+        return FALSE;
+    if (copy != NULL)
+    {
+        memcpy(copy, data, len);
+        copy[len] = '\0';
+    }
+    if (stream->stop)
+    {
+        /* Nothing is taking records any more */
+        free(copy);
+        return TRUE;
+    }
+    (void) WaitForSingleObject(stream->slotFree, INFINITE);
+    stream->record[stream->tail] = copy;
+    stream->tail = (stream->tail + 1) % stream->size;
+    (void) ReleaseSemaphore(stream->slotFilled, 1, NULL);
+    return TRUE;
+}
+
+static void releaseStream(LOGSTREAM *stream);
+
+static unsigned __stdcall streamReader(
+    void *arg                   /* The LOGSTREAM */
+)
+{
+    LOGSTREAM *stream = arg;
+    OUTBUF partial = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    char *chunk = malloc(STREAM_CHUNK);
+    int n;
+    stream->failed = (chunk == NULL);
+    while (!stream->failed && !stream->stop &&
+            ((n = _read(stream->fd, chunk, STREAM_CHUNK)) > 0))
+    {
+        char *p = chunk;
+        char *end = chunk + n;
+        while (!stream->failed && (p < end))
+        {
+            char *delim = memchr(p, stream->delimiter, end - p);
+            size_t len = partial.len;
+            if (delim == NULL)
+            {
+                /* Carried over to the next block */
+                outMem(&partial, p, end - p);
+                stream->failed = (partial.len != len + (end - p));
+                break;
+            }
+            if (partial.len > 0)
+            {
+                outMem(&partial, p, delim - p);
+                stream->failed = (partial.len != len + (delim - p)) ||
+                                 !queueRecord(stream, partial.data, partial.len);
+                partial.len = 0;
+            }
+            else
+                stream->failed = !queueRecord(stream, p, delim - p);
+            p = delim + 1;
+        }
+    }
+    if (!stream->failed && (partial.len > 0))
+        stream->failed = !queueRecord(stream, partial.data, partial.len);
+    (void) queueRecord(stream, NULL, 0);
+    free(partial.data);
+    free(chunk);
+    releaseStream(stream);
+    return 0;
+}
+
+/*
+ * Take the next record off the queue, waiting for one if wait is set.
+ * Returns FALSE if there is none (without waiting) or the stream has
+ * ended, in which case *ended is set.
+ */
+static BOOL takeRecord(
+    LOGSTREAM *stream,          /* The stream */
+    BOOL wait,                  /* Wait for a record */
+    char **record,              /* Returned record, malloc'ed */
+    BOOL *ended                 /* Set at the end of the stream */
+)
+{
+    if (*ended || (WaitForSingleObject(stream->slotFilled, wait ? INFINITE : 0) != WAIT_OBJECT_0))
+        return FALSE;
+    *record = stream->record[stream->head];
+    stream->head = (stream->head + 1) % stream->size;
+    (void) ReleaseSemaphore(stream->slotFree, 1, NULL);
+    if (*record == NULL)
+        *ended = TRUE;
+    return (*record != NULL);
+}
+
+/*
+ * Drop a thread's use of the stream, freeing it and anything still queued
+ * once neither thread is using it.
+ */
+static void releaseStream(
+    LOGSTREAM *stream           /* The stream */
+)
+{
+    char *record;
+    BOOL ended = FALSE;
+    if (InterlockedDecrement(&(stream->refs)) > 0)
+        return;
+    while (takeRecord(stream, FALSE, &record, &ended))
+        free(record);
+    CloseHandle(stream->slotFree);
+    CloseHandle(stream->slotFilled);
+    free(stream->record);
+    free(stream);
+}
+
+static int logStream(
+    DSJOB hJob,                 /* Job to log to */
+    int type,                   /* DSJ_LOGINFO or DSJ_LOGWARNING */
+    char delimiter,             /* Ends a record */
+    int batch,                  /* Most records in an entry */
+    int rate,                   /* Most entries a second, 0 for no limit */
+    int queueSize               /* Records that may be queued */
+)
+{
+    LOGSTREAM *stream = calloc(1, sizeof(LOGSTREAM));
+    OUTBUF entry = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    HANDLE reader = 0;
+    DWORD startTime = GetTickCount();
+    long nRecords = 0;
+    long nEntries = 0;
+    long nBytes = 0;
+    BOOL ended = FALSE;
+    int status = DSJE_NOERROR;
+    if (stream != NULL)
+    {
+        stream->fd = _fileno(stdin);
+        stream->delimiter = delimiter;
+        stream->size = queueSize;
+        stream->refs = 2;
+        stream->record = malloc(queueSize * sizeof(char *));
+        stream->slotFree = CreateSemaphore(NULL, queueSize, queueSize, NULL);
+        stream->slotFilled = CreateSemaphore(NULL, 0, queueSize, NULL);
+    }
+    if ((stream == NULL) || (stream->record == NULL) ||
+            (stream->slotFree == NULL) || (stream->slotFilled == NULL) ||
+            ((reader = (HANDLE) _beginthreadex(NULL, 0, streamReader, stream, 0, NULL)) == 0))
+    {
+        fprintf(stderr, "ERROR: Failed to start reading stdin\n");
+        if (stream != NULL)
+        {
+            if (stream->slotFree != NULL)
+                CloseHandle(stream->slotFree);
+            if (stream->slotFilled != NULL)
+                CloseHandle(stream->slotFilled);
+            free(stream->record);
+            free(stream);
+        }
+        return DSJE_DSJOB_ERROR;
+    }
+    for (;;)
+    {
+        char *record;
+        int n = 0;
+        if (!takeRecord(stream, TRUE, &record, &ended))
+            break;
+        /* Anything else already queued can share the entry */
+        entry.len = 0;
+        do
+        {
+            if (n++ > 0)
+                outChar(&entry, '\n');
+            outStr(&entry, record);
+            free(record);
+        } while ((n < batch) && takeRecord(stream, FALSE, &record, &ended));
+        outChar(&entry, '\0');
+        if (entry.data == NULL)
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            status = DSJE_DSJOB_ERROR;
+            break;
+        }
+        if (rate > 0)
+        {
+            /* Entry k is not logged before k/rate seconds have gone by */
+            DWORD due = (DWORD) ((double) nEntries * 1000.0 / rate);
+            DWORD elapsed = GetTickCount() - startTime;
+            if (elapsed < due)
+                Sleep(due - elapsed);
+        }
+        if ((status = DSLogEvent(hJob, type, NULL, entry.data)) != DSJE_NOERROR)
+        {
+            fprintf(stderr, "Error %d adding log entry\n", status);
+            break;
+        }
+        nRecords += n;
+        nEntries++;
+        nBytes += (long) entry.len - 1;
+    }
+    /*
+     * Tell the reader to give up, and make room for any record it is
+     * waiting to queue. Only wait for it if it has already reached the
+     * end; otherwise it may be blocked reading a pipe that stays open.
+     */
+    InterlockedIncrement(&(stream->stop));
+    while (!ended)
+    {
+        char *record;
+        if (!takeRecord(stream, FALSE, &record, &ended))
+            break;
+        free(record);
+    }
+    if (ended)
+    {
+        (void) WaitForSingleObject(reader, INFINITE);
+        if (stream->failed && (status == DSJE_NOERROR))
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            status = DSJE_DSJOB_ERROR;
+        }
+    }
+    CloseHandle(reader);
+    releaseStream(stream);
+    outBeginRecord(&stdoutBuf, logStreamColumns);
+    outIntField(&stdoutBuf, "records", "Records\t: ", nRecords);
+    outIntField(&stdoutBuf, "entries", "Entries\t: ", nEntries);
+    outIntField(&stdoutBuf, "bytes", "Bytes\t: ", nBytes);
+    outEndRecord(&stdoutBuf);
+    free(entry.data);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -log sub-command
+ */
+static int jobLog(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    int i;
+    char *project;
+    char *job;
+    int type = DSJ_LOGINFO;
+    BOOL stream = FALSE;
+    BOOL streamOptions = FALSE;
+    char delimiter = '\n';
+    int batch = 1;
+    int rate = 0;
+    int queueSize = STREAM_QUEUE;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        /* Note: not mutually exclusive check on info or warn */
+        if (strcmp(opt, "info") == 0)
+            type = DSJ_LOGINFO;
+        else if (strcmp(opt, "warn") == 0)
+            type = DSJ_LOGWARNING;
+        else if (strcmp(opt, "stream") == 0)
+            stream = TRUE;
+        else if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "delim") == 0)
+        {
+            /* A single character, or \n, \t or \0 */
+            if (strlen(arg) == 1)
+                delimiter = arg[0];
+            else if (strcmp(arg, "\\n") == 0)
+                delimiter = '\n';
+            else if (strcmp(arg, "\\t") == 0)
+                delimiter = '\t';
+            else if (strcmp(arg, "\\0") == 0)
+                delimiter = '\0';
+            else
+                badOptions = TRUE;
+            streamOptions = TRUE;
+        }
+        else if (strcmp(opt, "batch") == 0)
+        {
+            if ((batch = atoi(arg)) < 1)
+                badOptions = TRUE;
+            streamOptions = TRUE;
+        }
+        else if (strcmp(opt, "rate") == 0)
+        {
+            if ((rate = atoi(arg)) < 1)
+                badOptions = TRUE;
+            streamOptions = TRUE;
+        }
+        else if (strcmp(opt, "queue") == 0)
+        {
+            if ((queueSize = atoi(arg)) < 1)
+                badOptions = TRUE;
+            streamOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    if (streamOptions && !stream)
+        badOptions = TRUE;
+    /* Must be two parameters left... project and job */
+    if ((i+2) == argc)
+    {
+        project = argv[i];
+        job = argv[i+1];
+    }
+    else
+        badOptions = TRUE;
+    /* Report validation problems and exit */
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -log\n");
+        fprintf(stderr, "\t\t\t[-info | -warn]\n");
+        fprintf(stderr, "\t\t\t[-stream [-delim <character>] [-batch <n>] [-rate <n>] [-queue <n>]]\n");
+        fprintf(stderr, "\t\t\t<project> <job>\n");
+        fprintf(stderr, "\nLog message is read from stdin. With -stream, each record read\n");
+        fprintf(stderr, "(by default each line) is logged as an entry of its own.\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+		if ((hJob = openJob(hProject, job, &status)) == NULL)
+		{
+			fprintf(stderr, "ERROR: Failed to open job\n");
+		}
+		else if (stream)
+		{
+			status = logStream(hJob, type, delimiter, batch, rate, queueSize);
+			(void) closeJob(hJob);
+		}
+		else
+		{
+			#define MAX_MSG_LEN 4096
+			char message[MAX_MSG_LEN + 4];
+			int n = 0;
+			/* Read the message from stdin */
+			outText(&stdoutBuf, "Enter message text, terminating with Ctrl-d\n");
+			outFlush(&stdoutBuf);
+			while (n < MAX_MSG_LEN)
+			{
+				int ch;
+				ch = getchar();
+				if (IS_END_OF_TEXT(ch))
+					break;
+				if ((ch == '\n') || isprint(ch))
+					message[n++] = ch;
+			}
+			outText(&stdoutBuf, "\nMessage read.\n");
+			message[n] = '\0';
+			/* Add message to the log */
+			status = DSLogEvent(hJob, type, NULL, message);
+			if (status != DSJE_NOERROR)
+				fprintf(stderr, "Error adding log entry\n");
+			(void) closeJob(hJob);
+		}
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Write the summary of a log entry in the -logsum format.
+ */
+static const char logSumColumns[] = "eventId,type,typeCode,time,message";
+
+static void writeLogSummary(
+    OUTBUF *buf,                /* Buffer to write to */
+    int eventId,                /* Event id */
+    int type,                   /* DSJ_LOGxxx type */
+    time_t timestamp,           /* Time the event was logged */
+    char *message               /* Message summary */
+)
+{
+    outBeginRecord(buf, logSumColumns);
+    outIntField(buf, "eventId", NULL, eventId);
+    outNameField(buf, "type", NULL, logTypeName(type), type);
+    outTimeField(buf, "time", NULL, timestamp); /* ctime has \n at end */
+    outStrField(buf, "message", NULL, message);
+    outEndRecord(buf);
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -logsum sub-command
+ *
+ * The summary is formatted into the stdout buffer, so each entry costs a
+ * few memory copies rather than several stdio calls. With -since only the
+ * entries after the given event id are listed: the time of that event is
+ * used as the start of the search so that the server need not return the
+ * older entries at all, and the id of the last entry listed is reported so
+ * that it can be passed to the next -since.
+ */
+static int jobLogSum(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    int i;
+    char *project;
+    char *job;
+    int type = DSJ_LOGANY;
+    time_t startTime = 0;
+    time_t endTime = 0;
+    int maxNumber = 0;
+    int sinceId = -1;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "type") == 0)
+        {
+            if (!parseLogType(arg, strlen(arg), &type))
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "max") == 0)
+            maxNumber = atoi(arg);
+        else if (strcmp(opt, "since") == 0)
+            sinceId = atoi(arg);
+        else
+                badOptions = TRUE;
+    }
+    /* Must be two parameters left... project and job */
+    if ((i+2) == argc)
+    {
+        project = argv[i];
+        job = argv[i+1];
+    }
+    else
+        badOptions = TRUE;
+    /* Report validation problems and exit */
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -logsum\n");
+        fprintf(stderr, "\t\t\t[-type <INFO | WARNING | FATAL | REJECT | STARTED | RESET | BATCH>]\n");
+        fprintf(stderr, "\t\t\t[-max <n>]\n");
+        fprintf(stderr, "\t\t\t[-since <event id>]\n");
+        fprintf(stderr, "\t\t\t<project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Attempt to open the project, open the job and lock it */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            DSLOGEVENT event;
+            DSLOGDETAIL since;
+            int lastId = sinceId;
+            /* Start the search at the time of the -since event */
+            if ((sinceId >= 0) && (DSGetLogEntry(hJob, sinceId, &since) == DSJE_NOERROR))
+                startTime = since.timestamp;
+            /* Make the first call to establish the log info */
+            status = DSFindFirstLogEntry(hJob, type, startTime,
+                                endTime, maxNumber, &event);
+            while(status == DSJE_NOERROR)
+            {
+                if (event.eventId > sinceId)
+                {
+                    writeLogSummary(&stdoutBuf, event.eventId, event.type,
+                                    event.timestamp, event.message);
+                    if (event.eventId > lastId)
+                        lastId = event.eventId;
+                }
+                /* Go on to next entry */
+                status = DSFindNextLogEntry(hJob, &event);
+            }
+            outFlush(&stdoutBuf);
+            if (status == DSJE_NOMORE)
+                status = DSJE_NOERROR;
+            else
+                fprintf(stderr, "Error %d getting log summary\n", status);
+            if ((sinceId >= 0) && (status == DSJE_NOERROR))
+                fprintf(stderr, "Last event id\t: %d\n", lastId);
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Patterns for -logsearch. A pattern is compiled once into a list of
+ * nodes and then matched against each message as it is streamed from the
+ * server. The syntax is the basic regular expression subset:
+ *
+ *  c           the character c (\c for a special character)
+ *  .           any character except a newline
+ *  [set]       any character in the set, ranges such as a-z allowed;
+ *              [^set] any character not in it
+ *  \d \w \s    a digit, a word character, white space
+ *  ^ $         the start and end of a line of the message
+ *
+ * and any character, set or class can be followed by *, + or ?. With no ^
+ * the pattern can match anywhere in the message.
+ */
+#define PAT_SET         0       /* Node matches a character in the set */
+#define PAT_BOL         1       /* Node matches at the start of a line */
+#define PAT_EOL         2       /* Node matches at the end of a line */
+
+#define PAT_ONE         0       /* Node matches once */
+#define PAT_STAR        1       /* ... zero or more times */
+#define PAT_PLUS        2       /* ... one or more times */
+#define PAT_QUEST       3       /* ... zero or one times */
+
+typedef struct PATNODE
+{
+    int kind;                   /* PAT_SET, PAT_BOL or PAT_EOL */
+    int repeat;                 /* PAT_ONE, PAT_STAR, PAT_PLUS or PAT_QUEST */
+    unsigned char set[32];      /* Bit per character for PAT_SET */
+} PATNODE;
+
+typedef struct PATTERN
+{
+    PATNODE *node;
+    int nNodes;
+} PATTERN;
+
+static void addToSet(
+    unsigned char *set,         /* Set to add to */
+    int c,                      /* Character to add */
+    BOOL ignoreCase             /* Add the other case too */
+)
+{
+    set[(c & 0xff) >> 3] |= (unsigned char) (1 << (c & 7));
+    if (ignoreCase && isalpha(c))
+    {
+        c = isupper(c) ? tolower(c) : toupper(c);
+        set[(c & 0xff) >> 3] |= (unsigned char) (1 << (c & 7));
+    }
+}
+
+/*
+ * Add the characters of the class \c to a set, returning FALSE if c does
+ * not name a class (it is then an escaped character).
+ */
+static BOOL addClass(
+    unsigned char *set,         /* Set to add to */
+    int c                       /* Class letter */
+)
+{
+    int i;
+    if ((c != 'd') && (c != 'w') && (c != 's'))
+        return FALSE;
+    for (i = 1; i < 256; i++)
+        if (((c == 'd') && isdigit(i)) || ((c == 's') && isspace(i)) ||
+                ((c == 'w') && (isalnum(i) || (i == '_'))))
+            addToSet(set, i, FALSE);
+    return TRUE;
+}
+
+static void freePattern(
+    PATTERN *pattern
+)
+{
+    free(pattern->node);
+    pattern->node = NULL;
+    pattern->nNodes = 0;
+}
+
+/*
+ * Compile a pattern, returning FALSE and reporting the problem if it is not
+ * valid.
+ */
+static BOOL compilePattern(
+    PATTERN *pattern,           /* Returned compiled pattern */
+    const char *text,           /* Pattern text */
+    BOOL ignoreCase             /* Match either case */
+)
+{
+    const unsigned char *p = (const unsigned char *) text;
+    BOOL valid = TRUE;
+    /* No node is longer than one character of the text */
+    pattern->nNodes = 0;
+    if ((pattern->node = calloc(strlen(text) + 1, sizeof(PATNODE))) == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return FALSE;
+    }
+    while (valid && (*p != '\0'))
+    {
+        PATNODE *node = &(pattern->node[pattern->nNodes]);
+        if ((*p == '*') || (*p == '+') || (*p == '?'))
+        {
+            if ((pattern->nNodes == 0) || (node[-1].kind != PAT_SET) ||
+                    (node[-1].repeat != PAT_ONE))
+            {
+                valid = FALSE;
+                break;
+            }
+            node[-1].repeat = (*p == '*') ? PAT_STAR : (*p == '+') ? PAT_PLUS : PAT_QUEST;
+            p++;
+            continue;
+        }
+        pattern->nNodes++;
+        if (*p == '^')
+            node->kind = PAT_BOL;
+        else if (*p == '$')
+            node->kind = PAT_EOL;
+        else if (*p == '.')
+        {
+            int i;
+            for (i = 1; i < 256; i++)
+                if (i != '\n')
+                    addToSet(node->set, i, FALSE);
+        }
+        else if (*p == '\\')
+        {
+            if (*++p == '\0')
+            {
+                valid = FALSE;
+                break;
+            }
+            if (!addClass(node->set, *p))
+                addToSet(node->set, *p, ignoreCase);
+        }
+        else if (*p == '[')
+        {
+            BOOL negate = (*++p == '^');
+            if (negate)
+                p++;
+            /* A ] straight after the [ is part of the set */
+            do
+            {
+                int first = *p;
+                if (first == '\0')
+                    break;
+                if ((first == '\\') && (p[1] != '\0'))
+                {
+                    if (addClass(node->set, *++p))
+                        continue;
+                    first = *p;
+                }
+                if ((p[1] == '-') && (p[2] != ']') && (p[2] != '\0'))
+                {
+                    int last = p[2];
+                    p += 2;
+                    for (; first <= last; first++)
+                        addToSet(node->set, first, ignoreCase);
+                }
+                else
+                    addToSet(node->set, first, ignoreCase);
+            }
+            while (*++p != ']');
+            if (*p != ']')
+            {
+                valid = FALSE;
+                break;
+            }
+            if (negate)
+            {
+                int i;
+                for (i = 0; i < 32; i++)
+                    node->set[i] = (unsigned char) ~node->set[i];
+            }
+        }
+        else
+            addToSet(node->set, *p, ignoreCase);
+        /* Never match the terminating null */
+        node->set[0] &= (unsigned char) ~1;
+        p++;
+    }
+    if (!valid)
+    {
+        fprintf(stderr, "Invalid pattern '%s' at character %d\n", text,
+                (int) (p - (const unsigned char *) text) + 1);
+        freePattern(pattern);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+#define inSet(node, c)  (((node)->set[(c) >> 3] & (1 << ((c) & 7))) != 0)
+
+/*
+ * Match the nodes from node onwards at text, backtracking over repeats.
+ */
+static BOOL matchHere(
+    PATNODE *node,              /* First node to match */
+    PATNODE *end,               /* End of the nodes */
+    const unsigned char *start, /* Start of the message */
+    const unsigned char *text   /* Text to match at */
+)
+{
+    for (; node < end; node++)
+    {
+        if (node->kind == PAT_BOL)
+        {
+            if ((text != start) && (text[-1] != '\n'))
+                return FALSE;
+        }
+        else if (node->kind == PAT_EOL)
+        {
+            if ((*text != '\0') && (*text != '\n') && (*text != '\r'))
+                return FALSE;
+        }
+        else if (node->repeat == PAT_ONE)
+        {
+            if (!inSet(node, *text))
+                return FALSE;
+            text++;
+        }
+        else
+        {
+            int n = 0;
+            int min = (node->repeat == PAT_PLUS) ? 1 : 0;
+            while (inSet(node, text[n]) && ((node->repeat != PAT_QUEST) || (n == 0)))
+                n++;
+            for (; n >= min; n--)
+                if (matchHere(node + 1, end, start, text + n))
+                    return TRUE;
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static BOOL matchPattern(
+    PATTERN *pattern,
+    const char *message         /* Text to search */
+)
+{
+    const unsigned char *start = (const unsigned char *) message;
+    const unsigned char *text;
+    for (text = start; ; text++)
+    {
+        if (matchHere(pattern->node, pattern->node + pattern->nNodes, start, text))
+            return TRUE;
+        if (*text == '\0')
+            return FALSE;
+    }
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -logsearch sub-command
+ *
+ * Search a job's log for the entries of some types in a time window whose
+ * message matches a pattern. The window and, if only one type is wanted,
+ * the type are passed to DSFindFirstLogEntry() so that the server returns
+ * only those entries; the pattern is matched as each one arrives, and the
+ * search stops as soon as -max matches have been found.
+ */
+/*
+ * Convert a local time of the form YYYY-MM-DD[ HH:MM[:SS]] (or with a T
+ * between the date and the time) to a time_t.
+ */
+static BOOL parseLogTime(
+    const char *text,           /* Time to convert */
+    time_t *result              /* Returned time */
+)
+{
+    struct tm tm;
+    char sep = ' ';
+    int n;
+    memset(&tm, 0, sizeof(tm));
+    n = sscanf(text, "%4d-%2d-%2d%c%2d:%2d:%2d", &tm.tm_year, &tm.tm_mon,
+               &tm.tm_mday, &sep, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if ((n != 3) && (n != 6) && (n != 7))
+        return FALSE;
+    if ((sep != ' ') && (sep != 'T'))
+        return FALSE;
+    tm.tm_year -= 1900;
+    tm.tm_mon--;
+    tm.tm_isdst = -1;
+    return ((*result = mktime(&tm)) != (time_t) -1);
+}
+
+static int jobLogSearch(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    int i;
+    char *project;
+    char *job;
+    int types[N_LOG_TYPES];
+    int nTypes = 0;
+    time_t startTime = 0;
+    time_t endTime = 0;
+    int maxMatches = 0;
+    char *patternText = NULL;
+    BOOL ignoreCase = FALSE;
+    PATTERN pattern;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (strcmp(opt, "i") == 0)
+        {
+            ignoreCase = TRUE;
+            continue;
+        }
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "type") == 0)
+        {
+            /* A comma-separated list of the types wanted */
+            while (!badOptions && (*arg != '\0'))
+            {
+                size_t len = strcspn(arg, ",");
+                if ((nTypes == N_LOG_TYPES) || !parseLogType(arg, len, &(types[nTypes])))
+                    badOptions = TRUE;
+                else
+                    nTypes++;
+                arg += len;
+                if (*arg == ',')
+                    arg++;
+            }
+        }
+        else if (strcmp(opt, "from") == 0)
+            badOptions = !parseLogTime(arg, &startTime);
+        else if (strcmp(opt, "to") == 0)
+            badOptions = !parseLogTime(arg, &endTime);
+        else if (strcmp(opt, "max") == 0)
+            badOptions = ((maxMatches = atoi(arg)) < 1);
+        else if (strcmp(opt, "pattern") == 0)
+            patternText = arg;
+        else
+            badOptions = TRUE;
+    }
+    /* Must be two parameters left... project and job */
+    if ((i+2) == argc)
+    {
+        project = argv[i];
+        job = argv[i+1];
+    }
+    else
+        badOptions = TRUE;
+    /* Report validation problems and exit */
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -logsearch\n");
+        fprintf(stderr, "\t\t\t[-type <INFO | WARNING | FATAL | REJECT | STARTED | RESET | BATCH | OTHER>[,...]]\n");
+        fprintf(stderr, "\t\t\t[-from <YYYY-MM-DD[ HH:MM[:SS]]>]\n");
+        fprintf(stderr, "\t\t\t[-to <YYYY-MM-DD[ HH:MM[:SS]]>]\n");
+        fprintf(stderr, "\t\t\t[-pattern <pattern> [-i]]\n");
+        fprintf(stderr, "\t\t\t[-max <n>]\n");
+        fprintf(stderr, "\t\t\t<project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    pattern.node = NULL;
+    pattern.nNodes = 0;
+    if ((patternText != NULL) && !compilePattern(&pattern, patternText, ignoreCase))
+        return DSJE_DSJOB_ERROR;
+    /* Attempt to open the project and open the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            DSLOGEVENT event;
+            int nMatches = 0;
+            /*
+             * The server can filter on one type; several are filtered here.
+             * Likewise it can stop at -max entries only if every entry it
+             * returns is a match.
+             */
+            status = DSFindFirstLogEntry(hJob, (nTypes == 1) ? types[0] : DSJ_LOGANY,
+                                startTime, endTime,
+                                ((nTypes <= 1) && (patternText == NULL)) ? maxMatches : 0,
+                                &event);
+            while (status == DSJE_NOERROR)
+            {
+                BOOL wanted = (nTypes <= 1);
+                for (i = 0; !wanted && (i < nTypes); i++)
+                    wanted = (event.type == types[i]);
+                if (wanted && ((patternText == NULL) || matchPattern(&pattern, event.message)))
+                {
+                    writeLogSummary(&stdoutBuf, event.eventId, event.type,
+                                    event.timestamp, event.message);
+                    if (++nMatches == maxMatches)
+                        break;
+                }
+                /* Go on to next entry */
+                status = DSFindNextLogEntry(hJob, &event);
+            }
+            outFlush(&stdoutBuf);
+            if ((status == DSJE_NOMORE) || (status == DSJE_NOERROR))
+                status = DSJE_NOERROR;
+            else
+                fprintf(stderr, "Error %d searching log\n", status);
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    freePattern(&pattern);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -logfollow sub-command
+ *
+ * Stream new log entries as they are written, until the job is no longer
+ * running. Each poll asks only for the newest event id; if it has moved,
+ * just the new entries are fetched, one at a time with DSGetLogEntry() for
+ * a small gap or with a DSFindFirstLogEntry() search starting at the time
+ * of the last entry seen for a large one. The last id seen can be kept in
+ * a cursor file so that a later -logfollow carries on where this one left
+ * off.
+ */
+#define FOLLOW_WINDOW   32      /* Largest gap fetched entry by entry */
+
+/*
+ * Write the entries after lastId up to newestId. Returns the id of the last
+ * entry written (or lastId if none were) and sets *status on error.
+ */
+static int followLog(
+    DSJOB hJob,                 /* Job whose log we are following */
+    int type,                   /* DSJ_LOGxxx type wanted, or DSJ_LOGANY */
+    int lastId,                 /* Newest entry already written */
+    int newestId,               /* Newest entry in the log */
+    int *status                 /* Returned error status */
+)
+{
+    DSLOGDETAIL detail;
+    DSLOGEVENT event;
+    int id;
+    int result = lastId;
+    if (newestId - lastId <= FOLLOW_WINDOW)
+    {
+        for (id = lastId + 1; id <= newestId; id++)
+        {
+            /* Entries may have been purged... just skip them */
+            if (DSGetLogEntry(hJob, id, &detail) != DSJE_NOERROR)
+                continue;
+            result = id;
+            /* The first line of the full text is the summary a search gives */
+            if ((type == DSJ_LOGANY) || (detail.type == type))
+                writeLogSummary(&stdoutBuf, detail.eventId, detail.type,
+                                detail.timestamp, detail.fullMessage);
+        }
+    }
+    else
+    {
+        /* Large gap... search from the time of the last entry we saw */
+        time_t startTime = 0;
+        int found;
+        if ((lastId >= 0) && (DSGetLogEntry(hJob, lastId, &detail) == DSJE_NOERROR))
+            startTime = detail.timestamp;
+        found = DSFindFirstLogEntry(hJob, type, startTime, 0, 0, &event);
+        while (found == DSJE_NOERROR)
+        {
+            if ((event.eventId > lastId) && (event.eventId <= newestId))
+            {
+                writeLogSummary(&stdoutBuf, event.eventId, event.type,
+                                event.timestamp, event.message);
+                if (event.eventId > result)
+                    result = event.eventId;
+            }
+            found = DSFindNextLogEntry(hJob, &event);
+        }
+        if (found != DSJE_NOMORE)
+            *status = found;
+        else
+            result = newestId;
+    }
+    outFlush(&stdoutBuf);
+    return result;
+}
+
+static int jobLogFollow(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status = DSJE_NOERROR;
+    int i;
+    char *project;
+    char *job;
+    int type = DSJ_LOGANY;
+    int interval = 2;
+    int lastId = -1;
+    char *cursorFile = NULL;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "type") == 0)
+        {
+            if (!parseLogType(arg, strlen(arg), &type))
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "interval") == 0)
+        {
+            if ((interval = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "since") == 0)
+            lastId = atoi(arg);
+        else if (strcmp(opt, "cursor") == 0)
+            cursorFile = arg;
+        else
+            badOptions = TRUE;
+    }
+    /* Must be two parameters left... project and job */
+    if ((i+2) == argc)
+    {
+        project = argv[i];
+        job = argv[i+1];
+    }
+    else
+        badOptions = TRUE;
+    /* Report validation problems and exit */
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -logfollow\n");
+        fprintf(stderr, "\t\t\t[-type <INFO | WARNING | FATAL | REJECT | STARTED | RESET | BATCH>]\n");
+        fprintf(stderr, "\t\t\t[-interval <seconds>]\n");
+        fprintf(stderr, "\t\t\t[-since <event id>]\n");
+        fprintf(stderr, "\t\t\t[-cursor <file>]\n");
+        fprintf(stderr, "\t\t\t<project> <job>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* A cursor file left by an earlier run says where we got to */
+    if ((cursorFile != NULL) && (lastId < 0))
+    {
+        FILE *fp = fopen(cursorFile, "r");
+        if (fp != NULL)
+        {
+            if (fscanf(fp, "%d", &lastId) != 1)
+                lastId = -1;
+            fclose(fp);
+        }
+    }
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /* With no cursor, start from the entries written from now on */
+            if (lastId < 0)
+                lastId = DSGetNewestLogId(hJob, DSJ_LOGANY);
+            while (status == DSJE_NOERROR)
+            {
+                DSJOBINFO jobInfo;
+                int newestId;
+                /*
+                 * Check the status before reading the log, so that the
+                 * entries written as the job finished are still read.
+                 */
+                status = DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo);
+                if (status != DSJE_NOERROR)
+                {
+                    fprintf(stderr, "Error %d getting job status\n", status);
+                    break;
+                }
+                newestId = DSGetNewestLogId(hJob, DSJ_LOGANY);
+                if (newestId > lastId)
+                {
+                    lastId = followLog(hJob, type, lastId, newestId, &status);
+                    if (status != DSJE_NOERROR)
+                        fprintf(stderr, "Error %d getting log entries\n", status);
+                    if (cursorFile != NULL)
+                    {
+                        FILE *fp = fopen(cursorFile, "w");
+                        if (fp != NULL)
+                        {
+                            fprintf(fp, "%d\n", lastId);
+                            fclose(fp);
+                        }
+                    }
+                }
+                if (jobInfo.info.jobStatus != DSJS_RUNNING)
+                    break;
+                Sleep(interval * 1000);
+            }
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -watch sub-command
+ *
+ * Watch the logs of a set of jobs (by default every job in the project)
+ * and write out each new entry of the types wanted as a record naming its
+ * job, on standard output or down a named pipe. For each job the newest
+ * event id is kept, of any type and of each type watched, so that a poll
+ * costs one DSGetNewestLogId() per job while nothing is being logged, and
+ * a type is only searched once its newest id moves on. The search starts
+ * at the time of the last entry of the type seen, so its cost follows the
+ * number of new entries rather than the size of the log.
+ *
+ * With -warnings, warnings are only written once a run has logged more
+ * than that many since the watch started, the count starting again when
+ * the newest DSJ_LOGSTARTED id shows that a new run has begun. The watch
+ * goes on until it is interrupted. While the pipe can't be opened no
+ * entries are taken, so none are lost before the reader comes back.
+ */
+#define DEFAULT_WATCH_INTERVAL 5
+
+typedef struct LOGWATCH
+{
+    char *job;                  /* Job name */
+    DSJOB hJob;                 /* Open job, NULL if it could not be opened */
+    int newestId;               /* Newest entry of any type */
+    int lastId[N_LOG_TYPES];    /* Newest entry of each type watched */
+    time_t lastTime[N_LOG_TYPES];   /* ... and its time, 0 until known */
+    int startedId;              /* Newest DSJ_LOGSTARTED entry */
+    int countedId;              /* Start of the run warnings are counted for */
+    int warnings;               /* Warnings counted */
+} LOGWATCH;
+
+/*
+ * The entries found in one poll of a job. Each type is searched on its
+ * own, so they are sorted back into event id order before being written.
+ */
+typedef struct WATCHEVENT
+{
+    int eventId;
+    int type;
+    time_t timestamp;
+    char *message;              /* malloc'ed */
+} WATCHEVENT;
+
+typedef struct WATCHEVENTS
+{
+    WATCHEVENT *event;
+    int nEvents;
+    int maxEvents;
+} WATCHEVENTS;
+
+static const char watchLogColumns[] = "job,eventId,type,typeCode,time,message";
+
+static BOOL addWatchEvent(
+    WATCHEVENTS *events,        /* List to add to */
+    DSLOGEVENT *event           /* Entry found */
+)
+{
+    WATCHEVENT *entry;
+    if (events->nEvents == events->maxEvents)
+    {
+        WATCHEVENT *bigger = realloc(events->event, (events->maxEvents + 64) * sizeof(WATCHEVENT));
+        if (bigger == NULL)
+            return FALSE;
+        events->event = bigger;
+        events->maxEvents += 64;
+    }
+    entry = &(events->event[events->nEvents]);
+    if ((entry->message = copyString(event->message)) == NULL)
+        return FALSE;
+    entry->eventId = event->eventId;
+    entry->type = event->type;
+    entry->timestamp = event->timestamp;
+    events->nEvents++;
+    return TRUE;
+}
+
+static int compareWatchEvents(
+    const void *a,
+    const void *b
+)
+{
+    int idA = ((const WATCHEVENT *) a)->eventId;
+    int idB = ((const WATCHEVENT *) b)->eventId;
+    return (idA < idB) ? -1 : (idA > idB) ? 1 : 0;
+}
+
+/*
+ * Collect the entries of the type watched in slot t that were logged after
+ * the last one seen, up to newestId. Sets *status if the search fails.
+ */
+static void scanLogType(
+    WATCHEVENTS *events,        /* List to add the entries to */
+    LOGWATCH *watch,            /* The job */
+    int t,                      /* Slot of the type */
+    int type,                   /* DSJ_LOGxxx type in the slot */
+    int newestId,               /* Newest entry of the type */
+    int threshold,              /* Warnings allowed in a run, -1 for no limit */
+    int *status                 /* Returned error status */
+)
+{
+    DSLOGDETAIL detail;
+    DSLOGEVENT event;
+    int found;
+    int lastId = watch->lastId[t];
+    if ((watch->lastTime[t] == 0) && (lastId > 0) &&
+            (DSGetLogEntry(watch->hJob, lastId, &detail) == DSJE_NOERROR))
+        watch->lastTime[t] = detail.timestamp;
+    found = DSFindFirstLogEntry(watch->hJob, type, watch->lastTime[t], 0, 0, &event);
+    while (found == DSJE_NOERROR)
+    {
+        if ((event.eventId > lastId) && (event.eventId <= newestId))
+        {
+            BOOL wanted = TRUE;
+            if ((type == DSJ_LOGWARNING) && (threshold >= 0))
+            {
+                /* The first warning after a new run started begins its count */
+                if ((watch->countedId != watch->startedId) && (event.eventId > watch->startedId))
+                {
+                    watch->countedId = watch->startedId;
+                    watch->warnings = 0;
+                }
+                wanted = (++(watch->warnings) > threshold);
+            }
+            if (wanted && !addWatchEvent(events, &event))
+            {
+                fprintf(stderr, "ERROR: Out of memory\n");
+                *status = DSJE_DSJOB_ERROR;
+                return;
+            }
+            if (event.eventId > watch->lastId[t])
+            {
+                watch->lastId[t] = event.eventId;
+                watch->lastTime[t] = event.timestamp;
+            }
+        }
+        found = DSFindNextLogEntry(watch->hJob, &event);
+    }
+    if (found != DSJE_NOMORE)
+    {
+        fprintf(stderr, "Error %d searching log of job '%s'\n", found, watch->job);
+        *status = found;
+    }
+    else
+        watch->lastId[t] = newestId;
+}
+
+/*
+ * Poll the log of one job, writing out the entries logged since the last
+ * poll. Sets *status on error.
+ */
+static void pollLogWatch(
+    OUTBUF *buf,                /* Buffer to write to */
+    LOGWATCH *watch,            /* The job */
+    int *types,                 /* DSJ_LOGxxx types watched */
+    int nTypes,
+    int threshold,              /* Warnings allowed in a run, -1 for no limit */
+    int *status                 /* Returned error status */
+)
+{
+    WATCHEVENTS events;
+    int newestId = DSGetNewestLogId(watch->hJob, DSJ_LOGANY);
+    int pollStatus = DSJE_NOERROR;
+    int t;
+    if (newestId < 0)
+    {
+        *status = DSGetLastError();
+        fprintf(stderr, "Error %d getting newest log id of job '%s'\n", *status, watch->job);
+        return;
+    }
+    if (newestId <= watch->newestId)
+        return;
+    memset(&events, 0, sizeof(events));
+    if (threshold >= 0)
+    {
+        int id = DSGetNewestLogId(watch->hJob, DSJ_LOGSTARTED);
+        if (id < 0)
+        {
+            pollStatus = DSGetLastError();
+            fprintf(stderr, "Error %d getting newest log id of job '%s'\n", pollStatus, watch->job);
+        }
+        else if (id > watch->startedId)
+            watch->startedId = id;
+    }
+    for (t = 0; t < nTypes; t++)
+    {
+        int id = DSGetNewestLogId(watch->hJob, types[t]);
+        if (id < 0)
+        {
+            pollStatus = DSGetLastError();
+            fprintf(stderr, "Error %d getting newest log id of job '%s'\n", pollStatus, watch->job);
+        }
+        else if (id > watch->lastId[t])
+            scanLogType(&events, watch, t, types[t], id, threshold, &pollStatus);
+    }
+    qsort(events.event, events.nEvents, sizeof(WATCHEVENT), compareWatchEvents);
+    for (t = 0; t < events.nEvents; t++)
+    {
+        WATCHEVENT *event = &(events.event[t]);
+        outBeginRecord(buf, watchLogColumns);
+        outStrField(buf, "job", NULL, watch->job);
+        outIntField(buf, "eventId", NULL, event->eventId);
+        outNameField(buf, "type", NULL, logTypeName(event->type), event->type);
+        outTimeField(buf, "time", NULL, event->timestamp);
+        outStrField(buf, "message", NULL, event->message);
+        outEndRecord(buf);
+        free(event->message);
+    }
+    free(events.event);
+    if ((threshold >= 0) && (watch->countedId != watch->startedId))
+    {
+        watch->countedId = watch->startedId;
+        watch->warnings = 0;
+    }
+    if (pollStatus == DSJE_NOERROR)
+        watch->newestId = newestId;
+    else
+        *status = pollStatus;
+}
+
+static int jobWatch(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSPROJECTINFO pInfo;
+    LOGWATCH *watch;
+    OUTBUF pipeBuf = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+    OUTBUF *buf = &stdoutBuf;
+    FILE *pipeFp = NULL;
+    int status = DSJE_NOERROR;
+    int i;
+    int t;
+    int nWatch = 0;
+    int nOpen = 0;
+    char *project;
+    char *str;
+    int types[N_LOG_TYPES];
+    int nTypes = 0;
+    int threshold = -1;
+    int interval = DEFAULT_WATCH_INTERVAL;
+    char pipeName[256];
+    BOOL usePipe = FALSE;
+    BOOL copied = FALSE;
+    BOOL waiting = FALSE;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "type") == 0)
+        {
+            /* A comma-separated list of the types wanted */
+            while (!badOptions && (*arg != '\0'))
+            {
+                size_t len = strcspn(arg, ",");
+                if ((nTypes == N_LOG_TYPES) || !parseLogType(arg, len, &(types[nTypes])))
+                    badOptions = TRUE;
+                else
+                    nTypes++;
+                arg += len;
+                if (*arg == ',')
+                    arg++;
+            }
+        }
+        else if (strcmp(opt, "warnings") == 0)
+        {
+            if ((threshold = atoi(arg)) < 0)
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "interval") == 0)
+        {
+            if ((interval = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else if ((strcmp(opt, "pipe") == 0) && (strlen(arg) <= 200))
+        {
+            sprintf(pipeName, PIPE_PREFIX "%s", arg);
+            usePipe = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be at least one parameter left... the project, then any jobs */
+    if (i >= argc)
+        badOptions = TRUE;
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -watch\n");
+        fprintf(stderr, "\t\t\t[-type <INFO | WARNING | FATAL | REJECT | STARTED | RESET | BATCH | OTHER>[,...]]\n");
+        fprintf(stderr, "\t\t\t[-warnings <n>]\n");
+        fprintf(stderr, "\t\t\t[-interval <seconds>]\n");
+        fprintf(stderr, "\t\t\t[-pipe <pipe name>]\n");
+        fprintf(stderr, "\t\t\t<project> [<job>...]\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* By default, fatal errors and warnings; -warnings implies warnings */
+    if (nTypes == 0)
+    {
+        types[nTypes++] = DSJ_LOGFATAL;
+        types[nTypes++] = DSJ_LOGWARNING;
+    }
+    if (threshold >= 0)
+    {
+        for (t = 0; (t < nTypes) && (types[t] != DSJ_LOGWARNING); t++)
+            ;
+        if ((t == nTypes) && (nTypes < N_LOG_TYPES))
+            types[nTypes++] = DSJ_LOGWARNING;
+    }
+    project = argv[i++];
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+        return status;
+    }
+
+    /* The jobs named, or else every job in the project */
+    if (i < argc)
+    {
+        if ((watch = calloc(argc - i, sizeof(LOGWATCH))) != NULL)
+            for (; i < argc; i++)
+                watch[nWatch++].job = argv[i];
+    }
+    else
+    {
+        status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &pInfo);
+        if (status == DSJE_NOT_AVAILABLE)
+        {
+            fprintf(stderr, "ERROR: No jobs to watch\n");
+            (void) closeProject(hProject);
+            return DSJE_DSJOB_ERROR;
+        }
+        if (status != DSJE_NOERROR)
+        {
+            fprintf(stderr, "Error %d getting job list\n", status);
+            (void) closeProject(hProject);
+            return status;
+        }
+        for (str = pInfo.info.jobList; *str != '\0'; str += strlen(str) + 1)
+            nWatch++;
+        copied = TRUE;
+        if ((watch = calloc(nWatch + 1, sizeof(LOGWATCH))) != NULL)
+            for (i = 0, str = pInfo.info.jobList; i < nWatch; i++, str += strlen(str) + 1)
+                if ((watch[i].job = copyString(str)) == NULL)
+                    nWatch = i;
+    }
+    if (watch == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        (void) closeProject(hProject);
+        return DSJE_DSJOB_ERROR;
+    }
+
+    /*
+     * Entries are taken from the newest at the start, which is newer than
+     * the newest of any one type, so that needs no further calls.
+     */
+    for (i = 0; i < nWatch; i++)
+    {
+        if ((watch[i].hJob = openJob(hProject, watch[i].job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job '%s'\n", watch[i].job);
+            continue;
+        }
+        nOpen++;
+        watch[i].newestId = DSGetNewestLogId(watch[i].hJob, DSJ_LOGANY);
+        if (watch[i].newestId < 0)
+        {
+            status = DSGetLastError();
+            fprintf(stderr, "Error %d getting newest log id of job '%s'\n", status, watch[i].job);
+            watch[i].newestId = -1;
+        }
+        for (t = 0; t < nTypes; t++)
+            watch[i].lastId[t] = watch[i].newestId;
+        watch[i].startedId = watch[i].countedId = watch[i].newestId;
+    }
+    if (nOpen > 0)
+    {
+        status = DSJE_NOERROR;
+        /*
+         * Records for a pipe are held in memory until the reader has them
+         * all, so any taken from the log when a reader goes away are sent
+         * to the next one. The header goes at the start of each connection,
+         * not in the held records.
+         */
+        if (usePipe)
+        {
+            pipeBuf.columns = watchLogColumns;
+            buf = &pipeBuf;
+        }
+    }
+    while ((nOpen > 0) && (status != DSJE_DSJOB_ERROR))
+    {
+        if (usePipe && (pipeFp == NULL))
+        {
+            OUTBUF head = { NULL, NULL, 0, 0, -1, "", NULL, 0 };
+            /* Nothing is taken until there is a reader */
+            if ((pipeFp = openPipeWriter(pipeName)) == NULL)
+            {
+                if (!waiting)
+                    fprintf(stderr, "Waiting for a reader on %s\n", pipeName);
+                waiting = TRUE;
+                Sleep(interval * 1000);
+                continue;
+            }
+            waiting = FALSE;
+            fprintf(stderr, "Writing to %s\n", pipeName);
+            outHeader(&head, watchLogColumns);
+            if (head.len > 0)
+                (void) fwrite(head.data, 1, head.len, pipeFp);
+            free(head.data);
+        }
+        for (i = 0; i < nWatch; i++)
+            if (watch[i].hJob != NULL)
+                pollLogWatch(buf, &(watch[i]), types, nTypes, threshold, &status);
+        outFlush(buf);
+        if (usePipe)
+        {
+            if (pipeBuf.len > 0)
+                (void) fwrite(pipeBuf.data, 1, pipeBuf.len, pipeFp);
+            fflush(pipeFp);
+            if (ferror(pipeFp))
+            {
+                fprintf(stderr, "ERROR: Lost %s\n", pipeName);
+                fclose(pipeFp);
+                pipeFp = NULL;
+            }
+            else
+                pipeBuf.len = 0;
+        }
+        Sleep(interval * 1000);
+    }
+    if (pipeFp != NULL)
+        fclose(pipeFp);
+    for (i = 0; i < nWatch; i++)
+    {
+        if (watch[i].hJob != NULL)
+            (void) closeJob(watch[i].hJob);
+        if (copied)
+            free(watch[i].job);
+    }
+    free(watch);
+    free(pipeBuf.data);
+    (void) closeProject(hProject);
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Fetching a range of log entries for -logdetail.
+ *
+ * DSGetLogEntry() costs a server round trip per entry, so a range is split
+ * into blocks of DETAIL_BLOCK entries that the workers fetch concurrently,
+ * each on its own job handle, formatting each block into a memory OUTBUF.
+ * Blocks must come out in event id order, so the worker that completes a
+ * block also writes out any completed blocks at the head of the range.
+ *
+ * A worker claims a block only once it holds one of the nSlots slots (the
+ * slotFree semaphore counts the free ones), and a slot is given back when
+ * its block has been written out. So no more than nSlots blocks are ever
+ * held in memory however far ahead some workers get, and because a slot is
+ * taken before a block is claimed, the oldest block not yet written out is
+ * always in the hands of a worker. The blocks held are always consecutive,
+ * so block b can simply use slot b % nSlots.
+ */
+#define DETAIL_BLOCK    64
+
+typedef struct DETAILSLOT
+{
+    int block;                  /* Block held, or -1 if the slot is free */
+    BOOL done;                  /* TRUE once the block has been fetched */
+    OUTBUF buf;                 /* The block's formatted entries */
+} DETAILSLOT;
+
+typedef struct DETAILRANGE
+{
+    char *project;
+    char *job;
+    int *ids;                   /* Event ids to fetch, or NULL for... */
+    int firstId;                /* ...the nIds ids from firstId on */
+    int nIds;
+    int nBlocks;
+    volatile LONG nextBlock;    /* Next block to be claimed */
+    int nextOutput;             /* Next block to be written out */
+    DETAILSLOT *slots;
+    int nSlots;
+    HANDLE slotFree;            /* Counts the free slots */
+    CRITICAL_SECTION lock;      /* Guards the slots, nextOutput and status */
+    int status;                 /* First error seen */
+} DETAILRANGE;
+
+static void detailWorker(
+    WORKER *worker              /* Calling worker */
+)
+{
+    DETAILRANGE *range = worker->context;
+    DSJOB hJob = NULL;
+    int openStatus = DSJE_NOERROR;
+    for (;;)
+    {
+        DETAILSLOT *slot;
+        LONG block;
+        int i;
+        int last;
+        (void) WaitForSingleObject(range->slotFree, INFINITE);
+        block = InterlockedIncrement(&(range->nextBlock)) - 1;
+        if (block >= range->nBlocks)
+        {
+            (void) ReleaseSemaphore(range->slotFree, 1, NULL);
+            break;
+        }
+        slot = &(range->slots[block % range->nSlots]);
+        EnterCriticalSection(&(range->lock));
+        slot->block = block;
+        slot->done = FALSE;
+        LeaveCriticalSection(&(range->lock));
+        /* Fetch and format the block's entries */
+        if ((hJob == NULL) && (openStatus == DSJE_NOERROR))
+        {
+            hJob = workerJob(worker, range->project, range->job, &openStatus);
+            if (hJob == NULL)
+            {
+                fprintf(stderr, "ERROR: Failed to open job\n");
+                EnterCriticalSection(&(range->lock));
+                if (range->status == DSJE_NOERROR)
+                    range->status = openStatus;
+                LeaveCriticalSection(&(range->lock));
+            }
+        }
+        last = (block + 1) * DETAIL_BLOCK;
+        if (last > range->nIds)
+            last = range->nIds;
+        for (i = block * DETAIL_BLOCK; (i < last) && (hJob != NULL); i++)
+        {
+            DSLOGDETAIL logDetail;
+            int eventId = (range->ids != NULL) ? range->ids[i] : range->firstId + i;
+            int status = DSGetLogEntry(hJob, eventId, &logDetail);
+            if (status == DSJE_NOERROR)
+            {
+                outBeginRecord(&(slot->buf), logDetailColumns);
+                writeLogDetail(&(slot->buf), 0, &logDetail);
+                outText(&(slot->buf), "\n");
+                outEndRecord(&(slot->buf));
+            }
+            else
+            {
+                fprintf(stderr, "Error %d getting details of event %d\n", status, eventId);
+                EnterCriticalSection(&(range->lock));
+                if (range->status == DSJE_NOERROR)
+                    range->status = status;
+                LeaveCriticalSection(&(range->lock));
+            }
+        }
+        /* Write out whatever is now complete at the head of the range */
+        EnterCriticalSection(&(range->lock));
+        slot->done = TRUE;
+        for (;;)
+        {
+            DETAILSLOT *head = &(range->slots[range->nextOutput % range->nSlots]);
+            if ((head->block != range->nextOutput) || !head->done)
+                break;
+            outMem(&stdoutBuf, head->buf.data, head->buf.len);
+            head->buf.len = 0;
+            head->block = -1;
+            head->done = FALSE;
+            range->nextOutput++;
+            (void) ReleaseSemaphore(range->slotFree, 1, NULL);
+        }
+        LeaveCriticalSection(&(range->lock));
+    }
+    if (hJob != NULL)
+        (void) DSCloseJob(hJob);
+}
+
+static int compareInts(
+    const void *a,              /* Pointers to the ints to compare */
+    const void *b
+)
+{
+    int x = *(const int *) a;
+    int y = *(const int *) b;
+    return (x < y) ? -1 : (x > y);
+}
+
+/*
+ * Collect the ids of the entries of one type that lie in a range of ids,
+ * in ascending order. Returns the number found, or -1 on failure with
+ * *status set.
+ */
+static int findLogIds(
+    DSJOB hJob,                 /* Job to search */
+    int type,                   /* Type of entry wanted */
+    int firstId,                /* Range of ids wanted */
+    int lastId,
+    int **idsOut,               /* Returned malloc'd array of ids */
+    int *status                 /* Returned error status */
+)
+{
+    DSLOGEVENT event;
+    int *ids = NULL;
+    int nIds = 0;
+    int maxIds = 0;
+    BOOL ascending = TRUE;
+    int result;
+    *idsOut = NULL;
+    result = DSFindFirstLogEntry(hJob, type, (time_t) 0, (time_t) 0, 0, &event);
+    while (result == DSJE_NOERROR)
+    {
+        if ((event.eventId >= firstId) && (event.eventId <= lastId))
+        {
+            if (nIds == maxIds)
+            {
+                int *bigger;
+                maxIds = (maxIds == 0) ? 256 : maxIds * 2;
+                if ((bigger = realloc(ids, maxIds * sizeof(int))) == NULL)
+                {
+                    free(ids);
+                    *status = DSJE_DSJOB_ERROR;
+                    fprintf(stderr, "ERROR: Out of memory\n");
+                    return -1;
+                }
+                ids = bigger;
+            }
+            if ((nIds > 0) && (event.eventId < ids[nIds-1]))
+                ascending = FALSE;
+            ids[nIds++] = event.eventId;
+        }
+        else if (ascending && (event.eventId > lastId))
+            break;              /* Past the end of the range */
+        result = DSFindNextLogEntry(hJob, &event);
+    }
+    if ((result != DSJE_NOERROR) && (result != DSJE_NOMORE))
+    {
+        free(ids);
+        *status = result;
+        fprintf(stderr, "Error %d getting log summary\n", result);
+        return -1;
+    }
+    if (!ascending)
+        qsort(ids, nIds, sizeof(int), compareInts);
+    *idsOut = ids;
+    return nIds;
+}
+
+/*
+ * Write out the details of the entries in a range of ids, optionally only
+ * those of one type.
+ */
+static int logDetailRange(
+    char *project,              /* Project and job */
+    char *job,
+    int type,                   /* Type wanted, DSJ_LOGANY for all */
+    int firstId,                /* Range of ids, lastId < 0 for the newest */
+    int lastId,
+    int nThreads                /* Number of workers */
+)
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    DETAILRANGE range;
+    int status = DSJE_NOERROR;
+    int i;
+    memset(&range, 0, sizeof(range));
+    range.project = project;
+    range.job = job;
+    /* Work out which entries are wanted */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+        return status;
+    }
+    if ((hJob = openJob(hProject, job, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open job\n");
+        (void) closeProject(hProject);
+        return status;
+    }
+    {
+        int newestId = DSGetNewestLogId(hJob, DSJ_LOGANY);
+        if ((lastId < 0) || (lastId > newestId))
+            lastId = newestId;
+    }
+    if (firstId < 0)
+        firstId = 0;
+    if (lastId < firstId)
+        range.nIds = 0;
+    else if (type == DSJ_LOGANY)
+    {
+        range.firstId = firstId;
+        range.nIds = lastId - firstId + 1;
+    }
+    else
+        range.nIds = findLogIds(hJob, type, firstId, lastId, &(range.ids), &status);
+    (void) closeJob(hJob);
+    (void) closeProject(hProject);
+    if (range.nIds <= 0)
+        return status;
+
+    /* Fetch the blocks */
+    range.nBlocks = (range.nIds + DETAIL_BLOCK - 1) / DETAIL_BLOCK;
+    if (nThreads > range.nBlocks)
+        nThreads = range.nBlocks;
+    if (nThreads > MAX_THREADS)
+        nThreads = MAX_THREADS;
+    range.nSlots = 2 * nThreads;
+    if ((range.slots = calloc(range.nSlots, sizeof(DETAILSLOT))) == NULL)
+    {
+        free(range.ids);
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Any CSV/TSV header is written once, before all the blocks */
+    outHeader(&stdoutBuf, logDetailColumns);
+    for (i = 0; i < range.nSlots; i++)
+    {
+        range.slots[i].block = -1;
+        range.slots[i].buf.lastTime = -1;
+        range.slots[i].buf.columns = stdoutBuf.columns;
+    }
+    if ((range.slotFree = CreateSemaphore(NULL, range.nSlots, range.nSlots, NULL)) == NULL)
+    {
+        free(range.slots);
+        free(range.ids);
+        fprintf(stderr, "ERROR: Failed to create semaphore\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    InitializeCriticalSection(&(range.lock));
+    runWorkers(nThreads, detailWorker, &range);
+    outFlush(&stdoutBuf);
+    DeleteCriticalSection(&(range.lock));
+    CloseHandle(range.slotFree);
+    for (i = 0; i < range.nSlots; i++)
+        free(range.slots[i].buf.data);
+    free(range.slots);
+    free(range.ids);
+    return range.status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -logdetail sub-command
+ */
+static int jobLogDetail(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status;
+    int i;
+    char *project;
+    char *job;
+    char *range;
+    int eventId;
+    int lastId;
+    int type = DSJ_LOGANY;
+    int nThreads = DEFAULT_THREADS;
+    BOOL badOptions = FALSE;
+    DSLOGDETAIL logDetail;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "type") == 0)
+        {
+            if (!parseLogType(arg, strlen(arg), &type))
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "threads") == 0)
+        {
+            if ((nThreads = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else
+            badOptions = TRUE;
+    }
+    /* Must be three parameters left... project, job and event id or range */
+    if ((i+3) == argc)
+    {
+        project = argv[i];
+        job = argv[i+1];
+        range = argv[i+2];
+    }
+    else
+        badOptions = TRUE;
+    /* Report validation problems and exit */
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -logdetail\n");
+        fprintf(stderr, "\t\t\t[-type <INFO | WARNING | FATAL | REJECT | STARTED | RESET | BATCH>]\n");
+        fprintf(stderr, "\t\t\t[-threads <n>]\n");
+        fprintf(stderr, "\t\t\t<project> <job> <event id | first-[last]>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    eventId = atoi(range);
+    /* A range of ids, or a type to pick out, is fetched by the workers */
+    if ((strchr(range, '-') != NULL) || (type != DSJ_LOGANY))
+    {
+        char *dash = strchr(range, '-');
+        lastId = (dash == NULL) ? eventId : (dash[1] == '\0') ? -1 : atoi(dash + 1);
+        return logDetailRange(project, job, type, eventId, lastId, nThreads);
+    }
+    /* Attempt to open the project and the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
+        else
+        {
+            /* Try getting all the log info */
+            status = DSGetLogEntry(hJob, eventId, &logDetail);
+            if (status != DSJE_NOERROR)
+                fprintf(stderr, "Error %d getting event details\n", status);
+            else
+            {
+                outBeginRecord(&stdoutBuf, logDetailColumns);
+                writeLogDetail(&stdoutBuf, 0, &logDetail);
+                outEndRecord(&stdoutBuf);
+            }
+            (void) closeJob(hJob);
+        }
+        (void) closeProject(hProject);
+    }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Handle the -lognewest sub-command
+ */
+static int jobLogNewest(int argc, char *argv[])
+{
+    DSPROJECT hProject;
+    DSJOB hJob;
+    int status = DSJE_NOERROR;
+    char *project;
+    char *job;
+    int type = DSJ_LOGANY;
+    BOOL badOptions = FALSE;
+    int id;
+    /* Validate arguments and extract optional arguments */
+    /* Must be at least two parameters left... project, job. Type is optional */
+    if ((argc < 2) || (argc > 3))
+            badOptions = TRUE;
+        else
+        {
+            project = argv[0];
+            job = argv[1];
+            if (argc == 3)
+            {
+                char *arg = argv[2];
+                if (!parseLogType(arg, strlen(arg), &type))
+                    badOptions = TRUE;
+            }
+        }
+        if (badOptions)
+        {
+            fprintf(stderr, "Invalid arguments: dsjob -lognewest <project> <job> [<event type>]\n");
+            fprintf(stderr, "\t event type = INFO | WARNING | FATAL | REJECT | STARTED | RESET | BATCH\n");
+            return DSJE_DSJOB_ERROR;
+        }
+        /* Attempt to open the project and the job */
+        if ((hProject = openProject(project, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open project\n");
+        }
+        else
+        {
+            if ((hJob = openJob(hProject, job, &status)) == NULL)
+            {
+                fprintf(stderr, "ERROR: Failed to open job\n");
+            }
+            else
+            {
+                /* Get the newest it */
+                id = DSGetNewestLogId(hJob, type);
+                if (id < 0)
+                {
+                    status = DSGetLastError();
+                    fprintf(stderr, "Error %d getting event details\n", status);
+                }
+                else
+                {
+                    outBeginRecord(&stdoutBuf, "newestId");
+                    outIntField(&stdoutBuf, "newestId", "Newsest id = ", id);
+                    outEndRecord(&stdoutBuf);
+                }
+                    (void) closeJob(hJob);
+                }
+            (void) closeProject(hProject);
+        }
+    return status;
+}
+
+/*****************************************************************************/
+/*
+ * Log archives (-logarchive and -logread).
+ *
+ * An archive holds the full detail of a job's log entries in a compact
+ * form that can be read without the server. After a LOGARCHHEADER, the
+ * entries are stored in blocks of LOGARCH_BLOCK, each laid out column by
+ * column:
+ *
+ *  - the number of entries in the block
+ *  - the event ids, the first in full and the rest as the difference from
+ *    the one before
+ *  - the timestamps, likewise, the differences zigzag encoded since the
+ *    log need not be in time order
+ *  - the event types, a byte each
+ *  - the message template numbers
+ *  - the variable parts of the messages
+ *
+ * A message template is the message with each run of digits replaced by a
+ * LOGARCH_VAR byte, so messages such as "processed 1000 rows" that differ
+ * only in their numbers share a template, kept once in the dictionary; a
+ * LOGARCH_VAR in the message itself is kept as a variable part too. The
+ * variable parts are stored in the block in order, and a message is a
+ * string list whose final terminator is left off. Every number is written
+ * as a base 128 varint, seven bits to a byte with the top bit set on every
+ * byte but the last.
+ *
+ * The dictionary follows the blocks, a varint length and the bytes of each
+ * template, and is followed by the index: a LOGARCHINDEX for each block
+ * with its range of ids and times and where it is, so that a reader need
+ * only decode the blocks that hold the entries it wants.
  */
-static void printStrList(
-    int indent,                 /* Number of tabs to indent */
-    char *str                   /* String list to print */
+#define LOGARCH_MAGIC   "DSJLOG01"
+#define LOGARCH_BLOCK   256     /* Entries per block */
+#define LOGARCH_VAR     '\001'  /* Marks a variable part in a template */
+
+typedef struct LOGARCHHEADER
+{
+    char magic[8];              /* LOGARCH_MAGIC */
+    unsigned nEvents;
+    unsigned nBlocks;
+    unsigned nTemplates;
+    unsigned dictOffset;        /* Where the dictionary starts */
+    unsigned indexOffset;       /* Where the index starts */
+} LOGARCHHEADER;
+
+typedef struct LOGARCHINDEX
+{
+    int firstId;                /* Ids of the first and last entry */
+    int lastId;
+    unsigned minTime;           /* Earliest and latest timestamp */
+    unsigned maxTime;
+    unsigned offset;            /* Where the block starts */
+    unsigned size;              /* Bytes in the block */
+} LOGARCHINDEX;
+
+/*
+ * The message templates seen so far by -logarchive, with a hash table of
+ * their numbers for finding a template again.
+ */
+typedef struct LOGDICT
+{
+    OUTBUF text;                /* The templates, one after another */
+    size_t *start;              /* Where each template starts in text */
+    size_t *len;
+    int nTemplates;
+    int maxTemplates;
+    int *table;                 /* Template number + 1, 0 for empty */
+    int tableSize;              /* A power of two */
+} LOGDICT;
+
+static void putVarint(
+    OUTBUF *buf,                /* Buffer to write to */
+    unsigned long value
 )
 {
-    int i;
-    while(*str != '\0')
+    while (value >= 0x80)
     {
-        for (i = 0; i < indent; i++)
-            putchar('\t');
-        printf("%s\n", str);
-        str += (strlen(str) + 1);
+        outChar(buf, (char) ((value & 0x7f) | 0x80));
+        value >>= 7;
     }
+    outChar(buf, (char) value);
+}
+
+static void putSigned(
+    OUTBUF *buf,                /* Buffer to write to */
+    long value
+)
+{
+    putVarint(buf, (value < 0) ? ((0UL - (unsigned long) (value + 1)) << 1) | 1 :
+              (unsigned long) value << 1);
 }
 
-/*****************************************************************************/
 /*
- * Print out the details of a job log entry. Each line we print is prefixed
- * by the requested number of tabs.
+ * Read a varint, returning FALSE if it runs off the end of the data.
  */
-static void printLogDetail(
-    int indent,                 /* Number of tabs to indent by */
-    DSLOGDETAIL *logDetail      /* The log entry to print */
+static BOOL getVarint(
+    const unsigned char **p,    /* Where to read, advanced past the varint */
+    const unsigned char *end,   /* End of the data */
+    unsigned long *value        /* Returned value */
 )
 {
-    char prefix[6] = "\t\t\t\t\t";
-    prefix[indent] = '\0';
-    printf("%sEvent Id: ", prefix);
-    if (logDetail->eventId < 0)
-        printf("unknown");
-    else
-        printf("%d", logDetail->eventId);
-    printf("\n");
-    printf("%sTime\t: %s", prefix, ctime(&(logDetail->timestamp)));
-    printf("%sType\t: ", prefix);
-    switch(logDetail->type)
+    int shift;
+    *value = 0;
+    for (shift = 0; (*p < end) && (shift < 35); shift += 7)
     {
-    case DSJ_LOGINFO:
-        printf("INFO");
-        break;
-    case DSJ_LOGWARNING:
-        printf("WARNING");
-        break;
-    case DSJ_LOGFATAL:
-        printf("FATAL");
-        break;
-    case DSJ_LOGREJECT:
-        printf("REJECT");
-        break;
-    case DSJ_LOGSTARTED:
-        printf("STARTED");
-        break;
-    case DSJ_LOGRESET:
-        printf("RESET");
-        break;
-    case DSJ_LOGBATCH:
-        printf("BATCH");
-        break;
-    case DSJ_LOGOTHER:
-        printf("OTHER");
-        break;
-    default:
-        printf("????");
-        break; 
+        unsigned char byte = *(*p)++;
+        *value |= (unsigned long) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return TRUE;
     }
-    printf("\n");
-    printf("%sMessage\t:\n", prefix);
-    printStrList(indent+1, logDetail->fullMessage);
+    return FALSE;
+}
+
+static long signedValue(
+    unsigned long value         /* Zigzag encoded value */
+)
+{
+    return (value & 1) ? -(long) (value >> 1) - 1 : (long) (value >> 1);
+}
+
+static void freeLogDict(
+    LOGDICT *dict
+)
+{
+    free(dict->text.data);
+    free(dict->start);
+    free(dict->len);
+    free(dict->table);
 }
 
-/*****************************************************************************/
-#define MAX_PARAMS 10 /* Arbitrary value */
 /*
- * Set a jobs parameter at the server end based on the "name=value" string
- * that we are given. This involves asking the server what the type of
- * the parameter is, converting the value part to that type and constructing
- * a DSPARAM value, and then calling DSSetParam to register the parameter and
- * its value.
+ * Return the number of a template, adding it to the dictionary if it is
+ * new, or -1 if we run out of memory.
  */
-static int setParam(
-    DSJOB hJob,             /* Job parameter belongs to */
-    char *param             /* param=value string */
+static int findTemplate(
+    LOGDICT *dict,
+    const char *text,           /* The template */
+    size_t len
 )
 {
-    char *value;
-    int status;
-    DSPARAMINFO paramInfo;
-    DSPARAM paramData;
-    /* Get the parameter name and its value string */
-    value = strchr(param, '=');
-    *value++ = '\0';
-    /* Get the parameter information which tells us what type it is */
-    status = DSGetParamInfo(hJob, param, &paramInfo);
-    if (status != DSJE_NOERROR)
-        fprintf(stderr, "Error %d getting information for parameter '%s'\n", status, param);
+    unsigned long hash = fnvHashBytes(text, len);
+    int slot;
+    int n;
+    /* Keep the table no more than half full */
+    if (2 * (dict->nTemplates + 1) > dict->tableSize)
+    {
+        int size = (dict->tableSize == 0) ? 256 : 2 * dict->tableSize;
+        int *table = calloc(size, sizeof(int));
+        int i;
+        if (table == NULL)
+            return -1;
+        for (i = 0; i < dict->nTemplates; i++)
+        {
+            slot = (int) (fnvHashBytes(dict->text.data + dict->start[i], dict->len[i]) & (size - 1));
+            while (table[slot] != 0)
+                slot = (slot + 1) & (size - 1);
+            table[slot] = i + 1;
+        }
+        free(dict->table);
+        dict->table = table;
+        dict->tableSize = size;
+    }
+    for (slot = (int) (hash & (dict->tableSize - 1)); (n = dict->table[slot]) != 0;
+            slot = (slot + 1) & (dict->tableSize - 1))
+        if ((dict->len[n - 1] == len) &&
+                (memcmp(dict->text.data + dict->start[n - 1], text, len) == 0))
+            return n - 1;
+    if (dict->nTemplates == dict->maxTemplates)
+    {
+        int max = dict->maxTemplates + 256;
+        size_t *start = realloc(dict->start, max * sizeof(size_t));
+        size_t *lens;
+        if (start == NULL)
+            return -1;
+        dict->start = start;
+        if ((lens = realloc(dict->len, max * sizeof(size_t))) == NULL)
+            return -1;
+        dict->len = lens;
+        dict->maxTemplates = max;
+    }
+    dict->start[dict->nTemplates] = dict->text.len;
+    dict->len[dict->nTemplates] = len;
+    outMem(&(dict->text), text, len);
+    if (dict->text.len != dict->start[dict->nTemplates] + len)
+        return -1;
+    dict->table[slot] = ++(dict->nTemplates);
+    return dict->nTemplates - 1;
+}
+
+static BOOL isLogVar(
+    char c
+)
+{
+    return (isdigit((unsigned char) c) || (c == LOGARCH_VAR));
+}
+
+/*
+ * The columns of the block being built by -logarchive.
+ */
+typedef struct LOGBLOCK
+{
+    OUTBUF ids;
+    OUTBUF times;
+    OUTBUF types;
+    OUTBUF templates;
+    OUTBUF vars;
+    OUTBUF scratch;             /* For building a template */
+    int nEvents;
+    LOGARCHINDEX index;
+    int lastId;
+    unsigned lastTime;
+} LOGBLOCK;
+
+/*
+ * Add a log entry to the block. Returns FALSE if we run out of memory.
+ */
+static BOOL addLogArchive(
+    LOGBLOCK *block,
+    LOGDICT *dict,
+    DSLOGDETAIL *detail
+)
+{
+    const char *msg = detail->fullMessage;
+    const char *p;
+    size_t len = 0;
+    unsigned t = (unsigned) detail->timestamp;
+    int number;
+    /* The message is a string list, ended by an empty string */
+    if (msg != NULL)
+        for (p = msg; *p != '\0'; p += strlen(p) + 1)
+            len = (size_t) (p - msg) + strlen(p);
+    if (block->nEvents == 0)
+    {
+        block->index.firstId = detail->eventId;
+        block->index.minTime = t;
+        block->index.maxTime = t;
+        putVarint(&(block->ids), (unsigned long) detail->eventId);
+        putVarint(&(block->times), t);
+    }
     else
     {
-        /*
-         * Construct the value structure to pass to the server. We could
-         * attempt to validate some of these parameters rather than
-         * simply copying them... but for simplicity we don't!
-         */
-        paramData.paramType = paramInfo.paramType;
-        switch(paramInfo.paramType)
+        putVarint(&(block->ids), (unsigned long) (detail->eventId - block->lastId));
+        putSigned(&(block->times), (long) t - (long) block->lastTime);
+        if (t < block->index.minTime)
+            block->index.minTime = t;
+        if (t > block->index.maxTime)
+            block->index.maxTime = t;
+    }
+    block->index.lastId = detail->eventId;
+    block->lastId = detail->eventId;
+    block->lastTime = t;
+    outChar(&(block->types), (char) detail->type);
+    /* Split the message into its template and variable parts */
+    block->scratch.len = 0;
+    for (p = msg; p < msg + len; )
+    {
+        if (isLogVar(*p))
         {
-        case DSJ_PARAMTYPE_STRING:
-            paramData.paramValue.pString = value;
-            break;
-        case DSJ_PARAMTYPE_ENCRYPTED:
-            paramData.paramValue.pEncrypt = value;
-            break;
-        case DSJ_PARAMTYPE_INTEGER:
-            paramData.paramValue.pInt = atoi(value);
-            break;
-        case DSJ_PARAMTYPE_FLOAT:
-            paramData.paramValue.pFloat = (float) atof(value);
-            break;
-        case DSJ_PARAMTYPE_PATHNAME:
-            paramData.paramValue.pPath = value;
-            break;
-        case DSJ_PARAMTYPE_LIST:
-            paramData.paramValue.pListValue = value;
-            break;
-        case DSJ_PARAMTYPE_DATE:
-            paramData.paramValue.pDate = value;
-            break;
-        case DSJ_PARAMTYPE_TIME:
-            paramData.paramValue.pTime = value;
-            break;
-        default:        /* try string!!!! */
-            paramData.paramType = DSJ_PARAMTYPE_STRING;
-            paramData.paramValue.pString = value;
-            break;
+            const char *end = p;
+            while ((end < msg + len) && isLogVar(*end))
+                end++;
+            outChar(&(block->scratch), LOGARCH_VAR);
+            putVarint(&(block->vars), (unsigned long) (end - p));
+            outMem(&(block->vars), p, end - p);
+            p = end;
         }
-        /* Try setting the parameter */
-        status = DSSetParam(hJob, param, &paramData);
-        if (status != DSJE_NOERROR)
-            fprintf(stderr, "Error setting value of parameter '%s'\n", param);
+        else
+            outChar(&(block->scratch), *p++);
     }
-    return status;
+    if ((number = findTemplate(dict, block->scratch.data, block->scratch.len)) < 0)
+        return FALSE;
+    putVarint(&(block->templates), (unsigned long) number);
+    block->nEvents++;
+    return TRUE;
 }
 
-/*****************************************************************************/
 /*
- * Handle the -run sub-command
+ * Write out the block, and add it to the index. Returns FALSE if we run
+ * out of memory.
  */
-static int jobRun(int argc, char *argv[])
+static BOOL flushLogArchive(
+    FILE *fp,                   /* Archive */
+    LOGBLOCK *block,
+    OUTBUF *index               /* The index so far */
+)
+{
+    OUTBUF count;
+    char data[8];
+    size_t indexLen = index->len;
+    count.fp = NULL;
+    count.data = data;
+    count.len = 0;
+    count.size = sizeof(data);
+    putVarint(&count, (unsigned long) block->nEvents);
+    block->index.offset = (unsigned) ftell(fp);
+    (void) fwrite(count.data, 1, count.len, fp);
+    (void) fwrite(block->ids.data, 1, block->ids.len, fp);
+    (void) fwrite(block->times.data, 1, block->times.len, fp);
+    (void) fwrite(block->types.data, 1, block->types.len, fp);
+    (void) fwrite(block->templates.data, 1, block->templates.len, fp);
+    (void) fwrite(block->vars.data, 1, block->vars.len, fp);
+    block->index.size = (unsigned) ftell(fp) - block->index.offset;
+    outMem(index, (const char *) &(block->index), sizeof(LOGARCHINDEX));
+    block->ids.len = 0;
+    block->times.len = 0;
+    block->types.len = 0;
+    block->templates.len = 0;
+    block->vars.len = 0;
+    block->nEvents = 0;
+    return (index->len == indexLen + sizeof(LOGARCHINDEX));
+}
+
+/*
+ * Handle the -logarchive sub-command
+ */
+static const char logArchiveColumns[] = "events,templates,bytes";
+
+static int jobLogArchive(int argc, char *argv[])
 {
     DSPROJECT hProject;
     DSJOB hJob;
-    int status;
+    int status = DSJE_NOERROR;
     int i;
     char *project;
     char *job;
-    int mode = DSJ_RUNNORMAL;
-    int warningLimit = -1;
-    int rowLimit = 0;
+    char *fileName;
+    int sinceId = -1;
     BOOL badOptions = FALSE;
-    char *param[MAX_PARAMS];
-    int nParams = 0;
-    BOOL waitForJob = FALSE;
     /* Validate arguments and extract optional arguments */
-    for (i = 0; (i < argc) && !badOptions && (
-                (argv[i][0] == '-') || (argv[i][0] == '/')); i++)
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
     {
         char *opt = &(argv[i][1]);
-        if (strcmp(opt, "wait") == 0)
-            waitForJob = TRUE;
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "since") == 0)
+            sinceId = atoi(arg);
+        else
+            badOptions = TRUE;
+    }
+    /* Must be three parameters left... project, job and archive file */
+    if ((i+3) == argc)
+    {
+        project = argv[i];
+        job = argv[i+1];
+        fileName = argv[i+2];
+    }
+    else
+        badOptions = TRUE;
+    /* Report validation problems and exit */
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -logarchive\n");
+        fprintf(stderr, "\t\t\t[-since <event id>]\n");
+        fprintf(stderr, "\t\t\t<project> <job> <archive file>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    /* Attempt to open the project and open the job */
+    if ((hProject = openProject(project, &status)) == NULL)
+    {
+        fprintf(stderr, "ERROR: Failed to open project\n");
+    }
+    else
+    {
+        if ((hJob = openJob(hProject, job, &status)) == NULL)
+        {
+            fprintf(stderr, "ERROR: Failed to open job\n");
+        }
         else
         {
-            char *arg = argv[i+1];
-            if (++i >= argc)
-                badOptions = TRUE;
-            else if (strcmp(opt, "mode") == 0)
+            int newestId = DSGetNewestLogId(hJob, DSJ_LOGANY);
+            FILE *fp = NULL;
+            if (newestId < 0)
             {
-                if (strcmp(arg, "NORMAL") == 0)
-                    mode = DSJ_RUNNORMAL;
-                else if (strcmp(arg, "RESET") == 0)
-                    mode = DSJ_RUNRESET;
-                else if (strcmp(arg, "VALIDATE") == 0)
-                    mode = DSJ_RUNVALIDATE;
-                else
-                    badOptions = TRUE;
+                status = DSGetLastError();
+                fprintf(stderr, "Error %d getting newest log id\n", status);
             }
-            else if (strcmp(opt, "param") == 0)
+            else if ((fp = fopen(fileName, "wb")) == NULL)
             {
-                if (strchr(arg, '=') == NULL)
-                    badOptions = TRUE;
-                else
-                    param[nParams++] = arg;
+                fprintf(stderr, "ERROR: Failed to create archive '%s'\n", fileName);
+                status = DSJE_DSJOB_ERROR;
             }
-            else if (strcmp(opt, "warn") == 0)
-                warningLimit = atoi(arg);
-            else if (strcmp(opt, "rows") == 0)
-                rowLimit = atoi(arg);
             else
-                badOptions = TRUE;
+            {
+                LOGARCHHEADER header;
+                LOGBLOCK block;
+                LOGDICT dict;
+                OUTBUF index;
+                int id;
+                memset(&header, 0, sizeof(header));
+                memset(&block, 0, sizeof(block));
+                memset(&dict, 0, sizeof(dict));
+                memset(&index, 0, sizeof(index));
+                memcpy(header.magic, LOGARCH_MAGIC, 8);
+                (void) fwrite(&header, sizeof(header), 1, fp);
+                for (id = sinceId + 1; (id <= newestId) && (status == DSJE_NOERROR); id++)
+                {
+                    DSLOGDETAIL detail;
+                    /* Entries may have been purged... just skip them */
+                    if (DSGetLogEntry(hJob, id, &detail) != DSJE_NOERROR)
+                        continue;
+                    if (!addLogArchive(&block, &dict, &detail) ||
+                            ((block.nEvents == LOGARCH_BLOCK) && !flushLogArchive(fp, &block, &index)))
+                        status = DSJE_DSJOB_ERROR;
+                    header.nEvents++;
+                }
+                if ((status == DSJE_NOERROR) && (block.nEvents > 0) &&
+                        !flushLogArchive(fp, &block, &index))
+                    status = DSJE_DSJOB_ERROR;
+                if (status != DSJE_NOERROR)
+                    fprintf(stderr, "ERROR: Out of memory\n");
+                else
+                {
+                    /* The dictionary, the index, and the header again */
+                    OUTBUF dictText;
+                    memset(&dictText, 0, sizeof(dictText));
+                    header.nBlocks = (unsigned) (index.len / sizeof(LOGARCHINDEX));
+                    header.nTemplates = (unsigned) dict.nTemplates;
+                    header.dictOffset = (unsigned) ftell(fp);
+                    for (i = 0; i < dict.nTemplates; i++)
+                    {
+                        putVarint(&dictText, (unsigned long) dict.len[i]);
+                        outMem(&dictText, dict.text.data + dict.start[i], dict.len[i]);
+                    }
+                    /* The index is aligned so that it can be read in place */
+                    outMem(&dictText, "\0\0\0", (4 - (header.dictOffset + dictText.len) % 4) % 4);
+                    (void) fwrite(dictText.data, 1, dictText.len, fp);
+                    free(dictText.data);
+                    header.indexOffset = (unsigned) ftell(fp);
+                    (void) fwrite(index.data, 1, index.len, fp);
+                    (void) fseek(fp, 0, SEEK_SET);
+                    (void) fwrite(&header, sizeof(header), 1, fp);
+                    (void) fseek(fp, 0, SEEK_END);
+                    outBeginRecord(&stdoutBuf, logArchiveColumns);
+                    outIntField(&stdoutBuf, "events", "Events\t\t: ", (long) header.nEvents);
+                    outIntField(&stdoutBuf, "templates", "Templates\t: ", (long) header.nTemplates);
+                    outIntField(&stdoutBuf, "bytes", "Bytes\t\t: ", ftell(fp));
+                    outEndRecord(&stdoutBuf);
+                }
+                if (ferror(fp))
+                {
+                    fprintf(stderr, "ERROR: Failed to write archive '%s'\n", fileName);
+                    status = DSJE_DSJOB_ERROR;
+                }
+                if ((fclose(fp) != 0) && (status == DSJE_NOERROR))
+                {
+                    fprintf(stderr, "ERROR: Failed to write archive '%s'\n", fileName);
+                    status = DSJE_DSJOB_ERROR;
+                }
+                free(block.ids.data);
+                free(block.times.data);
+                free(block.types.data);
+                free(block.templates.data);
+                free(block.vars.data);
+                free(block.scratch.data);
+                free(index.data);
+                freeLogDict(&dict);
+            }
+            (void) closeJob(hJob);
         }
+        (void) closeProject(hProject);
     }
-    /* Must be two parameters left... project and job */
-    if ((i+2) == argc)
+    return status;
+}
+
+/*
+ * Decode a block of an archive and write the entries in it that are wanted.
+ * Returns FALSE if the block is damaged.
+ */
+static BOOL readLogBlock(
+    FILEVIEW *view,             /* The mapped archive */
+    LOGARCHINDEX *index,        /* The block's index entry */
+    const unsigned char **templates,    /* The dictionary */
+    const unsigned long *templateLen,
+    unsigned nTemplates,
+    int firstId,                /* Ids wanted */
+    int lastId,
+    time_t startTime,           /* Times wanted, 0 for no limit */
+    time_t endTime
+)
+{
+    const unsigned char *p = (const unsigned char *) view->base + index->offset;
+    const unsigned char *end = p + index->size;
+    const unsigned char *types;
+    unsigned long nEvents;
+    unsigned long value;
+    int ids[LOGARCH_BLOCK];
+    unsigned times[LOGARCH_BLOCK];
+    unsigned long tmpl[LOGARCH_BLOCK];
+    OUTBUF msg;
+    unsigned long i;
+    BOOL valid;
+    if (!getVarint(&p, end, &nEvents) || (nEvents == 0) || (nEvents > LOGARCH_BLOCK))
+        return FALSE;
+    for (i = 0; i < nEvents; i++)
+    {
+        if (!getVarint(&p, end, &value))
+            return FALSE;
+        ids[i] = (i == 0) ? (int) value : ids[i - 1] + (int) value;
+    }
+    for (i = 0; i < nEvents; i++)
+    {
+        if (!getVarint(&p, end, &value))
+            return FALSE;
+        times[i] = (i == 0) ? (unsigned) value : times[i - 1] + (unsigned) signedValue(value);
+    }
+    types = p;
+    if ((p += nEvents) > end)
+        return FALSE;
+    for (i = 0; i < nEvents; i++)
+        if (!getVarint(&p, end, &(tmpl[i])) || (tmpl[i] >= nTemplates))
+            return FALSE;
+    memset(&msg, 0, sizeof(msg));
+    for (i = 0, valid = TRUE; valid && (i < nEvents); i++)
+    {
+        const unsigned char *t = templates[tmpl[i]];
+        const unsigned char *tEnd = t + templateLen[tmpl[i]];
+        /* Put the message back together */
+        msg.len = 0;
+        for (; valid && (t < tEnd); t++)
+        {
+            if (*t != LOGARCH_VAR)
+                outChar(&msg, (char) *t);
+            else if ((valid = (getVarint(&p, end, &value) && (value <= (unsigned long) (end - p)))))
+            {
+                outMem(&msg, (const char *) p, value);
+                p += value;
+            }
+        }
+        outMem(&msg, "\0\0", 2);
+        if (valid && (msg.len >= 2) && (ids[i] >= firstId) && ((lastId < 0) || (ids[i] <= lastId)) &&
+                ((startTime == 0) || ((time_t) times[i] >= startTime)) &&
+                ((endTime == 0) || ((time_t) times[i] <= endTime)))
+        {
+            DSLOGDETAIL detail;
+            memset(&detail, 0, sizeof(detail));
+            detail.eventId = ids[i];
+            detail.timestamp = (time_t) times[i];
+            detail.type = types[i];
+            detail.fullMessage = msg.data;
+            outBeginRecord(&stdoutBuf, logDetailColumns);
+            writeLogDetail(&stdoutBuf, 0, &detail);
+            outText(&stdoutBuf, "\n");
+            outEndRecord(&stdoutBuf);
+        }
+    }
+    free(msg.data);
+    return valid;
+}
+
+/*
+ * Handle the -logread sub-command
+ *
+ * Read entries from an archive written by -logarchive, by event id or
+ * range of ids, or by time, without going to the server. The index is
+ * searched for the blocks that hold the entries wanted and only those are
+ * decoded.
+ */
+static int jobLogRead(int argc, char *argv[])
+{
+    FILEVIEW view;
+    LOGARCHHEADER header;
+    LOGARCHINDEX *index;
+    const unsigned char **templates = NULL;
+    unsigned long *templateLen = NULL;
+    int status = DSJE_NOERROR;
+    int i;
+    char *fileName;
+    char *range = NULL;
+    int firstId = 0;
+    int lastId = -1;
+    time_t startTime = 0;
+    time_t endTime = 0;
+    BOOL badOptions = FALSE;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
+    {
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "id") == 0)
+            range = arg;
+        else if (strcmp(opt, "from") == 0)
+            badOptions = !parseLogTime(arg, &startTime);
+        else if (strcmp(opt, "to") == 0)
+            badOptions = !parseLogTime(arg, &endTime);
+        else
+            badOptions = TRUE;
+    }
+    /* Must be one parameter left... the archive file */
+    if ((i+1) == argc)
+        fileName = argv[i];
+    else
+        badOptions = TRUE;
+    /* Report validation problems and exit */
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -logread\n");
+        fprintf(stderr, "\t\t\t[-id <event id | first-[last]>]\n");
+        fprintf(stderr, "\t\t\t[-from <YYYY-MM-DD[ HH:MM[:SS]]>]\n");
+        fprintf(stderr, "\t\t\t[-to <YYYY-MM-DD[ HH:MM[:SS]]>]\n");
+        fprintf(stderr, "\t\t\t<archive file>\n");
+        return DSJE_DSJOB_ERROR;
+    }
+    if (range != NULL)
+    {
+        char *dash = strchr(range, '-');
+        firstId = atoi(range);
+        lastId = (dash == NULL) ? firstId : (dash[1] == '\0') ? -1 : atoi(dash + 1);
+    }
+    if (!mapFile(fileName, &view))
     {
-        project = argv[i];
-        job = argv[i+1];
+        fprintf(stderr, "ERROR: Failed to open archive '%s'\n", fileName);
+        return DSJE_DSJOB_ERROR;
     }
-    else
-        badOptions = TRUE;
-    /* Report validation problems and exit */
-    if (badOptions)
+    /* Check that the header, dictionary and index all fit */
+    if (view.size >= sizeof(header))
+        memcpy(&header, view.base, sizeof(header));
+    if ((view.size < sizeof(header)) || (memcmp(header.magic, LOGARCH_MAGIC, 8) != 0) ||
+            (header.dictOffset < sizeof(header)) || (header.indexOffset < header.dictOffset) ||
+            (header.indexOffset > view.size) ||
+            (header.nBlocks > (view.size - header.indexOffset) / sizeof(LOGARCHINDEX)) ||
+            (header.nTemplates > header.indexOffset - header.dictOffset))
     {
-        fprintf(stderr, "Invalid arguments: dsjob -run\n");
-        fprintf(stderr, "\t\t\t[-mode <NORMAL | RESET | VALIDATE>]\n");
-        fprintf(stderr, "\t\t\t[-param <name>=<value>]\n");
-        fprintf(stderr, "\t\t\t[-warn <n>]\n");
-        fprintf(stderr, "\t\t\t[-rows <n>]\n");
-        fprintf(stderr, "\t\t\t[-wait]\n");
-        fprintf(stderr, "\t\t\t<project> <job>\n");
+        fprintf(stderr, "ERROR: '%s' is not a dsjob log archive\n", fileName);
+        unmapFile(&view);
         return DSJE_DSJOB_ERROR;
     }
-    /* Attempt to open the project, open the job and lock it */
-    if ((hProject = DSOpenProject(project)) == NULL)
+    index = (LOGARCHINDEX *) (view.base + header.indexOffset);
+    if ((header.nTemplates > 0) &&
+            (((templates = malloc(header.nTemplates * sizeof(*templates))) == NULL) ||
+             ((templateLen = malloc(header.nTemplates * sizeof(*templateLen))) == NULL)))
     {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
+        fprintf(stderr, "ERROR: Out of memory\n");
+        status = DSJE_DSJOB_ERROR;
     }
     else
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
+        const unsigned char *p = (const unsigned char *) view.base + header.dictOffset;
+        const unsigned char *end = (const unsigned char *) view.base + header.indexOffset;
+        unsigned n;
+        for (n = 0; (status == DSJE_NOERROR) && (n < header.nTemplates); n++)
         {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
+            if (!getVarint(&p, end, &(templateLen[n])) || (templateLen[n] > (unsigned long) (end - p)))
+                status = DSJE_DSJOB_ERROR;
+            else
+            {
+                templates[n] = p;
+                p += templateLen[n];
+            }
         }
-        else
+        if (status == DSJE_NOERROR)
         {
-            if ((status = DSLockJob(hJob)) != DSJE_NOERROR)
-                fprintf(stderr, "ERROR: Failed to lock job\n");
-            else
+            /* Find the first block that can hold firstId... */
+            unsigned low = 0;
+            unsigned high = header.nBlocks;
+            while (low < high)
             {
-                /* Now set any job attributes and try running the job */
-                if (warningLimit >= 0)
-                {
-                    status = DSSetJobLimit(hJob, DSJ_LIMITWARN, warningLimit);
-                    if (status != DSJE_NOERROR)
-                        fprintf(stderr, "Error setting warning limit\n");
-                }
-                if ((rowLimit != 0) && (status == DSJE_NOERROR))
-                {
-                    status = DSSetJobLimit(hJob, DSJ_LIMITROWS, rowLimit);
-                    if (status != DSJE_NOERROR)
-                        fprintf(stderr, "Error setting row limit\n");
-                }
-                for (i = 0; (status == DSJE_NOERROR) && (i < nParams); i++)
-                    status = setParam(hJob, param[i]);
-                if (status == DSJE_NOERROR)
-                {
-                    status = DSRunJob(hJob, mode);
-                    if (status != DSJE_NOERROR)
-                        fprintf(stderr, "Error running job\n");
-                }
-                /* Now wait for the job to finish */
-                if ((status == DSJE_NOERROR) && waitForJob)
-                {
-                    printf("Waiting for job...\n");
-                    status = DSWaitForJob(hJob);
-                    if (status != DSJE_NOERROR)
-                        fprintf(stderr, "Error waiting for job\n");
-                }
-                (void) DSUnlockJob(hJob);
+                unsigned mid = (low + high) / 2;
+                if (index[mid].lastId < firstId)
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+            /* ...then decode each block in range */
+            for (n = low; (status == DSJE_NOERROR) && (n < header.nBlocks); n++)
+            {
+                LOGARCHINDEX entry;
+                memcpy(&entry, &(index[n]), sizeof(entry));
+                if ((lastId >= 0) && (entry.firstId > lastId))
+                    break;
+                if (((startTime != 0) && ((time_t) entry.maxTime < startTime)) ||
+                        ((endTime != 0) && ((time_t) entry.minTime > endTime)))
+                    continue;
+                if ((entry.offset < sizeof(header)) || (entry.offset > header.dictOffset) ||
+                        (entry.size > header.dictOffset - entry.offset) ||
+                        !readLogBlock(&view, &entry, templates, templateLen, header.nTemplates,
+                                      firstId, lastId, startTime, endTime))
+                    status = DSJE_DSJOB_ERROR;
             }
-            (void) DSCloseJob(hJob);
         }
-        (void) DSCloseProject(hProject);
+        outFlush(&stdoutBuf);
+        if (status != DSJE_NOERROR)
+            fprintf(stderr, "ERROR: '%s' is damaged\n", fileName);
     }
+    free(templates);
+    free(templateLen);
+    unmapFile(&view);
     return status;
 }
 
 /*****************************************************************************/
 /*
- * Handle the -stop sub-command
+ * Handle the -recover sub-command
+ *
+ * Bring the jobs of a project that have failed, crashed or been stopped, or
+ * that are still running after an outage, back to a state in which they
+ * can be run again. A pattern, matched against the job names as -logsearch
+ * matches messages, picks out the jobs to recover.
+ *
+ * A pool of workers looks at each job in turn. A job that needs a reset is
+ * locked, run in DSJ_RUNRESET mode and unlocked straight away; a running
+ * job is sent DSStopJob() and left. Once every job has been looked at, all
+ * the stopped jobs are watched together (as -waitall watches them) until
+ * they have settled, and the ones that then need a reset are shared out
+ * among the workers again. Finally the reset runs are watched until they
+ * have finished, so that the table shows the state each job was left in.
+ * -timeout bounds the two waits together.
  */
-static int jobStop(int argc, char *argv[])
+typedef struct RECOVERJOB
+{
+    char *job;                  /* Job name, in the job list */
+    int jobStatus;              /* Status found, -1 until known */
+    BOOL stopped;               /* DSStopJob() was called */
+    BOOL settled;               /* The stopped job is no longer running */
+    BOOL reset;                 /* A reset run was started */
+    int waveNumber;             /* ... as this wave */
+    int finalStatus;            /* Status once recovered, -1 if not known */
+    int status;                 /* First error */
+} RECOVERJOB;
+
+typedef struct RECOVERY
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
-    int status;
     char *project;
-    char *job;
-    /* Validate arguments and extract optional arguments */
-    /* Must be two parameters left... project and job */
-    if (argc != 2)
-    {
-        fprintf(stderr, "Invalid arguments: dsjob -stop <project> <job>\n");
-        return DSJE_DSJOB_ERROR;
-    }
-    project = argv[0];
-    job = argv[1];
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
-    {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
-    }
-    else
+    RECOVERJOB **jobs;          /* Jobs for the workers to process */
+    int nJobs;
+    volatile LONG nextJob;      /* Next job for a worker to take */
+} RECOVERY;
+
+static BOOL needsReset(
+    int jobStatus               /* DSJS_xxx */
+)
+{
+    return ((jobStatus == DSJS_RUNFAILED) || (jobStatus == DSJS_STOPPED) ||
+            (jobStatus == DSJS_CRASHED));
+}
+
+/*
+ * Start a reset run of a job and note its wave number.
+ */
+static void resetJob(
+    DSJOB hJob,                 /* Job to reset */
+    RECOVERJOB *rj
+)
+{
+    DSJOBINFO jobInfo;
+    int status;
+    if ((status = DSLockJob(hJob)) == DSJE_NOERROR)
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
+        if (((status = DSRunJob(hJob, DSJ_RUNRESET)) == DSJE_NOERROR) &&
+                ((status = DSGetJobInfo(hJob, DSJ_JOBWAVENO, &jobInfo)) == DSJE_NOERROR))
         {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
+            rj->reset = TRUE;
+            rj->waveNumber = jobInfo.info.jobWaveNumber;
         }
-        else
+        (void) DSUnlockJob(hJob);
+    }
+    if (status != DSJE_NOERROR)
+        rj->status = status;
+}
+
+static void recoverWorker(
+    WORKER *worker              /* Calling worker */
+)
+{
+    RECOVERY *rec = worker->context;
+    LONG i;
+    while ((i = InterlockedIncrement(&(rec->nextJob)) - 1) < rec->nJobs)
+    {
+        RECOVERJOB *rj = rec->jobs[i];
+        DSJOBINFO jobInfo;
+        DSJOB hJob;
+        if ((hJob = workerJob(worker, rec->project, rj->job, &(rj->status))) == NULL)
+            continue;
+        /* A job settled after being stopped already has its status */
+        if (rj->jobStatus < 0)
         {
-            /* Now stop the job */
-            status = DSStopJob(hJob);
-            if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error stopping job\n");
-            (void) DSCloseJob(hJob);
+            if ((rj->status = DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo)) == DSJE_NOERROR)
+                rj->jobStatus = jobInfo.info.jobStatus;
+            if (rj->jobStatus == DSJS_RUNNING)
+            {
+                if ((rj->status = DSStopJob(hJob)) == DSJE_NOERROR)
+                    rj->stopped = TRUE;
+            }
+            else if (needsReset(rj->jobStatus))
+                resetJob(hJob, rj);
         }
-        (void) DSCloseProject(hProject);
+        else if (needsReset(rj->finalStatus))
+            resetJob(hJob, rj);
+        (void) DSCloseJob(hJob);
     }
-    return status;
 }
 
-/*****************************************************************************/
 /*
- * Handle the -lprojects sub-command
+ * Watch the given jobs until they finish, or until the deadline passes,
+ * setting the final status of each. Returns FALSE if any are still running.
  */
-static int jobLProjects(int argc, char *argv[])
+static BOOL watchRecovery(
+    DSPROJECT hProject,         /* Project the jobs are in */
+    char *project,
+    RECOVERJOB **jobs,          /* The jobs */
+    int nJobs,
+    BOOL resetRuns,             /* Watching the reset runs */
+    BOOL limited,               /* There is a deadline */
+    DWORD deadline              /* GetTickCount() to give up at */
+)
 {
-    int result = DSJE_NOERROR;
-    char *list;
-    /* Validate arguments */
-    if (argc != 0)
+    JOBWATCH *watch;
+    DWORD timeout = 0;
+    BOOL done;
+    int i;
+    if (nJobs == 0)
+        return TRUE;
+    if ((watch = malloc(nJobs * sizeof(JOBWATCH))) == NULL)
     {
-        fprintf(stderr, "Invalid arguments: dsjob -lproject\n");
-        return DSJE_DSJOB_ERROR;
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return FALSE;
     }
-    /* Action request */
-    list = DSGetProjectList();
-    if (list == NULL)
-        result = DSGetLastError();
-    else
-        printStrList(0, list);
-    return result;
+    for (i = 0; i < nJobs; i++)
+    {
+        int openStatus;
+        DSJOB hJob = openJob(hProject, jobs[i]->job, &openStatus);
+        initWatch(&(watch[i]), project, jobs[i]->job, hJob,
+                  resetRuns ? jobs[i]->waveNumber : -1, 0);
+        /* A stop is timed from now, not from when the run started */
+        if (!resetRuns)
+            watch[i].startTime = time(NULL);
+        if (hJob == NULL)
+        {
+            watch[i].status = openStatus;
+            watch[i].finished = TRUE;
+        }
+    }
+    /* Once the deadline has passed each job is still polled once */
+    if (limited)
+    {
+        LONG left = (LONG) (deadline - GetTickCount());
+        timeout = (left > 0) ? (DWORD) left : 1;
+    }
+    done = watchJobs(watch, nJobs, FALSE, timeout);
+    for (i = 0; i < nJobs; i++)
+    {
+        if (watch[i].status != DSJE_NOERROR)
+            jobs[i]->status = watch[i].status;
+        else if (watch[i].finished && !watch[i].superseded)
+            jobs[i]->finalStatus = watch[i].jobStatus;
+        if (!resetRuns)
+            jobs[i]->settled = watch[i].finished;
+        if (watch[i].hJob != NULL)
+            (void) closeJob(watch[i].hJob);
+    }
+    free(watch);
+    return done;
 }
 
-/*****************************************************************************/
-/*
- * Handle the -ljobs sub-command
- */
-static int jobLJobs(int argc, char *argv[])
+static const char recoverColumns[] = "job,jobStatus,jobStatusCode,action,result,resultCode,status";
+
+static int jobRecover(int argc, char *argv[])
 {
     DSPROJECT hProject;
     DSPROJECTINFO pInfo;
+    RECOVERY rec;
+    RECOVERJOB *jobs;
+    RECOVERJOB **pending;
+    PATTERN pattern;
+    int nJobs = 0;
+    int nPending;
     int status;
-    /* Validate arguments */
-    if (argc != 1)
+    int i;
+    int nThreads = DEFAULT_THREADS;
+    int timeout = 0;
+    DWORD deadline;
+    char *project;
+    char *str;
+    BOOL complete = TRUE;
+    BOOL badOptions = FALSE;
+    maxWatchInterval = WATCH_MAX_INTERVAL;
+    /* Validate arguments and extract optional arguments */
+    for (i = 0; (i < argc) && !badOptions && IS_SWITCH(argv[i]); i++)
     {
-        fprintf(stderr, "Invalid arguments: dsjob -ljobs <project>\n");
+        char *opt = &(argv[i][1]);
+        char *arg = argv[i+1];
+        if (++i >= argc)
+            badOptions = TRUE;
+        else if (strcmp(opt, "threads") == 0)
+        {
+            if ((nThreads = atoi(arg)) < 1)
+                badOptions = TRUE;
+        }
+        else if (strcmp(opt, "timeout") == 0)
+            timeout = atoi(arg);
+        else
+            badOptions = TRUE;
+    }
+    /* Must be a project and optionally a pattern left */
+    if ((i+1 != argc) && (i+2 != argc))
+        badOptions = TRUE;
+    if (badOptions)
+    {
+        fprintf(stderr, "Invalid arguments: dsjob -recover\n");
+        fprintf(stderr, "\t\t\t[-threads <n>]\n");
+        fprintf(stderr, "\t\t\t[-timeout <seconds>]\n");
+        fprintf(stderr, "\t\t\t<project> [<job name pattern>]\n");
         return DSJE_DSJOB_ERROR;
     }
-    /* Action request */
-    hProject = DSOpenProject(argv[0]);
-    if (hProject == NULL)
-        status = DSGetLastError();
-    else
+    project = argv[i];
+    pattern.node = NULL;
+    pattern.nNodes = 0;
+    if ((i+2 == argc) && !compilePattern(&pattern, argv[i+1], FALSE))
+        return DSJE_DSJOB_ERROR;
+    /* Get the job list */
+    if ((hProject = openProject(project, &status)) == NULL)
     {
-        status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &pInfo);
-        if (status == DSJE_NOT_AVAILABLE)
+        fprintf(stderr, "ERROR: Failed to open project\n");
+        freePattern(&pattern);
+        return status;
+    }
+    status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &pInfo);
+    if (status == DSJE_NOT_AVAILABLE)
+    {
+        outText(&stdoutBuf, "<none>\n");
+        (void) closeProject(hProject);
+        freePattern(&pattern);
+        return DSJE_NOERROR;
+    }
+    if (status != DSJE_NOERROR)
+    {
+        fprintf(stderr, "Error %d getting job list\n", status);
+        (void) closeProject(hProject);
+        freePattern(&pattern);
+        return status;
+    }
+    for (str = pInfo.info.jobList; *str != '\0'; str += strlen(str) + 1)
+        nJobs++;
+    jobs = calloc(nJobs + 1, sizeof(RECOVERJOB));
+    pending = malloc((nJobs + 1) * sizeof(RECOVERJOB *));
+    if ((jobs == NULL) || (pending == NULL))
+    {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        free(jobs);
+        free(pending);
+        (void) closeProject(hProject);
+        freePattern(&pattern);
+        return DSJE_DSJOB_ERROR;
+    }
+    /* The list belongs to the project handle, so the names are copied */
+    for (nJobs = 0, str = pInfo.info.jobList; *str != '\0'; str += strlen(str) + 1)
+    {
+        if ((pattern.node != NULL) && !matchPattern(&pattern, str))
+            continue;
+        jobs[nJobs].jobStatus = -1;
+        jobs[nJobs].finalStatus = -1;
+        if ((jobs[nJobs].job = copyString(str)) == NULL)
+            break;
+        nJobs++;
+    }
+    freePattern(&pattern);
+    if (nThreads > nJobs)
+        nThreads = nJobs;
+    memset(&rec, 0, sizeof(rec));
+    rec.project = project;
+    rec.jobs = pending;
+
+    /* Look at every job, resetting or stopping it as need be */
+    for (i = 0; i < nJobs; i++)
+        pending[i] = &(jobs[i]);
+    rec.nJobs = nJobs;
+    if (nThreads > 0)
+        runWorkers(nThreads, recoverWorker, &rec);
+
+    /* Wait for the stopped jobs to settle, then reset them */
+    deadline = GetTickCount() + timeout * 1000UL;
+    for (i = 0, nPending = 0; i < nJobs; i++)
+        if (jobs[i].stopped)
+            pending[nPending++] = &(jobs[i]);
+    if (!watchRecovery(hProject, project, pending, nPending, FALSE, timeout > 0, deadline))
+        complete = FALSE;
+    for (i = 0, rec.nJobs = 0; i < nPending; i++)
+        if (pending[i]->settled && needsReset(pending[i]->finalStatus))
+            pending[rec.nJobs++] = pending[i];
+    rec.nextJob = 0;
+    if (rec.nJobs > 0)
+        runWorkers((nThreads < rec.nJobs) ? nThreads : rec.nJobs, recoverWorker, &rec);
+
+    /* Wait for the resets to finish */
+    for (i = 0, nPending = 0; i < nJobs; i++)
+        if (jobs[i].reset)
+            pending[nPending++] = &(jobs[i]);
+    if (!watchRecovery(hProject, project, pending, nPending, TRUE, timeout > 0, deadline))
+        complete = FALSE;
+    (void) closeProject(hProject);
+
+    /* Report the jobs that needed recovery */
+    outText(&stdoutBuf, "Job\tJob Status\tAction\tResult\n");
+    for (i = 0; i < nJobs; i++)
+    {
+        RECOVERJOB *rj = &(jobs[i]);
+        if ((rj->status == DSJE_NOERROR) && !rj->stopped && !needsReset(rj->jobStatus))
+            continue;
+        outBeginRecord(&stdoutBuf, recoverColumns);
+        outStrField(&stdoutBuf, "job", NULL, rj->job);
+        if (rj->jobStatus >= 0)
+            outCodeField(&stdoutBuf, "jobStatus", NULL, jobStatusName(rj->jobStatus), rj->jobStatus);
+        else
+            outNullCodeField(&stdoutBuf, "jobStatus", NULL, "-");
+        outStrField(&stdoutBuf, "action", NULL,
+                    (rj->stopped && rj->reset) ? "stop, reset" :
+                    rj->stopped ? "stop" : rj->reset ? "reset" : "none");
+        if (rj->status != DSJE_NOERROR)
         {
-            printf("<none>\n");
-            status = DSJE_NOERROR;
+            char text[32];
+            sprintf(text, "Error %d", rj->status);
+            outStateField(&stdoutBuf, "result", NULL, text);
         }
-        else if (status == DSJE_NOERROR)
-            printStrList(0, pInfo.info.jobList);
-        DSCloseProject(hProject);
+        else if (rj->finalStatus >= 0)
+            outCodeField(&stdoutBuf, "result", NULL, jobStatusName(rj->finalStatus), rj->finalStatus);
+        else
+            outStateField(&stdoutBuf, "result", NULL, "still running");
+        /* The API status is only shown in the machine-readable formats */
+        if (outputFormat != FORMAT_TEXT)
+            outIntField(&stdoutBuf, "status", NULL, rj->status);
+        outEndRecord(&stdoutBuf);
+        if ((rj->status != DSJE_NOERROR) && (status == DSJE_NOERROR))
+            status = rj->status;
+    }
+    outFlush(&stdoutBuf);
+    if (!complete)
+    {
+        fprintf(stderr, "Timed out waiting for jobs\n");
+        if (status == DSJE_NOERROR)
+            status = DSJE_DSJOB_ERROR;
     }
+    for (i = 0; i < nJobs; i++)
+        free(jobs[i].job);
+    free(jobs);
+    free(pending);
     return status;
 }
 
 /*****************************************************************************/
 /*
- * Handle the -lstages sub-command
+ * Status publishing for -daemon -publish.
+ *
+ * The publishing thread fills the shared status segment (see -jobinfo
+ * -cached) from its own connection, with a WORKER per project so that its
+ * opens are serialized with everyone else's, and keeps its job handles
+ * open from one poll to the next. A job that is not running and whose
+ * status and wave number have not moved since the last poll still has its
+ * other items and link row counts, so the poll just marks its slot as
+ * fresh: an idle job costs two calls per poll. stderr belongs to whichever
+ * client the daemon is serving, so the thread's only message, that the
+ * segment is full, goes to a copy of the daemon's own.
+ *
+ * apiLock alone only keeps the publisher out between the main thread's
+ * failing call and its last-error read when both are in connectOpen(). So
+ * each poll is also made under publishLock, which runCommand() holds for
+ * the whole of each command, and the publisher waits for the command to
+ * finish. Workers do not take publishLock, so a command that runs them
+ * while holding it cannot deadlock.
  */
-static int jobLStages(int argc, char *argv[])
+#define MAX_PUBLISH     16      /* Projects one daemon publishes */
+#define DEFAULT_PUBLISH_INTERVAL 5  /* Seconds */
+
+static CRITICAL_SECTION publishLock;
+
+typedef struct PUBJOB
+{
+    char *job;                  /* Job name */
+    int slot;                   /* Its slot in the segment, -1 if none yet */
+    DSJOB hJob;                 /* Kept open between polls */
+    int jobStatus;              /* As last published, -1 before */
+    int waveNumber;
+    MONLINK *links;             /* Link list, walked again when the wave moves */
+    int nLinks;
+} PUBJOB;
+
+typedef struct PUBPROJECT
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
-    int status;
     char *project;
-    char *job;
-    DSJOBINFO jobInfo;
-    /* Validate arguments and extract optional arguments */
-    /* Must be two parameters left... project and job */
-    if (argc != 2)
+    WORKER worker;              /* For the project handle */
+    PUBJOB *jobs;               /* In job list order */
+    int nJobs;
+} PUBPROJECT;
+
+typedef struct PUBLISHER
+{
+    PUBPROJECT projects[MAX_PUBLISH];
+    int nProjects;
+    int interval;               /* Seconds between polls */
+    HANDLE hMap;                /* The segment */
+    STATUSSEGMENT *segment;
+    HANDLE hStop;               /* Set to stop the thread */
+    HANDLE hThread;
+    FILE *errFile;              /* The daemon's stderr */
+    BOOL full;                  /* A job has not found a slot */
+} PUBLISHER;
+
+static void freePubJob(
+    PUBJOB *pj
+)
+{
+    if (pj->hJob != NULL)
     {
-        fprintf(stderr, "Invalid arguments: dsjob -lstages <project> <job>\n");
-        return DSJE_DSJOB_ERROR;
+        EnterCriticalSection(&apiLock);
+        (void) DSCloseJob(pj->hJob);
+        LeaveCriticalSection(&apiLock);
     }
-    project = argv[0];
-    job = argv[1];
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
+    freeMonLinks(pj->links, pj->nLinks);
+    free(pj->job);
+}
+
+/*
+ * Find or claim the slot for a key, reusing the first slot given back on
+ * the way. Only the publishing thread writes the segment, so it can read
+ * its own slots without the sequence dance. Returns -1 if the segment is
+ * full.
+ */
+static int claimStatusSlot(
+    STATUSSEGMENT *segment,
+    const char *key             /* "server/project/job" */
+)
+{
+    unsigned int n = fnvHash(key) % STATUS_SLOTS;
+    unsigned int i;
+    int freed = -1;
+    STATUSSLOT *slot;
+    for (i = 0; i < STATUS_SLOTS; i++, n = (n + 1) % STATUS_SLOTS)
     {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
+        slot = &(segment->slot[n]);
+        if (strcmp(slot->key, key) == 0)
+            return (int) n;
+        if (slot->key[0] == '\0')
+            break;
+        if ((freed < 0) && (strcmp(slot->key, STATUS_FREED) == 0))
+            freed = (int) n;
     }
-    else
+    if (freed >= 0)
+        n = (unsigned int) freed;
+    else if (i == STATUS_SLOTS)
+        return -1;
+    slot = &(segment->slot[n]);
+    (void) InterlockedIncrement(&(slot->sequence));
+    strcpy(slot->key, key);
+    (void) InterlockedIncrement(&(slot->sequence));
+    return (int) n;
+}
+
+/*
+ * Give back the slot of a job that has left the job list. The rest of the
+ * slot is cleared too, so that nothing of the job can be read from it.
+ */
+static void freeStatusSlot(
+    STATUSSLOT *slot            /* Slot in the segment */
+)
+{
+    size_t skip = offsetof(STATUSSLOT, published);
+    (void) InterlockedIncrement(&(slot->sequence));
+    memset((char *) slot + skip, 0, sizeof(STATUSSLOT) - skip);
+    strcpy(slot->key, STATUS_FREED);
+    (void) InterlockedIncrement(&(slot->sequence));
+}
+
+/*
+ * Replace the contents of a slot (everything after the sequence number).
+ */
+static void writeStatusSlot(
+    STATUSSLOT *slot,           /* Slot in the segment */
+    STATUSSLOT *data            /* New contents */
+)
+{
+    size_t skip = offsetof(STATUSSLOT, published);
+    (void) InterlockedIncrement(&(slot->sequence));
+    memcpy((char *) slot + skip, (char *) data + skip, sizeof(STATUSSLOT) - skip);
+    (void) InterlockedIncrement(&(slot->sequence));
+}
+
+static void touchStatusSlot(
+    STATUSSLOT *slot            /* Slot in the segment */
+)
+{
+    (void) InterlockedIncrement(&(slot->sequence));
+    slot->published = (unsigned int) time(NULL);
+    (void) InterlockedIncrement(&(slot->sequence));
+}
+
+/*
+ * Walk the stages of a job for its links, as findMonLinks() does but
+ * straight from the server, since the metadata cache belongs to the
+ * daemon's main thread, and without any messages.
+ */
+static void listPubLinks(
+    PUBJOB *pj
+)
+{
+    DSJOBINFO jobInfo;
+    DSSTAGEINFO stageInfo;
+    char *stageList;
+    char *stage;
+    char *link;
+    freeMonLinks(pj->links, pj->nLinks);
+    pj->links = NULL;
+    pj->nLinks = 0;
+    if (DSGetJobInfo(pj->hJob, DSJ_STAGELIST, &jobInfo) != DSJE_NOERROR)
+        return;
+    for (stage = jobInfo.info.stageList; *stage != '\0'; stage += strlen(stage) + 1)
+        ;
+    if ((stageList = malloc(stage - jobInfo.info.stageList + 1)) == NULL)
+        return;
+    memcpy(stageList, jobInfo.info.stageList, stage - jobInfo.info.stageList + 1);
+    if ((pj->links = malloc(STATUS_LINKS * sizeof(MONLINK))) != NULL)
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
-		{
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
-        }
-        else
+        for (stage = stageList; (*stage != '\0') && (pj->nLinks < STATUS_LINKS);
+                stage += strlen(stage) + 1)
         {
-            /* Get the list of stages */
-            status = DSGetJobInfo(hJob, DSJ_STAGELIST, &jobInfo);
-            if (status == DSJE_NOT_AVAILABLE)
+            if (DSGetStageInfo(pj->hJob, stage, DSJ_LINKLIST, &stageInfo) != DSJE_NOERROR)
+                continue;
+            for (link = stageInfo.info.linkList; (*link != '\0') && (pj->nLinks < STATUS_LINKS);
+                    link += strlen(link) + 1)
             {
-                printf("<none>\n");
-                status = DSJE_NOERROR;
+                MONLINK *entry = &(pj->links[pj->nLinks]);
+                int i;
+                entry->stage = copyString(stage);
+                entry->link = copyString(link);
+                if ((entry->stage == NULL) || (entry->link == NULL))
+                {
+                    free(entry->stage);
+                    free(entry->link);
+                    break;
+                }
+                entry->sampled = pj->nLinks;
+                for (i = 0; i < pj->nLinks; i++)
+                {
+                    if ((pj->links[i].sampled == i) && (strcmp(pj->links[i].link, link) == 0))
+                    {
+                        entry->sampled = i;
+                        break;
+                    }
+                }
+                pj->nLinks++;
             }
-            else if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting stage list\n", status);
-            else
-                printStrList(0, jobInfo.info.stageList);
-            (void) DSCloseJob(hJob);
         }
-        (void) DSCloseProject(hProject);
     }
-    return status;
+    free(stageList);
 }
 
-/*****************************************************************************/
 /*
- * Handle the -llinks sub-command
+ * Copy a string item into a slot. Returns FALSE if it doesn't fit.
  */
-static int jobLLinks(int argc, char *argv[])
+static BOOL putStatusText(
+    char *field,                /* Field in the slot, STATUS_TEXT characters */
+    const char *text
+)
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
+    if (strlen(text) >= STATUS_TEXT)
+        return FALSE;
+    strcpy(field, text);
+    return TRUE;
+}
+
+/*
+ * Poll one job and publish what it returns.
+ */
+static void publishJob(
+    PUBLISHER *pub,
+    PUBPROJECT *pp,             /* Project the job is in */
+    PUBJOB *pj
+)
+{
+    STATUSSLOT data;
+    STATUSSLOT *slot;
+    DSJOBINFO jobInfo;
     int status;
-    char *project;
-    char *job;
-    char *stage;
-    DSSTAGEINFO stageInfo;
-    /* Validate arguments and extract optional arguments */
-    /* Must be three parameters left... project, job and stage */
-    if (argc != 3)
+    int i;
+    if (pj->slot < 0)
     {
-        fprintf(stderr, "Invalid arguments: dsjob -llinks <project> <job> <stage>\n");
-        return DSJE_DSJOB_ERROR;
+        if (!statusKey(data.key, pp->project, pj->job))
+            return;
+        if ((pj->slot = claimStatusSlot(pub->segment, data.key)) < 0)
+        {
+            /* Said once, until a slot is given back */
+            if (!pub->full && (pub->errFile != NULL))
+            {
+                fprintf(pub->errFile, "WARNING: Status segment is full, %s/%s and any other new jobs are not published\n",
+                        pp->project, pj->job);
+                fflush(pub->errFile);
+            }
+            pub->full = TRUE;
+            return;
+        }
     }
-    project = argv[0];
-    job = argv[1];
-    stage = argv[2];
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
+    slot = &(pub->segment->slot[pj->slot]);
+    if ((pj->hJob == NULL) &&
+            ((pj->hJob = workerJob(&(pp->worker), pp->project, pj->job, &status)) == NULL))
+        return;
+    /*
+     * The calls below set the last error that the main thread reads, so are
+     * made under the lock its reads are.
+     */
+    EnterCriticalSection(&apiLock);
+    memset(&data, 0, offsetof(STATUSSLOT, link));
+    if ((status = DSGetJobInfo(pj->hJob, DSJ_JOBSTATUS, &jobInfo)) == DSJE_NOERROR)
     {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
+        data.jobStatus = jobInfo.info.jobStatus;
+        if ((status = DSGetJobInfo(pj->hJob, DSJ_JOBWAVENO, &jobInfo)) == DSJE_NOERROR)
+            data.waveNumber = jobInfo.info.jobWaveNumber;
     }
-    else
+    if (status != DSJE_NOERROR)
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
-		{
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
-        }
+        /* Try a new handle next time; the slot goes stale meanwhile */
+        (void) DSCloseJob(pj->hJob);
+        LeaveCriticalSection(&apiLock);
+        pj->hJob = NULL;
+        pj->jobStatus = -1;
+        return;
+    }
+    if ((data.jobStatus != DSJS_RUNNING) && (data.jobStatus == pj->jobStatus) &&
+            (data.waveNumber == pj->waveNumber))
+    {
+        LeaveCriticalSection(&apiLock);
+        touchStatusSlot(slot);
+        return;
+    }
+    if (data.waveNumber != pj->waveNumber)
+        listPubLinks(pj);
+    strcpy(data.key, slot->key);
+    data.flags = STATUS_JOBINFO;
+    status = DSGetJobInfo(pj->hJob, DSJ_JOBCONTROLLER, &jobInfo);
+    if ((status == DSJE_NOERROR) && putStatusText(data.controller, jobInfo.info.jobController))
+        data.flags |= STATUS_CONTROLLER;
+    else if (status != DSJE_NOT_AVAILABLE)
+        data.flags &= ~STATUS_JOBINFO;
+    status = DSGetJobInfo(pj->hJob, DSJ_JOBSTARTTIMESTAMP, &jobInfo);
+    if (status == DSJE_NOERROR)
+    {
+        data.flags |= STATUS_STARTTIME;
+        data.startTime = (unsigned int) jobInfo.info.jobStartTime;
+    }
+    else if (status != DSJE_NOT_AVAILABLE)
+        data.flags &= ~STATUS_JOBINFO;
+    status = DSGetJobInfo(pj->hJob, DSJ_USERSTATUS, &jobInfo);
+    if ((status == DSJE_NOERROR) && putStatusText(data.userStatus, jobInfo.info.userStatus))
+        data.flags |= STATUS_USERSTATUS;
+    else if (status != DSJE_NOT_AVAILABLE)
+        data.flags &= ~STATUS_JOBINFO;
+    /* A link listed twice is only asked about under its first stage */
+    for (i = 0; i < pj->nLinks; i++)
+    {
+        MONLINK *link = &(pj->links[i]);
+        STATUSLINK *entry = &(data.link[i]);
+        DSLINKINFO linkInfo;
+        if (link->sampled != i)
+            *entry = data.link[link->sampled];
         else
         {
-            /* Get the list of stages */
-            status = DSGetStageInfo(hJob, stage, DSJ_LINKLIST, &stageInfo);
-            if (status == DSJE_NOT_AVAILABLE)
-            {
-                printf("<none>\n");
-                status = DSJE_NOERROR;
-            }
-            if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting link list\n", status);
-            else
-                printStrList(0, stageInfo.info.linkList);
-            (void) DSCloseJob(hJob);
+            entry->rowCount = -1;
+            if (DSGetLinkInfo(pj->hJob, link->stage, link->link, DSJ_LINKROWCOUNT, &linkInfo)
+                    == DSJE_NOERROR)
+                entry->rowCount = linkInfo.info.rowCount;
+            entry->noError = (DSGetLinkInfo(pj->hJob, link->stage, link->link,
+                                            DSJ_LINKLASTERR, &linkInfo) == DSJE_NOT_AVAILABLE);
         }
-        (void) DSCloseProject(hProject);
+        if (strlen(link->stage) + strlen(link->link) + 2 <= STATUS_NAME)
+            sprintf(entry->name, "%s.%s", link->stage, link->link);
+        else
+            entry->name[0] = '\0';
     }
-    return status;
+    LeaveCriticalSection(&apiLock);
+    data.nLinks = pj->nLinks;
+    data.published = (unsigned int) time(NULL);
+    writeStatusSlot(slot, &data);
+    pj->jobStatus = data.jobStatus;
+    pj->waveNumber = data.waveNumber;
 }
 
-/*****************************************************************************/
 /*
- * Handle the -jobinfo sub-command
+ * Poll every job of a project. The job list is read each time, and jobs
+ * carried over from the last poll keep their handles and links.
  */
-static int jobJobInfo(int argc, char *argv[])
+static void publishProject(
+    PUBLISHER *pub,
+    PUBPROJECT *pp
+)
 {
     DSPROJECT hProject;
-    DSJOB hJob;
+    DSPROJECTINFO projectInfo;
+    PUBJOB *jobs;
+    char *str;
+    int nJobs = 0;
     int status;
-    char *project;
-    char *job;
-    DSJOBINFO jobInfo;
-    /* Validate arguments and extract optional arguments */
-    /* Must be two parameters left... project and job */
-    if (argc != 2)
+    int i;
+    int j;
+    int next = 0;
+    if ((hProject = workerProject(&(pp->worker), pp->project, &status)) == NULL)
+        return;
+    /* Under the lock, as for publishJob() */
+    EnterCriticalSection(&apiLock);
+    status = DSGetProjectInfo(hProject, DSJ_JOBLIST, &projectInfo);
+    if (isConnectionError(status))
     {
-        fprintf(stderr, "Invalid arguments: dsjob -jobinfo <project> <job>\n");
-        return DSJE_DSJOB_ERROR;
+        /* Start again with a new connection next time */
+        for (i = 0; i < pp->nJobs; i++)
+        {
+            if (pp->jobs[i].hJob != NULL)
+                (void) DSCloseJob(pp->jobs[i].hJob);
+            pp->jobs[i].hJob = NULL;
+            pp->jobs[i].jobStatus = -1;
+        }
+        (void) DSCloseProject(hProject);
+        LeaveCriticalSection(&apiLock);
+        pp->worker.hProject = NULL;
+        return;
     }
-    project = argv[0];
-    job = argv[1];
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
+    LeaveCriticalSection(&apiLock);
+    if (status == DSJE_NOT_AVAILABLE)
+        projectInfo.info.jobList = "";
+    else if (status != DSJE_NOERROR)
+        return;
+    for (str = projectInfo.info.jobList; *str != '\0'; str += strlen(str) + 1)
+        nJobs++;
+    if ((jobs = calloc(nJobs + 1, sizeof(PUBJOB))) == NULL)
+        return;
+    for (i = 0, str = projectInfo.info.jobList; i < nJobs; i++, str += strlen(str) + 1)
     {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
-    }
-    else
-	{
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
+        /* A job usually keeps its place in the list, so look there first */
+        for (j = 0; j < pp->nJobs; j++)
         {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
+            PUBJOB *old = &(pp->jobs[(next + j) % pp->nJobs]);
+            if ((old->job != NULL) && (strcmp(old->job, str) == 0))
+                break;
         }
+        if (j < pp->nJobs)
+        {
+            j = (next + j) % pp->nJobs;
+            jobs[i] = pp->jobs[j];
+            pp->jobs[j].job = NULL;
+            next = j + 1;
+        }
+        else if ((jobs[i].job = copyString(str)) == NULL)
+            break;
         else
         {
-            /*
-             * Try getting all the job info (except the stage and
-             * parameter lists which we deal with elsewhere)
-             */
-            status = DSGetJobInfo(hJob, DSJ_JOBSTATUS, &jobInfo);
-            if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting job status\n", status);
-            else
+            jobs[i].slot = -1;
+            jobs[i].jobStatus = jobs[i].waveNumber = -1;
+        }
+    }
+    nJobs = i;
+    for (j = 0; j < pp->nJobs; j++)
+        if (pp->jobs[j].job != NULL)
+        {
+            if (pp->jobs[j].slot >= 0)
             {
-                printf("Job Status\t: ");
-                switch(jobInfo.info.jobStatus)
-                {
-                case DSJS_RUNNING:
-                    printf("RUNNING");
-                    break;
-                case DSJS_RUNOK:
-                    printf("RUN OK");
-                    break;
-                case DSJS_RUNWARN:
-                    printf("RUN with WARNINGS");
-                    break;
-                case DSJS_RUNFAILED:
-                    printf("RUN FAILED");
-                    break;
-                case DSJS_VALOK:
-                    printf("VALIDATED OK");
-                    break;
-                case DSJS_VALWARN:
-                    printf("VALIDATE with WARNINGS");
-                    break;
-                case DSJS_VALFAILED:
-                    printf("VALIDATION FILED");
-                    break;
-                case DSJS_RESET:
-                    printf("RESET");
-                    break;
-                case DSJS_STOPPED:
-                    printf("STOPPED");
-                    break;
-                case DSJS_NOTRUNNABLE:
-                    printf("NOT COMPILED");
-                    break;
-                case DSJS_NOTRUNNING:
-                    printf("NOT RUNNING");
-                    break;
-                default:
-                    printf("UNKNOWN");
-                    break;
-                }
-                printf(" (%d)\n", jobInfo.info.jobStatus);
+                freeStatusSlot(&(pub->segment->slot[pp->jobs[j].slot]));
+                pub->full = FALSE;
             }
-            status = DSGetJobInfo(hJob, DSJ_JOBCONTROLLER, &jobInfo);
-            if (status == DSJE_NOT_AVAILABLE)
-                printf("Job Controller\t: not available\n");
-            else if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting job controller\n", status);
-            else
-                printf("Job Controller\t: %s\n", jobInfo.info.jobController);
-            status = DSGetJobInfo(hJob, DSJ_JOBSTARTTIMESTAMP, &jobInfo);
-            if (status == DSJE_NOT_AVAILABLE)
-                printf("Job Start Time\t: not available\n");
-            else if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting job start time\n", status);
-            else
-                printf("Job Start Time\t: %s", ctime(&(jobInfo.info.jobStartTime)));
-            status = DSGetJobInfo(hJob, DSJ_JOBWAVENO, &jobInfo);
-            if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting job wave number\n", status);
-            else
-                printf("Job Wave Number\t: %d\n", jobInfo.info.jobWaveNumber);
-            status = DSGetJobInfo(hJob, DSJ_USERSTATUS, &jobInfo);
-            if (status == DSJE_NOT_AVAILABLE)
-                printf("User Status\t: not available\n");
-            else if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting job user status\n", status);
-            else
-                printf("User Status\t: %s\n", jobInfo.info.userStatus);
-            if (status == DSJE_NOT_AVAILABLE)
-                status = DSJE_NOERROR;
-            (void) DSCloseJob(hJob);    
+            freePubJob(&(pp->jobs[j]));
+        }
+    free(pp->jobs);
+    pp->jobs = jobs;
+    pp->nJobs = nJobs;
+    for (i = 0; i < nJobs; i++)
+        publishJob(pub, pp, &(jobs[i]));
+}
+
+static unsigned __stdcall publisherThread(
+    void *arg                   /* The PUBLISHER */
+)
+{
+    PUBLISHER *pub = arg;
+    DWORD started;
+    DWORD elapsed;
+    int p;
+    int i;
+    do
+    {
+        EnterCriticalSection(&publishLock);
+        started = GetTickCount();
+        for (p = 0; p < pub->nProjects; p++)
+            publishProject(pub, &(pub->projects[p]));
+        LeaveCriticalSection(&publishLock);
+        elapsed = GetTickCount() - started;
+        if (elapsed > (DWORD) pub->interval * 1000)
+            elapsed = (DWORD) pub->interval * 1000;
+    } while (WaitForSingleObject(pub->hStop, (DWORD) pub->interval * 1000 - elapsed) == WAIT_TIMEOUT);
+    /* The handles are closed by the thread that opened them */
+    for (p = 0; p < pub->nProjects; p++)
+    {
+        PUBPROJECT *pp = &(pub->projects[p]);
+        for (i = 0; i < pp->nJobs; i++)
+            freePubJob(&(pp->jobs[i]));
+        free(pp->jobs);
+        if (pp->worker.hProject != NULL)
+        {
+            EnterCriticalSection(&apiLock);
+            (void) DSCloseProject(pp->worker.hProject);
+            LeaveCriticalSection(&apiLock);
         }
-        (void) DSCloseProject(hProject);
     }
-    return status;
+    return 0;
 }
 
-/*****************************************************************************/
 /*
- * Handle the -stageinfo sub-command
+ * Create the status segment and start publishing to it. Only one daemon
+ * may publish to a segment.
  */
-static int jobStageInfo(int argc, char *argv[])
+static BOOL startPublisher(
+    PUBLISHER *pub              /* Projects and interval filled in */
+)
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
-    int status;
-    char *project;
-    char *job;
-    char *stage;
-    DSSTAGEINFO stageInfo;
-    /* Validate arguments and extract optional arguments */
-    /* Must be three parameters left... project, job and stage */
-    if (argc != 3)
+    const char *name = statusSegmentName();
+    int p;
+    int fd;
+    pub->hMap = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                                   0, sizeof(STATUSSEGMENT), name);
+    if (pub->hMap == NULL)
     {
-        fprintf(stderr, "Invalid arguments: dsjob -stageinfo <project> <job> <stage>\n");
-        return DSJE_DSJOB_ERROR;
+        fprintf(stderr, "ERROR: Failed to create status segment '%s' (%lu)\n", name, GetLastError());
+        return FALSE;
     }
-    project = argv[0];
-    job = argv[1];
-    stage = argv[2];
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
     {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
+        fprintf(stderr, "ERROR: Status segment '%s' is already being published\n", name);
+        (void) CloseHandle(pub->hMap);
+        return FALSE;
     }
-    else
+    pub->segment = MapViewOfFile(pub->hMap, FILE_MAP_WRITE, 0, 0, sizeof(STATUSSEGMENT));
+    pub->hStop = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if ((pub->segment == NULL) || (pub->hStop == NULL))
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
-        {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
-        }
-        else
-        {
-            /*
-             * Try getting all the stage info (except the link
-             * lists which we deal with elsewhere)
-             */
-            status = DSGetStageInfo(hJob, stage, DSJ_STAGETYPE, &stageInfo);
-            if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting stage type\n", status);
-            else
-                printf("Stage Type\t: %s\n", stageInfo.info.typeName);
-            status = DSGetStageInfo(hJob, stage, DSJ_STAGEINROWNUM, &stageInfo);
-            if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting stage row number\n", status);
-            else
-                printf("In Row Number\t: %d\n", stageInfo.info.inRowNum);
-            status = DSGetStageInfo(hJob, stage, DSJ_STAGELASTERR, &stageInfo);
-            if (status == DSJE_NOT_AVAILABLE)
-                printf("Stage Last Error: <none>\n");
-            else if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting stage last error\n", status);
-            else
-            {
-                printf("Stage Last Error:\n");
-                printLogDetail(1, &(stageInfo.info.lastError));
-            }
-            if (status == DSJE_NOT_AVAILABLE)
-                status = DSJE_NOERROR;
-            (void) DSCloseJob(hJob);
-        }
-        (void) DSCloseProject(hProject);
+        fprintf(stderr, "ERROR: Failed to map status segment '%s' (%lu)\n", name, GetLastError());
+        if (pub->segment != NULL)
+            (void) UnmapViewOfFile(pub->segment);
+        if (pub->hStop != NULL)
+            (void) CloseHandle(pub->hStop);
+        (void) CloseHandle(pub->hMap);
+        return FALSE;
     }
-    return status;
+    /* The segment starts out zero filled, so every slot is free */
+    pub->segment->interval = pub->interval;
+    pub->segment->nSlots = STATUS_SLOTS;
+    MemoryBarrier();
+    memcpy(pub->segment->magic, STATUS_MAGIC, 8);
+    /* stderr goes to whichever client the daemon is serving */
+    for (p = 0; p < pub->nProjects; p++)
+        pub->projects[p].worker.quiet = TRUE;
+    /* A failure here only costs the segment full warning */
+    fd = _dup(_fileno(stderr));
+    pub->errFile = (fd >= 0) ? _fdopen(fd, "w") : NULL;
+    if ((pub->errFile == NULL) && (fd >= 0))
+        _close(fd);
+    pub->full = FALSE;
+    lastErrorLock = &apiLock;
+    pub->hThread = (HANDLE) _beginthreadex(NULL, 0, publisherThread, pub, 0, NULL);
+    if (pub->hThread == 0)
+    {
+        lastErrorLock = NULL;
+        fprintf(stderr, "ERROR: Failed to start publishing thread\n");
+        if (pub->errFile != NULL)
+            fclose(pub->errFile);
+        (void) UnmapViewOfFile(pub->segment);
+        (void) CloseHandle(pub->hStop);
+        (void) CloseHandle(pub->hMap);
+        return FALSE;
+    }
+    fprintf(stderr, "Publishing status to '%s' every %d seconds\n", name, pub->interval);
+    return TRUE;
+}
+
+static void stopPublisher(
+    PUBLISHER *pub              /* Started by startPublisher() */
+)
+{
+    (void) SetEvent(pub->hStop);
+    (void) WaitForSingleObject(pub->hThread, INFINITE);
+    lastErrorLock = NULL;
+    if (pub->errFile != NULL)
+        fclose(pub->errFile);
+    (void) CloseHandle(pub->hThread);
+    (void) CloseHandle(pub->hStop);
+    (void) UnmapViewOfFile(pub->segment);
+    (void) CloseHandle(pub->hMap);
 }
 
 /*****************************************************************************/
 /*
- * Handle the -linkinfo sub-command
+ * Batch and daemon mode support. Commands are read one per line, split into
+ * arguments in the same way as a command line and dispatched through
+ * runCommand(), with the handle cache enabled so that open projects and jobs
+ * are shared between commands.
  */
-static int jobLinkInfo(int argc, char *argv[])
+static int runCommand(int argc, char *argv[]);
+static BOOL isQueryCommand(char *arg);
+
+static BOOL inBatch = FALSE;
+
+/*
+ * Read and run commands from the given file until end of file or an "exit"
+ * line. Blank lines and lines starting with '#' are ignored. If endMarker
+ * is set, each command's output is followed by an "END <status>" line so
+ * that a client knows when the response is complete. Returns the status of
+ * the last command that failed, or DSJE_NOERROR.
+ */
+static int runBatch(
+    FILE *in,                   /* Command source */
+    BOOL endMarker,             /* Terminate each response with END line */
+    BOOL *shutdown              /* Set if a "shutdown" line is read */
+)
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
-    int status;
-    char *project;
-    char *job;
-    char *stage;
-    char *link;
-    DSLINKINFO linkInfo;
-    /* Validate arguments and extract optional arguments */
-    /* Must be four parameters left... project, job, stage and link names */
-    if (argc != 4)
-    {
-        fprintf(stderr, "Invalid arguments: dsjob -linkinfo <project> <job> <stage> <link>\n");
-        return DSJE_DSJOB_ERROR;
-    }
-    project = argv[0];
-    job = argv[1];
-    stage = argv[2];
-    link = argv[3];
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
+    char *line = NULL;
+    size_t size = 0;
+    int result = DSJE_NOERROR;
+    while (readLine(in, &line, &size))
     {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
+        int argc;
+        char **argv;
+        int status;
+        argv = splitCommandLine(line, &argc);
+        if (argv == NULL)
+        {
+            fprintf(stderr, "ERROR: Out of memory\n");
+            result = DSJE_DSJOB_ERROR;
+            break;
+        }
+        if ((argc == 0) || (argv[0][0] == '#'))
+        {
+            free(argv);
+            continue;
+        }
+        if ((strcmp(argv[0], "exit") == 0) || (strcmp(argv[0], "shutdown") == 0))
+        {
+            if ((shutdown != NULL) && (argv[0][0] == 's'))
+                *shutdown = TRUE;
+            free(argv);
+            break;
+        }
+        /* Close anything that has not been used for a while */
+        evictIdleHandles();
+        status = runCommand(argc, argv);
+        if (isConnectionError(status) && (handleCache != NULL) && isQueryCommand(argv[0]))
+        {
+            /*
+             * Cached handles may belong to a dead session... retry once. A
+             * command that changes anything is not retried, as the call that
+             * reported the error may still have taken effect.
+             */
+            fprintf(stderr, "Reconnecting...\n");
+            flushHandleCache();
+            status = runCommand(argc, argv);
+        }
+        if (status != DSJE_NOERROR)
+            result = status;
+        if (endMarker)
+        {
+            outStr(&stdoutBuf, "END ");
+            outInt(&stdoutBuf, status);
+            outChar(&stdoutBuf, '\n');
+            outFlush(&stdoutBuf);
+        }
+        fflush(stdout);
+        fflush(stderr);
+        free(argv);
     }
-    else
+    free(line);
+    return result;
+}
+
+/*
+ * Parse the options common to -batch and -daemon, and the -daemon
+ * publishing options if pub is not NULL. Returns the index of the first
+ * non-option argument, or -1 if the options are invalid.
+ */
+static int parseSessionOptions(int argc, char *argv[], PUBLISHER *pub)
+{
+    int i;
+    for (i = 0; (i < argc) && IS_SWITCH(argv[i]) && (argv[i][1] != '\0'); i++)
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
+        char *opt = &(argv[i][1]);
+        if (i + 1 >= argc)
+            return -1;
+        else if (strcmp(opt, "idle") == 0)
+            cacheIdleTimeout = atoi(argv[++i]);
+        else if ((pub != NULL) && (strcmp(opt, "publish") == 0) &&
+                (pub->nProjects < MAX_PUBLISH))
+            pub->projects[pub->nProjects++].project = argv[++i];
+        else if ((pub != NULL) && (strcmp(opt, "interval") == 0))
         {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
+            if ((pub->interval = atoi(argv[++i])) < 1)
+                return -1;
         }
         else
-        {
-            /* Try getting all the link info */
-            status = DSGetLinkInfo(hJob, stage, link, DSJ_LINKROWCOUNT, &linkInfo);
-            if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting link row count\n", status);
-            else
-                printf("Link Row Count\t: %d\n", linkInfo.info.rowCount);
-            status = DSGetLinkInfo(hJob, stage, link, DSJ_LINKLASTERR, &linkInfo);
-            if (status == DSJE_NOT_AVAILABLE)
-            {
-                printf("Link Last Error\t: <none>\n");
-                status = DSJE_NOERROR;
-            }
-            else if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting link last error\n", status);
-            else
-            {
-                printf("Link Last Error\t:\n");
-                printLogDetail(1, &(linkInfo.info.lastError));
-            }
-            (void) DSCloseJob(hJob);
-        }
-        (void) DSCloseProject(hProject);
+            return -1;
     }
-    return status;
+    return i;
 }
 
 /*****************************************************************************/
 /*
- * Handle the -lparams sub-command
+ * Handle the -batch sub-command
  */
-static int jobLParams(int argc, char *argv[])
+static int jobBatch(int argc, char *argv[])
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
+    int i;
     int status;
-    char *project;
-    char *job;
-    DSJOBINFO jobInfo;
+    FILE *in = stdin;
     /* Validate arguments and extract optional arguments */
-    /* Must be two parameters left... project and job names */
-    if (argc != 2)
+    i = parseSessionOptions(argc, argv, NULL);
+    if (inBatch || (i < 0) || (i + 1 < argc))
     {
-        fprintf(stderr, "Invalid arguments: dsjob -lparams <project> <job>\n");
+        fprintf(stderr, "Invalid arguments: dsjob -batch\n");
+        fprintf(stderr, "\t\t\t[-idle <seconds>]\n");
+        fprintf(stderr, "\t\t\t[<command file> | -]\n");
+        fprintf(stderr, "\nCommands are read one per line, from stdin if no file is given.\n");
         return DSJE_DSJOB_ERROR;
     }
-    project = argv[0];
-    job = argv[1];
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
-    {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
-    }
-    else
+    if ((i < argc) && (strcmp(argv[i], "-") != 0) && ((in = fopen(argv[i], "r")) == NULL))
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
-        {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
-        }
-        else
-        {
-            /* Get the list of parameter names */
-            status = DSGetJobInfo(hJob, DSJ_PARAMLIST, &jobInfo);
-            if (status == DSJE_NOT_AVAILABLE)
-            {
-                printf("<none>\n");
-                status = DSJE_NOERROR;
-            }
-            else if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting parameter list\n", status);
-            else
-                printStrList(0, jobInfo.info.paramList);
-            (void) DSCloseJob(hJob);
-        }
-        (void) DSCloseProject(hProject);
+        fprintf(stderr, "ERROR: Failed to open command file '%s'\n", argv[i]);
+        return DSJE_DSJOB_ERROR;
     }
+    inBatch = cacheHandles = TRUE;
+    status = runBatch(in, FALSE, NULL);
+    flushHandleCache();
+    inBatch = cacheHandles = FALSE;
+    if (in != stdin)
+        fclose(in);
     return status;
 }
 
 /*****************************************************************************/
 /*
- * Handle the -paraminfo sub-command
+ * Handle the -daemon sub-command
+ *
+ * Serve commands over the named pipe \\.\pipe\<name> (on POSIX systems the
+ * Unix domain socket /tmp/<name>), one client at a time.
+ * The client writes command lines and reads back the output of each,
+ * terminated by an "END <status>" line. Handles stay cached between
+ * clients; "exit" ends the client's session and "shutdown" stops the daemon.
+ * With -publish the daemon also keeps the status of the jobs in the given
+ * projects in the shared status segment, for -jobinfo -cached.
  */
-static void printValue(
-    DSPARAM *param
-)
-{
-    switch(param->paramType)
-    {
-    case DSJ_PARAMTYPE_STRING:
-        printf("%s", param->paramValue.pString);
-        break;
-    case DSJ_PARAMTYPE_ENCRYPTED:
-        printf("%s", param->paramValue.pEncrypt);
-        break;
-    case DSJ_PARAMTYPE_INTEGER:
-        printf("%d", param->paramValue.pInt);
-        break;
-    case DSJ_PARAMTYPE_FLOAT:
-        printf("%G", param->paramValue.pFloat);
-        break;
-    case DSJ_PARAMTYPE_PATHNAME:
-        printf("%s", param->paramValue.pPath);
-        break;
-    case DSJ_PARAMTYPE_LIST:
-        printf("%s", param->paramValue.pListValue);
-        break;
-    case DSJ_PARAMTYPE_DATE:
-        printf("%s", param->paramValue.pDate);
-        break;
-    case DSJ_PARAMTYPE_TIME:
-        printf("%s", param->paramValue.pTime);
-        break;
-    }
-}
-
-static int jobParamInfo(int argc, char *argv[])
+static int jobDaemon(int argc, char *argv[])
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
-    int status;
-    char *project;
-    char *job;
-    char *param;
-    DSPARAMINFO paramInfo;
+    int i;
+    char pipeName[256];
+    BOOL shutdown = FALSE;
+    int status = DSJE_NOERROR;
+    PUBLISHER pub;
     /* Validate arguments and extract optional arguments */
-    /* Must be three parameters left... project, job and parameter names */
-    if (argc != 3)
+    memset(&pub, 0, sizeof(pub));
+    pub.interval = DEFAULT_PUBLISH_INTERVAL;
+    i = parseSessionOptions(argc, argv, &pub);
+    if (inBatch || (i < 0) || (i + 1 != argc) || (strlen(argv[i]) > 200))
     {
-        fprintf(stderr, "Invalid arguments: dsjob -paraminfo <project> <job> <param>\n");
+        fprintf(stderr, "Invalid arguments: dsjob -daemon\n");
+        fprintf(stderr, "\t\t\t[-idle <seconds>]\n");
+        fprintf(stderr, "\t\t\t[-publish <project>]...\n");
+        fprintf(stderr, "\t\t\t[-interval <seconds>]\n");
+        fprintf(stderr, "\t\t\t<pipe name>\n");
         return DSJE_DSJOB_ERROR;
     }
-    project = argv[0];
-    job = argv[1];
-    param = argv[2];
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
-    {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
-    }
-    else
+    sprintf(pipeName, PIPE_PREFIX "%s", argv[i]);
+    if ((pub.nProjects > 0) && !startPublisher(&pub))
+        return DSJE_DSJOB_ERROR;
+    inBatch = cacheHandles = TRUE;
+    fprintf(stderr, "Listening on %s\n", pipeName);
+    while (!shutdown)
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
+        HANDLE hPipe;
+        DWORD mode = PIPE_READMODE_BYTE | PIPE_WAIT;
+        BOOL connected = FALSE;
+        int inFd;
+        int outFd;
+        int savedOut;
+        int savedErr;
+        FILE *in;
+        /*
+         * Create the pipe non-blocking so that we can keep evicting idle
+         * handles while we wait for a client, then switch it to blocking
+         * once one connects.
+         */
+        hPipe = CreateNamedPipeA(pipeName, PIPE_ACCESS_DUPLEX,
+                    PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_NOWAIT,
+                    1, 4096, 4096, 0, NULL);
+        if (hPipe == INVALID_HANDLE_VALUE)
         {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
+            fprintf(stderr, "ERROR: Failed to create pipe %s (%lu)\n", pipeName, GetLastError());
+            status = DSJE_DSJOB_ERROR;
+            break;
         }
-        else
+        while (!connected)
         {
-            /* Get the parameter information */
-            status = DSGetParamInfo(hJob, param, &paramInfo);
-            if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting info for parameter\n", status);
+            if (ConnectNamedPipe(hPipe, NULL) || (GetLastError() == ERROR_PIPE_CONNECTED))
+                connected = TRUE;
+            else if (GetLastError() != ERROR_PIPE_LISTENING)
+                break;
             else
             {
-                printf("Type\t\t: ");
-                switch(paramInfo.paramType)
-                {
-                case DSJ_PARAMTYPE_STRING:
-                    printf("String");
-                    break;
-                case DSJ_PARAMTYPE_ENCRYPTED:
-                    printf("Encrypted");
-                    break;
-                case DSJ_PARAMTYPE_INTEGER:
-                    printf("Integer");
-                    break;
-                case DSJ_PARAMTYPE_FLOAT:
-                    printf("Float");
-                    break;
-                case DSJ_PARAMTYPE_PATHNAME:
-                    printf("Pathname");
-                    break;
-                case DSJ_PARAMTYPE_LIST:
-                    printf("list");
-                    break;
-                case DSJ_PARAMTYPE_DATE:
-                    printf("Date");
-                    break;
-                case DSJ_PARAMTYPE_TIME:
-                    printf("Time");
-                    break;
-                default:
-                    printf("*** ERROR - UNKNOWN TYPE ***");
-                    break;
-                }
-                printf(" (%d)\n", paramInfo.paramType);
-
-                printf("Help Text\t: %s\n", paramInfo.helpText);
-                printf("Prompt\t\t: %s\n", paramInfo.paramPrompt);
-                printf("Prompt At Run\t: %d\n", paramInfo.promptAtRun);
-                printf("Default Value\t: ");
-                printValue(&(paramInfo.defaultValue));
-                printf("\n");
-                printf("Original Default: ");
-                printValue(&(paramInfo.desDefaultValue));
-                printf("\n");
-                if (paramInfo.paramType == DSJ_PARAMTYPE_LIST)
-                {
-                    printf("List Values\t:\n");
-                    printStrList(2, paramInfo.listValues);
-                    printf("Original List\t:\n");
-                    printStrList(2, paramInfo.desListValues);
-                }
-                printf("\n");
+                Sleep(250);
+                evictIdleHandles();
             }
-            (void) DSCloseJob(hJob);
         }
-        (void) DSCloseProject(hProject);
+        if (!connected || !SetNamedPipeHandleState(hPipe, &mode, NULL, NULL)
+                || ((inFd = _open_osfhandle((intptr_t) hPipe, _O_RDONLY)) < 0))
+        {
+            CloseHandle(hPipe);
+            continue;
+        }
+        /* The pipe handle now belongs to inFd (and so to in) */
+        in = _fdopen(inFd, "r");
+        outFd = _dup(inFd);
+        fflush(stdout);
+        fflush(stderr);
+        savedOut = _dup(_fileno(stdout));
+        savedErr = _dup(_fileno(stderr));
+        _dup2(outFd, _fileno(stdout));
+        _dup2(outFd, _fileno(stderr));
+        (void) runBatch(in, TRUE, &shutdown);
+        fflush(stdout);
+        fflush(stderr);
+        (void) flushPipe(outFd);
+        _dup2(savedOut, _fileno(stdout));
+        _dup2(savedErr, _fileno(stderr));
+        _close(savedOut);
+        _close(savedErr);
+        _close(outFd);
+        fclose(in);
     }
+    if (pub.nProjects > 0)
+        stopPublisher(&pub);
+    flushHandleCache();
+    inBatch = cacheHandles = FALSE;
     return status;
 }
 
 /*****************************************************************************/
 /*
- * Handle the -log sub-command
+ * The following array defines all the allowed/known primary command options
+ * and the routines that are used to process them.
  */
-static int jobLog(int argc, char *argv[])
+static struct MAJOROPTION
+{
+    char *name;
+    int (*optionHandler) (int, char **);
+    BOOL readOnly;              /* A query that ends by itself, so can be run
+                                   by -servers and run again by -batch */
+} MajorOption[] =
+{
+    { "run",              jobRun,             FALSE },
+    { "runmany",          jobRunMany,         FALSE },
+    { "rundag",           jobRunDag,          FALSE },
+    { "waitall",          jobWaitAll,         FALSE },
+    { "join",             jobJoin,            FALSE },
+    { "stop",             jobStop,            FALSE },
+    { "recover",          jobRecover,         FALSE },
+    { "lprojects",        jobLProjects,       TRUE },
+    { "ljobs",            jobLJobs,           TRUE },
+    { "lstages",          jobLStages,         TRUE },
+    { "llinks",           jobLLinks,          TRUE },
+    { "jobinfo",          jobJobInfo,         TRUE },
+    { "projectstatus",    jobProjectStatus,   TRUE },
+    { "stageinfo",        jobStageInfo,       TRUE },
+    { "linkinfo",         jobLinkInfo,        TRUE },
+    { "monitor",          jobMonitor,         FALSE },
+    { "graph",            jobGraph,           TRUE },
+    { "harvest",          jobHarvest,         FALSE },
+    { "perfreport",       jobPerfReport,      FALSE },
+    { "lparams",          jobLParams,         TRUE },
+    { "paraminfo",        jobParamInfo,       TRUE },
+    { "snapshot",         jobSnapshot,        FALSE },
+    { "verify",           jobVerify,          FALSE },
+    { "export-inventory", jobExportInventory, FALSE },
+    { "log",              jobLog,             FALSE },
+    { "logsum",           jobLogSum,          TRUE },
+    { "logsearch",        jobLogSearch,       TRUE },
+    { "logfollow",        jobLogFollow,       FALSE },
+    { "watch",            jobWatch,           FALSE },
+    { "logdetail",        jobLogDetail,       TRUE },
+    { "lognewest",        jobLogNewest,       TRUE },
+    { "logarchive",       jobLogArchive,      FALSE },
+    { "logread",          jobLogRead,         FALSE },
+    { "batch",            jobBatch,           FALSE },
+    { "daemon",           jobDaemon,          FALSE }
+};
+#define N_MAJOR_OPTIONS (sizeof(MajorOption) / sizeof(struct MAJOROPTION))
+
+/*
+ * Look up a primary command switch, returning its index in MajorOption or -1
+ * if it is not one we know.
+ */
+static int findMajorOption(
+    char *arg                   /* Command switch including the '-' */
+)
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
-    int status;
     int i;
-    char *project;
-    char *job;
-    int type = DSJ_LOGINFO;
-    BOOL badOptions = FALSE;
-    /* Validate arguments and extract optional arguments */
-    for (i = 0; (i < argc) && !badOptions && (
-                (argv[i][0] == '-') || (argv[i][0] == '/')); i++)
-    {
-        char *opt = &(argv[i][1]);
-        /* Note: not mutually exclusive check on info or warn */
-        if (strcmp(opt, "info") == 0)
-            type = DSJ_LOGINFO;
-        else if (strcmp(opt, "warn") == 0)
-            type = DSJ_LOGWARNING;
-        else
-            badOptions = TRUE;
-    }
-    /* Must be two parameters left... project and job */
-    if ((i+2) == argc)
-    {
-        project = argv[i];
-        job = argv[i+1];
-    }
-    else
-        badOptions = TRUE;
-    /* Report validation problems and exit */
-    if (badOptions)
+    /* ... that must start with a '-' (or '/' on NT)... */
+    if (!IS_SWITCH(arg))
+        return -1;
+    /* ... and it must be one of the primary commands... */
+    for (i = 0; i < N_MAJOR_OPTIONS; i++)
+        if (strcmp(&(arg[1]), MajorOption[i].name) == 0)
+            return i;
+    return -1;
+}
+
+/*
+ * Whether a command switch is one of the read-only queries. -monitor only
+ * reads too, but runs until its job ends: -servers would show nothing until
+ * then, and after a reconnect it would start again from the beginning.
+ */
+static BOOL isQueryCommand(
+    char *arg                   /* Command switch including the '-' */
+)
+{
+    int i = findMajorOption(arg);
+    return (i >= 0) && MajorOption[i].readOnly;
+}
+
+/*
+ * Run one primary command (argv[0] is the command switch) and report any
+ * failure together with the last error message recorded by the API. While
+ * the publisher runs, the whole command is run under publishLock, as a
+ * failure in the publisher would otherwise replace the command's last error
+ * before it is read.
+ */
+static int runCommand(int argc, char *argv[])
+{
+    int i;
+    int result;
+    char *errText;
+    BOOL publishing = (lastErrorLock != NULL);
+    if ((i = findMajorOption(argv[0])) < 0)
     {
-        fprintf(stderr, "Invalid arguments: dsjob -log\n");
-        fprintf(stderr, "\t\t\t[-info | -warn]\n");
-        fprintf(stderr, "\t\t\t<project> <job>\n");
-        fprintf(stderr, "\nLog message is read from stdin.\n");
+        fprintf(stderr, "Invalid/unknown primary command switch.\n");
         return DSJE_DSJOB_ERROR;
     }
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
+
+    if (publishing)
+        EnterCriticalSection(&publishLock);
+
+    /* Each command's output starts a new table */
+    stdoutBuf.columns = NULL;
+    commandNumber++;
+    result = MajorOption[i].optionHandler(argc - 1, &(argv[1]));
+    outFlush(&stdoutBuf);
+
+    if (result != DSJE_NOERROR)
+        fprintf(stderr, "\nStatus code = %d\n", result);
+
+    errText = DSGetLastErrorMsg(NULL);
+    if (errText != NULL)
     {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
+        fprintf(stderr, "\nLast recorded error message =\n");
+        writeStrList(&stdoutBuf, 0, errText);
+        outFlush(&stdoutBuf);
+        fprintf(stderr, "\n");
     }
-    else
-    {
-		if ((hJob = DSOpenJob(hProject, job)) == NULL)
-		{
-			status = DSGetLastError();
-			fprintf(stderr, "ERROR: Failed to open job\n");
-		}
-		else
-		{
-			#define MAX_MSG_LEN 4096
-			char message[MAX_MSG_LEN + 4];
-			int n = 0;
-			/* Read the message from stdin */
-			printf("Enter message text, terminating with Ctrl-d\n");
-			while (n < MAX_MSG_LEN)
-			{
-				int ch;
-				ch = getchar();
-				if ((ch == EOF)
-#ifdef WIN32
-								|| (ch == 4)    /* Ctrl-d */
-#endif
-						)
-					break;
-				if ((ch == '\n') || isprint(ch))
-					message[n++] = ch;
-			}
-			printf("\nMessage read.\n");
-			message[n] = '\0';
-			/* Add message to the log */
-			status = DSLogEvent(hJob, type, NULL, message);
-			if (status != DSJE_NOERROR)
-				fprintf(stderr, "Error adding log entry\n");
-			(void) DSCloseJob(hJob);
-		}
-        (void) DSCloseProject(hProject);
+
+    if (publishing)
+        LeaveCriticalSection(&publishLock);
+    return result;
+}
+
+/*****************************************************************************/
+/*
+ * Fan-out over several servers (-servers).
+ *
+ * DSSetServerParams() sets the server for the whole process, so each server
+ * is queried by a child dsjob of its own, all of them running at once. A
+ * child's output goes to a temporary file; once every child has finished,
+ * the files are copied to stdout and stderr in the order the servers are
+ * listed, each line tagged with its server:
+ *
+ *  - in text mode, each line is prefixed by the server name and a tab;
+ *  - in the other formats the children are run with -tag, which adds a
+ *    leading "server" field to every record, and only the first copy of
+ *    each CSV/TSV header is kept;
+ *  - error output is prefixed by the server name and a colon.
+ *
+ * The server file has a line for each server, with the server name and
+ * optionally the domain, user and password to use for it, "-" (or leaving
+ * it off) meaning the one given on the command line. Blank lines and lines
+ * starting with '#' are ignored.
+ *
+ * A child is never given a password on its command line, which any user
+ * on the host can read. It gets -stdinpassword instead, and its stdin is a
+ * temporary file, deleted on close, holding the password.
+ */
+typedef struct FANOUT
+{
+    char *server;               /* Fields of the server file line */
+    char *domain;
+    char *user;
+    char *password;
+    char *line;                 /* The line, split in place */
+    char **argv;
+    HANDLE hProcess;            /* Child dsjob, NULL if it did not start */
+    HANDLE hOut;                /* Its stdout and stderr files */
+    HANDLE hErr;
+} FANOUT;
+
+/*
+ * Append an argument to a command line, quoted as the C runtime expects
+ * when it splits the command line back into arguments.
+ */
+static void appendArg(
+    OUTBUF *cmd,                /* Command line so far */
+    const char *arg             /* Argument to add */
+)
+{
+    if (cmd->len > 0)
+        outChar(cmd, ' ');
+    if ((*arg != '\0') && (strpbrk(arg, " \t\"") == NULL))
+        outStr(cmd, arg);
+    else
+    {
+        outChar(cmd, '"');
+        for (; *arg != '\0'; arg++)
+        {
+            size_t nSlashes = strspn(arg, "\\");
+            /* Backslashes are only special before a quote */
+            if ((arg[nSlashes] == '"') || (arg[nSlashes] == '\0'))
+                nSlashes *= 2;
+            arg += strspn(arg, "\\");
+            while (nSlashes-- > 0)
+                outChar(cmd, '\\');
+            if (*arg == '\0')
+                break;
+            if (*arg == '"')
+                outChar(cmd, '\\');
+            outChar(cmd, *arg);
+        }
+        outChar(cmd, '"');
     }
-    return status;
 }
 
-/*****************************************************************************/
 /*
- * Handle the -logsum sub-command
+ * Create a temporary file for a child's output (or its password), deleted
+ * when it is closed.
  */
-static int jobLogSum(int argc, char *argv[])
+static HANDLE createOutputFile(void)
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
-    int status;
+    SECURITY_ATTRIBUTES sa;
+    char dir[MAX_PATH];
+    char fileName[MAX_PATH];
+    sa.nLength = sizeof(sa);
+    sa.lpSecurityDescriptor = NULL;
+    sa.bInheritHandle = TRUE;
+    if ((GetTempPathA(sizeof(dir), dir) == 0) ||
+            (GetTempFileNameA(dir, "dsj", 0, fileName) == 0))
+        return INVALID_HANDLE_VALUE;
+    return CreateFileA(fileName, GENERIC_READ | GENERIC_WRITE,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, &sa,
+                       CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+}
+
+/*
+ * Start a child dsjob that runs the command against one server.
+ */
+static BOOL startFanOut(
+    FANOUT *child,              /* Server to run against */
+    int argc,                   /* Command and its arguments */
+    char *argv[],
+    BOOL useCache               /* Child may use the metadata cache */
+)
+{
+    static const char *formatNames[] = { "text", "json", "csv", "tsv" };
+    STARTUPINFOA si;
+    PROCESS_INFORMATION pi;
+    OUTBUF cmd;
+    char exeName[MAX_PATH];
+    char retries[16];
+    HANDLE hIn = INVALID_HANDLE_VALUE;
+    DWORD nWritten;
+    BOOL started = FALSE;
     int i;
-    char *project;
-    char *job;
-    int type = DSJ_LOGANY;
-    time_t startTime = 0;
-    time_t endTime = 0;
-    int maxNumber = 0;
-    BOOL badOptions = FALSE;
-    /* Validate arguments and extract optional arguments */
-    for (i = 0; (i < argc) && !badOptions && (
-                (argv[i][0] == '-') || (argv[i][0] == '/')); i++)
+    memset(&cmd, 0, sizeof(cmd));
+    child->hProcess = NULL;
+    child->hOut = createOutputFile();
+    child->hErr = createOutputFile();
+    if ((child->hOut == INVALID_HANDLE_VALUE) || (child->hErr == INVALID_HANDLE_VALUE))
     {
-        char *opt = &(argv[i][1]);
-        char *arg = argv[i+1];
-        if (++i >= argc)
-            badOptions = TRUE;
-        else if (strcmp(opt, "type") == 0)
-        {
-            if (strcmp(arg, "INFO") == 0)
-                type = DSJ_LOGINFO;
-            else if (strcmp(arg, "WARNING") == 0)
-                type = DSJ_LOGWARNING;
-            else if (strcmp(arg, "FATAL") == 0)
-                type = DSJ_LOGFATAL;
-            else if (strcmp(arg, "REJECT") == 0)
-                type = DSJ_LOGREJECT;
-            else if (strcmp(arg, "STARTED") == 0)
-                type = DSJ_LOGSTARTED;
-            else if (strcmp(arg, "RESET") == 0)
-                type = DSJ_LOGRESET;
-            else if (strcmp(arg, "BATCH") == 0)
-                type = DSJ_LOGBATCH;
-            else if (strcmp(arg, "OTHER") == 0)
-                type = DSJ_LOGOTHER;
-            else
-                badOptions = TRUE;
-        }
-        else if (strcmp(opt, "max") == 0)
-            maxNumber = atoi(arg);
-        else
-                badOptions = TRUE;
+        fprintf(stderr, "%s: ERROR: Failed to create output file\n", child->server);
+        return FALSE;
     }
-    /* Must be two parameters left... project and job */
-    if ((i+2) == argc)
+    if ((child->password != NULL) &&
+            (((hIn = createOutputFile()) == INVALID_HANDLE_VALUE) ||
+             !WriteFile(hIn, child->password, (DWORD) strlen(child->password), &nWritten, NULL) ||
+             !WriteFile(hIn, "\n", 1, &nWritten, NULL) ||
+             (SetFilePointer(hIn, 0, NULL, FILE_BEGIN) == 0xFFFFFFFF)))
     {
-        project = argv[i];
-        job = argv[i+1];
+        fprintf(stderr, "%s: ERROR: Failed to create password file\n", child->server);
+        if (hIn != INVALID_HANDLE_VALUE)
+            CloseHandle(hIn);
+        return FALSE;
     }
-    else
-        badOptions = TRUE;
-    /* Report validation problems and exit */
-    if (badOptions)
+    if (GetModuleFileNameA(NULL, exeName, sizeof(exeName)) == 0)
     {
-        fprintf(stderr, "Invalid arguments: dsjob -logsum\n");
-        fprintf(stderr, "\t\t\t[-type <INFO | WARNING | FATAL | REJECT | STARTED | RESET | BATCH>]\n");
-        fprintf(stderr, "\t\t\t[-max <n>]\n");
-        fprintf(stderr, "\t\t\t<project> <job>\n");
-        return DSJE_DSJOB_ERROR;
+        if (hIn != INVALID_HANDLE_VALUE)
+            CloseHandle(hIn);
+        return FALSE;
     }
-    /* Attempt to open the project, open the job and lock it */
-    if ((hProject = DSOpenProject(project)) == NULL)
+    appendArg(&cmd, exeName);
+    if (child->domain != NULL)
     {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
+        appendArg(&cmd, "-domain");
+        appendArg(&cmd, child->domain);
     }
-    else
+    appendArg(&cmd, "-server");
+    appendArg(&cmd, child->server);
+    if (child->user != NULL)
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
+        appendArg(&cmd, "-user");
+        appendArg(&cmd, child->user);
+    }
+    if (child->password != NULL)
+        appendArg(&cmd, "-stdinpassword");
+    appendArg(&cmd, "-format");
+    appendArg(&cmd, formatNames[outputFormat]);
+    if (!useCache)
+        appendArg(&cmd, "-nocache");
+    if (outputFormat != FORMAT_TEXT)
+        appendArg(&cmd, "-tag");
+    if (openRetries != DEFAULT_OPEN_RETRIES)
+    {
+        sprintf(retries, "%d", openRetries);
+        appendArg(&cmd, "-retry");
+        appendArg(&cmd, retries);
+    }
+    for (i = 0; i < argc; i++)
+        appendArg(&cmd, argv[i]);
+    outChar(&cmd, '\0');
+    if (cmd.data != NULL)
+    {
+        memset(&si, 0, sizeof(si));
+        si.cb = sizeof(si);
+        si.dwFlags = STARTF_USESTDHANDLES;
+        si.hStdInput = (hIn != INVALID_HANDLE_VALUE) ? hIn : GetStdHandle(STD_INPUT_HANDLE);
+        si.hStdOutput = child->hOut;
+        si.hStdError = child->hErr;
+        started = CreateProcessA(NULL, cmd.data, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
+        if (started)
         {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
+            CloseHandle(pi.hThread);
+            child->hProcess = pi.hProcess;
         }
         else
+            fprintf(stderr, "%s: ERROR: Failed to start dsjob, error %lu\n",
+                    child->server, (unsigned long) GetLastError());
+    }
+    /* The child has its own handle to the file now */
+    if (hIn != INVALID_HANDLE_VALUE)
+        CloseHandle(hIn);
+    free(cmd.data);
+    return started;
+}
+
+/*
+ * Copy a child's output file to fp, tagging each line. A line starting with
+ * skipPrefix is a CSV/TSV header, which is left out if it is the same as
+ * the last one copied.
+ */
+static void copyFanOut(
+    HANDLE hFile,               /* File to copy */
+    FILE *fp,                   /* Where to copy it */
+    const char *tag,            /* Tag written before each line, or NULL */
+    const char *skipPrefix,     /* Start of a header line, or NULL */
+    char **lastHeader           /* Last header copied, updated */
+)
+{
+    LARGE_INTEGER size;
+    char *data;
+    char *line;
+    DWORD nRead = 0;
+    if (!GetFileSizeEx(hFile, &size) || (size.QuadPart == 0) ||
+            ((data = malloc((size_t) size.QuadPart + 1)) == NULL))
+        return;
+    (void) SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
+    if (ReadFile(hFile, data, (DWORD) size.QuadPart, &nRead, NULL))
+    {
+        data[nRead] = '\0';
+        for (line = data; *line != '\0'; )
         {
-            DSLOGEVENT event;
-            /* Make the first call to establish the log info */
-            status = DSFindFirstLogEntry(hJob, type, startTime,
-                                endTime, maxNumber, &event);
-            while(status == DSJE_NOERROR)
+            char *end = strchr(line, '\n');
+            size_t len = (end != NULL) ? (size_t) (end - line) + 1 : strlen(line);
+            if ((skipPrefix != NULL) && (strncmp(line, skipPrefix, strlen(skipPrefix)) == 0))
             {
-                printf("%d\t", event.eventId);
-                switch(event.type)
+                if ((*lastHeader == NULL) || (strncmp(*lastHeader, line, len) != 0) ||
+                        ((*lastHeader)[len] != '\0'))
                 {
-                case DSJ_LOGINFO:
-                    printf("INFO");
-                    break;
-                case DSJ_LOGWARNING:
-                    printf("WARNING");
-                    break;
-                case DSJ_LOGFATAL:
-                    printf("FATAL");
-                    break;
-                case DSJ_LOGREJECT:
-                    printf("REJECT");
-                    break;
-                case DSJ_LOGSTARTED:
-                    printf("STARTED");
-                    break;
-                case DSJ_LOGRESET:
-                    printf("RESET");
-                    break;
-                case DSJ_LOGBATCH:
-                    printf("BATCH");
-                    break;
-                case DSJ_LOGOTHER:
-                    printf("OTHER");
-                        break;
-                default:
-                    printf("????");
-                    break;
+                    free(*lastHeader);
+                    if ((*lastHeader = malloc(len + 1)) != NULL)
+                    {
+                        memcpy(*lastHeader, line, len);
+                        (*lastHeader)[len] = '\0';
+                    }
+                    fwrite(line, 1, len, fp);
                 }
-                printf("\t%s", ctime(&(event.timestamp))); /* ctime has \n at end */
-                printf("\t%s\n", event.message);
-                /* Go on to next entry */
-                status = DSFindNextLogEntry(hJob, &event);
             }
-            if (status == DSJE_NOMORE)
-                status = DSJE_NOERROR;
             else
-                fprintf(stderr, "Error %d getting log summary\n", status);
-            (void) DSCloseJob(hJob);
+            {
+                if (tag != NULL)
+                    fputs(tag, fp);
+                fwrite(line, 1, len, fp);
+                if (end == NULL)
+                    fputc('\n', fp);
+            }
+            line += len;
         }
-        (void) DSCloseProject(hProject);
     }
-    return status;
+    free(data);
 }
 
-/*****************************************************************************/
 /*
- * Handle the -logdetail sub-command
+ * Run a read-only command against every server in the file.
  */
-static int jobLogDetail(int argc, char *argv[])
+static int runFanOut(
+    char *serverFile,           /* File listing the servers */
+    char *domain,               /* Defaults for the servers */
+    char *user,
+    char *password,
+    int argc,                   /* Command and its arguments */
+    char *argv[]
+)
 {
-    DSPROJECT hProject;
-    DSJOB hJob;
-    int status;
-    char *project;
-    char *job;
-    int eventId;
-    DSLOGDETAIL logDetail;
-    /* Validate arguments and extract optional arguments */
-    /* Must be three parameters left... project, job and event id */
-    if (argc != 3)
+    FILE *fp;
+    FANOUT *children = NULL;
+    int nChildren = 0;
+    int maxChildren = 0;
+    char *line = NULL;
+    size_t size = 0;
+    char *lastHeader = NULL;
+    char outTag[256];
+    int result = DSJE_NOERROR;
+    int i;
+    if ((fp = fopen(serverFile, "r")) == NULL)
     {
-        fprintf(stderr, "Invalid arguments: dsjob -logdetail <project> <job> <event id>\n");
+        fprintf(stderr, "ERROR: Failed to open server file '%s'\n", serverFile);
         return DSJE_DSJOB_ERROR;
     }
-    project = argv[0];
-    job = argv[1];
-    eventId = atoi(argv[2]);
-    /* Attempt to open the project and the job */
-    if ((hProject = DSOpenProject(project)) == NULL)
-    {
-        status = DSGetLastError();
-        fprintf(stderr, "ERROR: Failed to open project\n");
-    }
-    else
+    while (readLine(fp, &line, &size))
     {
-        if ((hJob = DSOpenJob(hProject, job)) == NULL)
+        FANOUT *child;
+        int nArgs;
+        char *text = copyString(line);
+        char **args = (text != NULL) ? splitCommandLine(text, &nArgs) : NULL;
+        if (args == NULL)
         {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open job\n");
+            fprintf(stderr, "ERROR: Out of memory\n");
+            free(text);
+            result = DSJE_DSJOB_ERROR;
+            break;
         }
-        else
+        if ((nArgs == 0) || (args[0][0] == '#'))
         {
-            /* Try getting all the log info */
-            status = DSGetLogEntry(hJob, eventId, &logDetail);
-            if (status != DSJE_NOERROR)
-                fprintf(stderr, "Error %d getting event details\n", status);
-            else
-                printLogDetail(0, &logDetail);
-            (void) DSCloseJob(hJob);
+            free(args);
+            free(text);
+            continue;
         }
-        (void) DSCloseProject(hProject);
-    }
-    return status;
-}
-
-/*****************************************************************************/
-/*
- * Handle the -lognewest sub-command
- */
-static int jobLogNewest(int argc, char *argv[])
-{
-    DSPROJECT hProject;
-    DSJOB hJob;
-    int status = DSJE_NOERROR;
-    char *project;
-    char *job;
-    int type = DSJ_LOGANY;
-    BOOL badOptions = FALSE;
-    int id;
-    /* Validate arguments and extract optional arguments */
-    /* Must be at least two parameters left... project, job. Type is optional */
-    if ((argc < 2) || (argc > 3))
-            badOptions = TRUE;
-        else
+        if (nChildren == maxChildren)
         {
-            project = argv[0];
-            job = argv[1];
-            if (argc == 3)
+            FANOUT *more = realloc(children, (maxChildren + 16) * sizeof(FANOUT));
+            if (more == NULL)
             {
-                char *arg = argv[2];
-                if (strcmp(arg, "INFO") == 0)
-                    type = DSJ_LOGINFO;
-                else if (strcmp(arg, "WARNING") == 0)
-                    type = DSJ_LOGWARNING;
-                else if (strcmp(arg, "FATAL") == 0)
-                    type = DSJ_LOGFATAL;
-                else if (strcmp(arg, "REJECT") == 0)
-                    type = DSJ_LOGREJECT;
-                else if (strcmp(arg, "STARTED") == 0)
-                    type = DSJ_LOGSTARTED;
-                else if (strcmp(arg, "RESET") == 0)
-                    type = DSJ_LOGRESET;
-                else if (strcmp(arg, "BATCH") == 0)
-                    type = DSJ_LOGBATCH;
-                else if (strcmp(arg, "OTHER") == 0)
-                    type = DSJ_LOGOTHER;
-                else
-                    badOptions = TRUE;
+                fprintf(stderr, "ERROR: Out of memory\n");
+                free(args);
+                free(text);
+                result = DSJE_DSJOB_ERROR;
+                break;
             }
+            children = more;
+            maxChildren += 16;
         }
-        if (badOptions)
-        {
-            fprintf(stderr, "Invalid arguments: dsjob -lognewest <project> <job> [<event type>]\n");
-            fprintf(stderr, "\t event type = INFO | WARNING | FATAL | REJECT | STARTED | RESET | BATCH\n");
-            return DSJE_DSJOB_ERROR;
-        }
-        /* Attempt to open the project and the job */
-        if ((hProject = DSOpenProject(project)) == NULL)
+        child = &(children[nChildren++]);
+        child->line = text;
+        child->argv = args;
+        child->server = args[0];
+        child->domain = ((nArgs > 1) && (strcmp(args[1], "-") != 0)) ? args[1] : domain;
+        child->user = ((nArgs > 2) && (strcmp(args[2], "-") != 0)) ? args[2] : user;
+        child->password = ((nArgs > 3) && (strcmp(args[3], "-") != 0)) ? args[3] : password;
+        child->hProcess = NULL;
+        child->hOut = INVALID_HANDLE_VALUE;
+        child->hErr = INVALID_HANDLE_VALUE;
+    }
+    free(line);
+    fclose(fp);
+    if ((result == DSJE_NOERROR) && (nChildren == 0))
+    {
+        fprintf(stderr, "ERROR: No servers in '%s'\n", serverFile);
+        result = DSJE_DSJOB_ERROR;
+    }
+    /* Start them all, then wait for and copy the output of each in turn */
+    for (i = 0; (result == DSJE_NOERROR) && (i < nChildren); i++)
+        (void) startFanOut(&(children[i]), argc, argv, useMetaCache);
+    for (i = 0; i < nChildren; i++)
+    {
+        FANOUT *child = &(children[i]);
+        DWORD exitCode = (DWORD) DSJE_DSJOB_ERROR;
+        if (child->hProcess != NULL)
         {
-            status = DSGetLastError();
-            fprintf(stderr, "ERROR: Failed to open project\n");
+            (void) WaitForSingleObject(child->hProcess, INFINITE);
+            (void) GetExitCodeProcess(child->hProcess, &exitCode);
+            CloseHandle(child->hProcess);
         }
-        else
+        /* The child reports its own status code on its error output */
+        if (((int) exitCode != DSJE_NOERROR) && (result == DSJE_NOERROR))
+            result = (int) exitCode;
+        if (child->hOut != INVALID_HANDLE_VALUE)
         {
-            if ((hJob = DSOpenJob(hProject, job)) == NULL)
+            if (outputFormat == FORMAT_TEXT)
             {
-                status = DSGetLastError();
-                fprintf(stderr, "ERROR: Failed to open job\n");
+                sprintf(outTag, "%.250s\t", child->server);
+                copyFanOut(child->hOut, stdout, outTag, NULL, NULL);
             }
             else
-            {
-                /* Get the newest it */
-                id = DSGetNewestLogId(hJob, type);
-                if (id < 0)
-                {
-                    status = DSGetLastError();
-                    fprintf(stderr, "Error %d getting event details\n", status);
-                }
-                else
-                    printf("Newsest id = %d\n", id);
-                    (void) DSCloseJob(hJob);
-                }
-            (void) DSCloseProject(hProject);
+                copyFanOut(child->hOut, stdout, NULL,
+                           (outputFormat == FORMAT_CSV) ? "server," :
+                           (outputFormat == FORMAT_TSV) ? "server\t" : NULL,
+                           &lastHeader);
+            CloseHandle(child->hOut);
         }
-    return status;
+        if (child->hErr != INVALID_HANDLE_VALUE)
+        {
+            fflush(stdout);
+            sprintf(outTag, "%.250s: ", child->server);
+            copyFanOut(child->hErr, stderr, outTag, NULL, NULL);
+            CloseHandle(child->hErr);
+        }
+        free(child->argv);
+        free(child->line);
+    }
+    fflush(stdout);
+    free(lastHeader);
+    free(children);
+    return result;
 }
 
-/*****************************************************************************/
-/*
- * The following array defines all the allowed/known primary command options
- * and the routines that are used to process them.
- */
-static struct MAJOROPTION
-{
-    char *name;
-    int (*optionHandler) (int, char **);
-} MajorOption[] =
-{
-    "run",              jobRun,
-    "stop",             jobStop,
-    "lprojects",        jobLProjects,
-    "ljobs",            jobLJobs,
-    "lstages",          jobLStages,
-    "llinks",           jobLLinks,
-    "jobinfo",          jobJobInfo,
-    "stageinfo",        jobStageInfo,
-    "linkinfo",         jobLinkInfo,
-    "lparams",          jobLParams,
-    "paraminfo",        jobParamInfo,
-    "log",              jobLog,
-    "logsum",           jobLogSum,
-    "logdetail",        jobLogDetail,
-    "lognewest",        jobLogNewest
-};
-#define N_MAJOR_OPTIONS (sizeof(MajorOption) / sizeof(struct MAJOROPTION))
 /*
  * Main routine... simple!
  *
@@ -1382,8 +13439,21 @@ int main(
     char *server = NULL;
     char *user = NULL;
     char *password = NULL;
+    char *passwordLine = NULL;
+    size_t passwordSize = 0;
+    char *serverFile = NULL;
+    char *traceFileName = NULL;
+    BOOL stats = FALSE;
+    BOOL tag = FALSE;
     int result = DSJE_NOERROR;
 
+    InitializeCriticalSection(&apiLock);
+    InitializeCriticalSection(&publishLock);
+    InitializeCriticalSection(&metaLock);
+    InitializeCriticalSection(&(breaker.lock));
+    InitializeCriticalSection(&inventoryLock);
+    stdoutBuf.fp = stdout;
+
     /* Must have at least one argument */
     if (argc < 2)
         goto reportError;
@@ -1428,50 +13498,128 @@ int main(
 		argPos += 2;
         argc -= 2;
     }
+    /* ... or the first line of stdin, which is how -servers passes it on */
+    else if (strcmp(argv[argPos], "-stdinpassword") == 0)
+    {
+        if ((argc < 2) || !readLine(stdin, &passwordLine, &passwordSize))
+            goto reportError;
+        password = passwordLine;
+        argPos++;
+        argc--;
+    }
+    /* File of servers to run the command against, instead of -server */
+    if (strcmp(argv[argPos], "-servers") == 0)
+    {
+        if ((argc < 3) || (server != NULL))
+            goto reportError;
+        serverFile = argv[argPos + 1];
+        argPos += 2;
+        argc -= 2;
+    }
+
+    /* Output format */
+    if (strcmp(argv[argPos], "-format") == 0)
+    {
+        char *format;
+        if (argc < 3)
+            goto reportError;
+        format = argv[argPos + 1];
+        if (strcmp(format, "text") == 0)
+            setOutputFormat(FORMAT_TEXT);
+        else if (strcmp(format, "json") == 0)
+            setOutputFormat(FORMAT_JSON);
+        else if (strcmp(format, "csv") == 0)
+            setOutputFormat(FORMAT_CSV);
+        else if (strcmp(format, "tsv") == 0)
+            setOutputFormat(FORMAT_TSV);
+        else
+            goto reportError;
+        argPos += 2;
+        argc -= 2;
+    }
+    /* Don't use the metadata cache */
+    if (strcmp(argv[argPos], "-nocache") == 0)
+    {
+        if (argc < 2)
+            goto reportError;
+        useMetaCache = FALSE;
+        argPos++;
+        argc--;
+    }
+    /* Tag each record with the server name */
+    if (strcmp(argv[argPos], "-tag") == 0)
+    {
+        if (argc < 2)
+            goto reportError;
+        tag = TRUE;
+        argPos++;
+        argc--;
+    }
+    /* Time the API calls */
+    if (strcmp(argv[argPos], "-stats") == 0)
+    {
+        if (argc < 2)
+            goto reportError;
+        stats = TRUE;
+        argPos++;
+        argc--;
+    }
+    if (strcmp(argv[argPos], "-trace") == 0)
+    {
+        if (argc < 3)
+            goto reportError;
+        traceFileName = argv[argPos + 1];
+        argPos += 2;
+        argc -= 2;
+    }
+    /* Times to retry an open that fails to connect */
+    if (strcmp(argv[argPos], "-retry") == 0)
+    {
+        if ((argc < 3) || (sscanf(argv[argPos + 1], "%d", &openRetries) != 1) || (openRetries < 0))
+            goto reportError;
+        argPos += 2;
+        argc -= 2;
+    }
 
     /* Must be at least one command argument remaining... */
     if (argc < 1)
         goto reportError;
-    /* ... that must start with a '-' (or '/' on NT)... */
-    if ((argv[argPos][0] != '-')
-#ifdef WIN32
-                && (argv[argPos][0] != '/')
-#endif
-                )
-        goto reportError;
 
-    /* ... and it must be one of the primary commands... */
-    for (i = 0; i < N_MAJOR_OPTIONS; i++)
-	{
-        if (strcmp(&(argv[argPos][1]), MajorOption[i].name) == 0)
+    if ((serverFile != NULL) && ((i = findMajorOption(argv[argPos])) >= 0))
+    {
+        if (!MajorOption[i].readOnly || stats || (traceFileName != NULL))
         {
-            char *errText;
-
-            DSSetServerParams(domain, user, password, server);
-
-            result = MajorOption[i].optionHandler(argc - 1, &(argv[argPos + 1]));
-
-            if (result != DSJE_NOERROR)
-                fprintf(stderr, "\nStatus code = %d\n", result);
-
-            errText = DSGetLastErrorMsg(NULL);
-            if (errText != NULL)
-            {
-                fflush(stdout);
-                fprintf(stderr, "\nLast recorded error message =\n");
-                printStrList(0, errText);
-                fflush(stdout);
-                fprintf(stderr, "\n");
-            }
+            fprintf(stderr, "Only a query that ends by itself can be run with -servers, and without -stats or -trace\n");
+            result = DSJE_DSJOB_ERROR;
+            goto exitProgram;
+        }
+        result = runFanOut(serverFile, domain, user, password, argc, &(argv[argPos]));
+        goto exitProgram;
+    }
+    if (findMajorOption(argv[argPos]) >= 0)
+    {
+        if ((stats || (traceFileName != NULL)) && !startTrace(stats, traceFileName))
+        {
+            result = DSJE_DSJOB_ERROR;
             goto exitProgram;
         }
-	}
+        DSSetServerParams(domain, user, password, server);
+        serverName = server;
+        if (tag)
+            recordTag = (server != NULL) ? server : "";
+
+        result = runCommand(argc, &(argv[argPos]));
+        goto exitProgram;
+    }
 
     /* We only get here if we failed to find a valid command */
     fprintf(stderr, "Invalid/unknown primary command switch.\n");
 reportError:
     fprintf(stderr, "Command syntax:\n");
     fprintf(stderr, "\tdsjob [-domain <domain>][-server <server>][-user <user>][-password <password>]\n");
+    fprintf(stderr, "\t\t\t[-servers <server file>]\n");
+    fprintf(stderr, "\t\t\t[-format <text | json | csv | tsv>] [-nocache] [-tag]\n");
+    fprintf(stderr, "\t\t\t[-stats] [-trace <trace file>] [-retry <count>]\n");
     fprintf(stderr, "\t\t\t<primary command> [<arguments>]\n");
     fprintf(stderr, "\nValid primary command options are:\n");
     for (i = 0; i < N_MAJOR_OPTIONS; i++)
@@ -1479,6 +13627,8 @@ reportError:
     result = DSJE_DSJOB_ERROR;
 
 exitProgram:
+    endTrace();
+    free(passwordLine);
     return result;
 }
 
@@ -0,0 +1,1197 @@
+/*
+ * Copyright 2020 IBM Corp. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * dsport.c - the Win32 subset declared in dsport.h, for POSIX systems.
+ *
+ * Only what dsjob and dsbench use is here, and only as far as they use
+ * it. Every HANDLE is a PORTHANDLE; GetLastError() is errno, which the
+ * routines below set to a Win32 code where the callers test for one.
+ */
+
+#ifndef WIN32
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "dsport.h"
+
+#define STILL_ACTIVE            259
+
+typedef enum
+{
+    H_WAITABLE,                 /* Event, semaphore or thread */
+    H_PROCESS,
+    H_FILE,
+    H_MAPPING,
+    H_PIPE
+} HANDLEKIND;
+
+typedef struct
+{
+    HANDLEKIND kind;
+    int refs;                   /* The handle, and a thread still running */
+    BOOL permanent;             /* A standard handle, never freed */
+    /* Waitable objects */
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    LONG count;                 /* Signalled if > 0 */
+    LONG maxCount;
+    BOOL manualReset;           /* A wait leaves count alone */
+    /* Processes */
+    pid_t pid;
+    DWORD exitCode;
+    /* Files, mappings and pipes */
+    int fd;                     /* File, mapped object or listening socket */
+    int clientFd;               /* Connected client of a pipe, or -1 */
+    BOOL nonBlocking;
+    size_t size;                /* Size of a mapping */
+    char *name;                 /* Object to remove when closed, or NULL */
+} PORTHANDLE;
+
+/*
+ * Mapped views, so that UnmapViewOfFile() can find the size of one.
+ */
+typedef struct VIEW
+{
+    void *base;
+    size_t size;
+    struct VIEW *next;
+} VIEW;
+
+static pthread_mutex_t viewLock = PTHREAD_MUTEX_INITIALIZER;
+static VIEW *views = NULL;
+
+static PORTHANDLE stdHandles[3] =
+{
+    { H_FILE, 1, TRUE },
+    { H_FILE, 1, TRUE },
+    { H_FILE, 1, TRUE }
+};
+
+/*****************************************************************************/
+/*
+ * Handles
+ */
+
+static PORTHANDLE *newHandle(
+    HANDLEKIND kind
+)
+{
+    PORTHANDLE *h = calloc(1, sizeof(PORTHANDLE));
+    pthread_condattr_t attr;
+    if (h == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    h->kind = kind;
+    h->refs = 1;
+    h->fd = -1;
+    h->clientFd = -1;
+    /* Waits are timed against the monotonic clock, as GetTickCount() is */
+    (void) pthread_condattr_init(&attr);
+    (void) pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    (void) pthread_mutex_init(&(h->lock), NULL);
+    (void) pthread_cond_init(&(h->changed), &attr);
+    (void) pthread_condattr_destroy(&attr);
+    return h;
+}
+
+/*
+ * Drop a reference to a handle, freeing it with the last one.
+ */
+static void releaseHandle(
+    PORTHANDLE *h
+)
+{
+    int refs;
+    (void) pthread_mutex_lock(&(h->lock));
+    refs = --(h->refs);
+    (void) pthread_mutex_unlock(&(h->lock));
+    if (refs == 0)
+    {
+        (void) pthread_cond_destroy(&(h->changed));
+        (void) pthread_mutex_destroy(&(h->lock));
+        free(h->name);
+        free(h);
+    }
+}
+
+/*
+ * Set an object's count and wake anything waiting on it.
+ */
+static void signalHandle(
+    PORTHANDLE *h,
+    LONG count
+)
+{
+    (void) pthread_mutex_lock(&(h->lock));
+    h->count = count;
+    (void) pthread_cond_broadcast(&(h->changed));
+    (void) pthread_mutex_unlock(&(h->lock));
+}
+
+static void setNonBlocking(
+    int fd,
+    BOOL on
+)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags != -1)
+        (void) fcntl(fd, F_SETFL, on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+}
+
+BOOL CloseHandle(HANDLE handle)
+{
+    PORTHANDLE *h = handle;
+    if ((h == NULL) || (h == INVALID_HANDLE_VALUE))
+    {
+        errno = EBADF;
+        return FALSE;
+    }
+    if (h->permanent)
+        return TRUE;
+    if (h->clientFd >= 0)
+        (void) close(h->clientFd);
+    if (h->fd >= 0)
+        (void) close(h->fd);
+    if ((h->kind == H_MAPPING) && (h->name != NULL))
+        (void) shm_unlink(h->name);
+    else if ((h->kind == H_PIPE) && (h->name != NULL))
+        (void) unlink(h->name);
+    releaseHandle(h);
+    return TRUE;
+}
+
+HANDLE GetStdHandle(DWORD which)
+{
+    int fd = (int) (STD_INPUT_HANDLE - which);
+    if ((fd < 0) || (fd > 2))
+        return INVALID_HANDLE_VALUE;
+    stdHandles[fd].fd = fd;
+    stdHandles[fd].clientFd = -1;
+    return &(stdHandles[fd]);
+}
+
+/*****************************************************************************/
+/*
+ * Synchronisation and threads
+ */
+
+void InitializeCriticalSection(CRITICAL_SECTION *cs)
+{
+    pthread_mutexattr_t attr;
+    /* A thread may enter a critical section it is already in */
+    (void) pthread_mutexattr_init(&attr);
+    (void) pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    (void) pthread_mutex_init(cs, &attr);
+    (void) pthread_mutexattr_destroy(&attr);
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION *cs)
+{
+    (void) pthread_mutex_destroy(cs);
+}
+
+HANDLE CreateEvent(SECURITY_ATTRIBUTES *sa, BOOL manualReset, BOOL initialState, const char *name)
+{
+    PORTHANDLE *h;
+    if (name != NULL)
+    {
+        errno = ENOSYS;
+        return NULL;
+    }
+    if ((h = newHandle(H_WAITABLE)) != NULL)
+    {
+        h->count = initialState ? 1 : 0;
+        h->maxCount = 1;
+        h->manualReset = manualReset;
+    }
+    return h;
+}
+
+BOOL SetEvent(HANDLE hEvent)
+{
+    signalHandle(hEvent, 1);
+    return TRUE;
+}
+
+HANDLE CreateSemaphore(SECURITY_ATTRIBUTES *sa, LONG initialCount, LONG maximumCount, const char *name)
+{
+    PORTHANDLE *h;
+    if ((name != NULL) || (initialCount < 0) || (initialCount > maximumCount))
+    {
+        errno = (name != NULL) ? ENOSYS : EINVAL;
+        return NULL;
+    }
+    if ((h = newHandle(H_WAITABLE)) != NULL)
+    {
+        h->count = initialCount;
+        h->maxCount = maximumCount;
+    }
+    return h;
+}
+
+BOOL ReleaseSemaphore(HANDLE hSemaphore, LONG releaseCount, LONG *previousCount)
+{
+    PORTHANDLE *h = hSemaphore;
+    BOOL released = FALSE;
+    (void) pthread_mutex_lock(&(h->lock));
+    if ((releaseCount > 0) && (h->count <= h->maxCount - releaseCount))
+    {
+        if (previousCount != NULL)
+            *previousCount = h->count;
+        h->count += releaseCount;
+        (void) pthread_cond_broadcast(&(h->changed));
+        released = TRUE;
+    }
+    else
+        errno = EINVAL;
+    (void) pthread_mutex_unlock(&(h->lock));
+    return released;
+}
+
+/*
+ * Record how a child process ended.
+ */
+static void setExitCode(
+    PORTHANDLE *h,
+    int status
+)
+{
+    if (WIFEXITED(status))
+        h->exitCode = (DWORD) (LONG) (signed char) WEXITSTATUS(status);
+    else
+        h->exitCode = 128 + WTERMSIG(status);
+    h->count = 1;
+}
+
+/*
+ * Wait for a child process, polling if there is a time limit.
+ */
+static DWORD waitProcess(
+    PORTHANDLE *h,
+    DWORD milliseconds
+)
+{
+    DWORD start = GetTickCount();
+    int status;
+    while (h->count == 0)
+    {
+        pid_t pid = waitpid(h->pid, &status, (milliseconds == INFINITE) ? 0 : WNOHANG);
+        if (pid == h->pid)
+            setExitCode(h, status);
+        else if ((pid < 0) && (errno != EINTR))
+            return WAIT_FAILED;
+        else if ((pid == 0) && (GetTickCount() - start >= milliseconds))
+            return WAIT_TIMEOUT;
+        else if (pid == 0)
+            Sleep(10);
+    }
+    return WAIT_OBJECT_0;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+    PORTHANDLE *h = handle;
+    struct timespec deadline;
+    int rc = 0;
+    if (h->kind == H_PROCESS)
+        return waitProcess(h, milliseconds);
+    if (h->kind != H_WAITABLE)
+    {
+        errno = EINVAL;
+        return WAIT_FAILED;
+    }
+    if (milliseconds != INFINITE)
+    {
+        (void) clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += milliseconds / 1000;
+        deadline.tv_nsec += (long) (milliseconds % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    (void) pthread_mutex_lock(&(h->lock));
+    while ((h->count <= 0) && (rc == 0))
+    {
+        if (milliseconds == INFINITE)
+            rc = pthread_cond_wait(&(h->changed), &(h->lock));
+        else
+            rc = pthread_cond_timedwait(&(h->changed), &(h->lock), &deadline);
+    }
+    if (h->count > 0)
+    {
+        if (!h->manualReset)
+            h->count--;
+        rc = 0;
+    }
+    (void) pthread_mutex_unlock(&(h->lock));
+    return (rc == 0) ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+}
+
+typedef struct
+{
+    unsigned (*start)(void *);
+    void *arg;
+    PORTHANDLE *h;
+} THREADSTART;
+
+static void *threadMain(
+    void *arg                   /* The THREADSTART */
+)
+{
+    THREADSTART ts = *(THREADSTART *) arg;
+    free(arg);
+    (void) ts.start(ts.arg);
+    /* The thread's handle is signalled when it returns */
+    signalHandle(ts.h, 1);
+    releaseHandle(ts.h);
+    return NULL;
+}
+
+uintptr_t _beginthreadex(void *security, unsigned stackSize,
+                         unsigned (*start)(void *), void *arg,
+                         unsigned flags, unsigned *threadId)
+{
+    PORTHANDLE *h = newHandle(H_WAITABLE);
+    THREADSTART *ts = malloc(sizeof(THREADSTART));
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc;
+    if ((h == NULL) || (ts == NULL))
+    {
+        if (h != NULL)
+            releaseHandle(h);
+        free(ts);
+        errno = ENOMEM;
+        return 0;
+    }
+    h->manualReset = TRUE;
+    h->refs = 2;
+    ts->start = start;
+    ts->arg = arg;
+    ts->h = h;
+    (void) pthread_attr_init(&attr);
+    (void) pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (stackSize != 0)
+        (void) pthread_attr_setstacksize(&attr, stackSize);
+    rc = pthread_create(&thread, &attr, threadMain, ts);
+    (void) pthread_attr_destroy(&attr);
+    if (rc != 0)
+    {
+        free(ts);
+        h->refs = 1;
+        releaseHandle(h);
+        errno = rc;
+        return 0;
+    }
+    if (threadId != NULL)
+        *threadId = 0;
+    return (uintptr_t) h;
+}
+
+/*****************************************************************************/
+/*
+ * Time and identity
+ */
+
+void Sleep(DWORD milliseconds)
+{
+    struct timespec left;
+    left.tv_sec = milliseconds / 1000;
+    left.tv_nsec = (long) (milliseconds % 1000) * 1000000L;
+    while ((nanosleep(&left, &left) != 0) && (errno == EINTR))
+        ;
+}
+
+DWORD GetTickCount(void)
+{
+    struct timespec now;
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    return (DWORD) now.tv_sec * 1000 + (DWORD) (now.tv_nsec / 1000000L);
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *count)
+{
+    struct timespec now;
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    count->QuadPart = (LONGLONG) now.tv_sec * 1000000000LL + now.tv_nsec;
+    return TRUE;
+}
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency)
+{
+    frequency->QuadPart = 1000000000LL;
+    return TRUE;
+}
+
+DWORD GetCurrentProcessId(void)
+{
+    return (DWORD) getpid();
+}
+
+DWORD GetCurrentThreadId(void)
+{
+#ifdef SYS_gettid
+    return (DWORD) syscall(SYS_gettid);
+#else
+    return (DWORD) (uintptr_t) pthread_self();
+#endif
+}
+
+DWORD GetLastError(void)
+{
+    return (DWORD) errno;
+}
+
+DWORD GetModuleFileNameA(HANDLE hModule, char *fileName, DWORD size)
+{
+    ssize_t len = readlink("/proc/self/exe", fileName, size);
+    if ((len < 0) || ((DWORD) len >= size))
+        return 0;
+    fileName[len] = '\0';
+    return (DWORD) len;
+}
+
+/*****************************************************************************/
+/*
+ * Files
+ */
+
+HANDLE CreateFileA(const char *fileName, DWORD access, DWORD shareMode,
+                   SECURITY_ATTRIBUTES *sa, DWORD disposition,
+                   DWORD flags, HANDLE hTemplate)
+{
+    PORTHANDLE *h;
+    int oflags;
+    int fd;
+    if ((access & GENERIC_READ) && (access & GENERIC_WRITE))
+        oflags = O_RDWR;
+    else if (access & GENERIC_WRITE)
+        oflags = O_WRONLY;
+    else
+        oflags = O_RDONLY;
+    if (disposition == CREATE_ALWAYS)
+        oflags |= O_CREAT | O_TRUNC;
+    else if (disposition != OPEN_EXISTING)
+    {
+        errno = EINVAL;
+        return INVALID_HANDLE_VALUE;
+    }
+    if ((sa == NULL) || !sa->bInheritHandle)
+        oflags |= O_CLOEXEC;
+    if ((fd = open(fileName, oflags, 0666)) < 0)
+        return INVALID_HANDLE_VALUE;
+    /* The file lives on, nameless, until the last descriptor is closed */
+    if (flags & FILE_FLAG_DELETE_ON_CLOSE)
+        (void) unlink(fileName);
+    if ((h = newHandle(H_FILE)) == NULL)
+    {
+        (void) close(fd);
+        return INVALID_HANDLE_VALUE;
+    }
+    h->fd = fd;
+    return h;
+}
+
+BOOL ReadFile(HANDLE hFile, void *buffer, DWORD size, DWORD *nRead, void *overlapped)
+{
+    PORTHANDLE *h = hFile;
+    DWORD total = 0;
+    while (total < size)
+    {
+        ssize_t n = read(h->fd, (char *) buffer + total, size - total);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n < 0)
+        {
+            *nRead = total;
+            return FALSE;
+        }
+        if (n == 0)
+            break;
+        total += (DWORD) n;
+    }
+    *nRead = total;
+    return TRUE;
+}
+
+BOOL WriteFile(HANDLE hFile, const void *buffer, DWORD size, DWORD *nWritten, void *overlapped)
+{
+    PORTHANDLE *h = hFile;
+    DWORD total = 0;
+    while (total < size)
+    {
+        ssize_t n = write(h->fd, (const char *) buffer + total, size - total);
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n < 0)
+        {
+            *nWritten = total;
+            return FALSE;
+        }
+        total += (DWORD) n;
+    }
+    *nWritten = total;
+    return TRUE;
+}
+
+BOOL GetFileSizeEx(HANDLE hFile, LARGE_INTEGER *size)
+{
+    struct stat st;
+    if (fstat(((PORTHANDLE *) hFile)->fd, &st) != 0)
+        return FALSE;
+    size->QuadPart = (LONGLONG) st.st_size;
+    return TRUE;
+}
+
+DWORD SetFilePointer(HANDLE hFile, LONG distance, LONG *distanceHigh, DWORD method)
+{
+    off_t offset;
+    off_t pos;
+    int whence = (method == FILE_BEGIN) ? SEEK_SET : (method == 1) ? SEEK_CUR : SEEK_END;
+    /* Without a high part the distance is a signed 32 bit one */
+    if (distanceHigh != NULL)
+        offset = (off_t) (((LONGLONG) *distanceHigh << 32) | (DWORD) (distance & 0xFFFFFFFF));
+    else
+        offset = (off_t) (int) distance;
+    if ((pos = lseek(((PORTHANDLE *) hFile)->fd, offset, whence)) < 0)
+        return 0xFFFFFFFF;
+    if (distanceHigh != NULL)
+        *distanceHigh = (LONG) ((LONGLONG) pos >> 32);
+    errno = NO_ERROR;
+    return (DWORD) (pos & 0xFFFFFFFF);
+}
+
+BOOL SetEndOfFile(HANDLE hFile)
+{
+    int fd = ((PORTHANDLE *) hFile)->fd;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    return (pos >= 0) && (ftruncate(fd, pos) == 0);
+}
+
+BOOL FlushFileBuffers(HANDLE hFile)
+{
+    PORTHANDLE *h = hFile;
+    return (h->kind != H_FILE) || (fsync(h->fd) == 0) || (errno == EINVAL);
+}
+
+BOOL DeleteFileA(const char *fileName)
+{
+    return unlink(fileName) == 0;
+}
+
+/*
+ * Without MOVEFILE_REPLACE_EXISTING the new name is linked, which fails if
+ * it exists, rather than renamed, which would replace it.
+ */
+BOOL MoveFileExA(const char *existingName, const char *newName, DWORD flags)
+{
+    if (flags & MOVEFILE_REPLACE_EXISTING)
+        return rename(existingName, newName) == 0;
+    if (link(existingName, newName) != 0)
+    {
+        if (errno == EEXIST)
+            errno = ERROR_ALREADY_EXISTS;
+        return FALSE;
+    }
+    (void) unlink(existingName);
+    return TRUE;
+}
+
+BOOL CreateDirectoryA(const char *dirName, SECURITY_ATTRIBUTES *sa)
+{
+    if (mkdir(dirName, 0777) == 0)
+        return TRUE;
+    if (errno == EEXIST)
+        errno = ERROR_ALREADY_EXISTS;
+    return FALSE;
+}
+
+/*
+ * The temporary directory, with a trailing separator as on Windows. If the
+ * buffer is too small the size it needs is returned.
+ */
+DWORD GetTempPathA(DWORD size, char *buffer)
+{
+    const char *dir = getenv("TMPDIR");
+    size_t len;
+    if ((dir == NULL) || (*dir == '\0'))
+        dir = "/tmp";
+    len = strlen(dir);
+    if (dir[len - 1] != '/')
+        len++;
+    if (len + 1 > size)
+        return (DWORD) (len + 1);
+    strcpy(buffer, dir);
+    buffer[len - 1] = '/';
+    buffer[len] = '\0';
+    return (DWORD) len;
+}
+
+/*
+ * Create an empty file with a unique name in dir. Only a unique value of
+ * zero (let the system choose) is supported.
+ */
+unsigned GetTempFileNameA(const char *dir, const char *prefix, unsigned unique, char *tempName)
+{
+    size_t len = strlen(dir);
+    int fd;
+    if ((unique != 0) || (len + strlen(prefix) + sizeof("/XXXXXX") > MAX_PATH))
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    sprintf(tempName, "%s%s%.3sXXXXXX", dir, ((len > 0) && (dir[len - 1] == '/')) ? "" : "/", prefix);
+    if ((fd = mkstemp(tempName)) < 0)
+        return 0;
+    (void) close(fd);
+    return 1;
+}
+
+/*****************************************************************************/
+/*
+ * File mappings
+ *
+ * A named mapping is a POSIX shared memory object. The handle that
+ * created it holds an exclusive lock on it, so that another creator sees
+ * ERROR_ALREADY_EXISTS while it lives, but can take over the object left
+ * behind by one that died; and it removes the object when it is closed.
+ */
+
+/*
+ * The shared memory object name for a mapping: a single '/' and then the
+ * name, with any other '/' replaced.
+ */
+static char *sharedMemoryName(
+    const char *name
+)
+{
+    char *shmName = malloc(strlen(name) + 2);
+    char *p;
+    if (shmName == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    shmName[0] = '/';
+    strcpy(&(shmName[1]), name);
+    for (p = &(shmName[1]); (p = strchr(p, '/')) != NULL; )
+        *p = '_';
+    return shmName;
+}
+
+HANDLE CreateFileMappingA(HANDLE hFile, SECURITY_ATTRIBUTES *sa, DWORD protect,
+                          DWORD sizeHigh, DWORD sizeLow, const char *name)
+{
+    PORTHANDLE *h = newHandle(H_MAPPING);
+    off_t size = (off_t) (((ULONGLONG) sizeHigh << 32) | sizeLow);
+    struct stat st;
+    if (h == NULL)
+        return NULL;
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        /* A view of a file */
+        if (((h->fd = dup(((PORTHANDLE *) hFile)->fd)) < 0) || (fstat(h->fd, &st) != 0))
+        {
+            (void) CloseHandle(h);
+            return NULL;
+        }
+        h->size = (size != 0) ? (size_t) size : (size_t) st.st_size;
+        errno = NO_ERROR;
+        return h;
+    }
+    if ((name == NULL) || ((h->name = sharedMemoryName(name)) == NULL) ||
+            ((h->fd = shm_open(h->name, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) < 0))
+    {
+        if (name == NULL)
+            errno = ENOSYS;
+        free(h->name);
+        h->name = NULL;
+        (void) CloseHandle(h);
+        return NULL;
+    }
+    h->size = (size_t) size;
+    if (flock(h->fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        /* Someone else created it, and it isn't ours to remove */
+        free(h->name);
+        h->name = NULL;
+        errno = ERROR_ALREADY_EXISTS;
+        return h;
+    }
+    /*
+     * A new mapping starts out zero filled, whatever was left in it. What
+     * was left is cleared in place rather than cut back to nothing, so a
+     * reader that still has a view of it isn't faulted off the end; it is
+     * only ever grown.
+     */
+    if ((fstat(h->fd, &st) != 0) ||
+            ((st.st_size < size) && (ftruncate(h->fd, size) != 0)))
+    {
+        (void) CloseHandle(h);
+        return NULL;
+    }
+    if ((st.st_size > 0) && (size > 0))
+    {
+        size_t len = (size_t) ((st.st_size < size) ? st.st_size : size);
+        void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, h->fd, 0);
+        if (base == MAP_FAILED)
+        {
+            (void) CloseHandle(h);
+            return NULL;
+        }
+        memset(base, 0, len);
+        (void) munmap(base, len);
+    }
+    errno = NO_ERROR;
+    return h;
+}
+
+HANDLE OpenFileMappingA(DWORD access, BOOL inherit, const char *name)
+{
+    PORTHANDLE *h = newHandle(H_MAPPING);
+    char *shmName;
+    struct stat st;
+    if (h == NULL)
+        return NULL;
+    if ((shmName = sharedMemoryName(name)) == NULL)
+    {
+        (void) CloseHandle(h);
+        return NULL;
+    }
+    h->fd = shm_open(shmName, ((access & FILE_MAP_WRITE) ? O_RDWR : O_RDONLY) | O_CLOEXEC, 0);
+    free(shmName);
+    if ((h->fd < 0) || (fstat(h->fd, &st) != 0))
+    {
+        (void) CloseHandle(h);
+        return NULL;
+    }
+    h->size = (size_t) st.st_size;
+    return h;
+}
+
+void *MapViewOfFile(HANDLE hMap, DWORD access, DWORD offsetHigh,
+                    DWORD offsetLow, size_t size)
+{
+    PORTHANDLE *h = hMap;
+    off_t offset = (off_t) (((ULONGLONG) offsetHigh << 32) | offsetLow);
+    VIEW *view;
+    void *base;
+    struct stat st;
+    if ((size == 0) && ((size_t) offset < h->size))
+        size = h->size - (size_t) offset;
+    /* Touching a page past the end of the object would raise SIGBUS */
+    if (fstat(h->fd, &st) != 0)
+        return NULL;
+    if ((ULONGLONG) offset + size > (ULONGLONG) st.st_size)
+    {
+        errno = ERROR_ACCESS_DENIED;
+        return NULL;
+    }
+    if ((view = malloc(sizeof(VIEW))) == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    base = mmap(NULL, size, (access & FILE_MAP_WRITE) ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                MAP_SHARED, h->fd, offset);
+    if (base == MAP_FAILED)
+    {
+        free(view);
+        return NULL;
+    }
+    view->base = base;
+    view->size = size;
+    (void) pthread_mutex_lock(&viewLock);
+    view->next = views;
+    views = view;
+    (void) pthread_mutex_unlock(&viewLock);
+    return base;
+}
+
+BOOL UnmapViewOfFile(const void *base)
+{
+    VIEW **link;
+    VIEW *view = NULL;
+    (void) pthread_mutex_lock(&viewLock);
+    for (link = &views; *link != NULL; link = &((*link)->next))
+        if ((*link)->base == base)
+        {
+            view = *link;
+            *link = view->next;
+            break;
+        }
+    (void) pthread_mutex_unlock(&viewLock);
+    if (view == NULL)
+    {
+        errno = EINVAL;
+        return FALSE;
+    }
+    (void) munmap(view->base, view->size);
+    free(view);
+    return TRUE;
+}
+
+/*****************************************************************************/
+/*
+ * Named pipes
+ *
+ * A pipe server is a Unix domain socket listening at the pipe's name. As
+ * with a single instance pipe on Windows, it takes one client at a time:
+ * when the client's connection is taken over by _open_osfhandle() the
+ * socket stops listening, and the next CreateNamedPipeA() listens again.
+ * A socket left behind by a daemon that died is replaced, but not one that
+ * is still listening.
+ */
+
+HANDLE CreateNamedPipeA(const char *name, DWORD openMode, DWORD pipeMode,
+                        DWORD maxInstances, DWORD outSize, DWORD inSize,
+                        DWORD timeout, SECURITY_ATTRIBUTES *sa)
+{
+    PORTHANDLE *h;
+    struct sockaddr_un addr;
+    int rc;
+    if (strlen(name) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return INVALID_HANDLE_VALUE;
+    }
+    /* A client going away must not kill us as we write to it */
+    (void) signal(SIGPIPE, SIG_IGN);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, name);
+    if ((h = newHandle(H_PIPE)) == NULL)
+        return INVALID_HANDLE_VALUE;
+    if ((h->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    {
+        (void) CloseHandle(h);
+        return INVALID_HANDLE_VALUE;
+    }
+    rc = bind(h->fd, (struct sockaddr *) &addr, sizeof(addr));
+    if ((rc != 0) && (errno == EADDRINUSE))
+    {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        BOOL stale = (probe >= 0) &&
+                     (connect(probe, (struct sockaddr *) &addr, sizeof(addr)) != 0) &&
+                     (errno == ECONNREFUSED);
+        if (probe >= 0)
+            (void) close(probe);
+        if (stale && (unlink(name) == 0))
+            rc = bind(h->fd, (struct sockaddr *) &addr, sizeof(addr));
+        else
+            errno = EADDRINUSE;
+    }
+    if ((rc != 0) || (listen(h->fd, 1) != 0))
+    {
+        int err = errno;
+        (void) CloseHandle(h);
+        errno = err;
+        return INVALID_HANDLE_VALUE;
+    }
+    if ((h->name = malloc(strlen(name) + 1)) != NULL)
+        strcpy(h->name, name);
+    h->nonBlocking = (pipeMode & PIPE_NOWAIT) != 0;
+    setNonBlocking(h->fd, h->nonBlocking);
+    return h;
+}
+
+BOOL ConnectNamedPipe(HANDLE hPipe, void *overlapped)
+{
+    PORTHANDLE *h = hPipe;
+    int fd;
+    if (h->clientFd >= 0)
+    {
+        errno = ERROR_PIPE_CONNECTED;
+        return FALSE;
+    }
+    while (((fd = accept4(h->fd, NULL, NULL,
+                    SOCK_CLOEXEC | (h->nonBlocking ? SOCK_NONBLOCK : 0))) < 0) && (errno == EINTR))
+        ;
+    if (fd < 0)
+    {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            errno = ERROR_PIPE_LISTENING;
+        return FALSE;
+    }
+    h->clientFd = fd;
+    return TRUE;
+}
+
+BOOL SetNamedPipeHandleState(HANDLE hPipe, DWORD *mode,
+                             DWORD *maxCollection, DWORD *collectTimeout)
+{
+    PORTHANDLE *h = hPipe;
+    if (mode != NULL)
+    {
+        h->nonBlocking = (*mode & PIPE_NOWAIT) != 0;
+        setNonBlocking(h->fd, h->nonBlocking);
+        if (h->clientFd >= 0)
+            setNonBlocking(h->clientFd, h->nonBlocking);
+    }
+    return TRUE;
+}
+
+BOOL DisconnectNamedPipe(HANDLE hPipe)
+{
+    PORTHANDLE *h = hPipe;
+    if (h->clientFd >= 0)
+        (void) close(h->clientFd);
+    h->clientFd = -1;
+    return TRUE;
+}
+
+/*
+ * Hand a file, or a connected pipe, over to a file descriptor. The handle
+ * is gone afterwards, as on Windows; a pipe stops listening.
+ */
+int _open_osfhandle(intptr_t osHandle, int flags)
+{
+    PORTHANDLE *h = (PORTHANDLE *) osHandle;
+    int fd;
+    if (h->kind == H_PIPE)
+    {
+        fd = h->clientFd;
+        h->clientFd = -1;
+    }
+    else
+    {
+        fd = h->fd;
+        h->fd = -1;
+    }
+    if (fd < 0)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    (void) CloseHandle(h);
+    return fd;
+}
+
+FILE *openPipeWriter(const char *name)
+{
+    struct stat st;
+    FILE *fp = NULL;
+    int fd;
+    (void) signal(SIGPIPE, SIG_IGN);
+    /* Opening a FIFO without blocking fails with ENXIO if there is no reader */
+    if ((fd = open(name, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) < 0)
+        return NULL;
+    if ((fstat(fd, &st) != 0) || !S_ISFIFO(st.st_mode))
+        errno = ENXIO;
+    else
+    {
+        setNonBlocking(fd, FALSE);
+        fp = fdopen(fd, "w");
+    }
+    if (fp == NULL)
+        (void) close(fd);
+    return fp;
+}
+
+/*****************************************************************************/
+/*
+ * Processes
+ */
+
+/*
+ * Split a command line into arguments with the Microsoft C runtime's
+ * rules, as the child would on Windows: 2n backslashes and a quote are n
+ * backslashes and the quote opens or closes a quoted part, 2n+1 and a
+ * quote are n backslashes and a literal quote, and other backslashes are
+ * literal. The arguments are written back over the command line.
+ */
+static char **splitCommandLine(
+    char *cmdLine
+)
+{
+    size_t maxArgs = strlen(cmdLine) / 2 + 2;
+    char **args = malloc(maxArgs * sizeof(char *));
+    char *in = cmdLine;
+    char *out = cmdLine;
+    size_t nArgs = 0;
+    if (args == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (;;)
+    {
+        BOOL quoted = FALSE;
+        while ((*in == ' ') || (*in == '\t'))
+            in++;
+        if (*in == '\0')
+            break;
+        args[nArgs++] = out;
+        while ((*in != '\0') && (quoted || ((*in != ' ') && (*in != '\t'))))
+        {
+            size_t nSlashes = strspn(in, "\\");
+            if (in[nSlashes] == '"')
+            {
+                in += nSlashes;
+                for (; nSlashes >= 2; nSlashes -= 2)
+                    *out++ = '\\';
+                if (nSlashes == 1)
+                    *out++ = '"';
+                else
+                    quoted = !quoted;
+                in++;
+            }
+            else if (nSlashes > 0)
+            {
+                memmove(out, in, nSlashes);
+                out += nSlashes;
+                in += nSlashes;
+            }
+            else
+                *out++ = *in++;
+        }
+        if (*in != '\0')
+            in++;
+        *out++ = '\0';
+    }
+    args[nArgs] = NULL;
+    return args;
+}
+
+/*
+ * The descriptor a standard handle of the child is to be, or -1.
+ */
+static int handleFd(
+    HANDLE h
+)
+{
+    return ((h == NULL) || (h == INVALID_HANDLE_VALUE)) ? -1 : ((PORTHANDLE *) h)->fd;
+}
+
+/*
+ * Start a child process. There is no separate handle for its thread, so
+ * pi->hThread is NULL. A failure to run the program is reported here, as
+ * it is on Windows, through a pipe the child writes errno to if exec fails.
+ */
+BOOL CreateProcessA(const char *appName, char *commandLine,
+                    SECURITY_ATTRIBUTES *processAttributes,
+                    SECURITY_ATTRIBUTES *threadAttributes,
+                    BOOL inheritHandles, DWORD flags, void *environment,
+                    const char *currentDir, STARTUPINFOA *si,
+                    PROCESS_INFORMATION *pi)
+{
+    PORTHANDLE *h;
+    char *cmdLine;
+    char **args;
+    int report[2];
+    int err = 0;
+    ssize_t n;
+    pid_t pid;
+    if ((cmdLine = malloc(strlen(commandLine) + 1)) == NULL)
+    {
+        errno = ENOMEM;
+        return FALSE;
+    }
+    strcpy(cmdLine, commandLine);
+    if (((args = splitCommandLine(cmdLine)) == NULL) || (args[0] == NULL) ||
+            ((h = newHandle(H_PROCESS)) == NULL))
+    {
+        if ((args != NULL) && (args[0] == NULL))
+            errno = EINVAL;
+        free(args);
+        free(cmdLine);
+        return FALSE;
+    }
+    if (pipe2(report, O_CLOEXEC) != 0)
+        err = errno;
+    else if ((pid = fork()) < 0)
+    {
+        err = errno;
+        (void) close(report[0]);
+        (void) close(report[1]);
+    }
+    else if (pid == 0)
+    {
+        if ((si != NULL) && (si->dwFlags & STARTF_USESTDHANDLES))
+        {
+            int fds[3];
+            int i;
+            fds[0] = handleFd(si->hStdInput);
+            fds[1] = handleFd(si->hStdOutput);
+            fds[2] = handleFd(si->hStdError);
+            for (i = 0; i < 3; i++)
+                if ((fds[i] >= 0) && (fds[i] != i))
+                    (void) dup2(fds[i], i);
+        }
+        if ((currentDir == NULL) || (chdir(currentDir) == 0))
+            (void) execvp((appName != NULL) ? appName : args[0], args);
+        err = errno;
+        (void) write(report[1], &err, sizeof(err));
+        _exit(127);
+    }
+    else
+    {
+        (void) close(report[1]);
+        while (((n = read(report[0], &err, sizeof(err))) < 0) && (errno == EINTR))
+            ;
+        (void) close(report[0]);
+        if (n == sizeof(err))
+            (void) waitpid(pid, NULL, 0);
+        else
+        {
+            err = 0;
+            h->pid = pid;
+            pi->hProcess = h;
+            pi->hThread = NULL;
+            pi->dwProcessId = (DWORD) pid;
+            pi->dwThreadId = 0;
+        }
+    }
+    free(args);
+    free(cmdLine);
+    if (err != 0)
+    {
+        (void) CloseHandle(h);
+        errno = err;
+        return FALSE;
+    }
+    return TRUE;
+}
+
+BOOL GetExitCodeProcess(HANDLE hProcess, DWORD *exitCode)
+{
+    PORTHANDLE *h = hProcess;
+    int status;
+    if ((h->count == 0) && (waitpid(h->pid, &status, WNOHANG) == h->pid))
+        setExitCode(h, status);
+    *exitCode = (h->count != 0) ? h->exitCode : STILL_ACTIVE;
+    return TRUE;
+}
+
+#endif /* WIN32 */
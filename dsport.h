@@ -0,0 +1,283 @@
+/*
+ * Copyright 2020 IBM Corp. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * dsport.h - the platform layer for dsjob and dsbench.
+ *
+ * dsjob and dsbench are written to the Win32 API. On Windows this header
+ * just pulls in the system headers. Elsewhere (the Linux engine tier) it
+ * declares the subset of Win32 the two programs use, which dsport.c
+ * implements on POSIX threads, files, shared memory and sockets:
+ *
+ *  critical sections   recursive mutexes
+ *  events, semaphores  a mutex and condition variable per handle, which
+ *  and threads         WaitForSingleObject() waits on; a thread's handle
+ *                      is signalled when the thread returns
+ *  processes           fork() and execvp(), the command line split with
+ *                      the Microsoft C runtime's quoting rules; the exit
+ *                      code is only the low 8 bits of the child's status
+ *  file mappings       mmap(), of a file or of a POSIX shared memory
+ *                      object for a named mapping
+ *  named pipes         Unix domain sockets, bound to PIPE_PREFIX<name>
+ *
+ * Both programs also use the few macros below for what differs between
+ * the platforms, rather than testing WIN32 themselves.
+ */
+
+#ifndef DSPORT_H
+#define DSPORT_H
+
+#ifdef WIN32
+
+#include <windows.h>
+#include <io.h>
+#include <process.h>
+#include <malloc.h>
+
+/* Where named pipes live, and the separator in file names */
+#define PIPE_PREFIX             "\\\\.\\pipe\\"
+#define PATH_SEPARATOR          "\\"
+
+/* Switches may start with a '/' as well as a '-' on NT */
+#define IS_SWITCH(arg)          (((arg)[0] == '-') || ((arg)[0] == '/'))
+
+/* The console gives Ctrl-d as a character rather than as end of file */
+#define IS_END_OF_TEXT(ch)      (((ch) == EOF) || ((ch) == 4))
+
+/* Open a named pipe to write to, failing if nothing is reading it yet */
+#define openPipeWriter(name)    fopen((name), "w")
+
+/* Wait until what has been written to a pipe has been read */
+#define flushPipe(fd)           FlushFileBuffers((HANDLE) _get_osfhandle(fd))
+
+#else /* POSIX */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define PIPE_PREFIX             "/tmp/"
+#define PATH_SEPARATOR          "/"
+
+/* A '/' starts a path here, so only '-' starts a switch */
+#define IS_SWITCH(arg)          ((arg)[0] == '-')
+
+/* The terminal turns Ctrl-d into end of file */
+#define IS_END_OF_TEXT(ch)      ((ch) == EOF)
+
+#ifndef BOOL
+#define BOOL int
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define WINAPI
+#define __stdcall
+
+typedef void *HANDLE;
+typedef unsigned long DWORD;
+typedef long LONG;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef union
+{
+    struct
+    {
+        DWORD LowPart;
+        LONG HighPart;
+    } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+typedef struct
+{
+    DWORD nLength;
+    void *lpSecurityDescriptor;
+    BOOL bInheritHandle;
+} SECURITY_ATTRIBUTES;
+
+typedef struct
+{
+    DWORD cb;
+    DWORD dwFlags;
+    HANDLE hStdInput;
+    HANDLE hStdOutput;
+    HANDLE hStdError;
+} STARTUPINFOA;
+
+typedef struct
+{
+    HANDLE hProcess;
+    HANDLE hThread;
+    DWORD dwProcessId;
+    DWORD dwThreadId;
+} PROCESS_INFORMATION;
+
+#define MAX_PATH                4096
+#define INFINITE                0xFFFFFFFF
+#define INVALID_HANDLE_VALUE    ((HANDLE) -1)
+
+#define WAIT_OBJECT_0           0
+#define WAIT_TIMEOUT            258
+#define WAIT_FAILED             0xFFFFFFFF
+
+/* GetLastError() is errno, except for these, which are set explicitly */
+#define NO_ERROR                0
+#define ERROR_ACCESS_DENIED     5
+#define ERROR_ALREADY_EXISTS    183
+#define ERROR_PIPE_CONNECTED    535
+#define ERROR_PIPE_LISTENING    536
+
+#define GENERIC_READ            0x80000000
+#define GENERIC_WRITE           0x40000000
+#define FILE_SHARE_READ         0x00000001
+#define FILE_SHARE_WRITE        0x00000002
+#define FILE_SHARE_DELETE       0x00000004
+#define CREATE_ALWAYS           2
+#define OPEN_EXISTING           3
+#define FILE_ATTRIBUTE_NORMAL   0x00000080
+#define FILE_ATTRIBUTE_TEMPORARY 0x00000100
+#define FILE_FLAG_DELETE_ON_CLOSE 0x04000000
+#define FILE_BEGIN              0
+#define MOVEFILE_REPLACE_EXISTING 0x00000001
+
+#define PAGE_READONLY           0x02
+#define PAGE_READWRITE          0x04
+#define FILE_MAP_WRITE          0x0002
+#define FILE_MAP_READ           0x0004
+#define FILE_MAP_ALL_ACCESS     0x000F001F
+
+#define PIPE_ACCESS_DUPLEX      0x00000003
+#define PIPE_TYPE_BYTE          0x00000000
+#define PIPE_READMODE_BYTE      0x00000000
+#define PIPE_WAIT               0x00000000
+#define PIPE_NOWAIT             0x00000001
+#define PIPE_UNLIMITED_INSTANCES 255
+
+#define STARTF_USESTDHANDLES    0x00000100
+#define STD_INPUT_HANDLE        ((DWORD) -10)
+#define STD_OUTPUT_HANDLE       ((DWORD) -11)
+#define STD_ERROR_HANDLE        ((DWORD) -12)
+
+#define _O_RDONLY               0
+
+#define _read                   read
+#define _close                  close
+#define _dup                    dup
+#define _dup2                   dup2
+#define _fileno                 fileno
+#define _fdopen                 fdopen
+
+/* Times are formatted into the caller's buffer, as workers format them */
+#define ctime_s(buf, size, t)   ((ctime_r((t), (buf)) == NULL) ? -1 : 0)
+#define localtime_s(tm, t)      ((localtime_r((t), (tm)) == NULL) ? -1 : 0)
+
+#define InterlockedIncrement(p)         __sync_add_and_fetch((p), 1)
+#define InterlockedDecrement(p)         __sync_sub_and_fetch((p), 1)
+#define InterlockedExchangeAdd(p, v)    __sync_fetch_and_add((p), (v))
+#define InterlockedCompareExchange(p, v, c) __sync_val_compare_and_swap((p), (c), (v))
+#define MemoryBarrier()                 __sync_synchronize()
+
+extern void InitializeCriticalSection(CRITICAL_SECTION *cs);
+extern void DeleteCriticalSection(CRITICAL_SECTION *cs);
+#define EnterCriticalSection(cs)        ((void) pthread_mutex_lock(cs))
+#define LeaveCriticalSection(cs)        ((void) pthread_mutex_unlock(cs))
+
+extern HANDLE CreateEvent(SECURITY_ATTRIBUTES *sa, BOOL manualReset, BOOL initialState, const char *name);
+extern BOOL SetEvent(HANDLE hEvent);
+extern HANDLE CreateSemaphore(SECURITY_ATTRIBUTES *sa, LONG initialCount, LONG maximumCount, const char *name);
+extern BOOL ReleaseSemaphore(HANDLE hSemaphore, LONG releaseCount, LONG *previousCount);
+extern DWORD WaitForSingleObject(HANDLE h, DWORD milliseconds);
+extern BOOL CloseHandle(HANDLE h);
+extern uintptr_t _beginthreadex(void *security, unsigned stackSize,
+                                unsigned (*start)(void *), void *arg,
+                                unsigned flags, unsigned *threadId);
+
+extern void Sleep(DWORD milliseconds);
+extern DWORD GetTickCount(void);
+extern BOOL QueryPerformanceCounter(LARGE_INTEGER *count);
+extern BOOL QueryPerformanceFrequency(LARGE_INTEGER *frequency);
+extern DWORD GetCurrentProcessId(void);
+extern DWORD GetCurrentThreadId(void);
+extern DWORD GetLastError(void);
+/*
+ * The functions that take strings are the ANSI ("A") ones, by those names:
+ * the Windows projects build with the Unicode character set, where the
+ * plain names are the wide character functions.
+ */
+extern DWORD GetModuleFileNameA(HANDLE hModule, char *fileName, DWORD size);
+
+extern HANDLE CreateFileA(const char *fileName, DWORD access, DWORD shareMode,
+                          SECURITY_ATTRIBUTES *sa, DWORD disposition,
+                          DWORD flags, HANDLE hTemplate);
+extern BOOL ReadFile(HANDLE hFile, void *buffer, DWORD size, DWORD *nRead, void *overlapped);
+extern BOOL WriteFile(HANDLE hFile, const void *buffer, DWORD size, DWORD *nWritten, void *overlapped);
+extern BOOL GetFileSizeEx(HANDLE hFile, LARGE_INTEGER *size);
+extern DWORD SetFilePointer(HANDLE hFile, LONG distance, LONG *distanceHigh, DWORD method);
+extern BOOL SetEndOfFile(HANDLE hFile);
+extern BOOL FlushFileBuffers(HANDLE hFile);
+extern BOOL DeleteFileA(const char *fileName);
+extern BOOL MoveFileExA(const char *existingName, const char *newName, DWORD flags);
+extern BOOL CreateDirectoryA(const char *dirName, SECURITY_ATTRIBUTES *sa);
+extern DWORD GetTempPathA(DWORD size, char *buffer);
+extern unsigned GetTempFileNameA(const char *dir, const char *prefix, unsigned unique, char *tempName);
+
+extern HANDLE CreateFileMappingA(HANDLE hFile, SECURITY_ATTRIBUTES *sa, DWORD protect,
+                                 DWORD sizeHigh, DWORD sizeLow, const char *name);
+extern HANDLE OpenFileMappingA(DWORD access, BOOL inherit, const char *name);
+extern void *MapViewOfFile(HANDLE hMap, DWORD access, DWORD offsetHigh,
+                           DWORD offsetLow, size_t size);
+extern BOOL UnmapViewOfFile(const void *base);
+
+extern HANDLE CreateNamedPipeA(const char *name, DWORD openMode, DWORD pipeMode,
+                               DWORD maxInstances, DWORD outSize, DWORD inSize,
+                               DWORD timeout, SECURITY_ATTRIBUTES *sa);
+extern BOOL ConnectNamedPipe(HANDLE hPipe, void *overlapped);
+extern BOOL SetNamedPipeHandleState(HANDLE hPipe, DWORD *mode,
+                                    DWORD *maxCollection, DWORD *collectTimeout);
+extern BOOL DisconnectNamedPipe(HANDLE hPipe);
+extern int _open_osfhandle(intptr_t osHandle, int flags);
+
+extern HANDLE GetStdHandle(DWORD which);
+extern BOOL CreateProcessA(const char *appName, char *commandLine,
+                           SECURITY_ATTRIBUTES *processAttributes,
+                           SECURITY_ATTRIBUTES *threadAttributes,
+                           BOOL inheritHandles, DWORD flags, void *environment,
+                           const char *currentDir, STARTUPINFOA *si,
+                           PROCESS_INFORMATION *pi);
+extern BOOL GetExitCodeProcess(HANDLE hProcess, DWORD *exitCode);
+
+/*
+ * A named pipe that -watch writes to is a FIFO, which the reader creates.
+ * Opening it fails until the reader has it open.
+ */
+extern FILE *openPipeWriter(const char *name);
+
+/* Sockets are not buffered, so there is nothing to wait for */
+#define flushPipe(fd)           ((void) (fd), TRUE)
+
+#endif /* WIN32 */
+
+#endif /* DSPORT_H */